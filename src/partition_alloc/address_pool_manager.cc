@@ -7,6 +7,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cstdint>
+#include <iterator>
 #include <limits>
 
 #include "partition_alloc/address_space_stats.h"
@@ -14,7 +15,7 @@
 #include "partition_alloc/buildflags.h"
 #include "partition_alloc/page_allocator.h"
 #include "partition_alloc/page_allocator_constants.h"
-#include "partition_alloc/partition_alloc_base/notreached.h"
+#include "partition_alloc/partition_alloc_base/bits.h"
 #include "partition_alloc/partition_alloc_check.h"
 #include "partition_alloc/partition_alloc_constants.h"
 #include "partition_alloc/reservation_offset_table.h"
@@ -51,6 +52,14 @@ void DecommitPages(uintptr_t address, size_t size) {
   DecommitAndZeroSystemPages(address, size, kPageTag);
 }
 
+constexpr uint64_t kAllBits = std::numeric_limits<uint64_t>::max();
+
+// Mask of |count| bits of a word, starting at bit |offset|.
+PA_ALWAYS_INLINE uint64_t WordMask(size_t offset, size_t count) {
+  PA_DCHECK(count && offset + count <= 64);
+  return (count == 64 ? kAllBits : ((uint64_t{1} << count) - 1)) << offset;
+}
+
 }  // namespace
 
 void AddressPoolManager::Add(pool_handle handle, uintptr_t ptr, size_t length) {
@@ -133,7 +142,8 @@ void AddressPoolManager::Pool::Initialize(uintptr_t ptr, size_t length) {
   PA_CHECK(total_bits_ <= kMaxSuperPagesInPool);
 
   ScopedGuard scoped_lock(lock_);
-  alloc_bitset_.reset();
+  std::fill(std::begin(alloc_bitmap_), std::end(alloc_bitmap_), 0);
+  std::fill(std::begin(full_words_bitmap_), std::end(full_words_bitmap_), 0);
   bit_hint_ = 0;
 }
 
@@ -150,7 +160,12 @@ void AddressPoolManager::Pool::GetUsedSuperPages(
   ScopedGuard scoped_lock(lock_);
 
   PA_DCHECK(IsInitialized());
-  used = alloc_bitset_;
+  used.reset();
+  for (size_t word_index = 0; word_index < kAllocBitmapWords; ++word_index) {
+    for (uint64_t word = alloc_bitmap_[word_index]; word; word &= word - 1) {
+      used.set(word_index * kBitsPerWord + base::bits::CountrZero(word));
+    }
+  }
 }
 
 uintptr_t AddressPoolManager::Pool::GetBaseAddress() {
@@ -158,59 +173,153 @@ uintptr_t AddressPoolManager::Pool::GetBaseAddress() {
   return address_begin_;
 }
 
+size_t AddressPoolManager::Pool::FindFreeBit(size_t bit) {
+  size_t word_index = bit / kBitsPerWord;
+  if (word_index >= kAllocBitmapWords) {
+    return total_bits_;
+  }
+  const uint64_t free_bits =
+      ~alloc_bitmap_[word_index] & (kAllBits << (bit % kBitsPerWord));
+  if (free_bits) {
+    return std::min(
+        word_index * kBitsPerWord + base::bits::CountrZero(free_bits),
+        total_bits_);
+  }
+
+  // The rest of the word is allocated. Find the next word with a free bit in
+  // the summary, rather than looking at the words one by one.
+  ++word_index;
+  size_t summary_index = word_index / kBitsPerWord;
+  if (summary_index >= kFullWordsBitmapWords) {
+    return total_bits_;
+  }
+  uint64_t non_full_words = ~full_words_bitmap_[summary_index] &
+                            (kAllBits << (word_index % kBitsPerWord));
+  while (!non_full_words) {
+    if (++summary_index == kFullWordsBitmapWords) {
+      return total_bits_;
+    }
+    non_full_words = ~full_words_bitmap_[summary_index];
+  }
+  word_index =
+      summary_index * kBitsPerWord + base::bits::CountrZero(non_full_words);
+  if (word_index >= kAllocBitmapWords) {
+    return total_bits_;
+  }
+  return std::min(word_index * kBitsPerWord +
+                      base::bits::CountrZero(~alloc_bitmap_[word_index]),
+                  total_bits_);
+}
+
+size_t AddressPoolManager::Pool::FindAllocatedBit(size_t bit, size_t limit) {
+  PA_DCHECK(bit < limit);
+  PA_DCHECK(limit <= total_bits_);
+  size_t word_index = bit / kBitsPerWord;
+  uint64_t allocated_bits =
+      alloc_bitmap_[word_index] & (kAllBits << (bit % kBitsPerWord));
+  while (!allocated_bits) {
+    if (++word_index * kBitsPerWord >= limit) {
+      return limit;
+    }
+    allocated_bits = alloc_bitmap_[word_index];
+  }
+  return std::min(
+      word_index * kBitsPerWord + base::bits::CountrZero(allocated_bits),
+      limit);
+}
+
+bool AddressPoolManager::Pool::IsRangeFree(size_t begin_bit, size_t end_bit) {
+  return begin_bit == end_bit ||
+         FindAllocatedBit(begin_bit, end_bit) == end_bit;
+}
+
+void AddressPoolManager::Pool::SetRange(size_t begin_bit, size_t end_bit) {
+  for (size_t bit = begin_bit; bit < end_bit;) {
+    const size_t word_index = bit / kBitsPerWord;
+    const size_t offset = bit % kBitsPerWord;
+    const size_t count = std::min(end_bit - bit, kBitsPerWord - offset);
+    const uint64_t mask = WordMask(offset, count);
+    PA_DCHECK(!(alloc_bitmap_[word_index] & mask));
+    alloc_bitmap_[word_index] |= mask;
+    if (alloc_bitmap_[word_index] == kAllBits) {
+      full_words_bitmap_[word_index / kBitsPerWord] |=
+          uint64_t{1} << (word_index % kBitsPerWord);
+    }
+    bit += count;
+  }
+}
+
+void AddressPoolManager::Pool::ClearRange(size_t begin_bit, size_t end_bit) {
+  for (size_t bit = begin_bit; bit < end_bit;) {
+    const size_t word_index = bit / kBitsPerWord;
+    const size_t offset = bit % kBitsPerWord;
+    const size_t count = std::min(end_bit - bit, kBitsPerWord - offset);
+    const uint64_t mask = WordMask(offset, count);
+    PA_DCHECK((alloc_bitmap_[word_index] & mask) == mask);
+    alloc_bitmap_[word_index] &= ~mask;
+    full_words_bitmap_[word_index / kBitsPerWord] &=
+        ~(uint64_t{1} << (word_index % kBitsPerWord));
+    bit += count;
+  }
+}
+
 uintptr_t AddressPoolManager::Pool::FindChunk(size_t requested_size) {
   ScopedGuard scoped_lock(lock_);
 
   PA_DCHECK(!(requested_size & kSuperPageOffsetMask));
   const size_t need_bits = requested_size >> kSuperPageShift;
 
-  // Use first-fit policy to find an available chunk from free chunks. Start
-  // from |bit_hint_|, because we know there are no free chunks before.
-  size_t beg_bit = bit_hint_;
-  size_t curr_bit = bit_hint_;
-  while (true) {
-    // |end_bit| points 1 past the last bit that needs to be 0. If it goes past
-    // |total_bits_|, return |nullptr| to signal no free chunk was found.
-    size_t end_bit = beg_bit + need_bits;
-    if (end_bit > total_bits_) {
-      return 0;
-    }
-
-    bool found = true;
-    for (; curr_bit < end_bit; ++curr_bit) {
-      if (alloc_bitset_.test(curr_bit)) {
-        // The bit was set, so this chunk isn't entirely free. Set |found=false|
-        // to ensure the outer loop continues. However, continue the inner loop
-        // to set |beg_bit| just past the last set bit in the investigated
-        // chunk. |curr_bit| is advanced all the way to |end_bit| to prevent the
-        // next outer loop pass from checking the same bits.
-        beg_bit = curr_bit + 1;
-        found = false;
-        if (bit_hint_ == curr_bit) {
-          ++bit_hint_;
+  // Start from |bit_hint_|, because we know there are no free chunks before.
+  const size_t first_free_bit = FindFreeBit(bit_hint_);
+  bit_hint_ = first_free_bit;
+
+  // Any free bit fits a single super page, so use first-fit, which keeps the
+  // pool densely packed from its start.
+  size_t beg_bit = first_free_bit;
+  size_t end_bit = beg_bit + need_bits;
+  if (need_bits > 1) {
+    // Use best-fit for larger chunks (that is, direct maps), so that they fill
+    // holes left by previous ones rather than breaking up larger free runs.
+    // The search stops early on an exact fit.
+    size_t best_run = std::numeric_limits<size_t>::max();
+    for (size_t run_beg = first_free_bit; run_beg < total_bits_;) {
+      const size_t run_end = FindAllocatedBit(run_beg, total_bits_);
+      const size_t run = run_end - run_beg;
+      if (run >= need_bits && run < best_run) {
+        best_run = run;
+        beg_bit = run_beg;
+        if (run == need_bits) {
+          break;
         }
       }
-    }
-
-    // An entire [beg_bit;end_bit) region of 0s was found. Fill them with 1s (to
-    // mark as allocated) and return the allocated address.
-    if (found) {
-      for (size_t i = beg_bit; i < end_bit; ++i) {
-        PA_DCHECK(!alloc_bitset_.test(i));
-        alloc_bitset_.set(i);
-      }
-      if (bit_hint_ == beg_bit) {
-        bit_hint_ = end_bit;
+      if (run_end == total_bits_) {
+        break;
       }
-      uintptr_t address = address_begin_ + beg_bit * kSuperPageSize;
-#if PA_BUILDFLAG(DCHECKS_ARE_ON)
-      PA_DCHECK(address + requested_size <= address_end_);
-#endif
-      return address;
+      run_beg = FindFreeBit(run_end);
+    }
+    if (best_run == std::numeric_limits<size_t>::max()) {
+      return 0;
     }
+    end_bit = beg_bit + need_bits;
+  }
+
+  // |end_bit| points 1 past the last bit that needs to be 0. If it goes past
+  // |total_bits_|, return |nullptr| to signal no free chunk was found.
+  if (end_bit > total_bits_) {
+    return 0;
   }
 
-  PA_NOTREACHED();
+  // An entire [beg_bit;end_bit) region of 0s was found. Fill them with 1s (to
+  // mark as allocated) and return the allocated address.
+  SetRange(beg_bit, end_bit);
+  if (bit_hint_ == beg_bit) {
+    bit_hint_ = end_bit;
+  }
+  uintptr_t address = address_begin_ + beg_bit * kSuperPageSize;
+#if PA_BUILDFLAG(DCHECKS_ARE_ON)
+  PA_DCHECK(address + requested_size <= address_end_);
+#endif
+  return address;
 }
 
 bool AddressPoolManager::Pool::TryReserveChunk(uintptr_t address,
@@ -226,15 +335,11 @@ bool AddressPoolManager::Pool::TryReserveChunk(uintptr_t address,
     return false;
   }
   // Check if any bit of the requested region is set already.
-  for (size_t i = begin_bit; i < end_bit; ++i) {
-    if (alloc_bitset_.test(i)) {
-      return false;
-    }
+  if (!IsRangeFree(begin_bit, end_bit)) {
+    return false;
   }
   // Otherwise, set the bits.
-  for (size_t i = begin_bit; i < end_bit; ++i) {
-    alloc_bitset_.set(i);
-  }
+  SetRange(begin_bit, end_bit);
   return true;
 }
 
@@ -251,39 +356,28 @@ void AddressPoolManager::Pool::FreeChunk(uintptr_t address, size_t free_size) {
 
   const size_t beg_bit = (address - address_begin_) / kSuperPageSize;
   const size_t end_bit = beg_bit + free_size / kSuperPageSize;
-  for (size_t i = beg_bit; i < end_bit; ++i) {
-    PA_DCHECK(alloc_bitset_.test(i));
-    alloc_bitset_.reset(i);
-  }
+  ClearRange(beg_bit, end_bit);
   bit_hint_ = std::min(bit_hint_, beg_bit);
 }
 
 void AddressPoolManager::Pool::GetStats(PoolStats* stats) {
-  std::bitset<kMaxSuperPagesInPool> pages;
-  size_t i;
-  {
-    ScopedGuard scoped_lock(lock_);
-    pages = alloc_bitset_;
-    i = bit_hint_;
-  }
+  ScopedGuard scoped_lock(lock_);
 
-  stats->usage = pages.count();
+  size_t usage = 0;
+  for (uint64_t word : alloc_bitmap_) {
+    usage += std::bitset<kBitsPerWord>(word).count();
+  }
+  stats->usage = usage;
 
+  // Walks the free runs, skipping allocated words through the summary.
   size_t largest_run = 0;
-  size_t current_run = 0;
-  for (; i < total_bits_; ++i) {
-    if (!pages[i]) {
-      current_run += 1;
-      continue;
-    } else if (current_run > largest_run) {
-      largest_run = current_run;
+  for (size_t run_beg = FindFreeBit(bit_hint_); run_beg < total_bits_;) {
+    const size_t run_end = FindAllocatedBit(run_beg, total_bits_);
+    largest_run = std::max(largest_run, run_end - run_beg);
+    if (run_end == total_bits_) {
+      break;
     }
-    current_run = 0;
-  }
-
-  // Fell out of the loop with last bit being zero. Check once more.
-  if (current_run > largest_run) {
-    largest_run = current_run;
+    run_beg = FindFreeBit(run_end);
   }
   stats->largest_available_reservation = largest_run;
 }
@@ -560,9 +654,9 @@ void AddressPoolManager::DumpStats(AddressSpaceStatsDumper* dumper) {
 void AddressPoolManager::AssertThreadIsolatedLayout() {
   constexpr size_t last_pool_offset =
       offsetof(AddressPoolManager, pools_) + sizeof(Pool) * (kNumPools - 1);
-  constexpr size_t alloc_bitset_offset =
-      last_pool_offset + offsetof(Pool, alloc_bitset_);
-  static_assert(alloc_bitset_offset % PA_THREAD_ISOLATED_ALIGN_SZ == 0);
+  constexpr size_t alloc_bitmap_offset =
+      last_pool_offset + offsetof(Pool, alloc_bitmap_);
+  static_assert(alloc_bitmap_offset % PA_THREAD_ISOLATED_ALIGN_SZ == 0);
   static_assert(sizeof(AddressPoolManager) % PA_THREAD_ISOLATED_ALIGN_SZ == 0);
 }
 #endif  // PA_BUILDFLAG(ENABLE_THREAD_ISOLATION)
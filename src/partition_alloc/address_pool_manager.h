@@ -6,6 +6,7 @@
 #define PARTITION_ALLOC_ADDRESS_POOL_MANAGER_H_
 
 #include <bitset>
+#include <cstdint>
 #include <limits>
 
 #include "partition_alloc/address_pool_manager_types.h"
@@ -132,6 +133,8 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC)
     bool IsInitialized();
     void Reset();
 
+    // Single super pages are handed out first-fit, larger chunks best-fit, to
+    // keep large free runs intact for direct maps.
     uintptr_t FindChunk(size_t size);
     void FreeChunk(uintptr_t address, size_t size);
 
@@ -143,6 +146,27 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC)
     void GetStats(PoolStats* stats);
 
    private:
+    static constexpr size_t kBitsPerWord = 64;
+    static_assert(kMaxSuperPagesInPool % kBitsPerWord == 0);
+    static constexpr size_t kAllocBitmapWords =
+        kMaxSuperPagesInPool / kBitsPerWord;
+    static constexpr size_t kFullWordsBitmapWords =
+        (kAllocBitmapWords + kBitsPerWord - 1) / kBitsPerWord;
+
+    // Returns the index of the first free super page at or after |bit|, or
+    // |total_bits_| if there is none.
+    size_t FindFreeBit(size_t bit) PA_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    // Returns the index of the first allocated super page in [bit, limit), or
+    // |limit| if there is none.
+    size_t FindAllocatedBit(size_t bit, size_t limit)
+        PA_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    bool IsRangeFree(size_t begin_bit, size_t end_bit)
+        PA_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    void SetRange(size_t begin_bit, size_t end_bit)
+        PA_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+    void ClearRange(size_t begin_bit, size_t end_bit)
+        PA_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
     // The lock needs to be the first field in this class.
     // We write-protect the pool in the ThreadIsolated case, except that the
     // lock can be used without acquiring write-permission first (via
@@ -151,11 +175,17 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC)
     // See the alignment of ` below.
     Lock lock_;
 
-    // The bitset stores the allocation state of the address pool. 1 bit per
+    // The bitmap stores the allocation state of the address pool. 1 bit per
     // super-page: 1 = allocated, 0 = free.
-    std::bitset<kMaxSuperPagesInPool> alloc_bitset_ PA_GUARDED_BY(lock_);
+    uint64_t alloc_bitmap_[kAllocBitmapWords] PA_GUARDED_BY(lock_) = {};
+
+    // Summary of |alloc_bitmap_|, 1 bit per word of it: 1 = all 64 super pages
+    // of the word are allocated. Lets searches for a free super page skip
+    // allocated words 64 at a time, instead of testing each of their bits.
+    uint64_t full_words_bitmap_[kFullWordsBitmapWords] PA_GUARDED_BY(lock_) =
+        {};
 
-    // An index of a bit in the bitset before which we know for sure there all
+    // An index of a bit in the bitmap before which we know for sure there all
     // 1s. This is a best-effort hint in the sense that there still may be lots
     // of 1s after this index, but at least we know there is no point in
     // starting the search before it.
@@ -194,7 +224,7 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC)
   char pad_[PA_THREAD_ISOLATED_ARRAY_PAD_SZ_WITH_OFFSET(
       Pool,
       kNumPools,
-      offsetof(Pool, alloc_bitset_))] = {};
+      offsetof(Pool, alloc_bitmap_))] = {};
 #if defined(__clang__)
 #pragma clang diagnostic pop
 #endif
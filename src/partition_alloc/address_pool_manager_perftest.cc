@@ -0,0 +1,137 @@
+// Copyright 2026 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "partition_alloc/address_pool_manager.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/timer/lap_timer.h"
+#include "partition_alloc/buildflags.h"
+#include "partition_alloc/page_allocator.h"
+#include "partition_alloc/partition_alloc_base/time/time.h"
+#include "partition_alloc/partition_alloc_constants.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "testing/perf/perf_result_reporter.h"
+
+#if PA_BUILDFLAG(HAS_64_BIT_POINTERS)
+
+namespace partition_alloc::internal {
+
+class AddressPoolManagerForTesting : public AddressPoolManager {
+ public:
+  AddressPoolManagerForTesting() = default;
+  ~AddressPoolManagerForTesting() = default;
+};
+
+namespace {
+
+constexpr int kWarmupRuns = 10;
+constexpr ::base::TimeDelta kTimeLimit = ::base::Seconds(1);
+constexpr int kTimeCheckInterval = 100;
+
+constexpr char kMetricPrefixAddressPool[] = "AddressPoolReservation.";
+constexpr char kMetricThroughput[] = "throughput";
+constexpr char kMetricLatency[] = "latency_per_reservation_ns";
+
+// Number of chunks reserved, then released, on every lap.
+constexpr size_t kChunksPerLap = 16;
+
+perf_test::PerfResultReporter SetUpReporter(const std::string& story_name) {
+  perf_test::PerfResultReporter reporter(kMetricPrefixAddressPool, story_name);
+  reporter.RegisterImportantMetric(kMetricThroughput, "reservations/s");
+  reporter.RegisterImportantMetric(kMetricLatency, "ns");
+  return reporter;
+}
+
+class AddressPoolManagerPerfTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    manager_ = std::make_unique<AddressPoolManagerForTesting>();
+    base_address_ =
+        AllocPages(kPoolMaxSize, kSuperPageSize,
+                   PageAccessibilityConfiguration(
+                       PageAccessibilityConfiguration::kInaccessible),
+                   PageTag::kPartitionAlloc);
+    ASSERT_TRUE(base_address_);
+    manager_->Add(kRegularPoolHandle, base_address_, kPoolMaxSize);
+  }
+
+  void TearDown() override {
+    manager_->Remove(kRegularPoolHandle);
+    FreePages(base_address_, kPoolMaxSize);
+    manager_.reset();
+  }
+
+  // Reserves the whole pool, then releases every other super page of its first
+  // `fragmented_pages`, leaving that many single super page holes, followed by
+  // a large free run.
+  void Fragment(size_t fragmented_pages) {
+    constexpr size_t kPageCount = kPoolMaxSize / kSuperPageSize;
+    ASSERT_EQ(manager_->Reserve(kRegularPoolHandle, 0, kPoolMaxSize),
+              base_address_);
+    manager_->UnreserveAndDecommit(
+        kRegularPoolHandle, base_address_ + fragmented_pages * kSuperPageSize,
+        (kPageCount - fragmented_pages) * kSuperPageSize);
+    for (size_t i = 0; i < fragmented_pages; i += 2) {
+      manager_->UnreserveAndDecommit(kRegularPoolHandle,
+                                     base_address_ + i * kSuperPageSize,
+                                     kSuperPageSize);
+    }
+  }
+
+  // Measures reservations of `pages` super pages. Every lap releases what it
+  // reserved, so that the pool stays as fragmented as Fragment() left it.
+  void RunTest(const char* story_name, size_t pages) {
+    const size_t size = pages * kSuperPageSize;
+    std::vector<uintptr_t> addresses(kChunksPerLap);
+    ::base::LapTimer timer(kWarmupRuns, kTimeLimit, kTimeCheckInterval);
+    do {
+      for (uintptr_t& address : addresses) {
+        address = manager_->Reserve(kRegularPoolHandle, 0, size);
+        ASSERT_TRUE(address);
+      }
+      for (uintptr_t address : addresses) {
+        manager_->UnreserveAndDecommit(kRegularPoolHandle, address, size);
+      }
+      timer.NextLap();
+    } while (!timer.HasTimeLimitExpired());
+
+    auto reporter = SetUpReporter(story_name);
+    const double reservations_per_second =
+        kChunksPerLap * timer.LapsPerSecond();
+    reporter.AddResult(kMetricThroughput, reservations_per_second);
+    reporter.AddResult(kMetricLatency, 1e9 / reservations_per_second);
+  }
+
+  std::unique_ptr<AddressPoolManagerForTesting> manager_;
+  uintptr_t base_address_ = 0;
+};
+
+}  // namespace
+
+TEST_F(AddressPoolManagerPerfTest, EmptyPoolSuperPage) {
+  RunTest("empty_pool_super_page", 1);
+}
+
+TEST_F(AddressPoolManagerPerfTest, EmptyPoolDirectMap) {
+  RunTest("empty_pool_direct_map", 4);
+}
+
+TEST_F(AddressPoolManagerPerfTest, FragmentedPoolSuperPage) {
+  // Fragments 7/8th of the pool.
+  Fragment(kPoolMaxSize / kSuperPageSize / 8 * 7);
+  RunTest("fragmented_pool_super_page", 1);
+}
+
+TEST_F(AddressPoolManagerPerfTest, FragmentedPoolDirectMap) {
+  Fragment(kPoolMaxSize / kSuperPageSize / 8 * 7);
+  RunTest("fragmented_pool_direct_map", 4);
+}
+
+}  // namespace partition_alloc::internal
+
+#endif  // PA_BUILDFLAG(HAS_64_BIT_POINTERS)
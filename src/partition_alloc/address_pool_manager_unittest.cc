@@ -4,7 +4,11 @@
 
 #include "partition_alloc/address_pool_manager.h"
 
+#include <algorithm>
+#include <bitset>
 #include <cstdint>
+#include <utility>
+#include <vector>
 
 #include "partition_alloc/address_space_stats.h"
 #include "partition_alloc/build_config.h"
@@ -222,6 +226,102 @@ TEST_F(PartitionAllocAddressPoolManagerTest, IrregularPattern) {
                                                 15 * kSuperPageSize);
 }
 
+TEST_F(PartitionAllocAddressPoolManagerTest, BestFitForMultiplePages) {
+  // Spans several words of the pool bitmap.
+  constexpr size_t kReserved = 200;
+  for (size_t i = 0; i < kReserved; ++i) {
+    ASSERT_EQ(GetAddressPoolManager()->Reserve(pool_, 0, kSuperPageSize),
+              base_address_ + i * kSuperPageSize);
+  }
+  // Leave holes of 3, 2 and 5 super pages, the last one straddling two words.
+  GetAddressPoolManager()->UnreserveAndDecommit(
+      pool_, base_address_ + 10 * kSuperPageSize, 3 * kSuperPageSize);
+  GetAddressPoolManager()->UnreserveAndDecommit(
+      pool_, base_address_ + 70 * kSuperPageSize, 2 * kSuperPageSize);
+  GetAddressPoolManager()->UnreserveAndDecommit(
+      pool_, base_address_ + 126 * kSuperPageSize, 5 * kSuperPageSize);
+
+  // Multi-page chunks go to the smallest hole they fit in.
+  EXPECT_EQ(GetAddressPoolManager()->Reserve(pool_, 0, 2 * kSuperPageSize),
+            base_address_ + 70 * kSuperPageSize);
+  EXPECT_EQ(GetAddressPoolManager()->Reserve(pool_, 0, 4 * kSuperPageSize),
+            base_address_ + 126 * kSuperPageSize);
+  EXPECT_EQ(GetAddressPoolManager()->Reserve(pool_, 0, 6 * kSuperPageSize),
+            base_address_ + kReserved * kSuperPageSize);
+  // Single pages are still first-fit.
+  EXPECT_EQ(GetAddressPoolManager()->Reserve(pool_, 0, kSuperPageSize),
+            base_address_ + 10 * kSuperPageSize);
+  EXPECT_EQ(GetAddressPoolManager()->Reserve(pool_, 0, 2 * kSuperPageSize),
+            base_address_ + 11 * kSuperPageSize);
+  EXPECT_EQ(GetAddressPoolManager()->Reserve(pool_, 0, kSuperPageSize),
+            base_address_ + 130 * kSuperPageSize);
+  EXPECT_EQ(GetAddressPoolManager()->Reserve(pool_, 0, kSuperPageSize),
+            base_address_ + (kReserved + 6) * kSuperPageSize);
+
+  GetAddressPoolManager()->UnreserveAndDecommit(
+      pool_, base_address_, (kReserved + 7) * kSuperPageSize);
+  AddressSpaceStatsDumperForTesting dumper{};
+  GetAddressPoolManager()->DumpStats(&dumper);
+  EXPECT_EQ(dumper.regular_pool_usage_, 0ull);
+  EXPECT_EQ(dumper.regular_pool_largest_reservation_, kPageCnt);
+}
+
+TEST_F(PartitionAllocAddressPoolManagerTest, RandomPatternMatchesReference) {
+  std::bitset<kMaxSuperPagesInPool> reference;
+  std::vector<std::pair<uintptr_t, size_t>> reservations;
+  uint32_t random = 42;
+  auto next_random = [&random] {
+    random = random * 1103515245 + 12345;
+    return random >> 16;
+  };
+
+  for (size_t i = 0; i < 5000; ++i) {
+    if (reservations.empty() || next_random() % 3) {
+      const size_t pages = 1 + next_random() % 8;
+      const uintptr_t address =
+          GetAddressPoolManager()->Reserve(pool_, 0, pages * kSuperPageSize);
+      ASSERT_TRUE(address);
+      const size_t first_page = (address - base_address_) / kSuperPageSize;
+      for (size_t page = first_page; page < first_page + pages; ++page) {
+        ASSERT_FALSE(reference.test(page));
+        reference.set(page);
+      }
+      reservations.emplace_back(address, pages);
+    } else {
+      const size_t index = next_random() % reservations.size();
+      const auto [address, pages] = reservations[index];
+      GetAddressPoolManager()->UnreserveAndDecommit(pool_, address,
+                                                    pages * kSuperPageSize);
+      const size_t first_page = (address - base_address_) / kSuperPageSize;
+      for (size_t page = first_page; page < first_page + pages; ++page) {
+        reference.reset(page);
+      }
+      reservations[index] = reservations.back();
+      reservations.pop_back();
+    }
+  }
+
+  std::bitset<kMaxSuperPagesInPool> used;
+  GetAddressPoolManager()->GetPoolUsedSuperPages(pool_, used);
+  EXPECT_EQ(used, reference);
+
+  size_t largest_run = 0;
+  size_t run = 0;
+  for (size_t page = 0; page < kPageCnt; ++page) {
+    run = reference.test(page) ? 0 : run + 1;
+    largest_run = std::max(largest_run, run);
+  }
+  AddressSpaceStatsDumperForTesting dumper{};
+  GetAddressPoolManager()->DumpStats(&dumper);
+  EXPECT_EQ(dumper.regular_pool_usage_, reference.count());
+  EXPECT_EQ(dumper.regular_pool_largest_reservation_, largest_run);
+
+  for (const auto& [address, pages] : reservations) {
+    GetAddressPoolManager()->UnreserveAndDecommit(pool_, address,
+                                                  pages * kSuperPageSize);
+  }
+}
+
 TEST_F(PartitionAllocAddressPoolManagerTest, DecommittedDataIsErased) {
   uintptr_t address =
       GetAddressPoolManager()->Reserve(pool_, 0, kSuperPageSize);
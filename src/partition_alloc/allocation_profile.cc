@@ -0,0 +1,113 @@
+// Copyright 2026 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "partition_alloc/allocation_profile.h"
+
+#include <cstring>
+
+#include "partition_alloc/build_config.h"
+
+#if PA_BUILDFLAG(IS_POSIX)
+#include <unistd.h>
+
+#include "partition_alloc/partition_alloc_base/files/file_util.h"
+#include "partition_alloc/partition_alloc_base/posix/eintr_wrapper.h"
+#endif
+
+namespace partition_alloc {
+
+namespace {
+
+// Profiles are meant to be read by the next instance of the same binary, so
+// they are stored in the native byte order, and bumping the version discards
+// the ones saved by a previous release.
+constexpr uint32_t kMagic = 0x50415046;  // "PAPF"
+constexpr uint32_t kVersion = 1;
+
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t empty_slot_span_ring_size;
+  uint32_t bucket_count;
+};
+
+bool IsValid(const Header& header) {
+  return header.magic == kMagic && header.version == kVersion &&
+         header.bucket_count <= internal::kNumBuckets;
+}
+
+}  // namespace
+
+size_t AllocationProfile::SerializedSize() const {
+  return sizeof(Header) + bucket_count * sizeof(BucketUsage);
+}
+
+size_t AllocationProfile::Serialize(char* buffer, size_t buffer_size) const {
+  const size_t size = SerializedSize();
+  if (buffer_size < size) {
+    return 0;
+  }
+  const Header header = {kMagic, kVersion, empty_slot_span_ring_size,
+                         bucket_count};
+  memcpy(buffer, &header, sizeof(header));
+  memcpy(buffer + sizeof(header), buckets, bucket_count * sizeof(BucketUsage));
+  return size;
+}
+
+bool AllocationProfile::Deserialize(const char* buffer, size_t buffer_size) {
+  *this = AllocationProfile();
+  Header header;
+  if (buffer_size < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, buffer, sizeof(header));
+  if (!IsValid(header) ||
+      buffer_size != sizeof(header) + header.bucket_count * sizeof(BucketUsage)) {
+    return false;
+  }
+  memcpy(buckets, buffer + sizeof(header),
+         header.bucket_count * sizeof(BucketUsage));
+  empty_slot_span_ring_size = header.empty_slot_span_ring_size;
+  bucket_count = header.bucket_count;
+  return true;
+}
+
+#if PA_BUILDFLAG(IS_POSIX)
+
+bool AllocationProfile::WriteToFD(int fd) const {
+  char buffer[sizeof(Header) + sizeof(buckets)];
+  const size_t size = Serialize(buffer, sizeof(buffer));
+  size_t total_written = 0;
+  while (total_written < size) {
+    ssize_t bytes_written =
+        WrapEINTR(write)(fd, buffer + total_written, size - total_written);
+    if (bytes_written <= 0) {
+      return false;
+    }
+    total_written += bytes_written;
+  }
+  return true;
+}
+
+bool AllocationProfile::ReadFromFD(int fd) {
+  *this = AllocationProfile();
+  Header header;
+  if (!internal::base::ReadFromFD(fd, reinterpret_cast<char*>(&header),
+                                  sizeof(header)) ||
+      !IsValid(header)) {
+    return false;
+  }
+  if (!internal::base::ReadFromFD(fd, reinterpret_cast<char*>(buckets),
+                                  header.bucket_count * sizeof(BucketUsage))) {
+    *this = AllocationProfile();
+    return false;
+  }
+  empty_slot_span_ring_size = header.empty_slot_span_ring_size;
+  bucket_count = header.bucket_count;
+  return true;
+}
+
+#endif  // PA_BUILDFLAG(IS_POSIX)
+
+}  // namespace partition_alloc
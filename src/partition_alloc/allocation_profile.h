@@ -0,0 +1,60 @@
+// Copyright 2026 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef PARTITION_ALLOC_ALLOCATION_PROFILE_H_
+#define PARTITION_ALLOC_ALLOCATION_PROFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "partition_alloc/build_config.h"
+#include "partition_alloc/partition_alloc_base/component_export.h"
+#include "partition_alloc/partition_alloc_constants.h"
+
+namespace partition_alloc {
+
+// Compact summary of how a partition's buckets were used, so that a process
+// which restarts often can start in the state its previous instance reached:
+// taken with `PartitionRoot::ExportAllocationProfile()`, saved, then handed to
+// the next instance through `PartitionOptions::allocation_profile`.
+//
+// It doesn't allocate, so that it can be used to initialize the malloc()
+// partition.
+struct PA_COMPONENT_EXPORT(PARTITION_ALLOC) AllocationProfile {
+  struct BucketUsage {
+    // Identifies the bucket.
+    uint32_t slot_size;
+    // Number of slots allocated, including the ones held by thread caches.
+    uint32_t active_slots;
+    // Most bytes the bucket ever had in use at once, rounded up to whole slot
+    // spans.
+    uint64_t peak_active_bytes;
+  };
+
+  // Size of the serialized form of this profile, in bytes.
+  size_t SerializedSize() const;
+  // Writes the serialized form of this profile to `buffer`. Returns the number
+  // of bytes written, or 0 if `buffer_size` is too small.
+  size_t Serialize(char* buffer, size_t buffer_size) const;
+  // Replaces this profile with the one serialized in `buffer`. Returns false,
+  // leaving this profile empty, if `buffer` doesn't hold a valid profile.
+  bool Deserialize(const char* buffer, size_t buffer_size);
+
+#if PA_BUILDFLAG(IS_POSIX)
+  // Same as above, using a file descriptor.
+  bool WriteToFD(int fd) const;
+  bool ReadFromFD(int fd);
+#endif  // PA_BUILDFLAG(IS_POSIX)
+
+  // Size of the empty slot span ring, see
+  // `PartitionRoot::EnableLargeEmptySlotSpanRing()`.
+  uint32_t empty_slot_span_ring_size = 0;
+  // Only buckets that were used are recorded.
+  uint32_t bucket_count = 0;
+  BucketUsage buckets[internal::kNumBuckets] = {};
+};
+
+}  // namespace partition_alloc
+
+#endif  // PARTITION_ALLOC_ALLOCATION_PROFILE_H_
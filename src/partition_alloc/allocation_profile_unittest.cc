@@ -0,0 +1,212 @@
+// Copyright 2026 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "partition_alloc/allocation_profile.h"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "partition_alloc/build_config.h"
+#include "partition_alloc/partition_alloc_constants.h"
+#include "partition_alloc/partition_alloc_for_testing.h"
+#include "partition_alloc/partition_root.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+#if PA_BUILDFLAG(IS_POSIX)
+#include <unistd.h>
+#endif
+
+#if !defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
+
+namespace partition_alloc {
+
+namespace {
+
+AllocationProfile MakeProfile() {
+  AllocationProfile profile;
+  profile.empty_slot_span_ring_size = 128;
+  profile.buckets[profile.bucket_count++] = {
+      .slot_size = 32, .active_slots = 1000, .peak_active_bytes = 64 << 10};
+  profile.buckets[profile.bucket_count++] = {
+      .slot_size = 1024, .active_slots = 3, .peak_active_bytes = 32 << 10};
+  return profile;
+}
+
+void ExpectSameProfile(const AllocationProfile& expected,
+                       const AllocationProfile& actual) {
+  EXPECT_EQ(expected.empty_slot_span_ring_size,
+            actual.empty_slot_span_ring_size);
+  ASSERT_EQ(expected.bucket_count, actual.bucket_count);
+  for (uint32_t i = 0; i < expected.bucket_count; ++i) {
+    EXPECT_EQ(expected.buckets[i].slot_size, actual.buckets[i].slot_size);
+    EXPECT_EQ(expected.buckets[i].active_slots, actual.buckets[i].active_slots);
+    EXPECT_EQ(expected.buckets[i].peak_active_bytes,
+              actual.buckets[i].peak_active_bytes);
+  }
+}
+
+}  // namespace
+
+TEST(PartitionAllocAllocationProfileTest, Serialize) {
+  const AllocationProfile profile = MakeProfile();
+  std::vector<char> buffer(profile.SerializedSize());
+  EXPECT_EQ(0u, profile.Serialize(buffer.data(), buffer.size() - 1));
+  ASSERT_EQ(buffer.size(), profile.Serialize(buffer.data(), buffer.size()));
+
+  AllocationProfile deserialized;
+  ASSERT_TRUE(deserialized.Deserialize(buffer.data(), buffer.size()));
+  ExpectSameProfile(profile, deserialized);
+
+  // Truncated.
+  EXPECT_FALSE(deserialized.Deserialize(buffer.data(), buffer.size() - 1));
+  EXPECT_EQ(0u, deserialized.bucket_count);
+  // Not a profile.
+  buffer[0] ^= 1;
+  EXPECT_FALSE(deserialized.Deserialize(buffer.data(), buffer.size()));
+  EXPECT_EQ(0u, deserialized.bucket_count);
+}
+
+#if PA_BUILDFLAG(IS_POSIX)
+TEST(PartitionAllocAllocationProfileTest, FileDescriptor) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  const AllocationProfile profile = MakeProfile();
+  ASSERT_TRUE(profile.WriteToFD(fds[1]));
+  close(fds[1]);
+
+  AllocationProfile read;
+  ASSERT_TRUE(read.ReadFromFD(fds[0]));
+  ExpectSameProfile(profile, read);
+  // Nothing left to read.
+  EXPECT_FALSE(read.ReadFromFD(fds[0]));
+  close(fds[0]);
+}
+#endif  // PA_BUILDFLAG(IS_POSIX)
+
+TEST(PartitionAllocAllocationProfileTest, ExportAndApply) {
+  constexpr size_t kSize = 64;
+  constexpr size_t kCount = 1000;
+
+  AllocationProfile profile;
+  {
+    PartitionAllocatorForTesting allocator{PartitionOptions{}};
+    PartitionRoot* root = allocator.root();
+    root->EnableLargeEmptySlotSpanRing();
+    std::vector<void*> ptrs;
+    for (size_t i = 0; i < kCount; ++i) {
+      ptrs.push_back(root->Alloc(kSize));
+    }
+    ptrs.push_back(root->Alloc(1000));
+    root->ExportAllocationProfile(&profile);
+    for (void* ptr : ptrs) {
+      root->Free(ptr);
+    }
+  }
+
+  EXPECT_EQ(internal::kBackgroundEmptySlotSpanRingSize,
+            profile.empty_slot_span_ring_size);
+  ASSERT_EQ(2u, profile.bucket_count);
+  const AllocationProfile::BucketUsage& usage = profile.buckets[0];
+  EXPECT_GE(usage.slot_size, kSize);
+  EXPECT_EQ(kCount, usage.active_slots);
+  EXPECT_GE(usage.peak_active_bytes, kCount * usage.slot_size);
+  EXPECT_EQ(1u, profile.buckets[1].active_slots);
+
+  PartitionOptions opts;
+  opts.allocation_profile = &profile;
+  PartitionAllocatorForTesting allocator{opts};
+  PartitionRoot* root = allocator.root();
+  EXPECT_EQ(static_cast<int16_t>(internal::kBackgroundEmptySlotSpanRingSize),
+            PA_TS_UNCHECKED_READ(root->global_empty_slot_span_ring_size));
+  const size_t super_pages =
+      root->total_size_of_super_pages.load(std::memory_order_relaxed);
+  const size_t committed =
+      root->total_size_of_committed_pages.load(std::memory_order_relaxed);
+  EXPECT_GT(super_pages, 0u);
+  EXPECT_EQ(0u, root->get_total_size_of_allocated_bytes());
+  // The provisioned slot spans stay committed until they are used.
+  EXPECT_GE(PA_TS_UNCHECKED_READ(root->provisioned_slot_spans_dirty_bytes),
+            kCount * usage.slot_size);
+
+  // The profiled usage fits in the slot spans provisioned at initialization.
+  std::vector<void*> ptrs;
+  for (size_t i = 0; i < kCount; ++i) {
+    ptrs.push_back(root->Alloc(kSize));
+  }
+  ptrs.push_back(root->Alloc(1000));
+  EXPECT_EQ(super_pages,
+            root->total_size_of_super_pages.load(std::memory_order_relaxed));
+  EXPECT_EQ(committed,
+            root->total_size_of_committed_pages.load(std::memory_order_relaxed));
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->provisioned_slot_spans_dirty_bytes));
+  for (void* ptr : ptrs) {
+    root->Free(ptr);
+  }
+}
+
+TEST(PartitionAllocAllocationProfileTest, ExportRightAfterApply) {
+  const AllocationProfile applied = MakeProfile();
+  PartitionOptions opts;
+  opts.allocation_profile = &applied;
+  PartitionAllocatorForTesting allocator{opts};
+  PartitionRoot* root = allocator.root();
+  ASSERT_GT(PA_TS_UNCHECKED_READ(root->provisioned_slot_spans_dirty_bytes),
+            0u);
+
+  // The slot spans provisioned ahead of use were never needed.
+  AllocationProfile profile;
+  root->ExportAllocationProfile(&profile);
+  EXPECT_EQ(0u, profile.bucket_count);
+
+  // Only the one put to use counts.
+  void* ptr = root->Alloc(32);
+  root->ExportAllocationProfile(&profile);
+  ASSERT_EQ(1u, profile.bucket_count);
+  const internal::PartitionBucket* bucket = internal::SlotSpanMetadata<
+      internal::MetadataKind::kReadOnly>::FromObject(ptr)->bucket;
+  EXPECT_EQ(bucket->slot_size, profile.buckets[0].slot_size);
+  EXPECT_EQ(1u, profile.buckets[0].active_slots);
+  EXPECT_EQ(uint64_t{bucket->get_slots_per_span()} * bucket->slot_size,
+            profile.buckets[0].peak_active_bytes);
+  root->Free(ptr);
+}
+
+TEST(PartitionAllocAllocationProfileTest, ApplyUntrusted) {
+  AllocationProfile profile;
+  // Inconsistent: more slots in use than the peak allows.
+  profile.buckets[profile.bucket_count++] = {
+      .slot_size = 32, .active_slots = 1000, .peak_active_bytes = 32};
+  // Not a bucketed size.
+  profile.buckets[profile.bucket_count++] = {
+      .slot_size = 0, .active_slots = 0, .peak_active_bytes = 1 << 20};
+  // Far too large.
+  for (uint32_t slot_size : {64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384,
+                             32768, 65536}) {
+    profile.buckets[profile.bucket_count++] = {
+        .slot_size = slot_size,
+        .active_slots = 1,
+        .peak_active_bytes = uint64_t{1} << 40};
+  }
+
+  PartitionOptions opts;
+  opts.allocation_profile = &profile;
+  PartitionAllocatorForTesting allocator{opts};
+  PartitionRoot* root = allocator.root();
+  const size_t provisioned =
+      PA_TS_UNCHECKED_READ(root->provisioned_slot_spans_dirty_bytes);
+  EXPECT_GT(provisioned, 0u);
+  EXPECT_LE(provisioned, PartitionRoot::kMaxProvisionedBytes);
+  // Nothing was provisioned for the inconsistent entry.
+  const internal::PartitionBucket& bucket =
+      root->buckets[PartitionRoot::SizeToBucketIndex(
+          32, root->GetBucketDistribution())];
+  EXPECT_EQ(internal::SlotSpanMetadata<
+                internal::MetadataKind::kReadOnly>::get_sentinel_slot_span(),
+            bucket.active_slot_spans_head);
+}
+
+}  // namespace partition_alloc
+
+#endif  // !defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
@@ -77,6 +77,47 @@ PA_ALWAYS_INLINE void FreeSlotBitmapMarkSlotAsFree(uintptr_t slot_start) {
   *cell |= CellWithAOne(bit_index);
 }
 
+// Calls |callback| with the start address of every free slot within
+// [begin_addr, end_addr), in ascending order. The bitmap is scanned a cell at a
+// time with CountrZero(), so the cost depends on the number of free slots
+// rather than on the number of slots, and the free slots themselves are not
+// touched. Only slot starts ever have their bit set, so the slot size doesn't
+// need to be known.
+template <typename Callback>
+PA_ALWAYS_INLINE void FreeSlotBitmapForEachFreeSlot(uintptr_t begin_addr,
+                                                    uintptr_t end_addr,
+                                                    Callback callback) {
+  PA_DCHECK(begin_addr <= end_addr);
+  if (begin_addr == end_addr) {
+    return;
+  }
+  const uintptr_t super_page = begin_addr & kSuperPageBaseMask;
+  PA_DCHECK(end_addr - super_page <= kSuperPageSize);
+  const auto* cells = reinterpret_cast<const FreeSlotBitmapCellType*>(
+      GetFreeSlotBitmapAddressForPointer(begin_addr));
+  // Bit indices within the super page bitmap, |end_bit| is exclusive.
+  const size_t begin_bit = (begin_addr - super_page) / kSmallestBucket;
+  const size_t end_bit =
+      (end_addr - super_page + kSmallestBucket - 1) / kSmallestBucket;
+
+  for (size_t cell_index = begin_bit / kFreeSlotBitmapBitsPerCell;
+       cell_index * kFreeSlotBitmapBitsPerCell < end_bit; ++cell_index) {
+    const size_t cell_begin_bit = cell_index * kFreeSlotBitmapBitsPerCell;
+    FreeSlotBitmapCellType cell = cells[cell_index];
+    if (cell_begin_bit < begin_bit) {
+      cell &= ~CellWithTrailingOnes(begin_bit - cell_begin_bit);
+    }
+    if (end_bit - cell_begin_bit < kFreeSlotBitmapBitsPerCell) {
+      cell &= CellWithTrailingOnes(end_bit - cell_begin_bit);
+    }
+    while (cell) {
+      const size_t bit_index = base::bits::CountrZero(cell);
+      cell &= cell - 1;
+      callback(super_page + (cell_begin_bit + bit_index) * kSmallestBucket);
+    }
+  }
+}
+
 // Resets (= set to 0) all the bits corresponding to the slot-start addresses
 // within [begin_addr, end_addr). |begin_addr| has to be the beginning of a
 // slot, but |end_addr| does not.
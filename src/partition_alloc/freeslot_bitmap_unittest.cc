@@ -6,6 +6,7 @@
 
 #include <cstdint>
 #include <limits>
+#include <vector>
 
 #include "partition_alloc/buildflags.h"
 #include "partition_alloc/freeslot_bitmap_constants.h"
@@ -53,7 +54,7 @@ class PartitionAllocFreeSlotBitmapTest : public ::testing::Test {
   // that there are no slot spans and the superpage is only filled with the slot
   // of size |kSmallestBucket|.
   uintptr_t SlotAddr(size_t index) {
-    return SuperPagePayloadBegin(super_page_, false) + index * kSmallestBucket;
+    return SuperPagePayloadBegin(super_page_) + index * kSmallestBucket;
   }
 
   // Returns the last slot address in the virtual superpage. It assumes that
@@ -201,6 +202,31 @@ TEST_F(PartitionAllocFreeSlotBitmapTest, ResetSingleBitInMiddleOfCell) {
   EXPECT_FALSE(*cell_mid & CellWithAOne(bit_index_mid));
 }
 
+TEST_F(PartitionAllocFreeSlotBitmapTest, ForEachFreeSlot) {
+  const size_t kNumSlots = 3 * kFreeSlotBitmapBitsPerCell;
+  std::vector<uintptr_t> expected;
+  // Free slots on both sides of the scanned range, and in every cell.
+  for (size_t i : {size_t{0}, size_t{2}, size_t{63}, size_t{64}, size_t{100},
+                   size_t{127}, size_t{150}, kNumSlots - 1}) {
+    FreeSlotBitmapMarkSlotAsFree(SlotAddr(i));
+    if (i >= 2 && i < kNumSlots - 1) {
+      expected.push_back(SlotAddr(i));
+    }
+  }
+
+  std::vector<uintptr_t> visited;
+  FreeSlotBitmapForEachFreeSlot(
+      SlotAddr(2), SlotAddr(kNumSlots - 1),
+      [&](uintptr_t slot_start) { visited.push_back(slot_start); });
+  EXPECT_EQ(expected, visited);
+
+  visited.clear();
+  FreeSlotBitmapForEachFreeSlot(
+      SlotAddr(3), SlotAddr(3),
+      [&](uintptr_t slot_start) { visited.push_back(slot_start); });
+  EXPECT_TRUE(visited.empty());
+}
+
 }  // namespace partition_alloc::internal
 
 #endif  // PA_BUILDFLAG(USE_FREESLOT_BITMAP) &&
@@ -16,6 +16,7 @@
 #include "partition_alloc/partition_lock.h"
 #include "partition_alloc/partition_page.h"
 #include "partition_alloc/partition_root.h"
+#include "partition_alloc/random.h"
 
 namespace partition_alloc {
 
@@ -131,6 +132,34 @@ bool GwpAsanSupport::CanReuse(uintptr_t slot_start) {
       ->CanBeReusedByGwpAsan();
 }
 
+std::atomic<uint32_t> GwpAsanSupport::sampling_interval_{0};
+std::atomic<GwpAsanSupport::SampledAllocFn*>
+    GwpAsanSupport::sampled_alloc_fn_{nullptr};
+
+// static
+void GwpAsanSupport::SetSampler(size_t sampling_interval,
+                                SampledAllocFn* alloc_fn) {
+  PA_CHECK(!sampling_interval == !alloc_fn);
+  // Keeps the countdown within 32 bits.
+  PA_CHECK(sampling_interval <= std::numeric_limits<uint32_t>::max() / 2);
+  sampled_alloc_fn_.store(alloc_fn, std::memory_order_release);
+  sampling_interval_.store(static_cast<uint32_t>(sampling_interval),
+                           std::memory_order_relaxed);
+}
+
+// static
+uint32_t GwpAsanSupport::NextSamplingCountdown() {
+  const uint32_t sampling_interval =
+      sampling_interval_.load(std::memory_order_relaxed);
+  if (!sampling_interval) {
+    return kSamplingDisabledCountdown;
+  }
+  // Uniform in [1, 2 * sampling_interval - 1], so that the sampled
+  // allocations can't be predicted, and one in `sampling_interval` is sampled
+  // on average.
+  return 1 + internal::RandomValue() % (2 * sampling_interval - 1);
+}
+
 }  // namespace partition_alloc
 
 #endif  // PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
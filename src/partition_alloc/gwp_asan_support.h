@@ -7,9 +7,11 @@
 
 #include "partition_alloc/buildflags.h"
 #include "partition_alloc/partition_alloc_base/component_export.h"
+#include "partition_alloc/partition_alloc_forward.h"
 
 #if PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <vector>
@@ -111,6 +113,37 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) GwpAsanSupport {
  public:
   static void* MapRegion(size_t slot_count, std::vector<uint16_t>& free_list);
   static bool CanReuse(uintptr_t slot_start);
+
+  // Returns a GWP-ASan allocation of `size` bytes aligned on `alignment`, or
+  // nullptr to decline it, in place of one from `root`. `alignment` is the one
+  // PartitionAlloc would have provided, which callers of aligned allocation
+  // functions rely on.
+  using SampledAllocFn = void*(PartitionRoot* root,
+                               size_t size,
+                               size_t alignment);
+
+  // Diverts about one in `sampling_interval` allocations served by the thread
+  // cache of partitions with `PartitionOptions::gwp_asan_sampling` to
+  // `alloc_fn`, picking them at random. This spares GWP-ASan from
+  // setting allocation override hooks, which take all allocations off the fast
+  // path. The embedder remains responsible for intercepting frees, reallocs
+  // and size queries of the sampled allocations before they reach
+  // PartitionAlloc, as with any other GWP-ASan allocation.
+  //
+  // Pass 0 and nullptr to stop sampling. Threads pick up changes within
+  // `kSamplingDisabledCountdown` allocations.
+  static void SetSampler(size_t sampling_interval, SampledAllocFn* alloc_fn);
+  static SampledAllocFn* GetSampledAllocFn() {
+    return sampled_alloc_fn_.load(std::memory_order_acquire);
+  }
+
+  // Number of allocations until the next sampled one.
+  static uint32_t NextSamplingCountdown();
+  static constexpr uint32_t kSamplingDisabledCountdown = 1 << 16;
+
+ private:
+  static std::atomic<uint32_t> sampling_interval_;
+  static std::atomic<SampledAllocFn*> sampled_alloc_fn_;
 };
 
 }  // namespace partition_alloc
@@ -17,6 +17,7 @@
 #include "partition_alloc/partition_alloc_base/compiler_specific.h"
 #include "partition_alloc/partition_alloc_base/component_export.h"
 #include "partition_alloc/partition_alloc_base/immediate_crash.h"
+#include "partition_alloc/partition_alloc_base/threading/platform_thread.h"
 #include "partition_alloc/partition_alloc_check.h"
 #include "partition_alloc/partition_alloc_config.h"
 #include "partition_alloc/partition_alloc_constants.h"
@@ -64,6 +65,23 @@ struct BitField {
   }
 };
 
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+// Threads owning a thread-confined partition (see
+// `PartitionOptions::thread_confined`) are referred to by InSlotMetadata with a
+// tag, indexing this table. Tag 0 is never handed out.
+inline constexpr size_t kMaxBiasedCountOwners = 1024;
+PA_COMPONENT_EXPORT(PARTITION_ALLOC)
+extern base::PlatformThreadRef g_biased_count_owners[kMaxBiasedCountOwners];
+
+// Returns the tag of the current thread, registering it on first call.
+PA_COMPONENT_EXPORT(PARTITION_ALLOC) uint16_t RegisterBiasedCountOwner();
+
+PA_ALWAYS_INLINE bool IsBiasedCountOwner(uint16_t tag) {
+  return tag && g_biased_count_owners[tag % kMaxBiasedCountOwners] ==
+                    base::PlatformThread::CurrentRef();
+}
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+
 // Special-purpose atomic bit field class mainly used by RawPtrBackupRefImpl.
 // Formerly known as `PartitionRefCount`, but renamed to support usage that is
 // unrelated to BRP.
@@ -120,6 +138,16 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
   // |dangling_detected| is set and the error is reported via
   // DanglingRawPtrDetected(id). The matching DanglingRawPtrReleased(id) will be
   // called when the last raw_ptr<> is released.
+  //
+  // On `PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)` builds, slots
+  // allocated by the owner thread of a thread-confined partition are biased
+  // towards it: the owner counts its raw_ptr<T> in `owner_ptr_count_` with
+  // plain loads and stores, while other threads keep using |ptr_count|. The
+  // latter starts at `kOwnerBias`, so that it can't drop to zero before both
+  // counts are folded together. The owner folds them when freeing the slot.
+  // Slots freed by other threads are handed over to the owner, which folds the
+  // counts on its next allocation in the partition, see
+  // `PartitionRoot::ReclaimBiasedSlotsFreedElsewhere()`.
 #if !PA_BUILDFLAG(ENABLE_DANGLING_RAW_PTR_CHECKS)
   using CountType = uint32_t;
   static constexpr CountType kMemoryHeldByAllocatorBit =
@@ -128,6 +156,8 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
   // The most significant bit of the refcount is reserved to prevent races with
   // overflow detection.
   static constexpr CountType kMaxPtrCount = BitField<CountType>::Mask(1, 28);
+  // Initial |ptr_count| of biased slots, half of `kMaxPtrCount`.
+  static constexpr CountType kOwnerBias = BitField<CountType>::Bit(28);
   static constexpr CountType kRequestQuarantineBit =
       BitField<CountType>::Bit(30);
   static constexpr CountType kNeedsMac11MallocSizeHackBit =
@@ -168,7 +198,13 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
   static constexpr auto kUnprotectedPtrInc =
       SafeShift<CountType>(1, base::bits::CountrZero(kUnprotectedPtrCountMask));
 
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+  // `owner_tag` is the tag of the thread to bias the count towards, if any.
+  PA_ALWAYS_INLINE explicit InSlotMetadata(bool needs_mac11_malloc_size_hack,
+                                           uint16_t owner_tag = 0);
+#else
   PA_ALWAYS_INLINE explicit InSlotMetadata(bool needs_mac11_malloc_size_hack);
+#endif
 
   // Incrementing the counter doesn't imply any visibility about modified
   // memory, hence relaxed atomics. For decrement, visibility is required before
@@ -184,6 +220,15 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
   PA_ALWAYS_INLINE void Acquire() {
     CheckCookieIfSupported();
 
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+    // The owner thread turns to the shared count only once its own saturates.
+    if (IsBiasedTowardsCurrentThread() &&
+        owner_ptr_count_ != std::numeric_limits<int16_t>::max()) {
+      ++owner_ptr_count_;
+      return;
+    }
+#endif
+
     CountType old_count = count_.fetch_add(kPtrInc, std::memory_order_relaxed);
     // Check overflow.
     PA_CHECK((old_count & kPtrCountMask) != kMaxPtrCount);
@@ -207,6 +252,16 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
   PA_ALWAYS_INLINE bool Release() {
     CheckCookieIfSupported();
 
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+    if (IsBiasedTowardsCurrentThread() &&
+        owner_ptr_count_ != std::numeric_limits<int16_t>::min()) {
+      --owner_ptr_count_;
+      // The bias keeps `count_` non-zero until the counts are folded, which
+      // reclaims the slot if it was freed meanwhile.
+      return false;
+    }
+#endif
+
     CountType old_count = count_.fetch_sub(kPtrInc, std::memory_order_release);
     // Check underflow.
     PA_DCHECK(old_count & kPtrCountMask);
@@ -246,6 +301,12 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
   // dangling `raw_ptr` checks before quarantine, not after.
   PA_ALWAYS_INLINE void PreReleaseFromAllocator() {
     CheckCookieIfSupported();
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+    // The slot may be released from the quarantine on another thread.
+    if (IsBiasedTowardsCurrentThread()) {
+      FoldOwnerPtrCount();
+    }
+#endif
     CheckDanglingPointersOnFree(count_.load(std::memory_order_relaxed));
   }
 
@@ -253,6 +314,13 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
   // This function should be called by the allocator during Free().
   PA_ALWAYS_INLINE bool ReleaseFromAllocator() {
     CheckCookieIfSupported();
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+    // When freed by another thread, the slot stays biased until the owner
+    // calls ReleaseFromOwnerAfterFreeElsewhere().
+    if (IsBiasedTowardsCurrentThread()) {
+      FoldOwnerPtrCount();
+    }
+#endif
 
     CountType old_count =
         count_.fetch_and(~kMemoryHeldByAllocatorBit, std::memory_order_release);
@@ -288,8 +356,15 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
     CheckCookieIfSupported();
     static constexpr CountType mask =
         kMemoryHeldByAllocatorBit | kPtrCountMask | kUnprotectedPtrCountMask;
-    return (count_.load(std::memory_order_acquire) & mask) ==
-           kMemoryHeldByAllocatorBit;
+    CountType count = count_.load(std::memory_order_acquire);
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+    // Other threads can't see the owner's count, and conservatively find the
+    // bias instead.
+    if (IsBiasedTowardsCurrentThread()) {
+      count += OwnerPtrCountDelta();
+    }
+#endif
+    return (count & mask) == kMemoryHeldByAllocatorBit;
   }
 
   PA_ALWAYS_INLINE bool IsAlive() {
@@ -342,6 +417,10 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
   PA_ALWAYS_INLINE void InitializeForGwpAsan() {
 #if PA_CONFIG(IN_SLOT_METADATA_CHECK_COOKIE)
     brp_cookie_ = CalculateCookie();
+#endif
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+    owner_tag_.store(0, std::memory_order_relaxed);
+    owner_ptr_count_ = 0;
 #endif
     count_.store(kPtrInc | kMemoryHeldByAllocatorBit,
                  std::memory_order_release);
@@ -364,7 +443,48 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
   PA_ALWAYS_INLINE uint32_t requested_size() const { return requested_size_; }
 #endif  // PA_CONFIG(IN_SLOT_METADATA_STORE_REQUESTED_SIZE)
 
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+  // Whether the slot is biased towards a thread other than the current one.
+  // Once released from the allocator, such a slot must be handed over to its
+  // owner, which is the only thread able to fold the counts.
+  PA_ALWAYS_INLINE bool IsBiasedTowardsOtherThread() const {
+    const uint16_t owner_tag = owner_tag_.load(std::memory_order_relaxed);
+    return owner_tag && !IsBiasedCountOwner(owner_tag);
+  }
+
+  // Called by the owner thread on a slot another thread released from the
+  // allocator. Returns true if the allocation should be reclaimed.
+  PA_ALWAYS_INLINE bool ReleaseFromOwnerAfterFreeElsewhere() {
+    CheckCookieIfSupported();
+    PA_DCHECK(IsBiasedTowardsCurrentThread());
+    PA_DCHECK(!(count_.load(std::memory_order_relaxed) &
+                kMemoryHeldByAllocatorBit));
+    return ReleaseCommon(FoldOwnerPtrCount());
+  }
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+
  private:
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+  PA_ALWAYS_INLINE bool IsBiasedTowardsCurrentThread() const {
+    return IsBiasedCountOwner(owner_tag_.load(std::memory_order_relaxed));
+  }
+
+  // What folding the owner's count adds to `count_`, i.e. the owner's count
+  // minus the bias.
+  PA_ALWAYS_INLINE CountType OwnerPtrCountDelta() const {
+    return static_cast<CountType>(owner_ptr_count_) * kPtrInc - kOwnerBias;
+  }
+
+  // Folds the owner's count into `count_`, which all threads use from then on.
+  // Must be called on the owner thread. Returns the new value of `count_`.
+  PA_ALWAYS_INLINE CountType FoldOwnerPtrCount() {
+    const CountType delta = OwnerPtrCountDelta();
+    owner_tag_.store(0, std::memory_order_relaxed);
+    owner_ptr_count_ = 0;
+    return count_.fetch_add(delta, std::memory_order_release) + delta;
+  }
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+
   // If there are some dangling raw_ptr<>. Turn on the error flag, and
   // emit the `DanglingPtrDetected` once to embedders.
   PA_ALWAYS_INLINE void CheckDanglingPointersOnFree(CountType count) {
@@ -468,8 +588,28 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) InSlotMetadata {
 #if PA_CONFIG(IN_SLOT_METADATA_STORE_REQUESTED_SIZE)
   uint32_t requested_size_;
 #endif
+
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+  // Tag of the thread the count is biased towards, or 0 if it isn't (anymore).
+  // Read by all threads, but written only at construction and by the owner.
+  std::atomic<uint16_t> owner_tag_;
+  // Number of raw_ptr<T> acquired minus released by the owner thread, the only
+  // one accessing it. Goes negative when the owner releases references other
+  // threads acquired.
+  int16_t owner_ptr_count_;
+#endif
 };
 
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+PA_ALWAYS_INLINE InSlotMetadata::InSlotMetadata(
+    bool needs_mac11_malloc_size_hack,
+    uint16_t owner_tag)
+    : count_(kMemoryHeldByAllocatorBit |
+             (needs_mac11_malloc_size_hack ? kNeedsMac11MallocSizeHackBit : 0) |
+             (owner_tag ? kOwnerBias : 0)),
+      owner_tag_(owner_tag),
+      owner_ptr_count_(0) {}
+#else
 PA_ALWAYS_INLINE InSlotMetadata::InSlotMetadata(
     bool needs_mac11_malloc_size_hack)
     : count_(kMemoryHeldByAllocatorBit |
@@ -480,6 +620,7 @@ PA_ALWAYS_INLINE InSlotMetadata::InSlotMetadata(
 #endif
 {
 }
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
 
 static_assert(kAlignment % alignof(InSlotMetadata) == 0,
               "kAlignment must be multiples of alignof(InSlotMetadata).");
@@ -498,8 +639,9 @@ static constexpr size_t kInSlotMetadataSizeShift = 3;
 #if PA_CONFIG(IN_SLOT_METADATA_CHECK_COOKIE) && \
     PA_CONFIG(IN_SLOT_METADATA_STORE_REQUESTED_SIZE)
 static constexpr size_t kInSlotMetadataSizeShift = 4;
-#elif PA_CONFIG(IN_SLOT_METADATA_CHECK_COOKIE) || \
-    PA_CONFIG(IN_SLOT_METADATA_STORE_REQUESTED_SIZE)
+#elif PA_CONFIG(IN_SLOT_METADATA_CHECK_COOKIE) ||    \
+    PA_CONFIG(IN_SLOT_METADATA_STORE_REQUESTED_SIZE) || \
+    PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
 static constexpr size_t kInSlotMetadataSizeShift = 3;
 #else
 static constexpr size_t kInSlotMetadataSizeShift = 2;
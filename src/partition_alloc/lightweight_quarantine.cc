@@ -4,12 +4,36 @@
 
 #include "partition_alloc/lightweight_quarantine.h"
 
+#include <algorithm>
+#include <array>
+
 #include "partition_alloc/internal_allocator.h"
 #include "partition_alloc/partition_page.h"
 #include "partition_alloc/partition_root.h"
 
 namespace partition_alloc::internal {
 
+namespace {
+
+// With the asynchronous drain, an overflowing branch dequarantines down to
+// (1 - 1 / kAsyncDrainBatchRatio) of its capacity.
+constexpr size_t kAsyncDrainBatchRatio = 8;
+
+void FreeDequarantinedSlots(PartitionRoot& allocator_root,
+                            uintptr_t* slot_starts,
+                            size_t num_of_slots) {
+  if (!num_of_slots) {
+    return;
+  }
+  // Victims are picked at random. Sorting them groups the ones from the same
+  // slot span, which are then returned to it with a single lock acquisition,
+  // and walks memory in order.
+  std::sort(slot_starts, slot_starts + num_of_slots);
+  allocator_root.FreeNoHooksImmediateBatch(slot_starts, num_of_slots);
+}
+
+}  // namespace
+
 // Utility classes to lock only if a condition is met.
 
 template <>
@@ -64,17 +88,117 @@ class PA_SCOPED_LOCKABLE
   Lock& lock_;
 };
 
+LightweightQuarantineRoot::~LightweightQuarantineRoot() {
+  // Like the branches, which purge themselves.
+  DisableAsyncDrain();
+  ScopedGuard guard(pending_lock_);
+  PA_DCHECK(!num_pending_batches_);
+  for (size_t i = 0; i < num_spare_batches_; ++i) {
+    DestroyAtInternalPartition(spare_batches_[i]);
+  }
+}
+
 LightweightQuarantineBranch LightweightQuarantineRoot::CreateBranch(
     const LightweightQuarantineBranchConfig& config) {
   return LightweightQuarantineBranch(*this, config);
 }
 
+void LightweightQuarantineRoot::EnableAsyncDrain(
+    DrainRequestCallback request_drain) {
+  PA_CHECK(request_drain);
+  // Allocate the batches now, as they are taken with the branch locks held.
+  while (true) {
+    {
+      ScopedGuard guard(pending_lock_);
+      if (num_spare_batches_ + num_pending_batches_ >= kMaxPendingBatches) {
+        break;
+      }
+    }
+    ReturnSpareBatch(ConstructAtInternalPartition<ToBeFreedArray>());
+  }
+  ScopedGuard guard(pending_lock_);
+  request_drain_.store(request_drain, std::memory_order_relaxed);
+  async_drain_enabled_ = true;
+}
+
+void LightweightQuarantineRoot::DisableAsyncDrain() {
+  {
+    // Once this is seen by TryEnqueuePendingBatch(), no batch can be queued
+    // anymore, so none is left behind by the drain below.
+    ScopedGuard guard(pending_lock_);
+    async_drain_enabled_ = false;
+    request_drain_.store(nullptr, std::memory_order_relaxed);
+  }
+  DrainPendingFrees();
+}
+
+size_t LightweightQuarantineRoot::DrainPendingFrees() {
+  size_t freed_count = 0;
+  while (true) {
+    PendingBatch batch;
+    {
+      ScopedGuard guard(pending_lock_);
+      if (!num_pending_batches_) {
+        break;
+      }
+      batch = pending_batches_[--num_pending_batches_];
+    }
+    FreeDequarantinedSlots(allocator_root_, batch.slot_starts->data(),
+                           batch.num_of_slots);
+    freed_count += batch.num_of_slots;
+    ReturnSpareBatch(batch.slot_starts);
+  }
+  return freed_count;
+}
+
+bool LightweightQuarantineRoot::TryEnqueuePendingBatch(
+    ToBeFreedArray* slot_starts,
+    size_t num_of_slots) {
+  {
+    ScopedGuard guard(pending_lock_);
+    if (!async_drain_enabled_ || num_pending_batches_ == kMaxPendingBatches) {
+      return false;
+    }
+    pending_batches_[num_pending_batches_++] = {slot_starts, num_of_slots};
+  }
+  async_drain_batch_count_.fetch_add(1, std::memory_order_relaxed);
+  if (auto request_drain = request_drain_.load(std::memory_order_relaxed)) {
+    request_drain(*this);
+  }
+  return true;
+}
+
+LightweightQuarantineToBeFreedArray*
+LightweightQuarantineRoot::TakeSpareBatch() {
+  ScopedGuard guard(pending_lock_);
+  if (!num_spare_batches_) {
+    return nullptr;
+  }
+  return spare_batches_[--num_spare_batches_];
+}
+
+void LightweightQuarantineRoot::ReturnSpareBatch(ToBeFreedArray* batch) {
+  {
+    ScopedGuard guard(pending_lock_);
+    if (num_spare_batches_ < spare_batches_.size()) {
+      spare_batches_[num_spare_batches_++] = batch;
+      return;
+    }
+  }
+  DestroyAtInternalPartition(batch);
+}
+
 LightweightQuarantineBranch::LightweightQuarantineBranch(
     Root& root,
     const LightweightQuarantineBranchConfig& config)
     : root_(root),
       lock_required_(config.lock_required),
+      segregate_by_size_(config.segregate_by_size),
       branch_capacity_in_bytes_(config.branch_capacity_in_bytes) {
+  for (auto& share : budget_shares_) {
+    share.store(kBudgetShareDenominator / kNumSizeClasses,
+                std::memory_order_relaxed);
+  }
   if (lock_required_) {
     to_be_freed_working_memory_ =
         ConstructAtInternalPartition<ToBeFreedArray>();
@@ -85,10 +209,18 @@ LightweightQuarantineBranch::LightweightQuarantineBranch(
     LightweightQuarantineBranch&& b)
     : root_(b.root_),
       lock_required_(b.lock_required_),
+      segregate_by_size_(b.segregate_by_size_),
       slots_(std::move(b.slots_)),
+      size_class_size_in_bytes_(b.size_class_size_in_bytes_),
       branch_size_in_bytes_(b.branch_size_in_bytes_),
       branch_capacity_in_bytes_(
           b.branch_capacity_in_bytes_.load(std::memory_order_relaxed)) {
+  for (size_t i = 0; i < kNumSizeClasses; ++i) {
+    budget_shares_[i].store(
+        b.budget_shares_[i].load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+  }
+  b.size_class_size_in_bytes_ = {};
   b.branch_size_in_bytes_ = 0;
   if (lock_required_) {
     to_be_freed_working_memory_.store(b.to_be_freed_working_memory_.exchange(
@@ -109,9 +241,11 @@ bool LightweightQuarantineBranch::IsQuarantinedForTesting(void* object) {
   RuntimeConditionalScopedGuard guard(lock_required_, lock_);
   uintptr_t slot_start =
       root_.allocator_root_.ObjectToSlotStartUnchecked(object);
-  for (const auto& slot : slots_) {
-    if (slot.slot_start == slot_start) {
-      return true;
+  for (const auto& size_class_slots : slots_) {
+    for (const auto& slot : size_class_slots) {
+      if (slot.slot_start == slot_start) {
+        return true;
+      }
     }
   }
   return false;
@@ -123,8 +257,44 @@ void LightweightQuarantineBranch::SetCapacityInBytes(size_t capacity_in_bytes) {
 
 void LightweightQuarantineBranch::Purge() {
   RuntimeConditionalScopedGuard guard(lock_required_, lock_);
-  PurgeInternal(0);
-  slots_.shrink_to_fit();
+  for (size_t size_class = 0; size_class < kNumSizeClasses; ++size_class) {
+    PurgeInternal(size_class, 0);
+    slots_[size_class].shrink_to_fit();
+  }
+}
+
+void LightweightQuarantineBranch::RecordSizeClassRequest(size_t size_class,
+                                                         size_t usable_size) {
+  requested_bytes_[size_class].fetch_add(usable_size,
+                                         std::memory_order_relaxed);
+  if (requests_since_rebalance_.fetch_add(1, std::memory_order_relaxed) + 1 <
+      kRebalancePeriod) [[likely]] {
+    return;
+  }
+  requests_since_rebalance_.store(0, std::memory_order_relaxed);
+
+  std::array<size_t, kNumSizeClasses> requested_bytes;
+  size_t total_requested_bytes = 0;
+  for (size_t i = 0; i < kNumSizeClasses; ++i) {
+    requested_bytes[i] = requested_bytes_[i].load(std::memory_order_relaxed);
+    total_requested_bytes += requested_bytes[i];
+    // Decay, so that the shares follow recent frees.
+    requested_bytes_[i].fetch_sub(requested_bytes[i] / 2,
+                                  std::memory_order_relaxed);
+  }
+  if (!total_requested_bytes) {
+    return;
+  }
+  constexpr uint32_t kAdaptiveShares =
+      kBudgetShareDenominator - kMinBudgetShare * kNumSizeClasses;
+  for (size_t i = 0; i < kNumSizeClasses; ++i) {
+    // Go through double, as the product may overflow size_t.
+    const uint32_t adaptive_share = static_cast<uint32_t>(
+        static_cast<double>(kAdaptiveShares) * requested_bytes[i] /
+        total_requested_bytes);
+    budget_shares_[i].store(kMinBudgetShare + adaptive_share,
+                            std::memory_order_relaxed);
+  }
 }
 
 template <LightweightQuarantineBranch::LockRequired lock_required>
@@ -137,11 +307,14 @@ bool LightweightQuarantineBranch::QuarantineInternal(
                            : lock_required == LockRequired::kNotRequired);
   PA_DCHECK(usable_size == root_.allocator_root_.GetSlotUsableSize(slot_span));
 
-  const size_t capacity_in_bytes =
-      branch_capacity_in_bytes_.load(std::memory_order_relaxed);
+  const size_t size_class = GetSizeClass(usable_size);
+  if (segregate_by_size_) {
+    RecordSizeClassRequest(size_class, usable_size);
+  }
+  const size_t capacity_in_bytes = GetSizeClassCapacityInBytes(size_class);
   if (capacity_in_bytes < usable_size) [[unlikely]] {
-    // Even if this branch dequarantines all entries held by it, this entry
-    // cannot fit within the capacity.
+    // Even if this branch dequarantines all entries held by it (in this size
+    // class), this entry cannot fit within the capacity.
     root_.allocator_root_.FreeNoHooksImmediate(object, slot_span, slot_start);
     root_.quarantine_miss_count_.fetch_add(1u, std::memory_order_relaxed);
     return false;
@@ -154,27 +327,48 @@ bool LightweightQuarantineBranch::QuarantineInternal(
     // `slots_` as `slots_` is annotated with `PA_GUARDED_BY(lock_)`.
     // CompileTimeConditionalScopedGuard's ctor and dtor behave as
     // PA_EXCLUSIVE_LOCK_FUNCTION and PA_UNLOCK_FUNCTION.
-    CompileTimeConditionalScopedGuard<lock_required> guard(lock_);
+    ToBeFreedArray* unqueued_batch = nullptr;
+    size_t num_of_slots = 0;
+    {
+      CompileTimeConditionalScopedGuard<lock_required> guard(lock_);
 
-    // Dequarantine some entries as required.
-    PurgeInternal(capacity_in_bytes - usable_size);
+      // Dequarantine some entries as required.
+      if (!TryPurgeInternalAsync(size_class, capacity_in_bytes - usable_size,
+                                 unqueued_batch, num_of_slots)) [[likely]] {
+        PurgeInternal(size_class, capacity_in_bytes - usable_size);
+      }
+      if (IsOverBranchCapacity(usable_size)) [[unlikely]] {
+        for (size_t i = 0; i < kNumSizeClasses; ++i) {
+          if (i != size_class) {
+            PurgeInternal(i, GetSizeClassCapacityInBytes(i));
+          }
+        }
+      }
 
-    // Put the entry onto the list.
-    branch_size_in_bytes_ += usable_size;
-    slots_.push_back({slot_start, usable_size});
+      // Put the entry onto the list.
+      auto& slots = slots_[size_class];
+      branch_size_in_bytes_ += usable_size;
+      size_class_size_in_bytes_[size_class] += usable_size;
+      slots.push_back({slot_start, usable_size});
 
-    // Swap randomly so that the quarantine list remain shuffled.
-    // This is not uniformly random, but sufficiently random.
-    const size_t random_index = random_.RandUint32() % slots_.size();
-    std::swap(slots_[random_index], slots_.back());
+      // Swap randomly so that the quarantine list remain shuffled.
+      // This is not uniformly random, but sufficiently random.
+      const size_t random_index = random_.RandUint32() % slots.size();
+      std::swap(slots[random_index], slots.back());
+    }
+    if (unqueued_batch) [[unlikely]] {
+      FreeUnqueuedBatch(unqueued_batch, num_of_slots);
+    }
   } else {
     std::unique_ptr<ToBeFreedArray, InternalPartitionDeleter<ToBeFreedArray>>
         to_be_freed;
     size_t num_of_slots = 0;
-
-    {
-      CompileTimeConditionalScopedGuard<lock_required> guard(lock_);
-
+    ToBeFreedArray* unqueued_batch = nullptr;
+    size_t num_of_unqueued_slots = 0;
+    auto borrow_to_be_freed = [&] {
+      if (to_be_freed) {
+        return;
+      }
       // Borrow the reserved working memory from to_be_freed_working_memory_,
       // and set nullptr to it indicating that it's in use.
       to_be_freed.reset(to_be_freed_working_memory_.exchange(nullptr));
@@ -183,34 +377,61 @@ bool LightweightQuarantineBranch::QuarantineInternal(
         // thread, fall back to allocate another chunk of working memory.
         to_be_freed.reset(ConstructAtInternalPartition<ToBeFreedArray>());
       }
+    };
+
+    {
+      CompileTimeConditionalScopedGuard<lock_required> guard(lock_);
 
-      // Dequarantine some entries as required. Save the objects to be
+      // Dequarantine some entries as required, handing them to the
+      // asynchronous drain if possible. Otherwise, save the objects to be
       // deallocated into `to_be_freed`.
-      PurgeInternalWithDefferedFree(capacity_in_bytes - usable_size,
-                                    *to_be_freed, num_of_slots);
+      if (!TryPurgeInternalAsync(size_class, capacity_in_bytes - usable_size,
+                                 unqueued_batch, num_of_unqueued_slots))
+          [[likely]] {
+        borrow_to_be_freed();
+        PurgeInternalWithDefferedFree(size_class,
+                                      capacity_in_bytes - usable_size,
+                                      *to_be_freed, num_of_slots);
+      }
+      if (IsOverBranchCapacity(usable_size)) [[unlikely]] {
+        borrow_to_be_freed();
+        for (size_t i = 0; i < kNumSizeClasses; ++i) {
+          if (i != size_class) {
+            PurgeInternalWithDefferedFree(i, GetSizeClassCapacityInBytes(i),
+                                          *to_be_freed, num_of_slots);
+          }
+        }
+      }
 
       // Put the entry onto the list.
+      auto& slots = slots_[size_class];
       branch_size_in_bytes_ += usable_size;
-      slots_.push_back({slot_start, usable_size});
+      size_class_size_in_bytes_[size_class] += usable_size;
+      slots.push_back({slot_start, usable_size});
 
       // Swap randomly so that the quarantine list remain shuffled.
       // This is not uniformly random, but sufficiently random.
-      const size_t random_index = random_.RandUint32() % slots_.size();
-      std::swap(slots_[random_index], slots_.back());
+      const size_t random_index = random_.RandUint32() % slots.size();
+      std::swap(slots[random_index], slots.back());
     }
 
-    // Actually deallocate the dequarantined objects.
-    BatchFree(*to_be_freed, num_of_slots);
-
-    // Return the possibly-borrowed working memory to
-    // to_be_freed_working_memory_. It doesn't matter much if it's really
-    // borrowed or locally-allocated. The important facts are 1) to_be_freed is
-    // non-null, and 2) to_be_freed_working_memory_ may likely be null (because
-    // this or another thread has already borrowed it). It's simply good to make
-    // to_be_freed_working_memory_ non-null whenever possible. Maybe yet another
-    // thread would be about to borrow the working memory.
-    to_be_freed.reset(
-        to_be_freed_working_memory_.exchange(to_be_freed.release()));
+    if (unqueued_batch) [[unlikely]] {
+      FreeUnqueuedBatch(unqueued_batch, num_of_unqueued_slots);
+    }
+    if (to_be_freed) {
+      // Actually deallocate the dequarantined objects.
+      BatchFree(to_be_freed->data(), num_of_slots);
+
+      // Return the possibly-borrowed working memory to
+      // to_be_freed_working_memory_. It doesn't matter much if it's really
+      // borrowed or locally-allocated. The important facts are 1) to_be_freed
+      // is non-null, and 2) to_be_freed_working_memory_ may likely be null
+      // (because this or another thread has already borrowed it). It's simply
+      // good to make to_be_freed_working_memory_ non-null whenever possible.
+      // Maybe yet another thread would be about to borrow the working memory.
+      to_be_freed.reset(
+          to_be_freed_working_memory_.exchange(to_be_freed.release()));
+    }
   }
 
   // Update stats (not locked).
@@ -237,35 +458,41 @@ template bool LightweightQuarantineBranch::QuarantineInternal<
     size_t usable_size);
 
 PA_ALWAYS_INLINE void LightweightQuarantineBranch::PurgeInternal(
+    size_t size_class,
     size_t target_size_in_bytes) {
+  auto& slots = slots_[size_class];
+  size_t& size_in_bytes = size_class_size_in_bytes_[size_class];
+
   int64_t freed_count = 0;
   int64_t freed_size_in_bytes = 0;
 
+  // Small enough to live on the stack, see `to_be_freed_working_memory_`.
+  std::array<uintptr_t, kPurgeBatchSize> to_be_freed;
+  size_t num_of_slots = 0;
+
   // Dequarantine some entries as required.
-  while (target_size_in_bytes < branch_size_in_bytes_) {
-    PA_DCHECK(!slots_.empty());
+  while (target_size_in_bytes < size_in_bytes) {
+    PA_DCHECK(!slots.empty());
 
     // As quarantined entries are shuffled, picking last entry is equivalent
     // to picking random entry.
-    const auto& to_free = slots_.back();
+    const auto& to_free = slots.back();
     size_t to_free_size = to_free.usable_size;
 
-    auto* slot_span = SlotSpanMetadata<MetadataKind::kReadOnly>::FromSlotStart(
-        to_free.slot_start);
-    void* object = root_.allocator_root_.SlotStartToObject(to_free.slot_start);
-    PA_DCHECK(slot_span ==
-              SlotSpanMetadata<MetadataKind::kReadOnly>::FromObject(object));
-
-    PA_DCHECK(to_free.slot_start);
-    root_.allocator_root_.FreeNoHooksImmediate(object, slot_span,
-                                               to_free.slot_start);
+    to_be_freed[num_of_slots++] = to_free.slot_start;
+    if (num_of_slots == to_be_freed.size()) {
+      BatchFree(to_be_freed.data(), num_of_slots);
+      num_of_slots = 0;
+    }
 
     freed_count++;
     freed_size_in_bytes += to_free_size;
+    size_in_bytes -= to_free_size;
     branch_size_in_bytes_ -= to_free_size;
 
-    slots_.pop_back();
+    slots.pop_back();
   }
+  BatchFree(to_be_freed.data(), num_of_slots);
 
   root_.size_in_bytes_.fetch_sub(freed_size_in_bytes,
                                  std::memory_order_relaxed);
@@ -274,51 +501,84 @@ PA_ALWAYS_INLINE void LightweightQuarantineBranch::PurgeInternal(
 
 PA_ALWAYS_INLINE void
 LightweightQuarantineBranch::PurgeInternalWithDefferedFree(
+    size_t size_class,
     size_t target_size_in_bytes,
     ToBeFreedArray& to_be_freed,
     size_t& num_of_slots) {
-  num_of_slots = 0;
+  auto& slots = slots_[size_class];
+  size_t& size_in_bytes = size_class_size_in_bytes_[size_class];
 
+  int64_t freed_count = 0;
   int64_t freed_size_in_bytes = 0;
 
   // Dequarantine some entries as required.
-  while (target_size_in_bytes < branch_size_in_bytes_) {
-    PA_DCHECK(!slots_.empty());
+  while (target_size_in_bytes < size_in_bytes &&
+         num_of_slots < kMaxFreeTimesPerPurge) {
+    PA_DCHECK(!slots.empty());
 
     // As quarantined entries are shuffled, picking last entry is equivalent to
     // picking random entry.
-    const QuarantineSlot& to_free = slots_.back();
+    const QuarantineSlot& to_free = slots.back();
     const size_t to_free_size = to_free.usable_size;
 
     to_be_freed[num_of_slots++] = to_free.slot_start;
-    slots_.pop_back();
+    slots.pop_back();
 
+    freed_count++;
     freed_size_in_bytes += to_free_size;
+    size_in_bytes -= to_free_size;
     branch_size_in_bytes_ -= to_free_size;
-
-    if (num_of_slots >= kMaxFreeTimesPerPurge) {
-      break;
-    }
   }
 
   root_.size_in_bytes_.fetch_sub(freed_size_in_bytes,
                                  std::memory_order_relaxed);
-  root_.count_.fetch_sub(num_of_slots, std::memory_order_relaxed);
+  root_.count_.fetch_sub(freed_count, std::memory_order_relaxed);
 }
 
 PA_ALWAYS_INLINE void LightweightQuarantineBranch::BatchFree(
-    const ToBeFreedArray& to_be_freed,
+    uintptr_t* slot_starts,
     size_t num_of_slots) {
-  for (size_t i = 0; i < num_of_slots; ++i) {
-    const uintptr_t slot_start = to_be_freed[i];
-    PA_DCHECK(slot_start);
-    auto* slot_span =
-        SlotSpanMetadata<MetadataKind::kReadOnly>::FromSlotStart(slot_start);
-    void* object = root_.allocator_root_.SlotStartToObject(slot_start);
-    PA_DCHECK(slot_span ==
-              SlotSpanMetadata<MetadataKind::kReadOnly>::FromObject(object));
-    root_.allocator_root_.FreeNoHooksImmediate(object, slot_span, slot_start);
+  FreeDequarantinedSlots(root_.allocator_root_, slot_starts, num_of_slots);
+}
+
+void LightweightQuarantineBranch::FreeUnqueuedBatch(ToBeFreedArray* batch,
+                                                    size_t num_of_slots) {
+  BatchFree(batch->data(), num_of_slots);
+  root_.ReturnSpareBatch(batch);
+}
+
+bool LightweightQuarantineBranch::TryPurgeInternalAsync(
+    size_t size_class,
+    size_t target_size_in_bytes,
+    ToBeFreedArray*& unqueued_batch,
+    size_t& num_of_slots) {
+  if (!root_.IsAsyncDrainEnabled()) [[likely]] {
+    return false;
+  }
+  if (size_class_size_in_bytes_[size_class] <= target_size_in_bytes) {
+    return true;
   }
+
+  ToBeFreedArray* batch = root_.TakeSpareBatch();
+  if (!batch) [[unlikely]] {
+    // All the batches are queued: the drain is lagging behind, apply
+    // backpressure.
+    root_.async_drain_fallback_count_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  const size_t capacity_in_bytes = GetSizeClassCapacityInBytes(size_class);
+  target_size_in_bytes =
+      std::min(target_size_in_bytes,
+               capacity_in_bytes - capacity_in_bytes / kAsyncDrainBatchRatio);
+  PurgeInternalWithDefferedFree(size_class, target_size_in_bytes, *batch,
+                                num_of_slots);
+  if (!root_.TryEnqueuePendingBatch(batch, num_of_slots)) [[unlikely]] {
+    // Same, the caller frees the batch once the lock is released.
+    root_.async_drain_fallback_count_.fetch_add(1, std::memory_order_relaxed);
+    unqueued_batch = batch;
+  }
+  return true;
 }
 
 }  // namespace partition_alloc::internal
@@ -61,18 +61,49 @@ struct LightweightQuarantineBranchConfig {
   bool lock_required = true;
   // Capacity for a branch in bytes.
   size_t branch_capacity_in_bytes = 0;
+  // When set, entries are segregated by size class, each with its own share of
+  // the capacity, so that large objects only evict other large objects. The
+  // shares follow the sizes of the objects recently freed, with a floor for
+  // each size class.
+  bool segregate_by_size = false;
 };
 
 class LightweightQuarantineBranch;
 
+// Slots dequarantined in one go, see `LightweightQuarantineBranch`.
+inline constexpr size_t kLightweightQuarantineMaxFreeTimesPerPurge = 1024;
+using LightweightQuarantineToBeFreedArray =
+    std::array<uintptr_t, kLightweightQuarantineMaxFreeTimesPerPurge>;
+
 class PA_COMPONENT_EXPORT(PARTITION_ALLOC) LightweightQuarantineRoot {
  public:
   explicit LightweightQuarantineRoot(PartitionRoot& allocator_root)
       : allocator_root_(allocator_root) {}
+  ~LightweightQuarantineRoot();
 
   LightweightQuarantineBranch CreateBranch(
       const LightweightQuarantineBranchConfig& config);
 
+  // By default, a branch going over its capacity dequarantines entries on the
+  // freeing thread. With the asynchronous drain, these entries are instead
+  // queued in batches, and freed by `DrainPendingFrees()`, typically called
+  // from a background thread owned by the embedder. `request_drain` is invoked
+  // once a batch is queued, to wake that thread up. It runs with quarantine
+  // locks held, so it must neither allocate nor free memory.
+  //
+  // The queue is bounded, and its batches are allocated here. When it is full,
+  // the freeing thread dequarantines entries itself, as if the asynchronous
+  // drain was disabled.
+  using DrainRequestCallback = void (*)(LightweightQuarantineRoot& root);
+  void EnableAsyncDrain(DrainRequestCallback request_drain);
+  // Also frees the batches still in the queue.
+  void DisableAsyncDrain();
+  bool IsAsyncDrainEnabled() const {
+    return request_drain_.load(std::memory_order_relaxed);
+  }
+  // Frees all the queued batches. Returns the number of slots freed.
+  size_t DrainPendingFrees();
+
   void AccumulateStats(LightweightQuarantineStats& stats) const {
     stats.count += count_.load(std::memory_order_relaxed);
     stats.size_in_bytes += size_in_bytes_.load(std::memory_order_relaxed);
@@ -81,17 +112,51 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) LightweightQuarantineRoot {
         cumulative_size_in_bytes_.load(std::memory_order_relaxed);
     stats.quarantine_miss_count +=
         quarantine_miss_count_.load(std::memory_order_relaxed);
+    stats.async_drain_batch_count +=
+        async_drain_batch_count_.load(std::memory_order_relaxed);
+    stats.async_drain_fallback_count +=
+        async_drain_fallback_count_.load(std::memory_order_relaxed);
   }
 
  private:
+  using ToBeFreedArray = LightweightQuarantineToBeFreedArray;
+  struct PendingBatch {
+    ToBeFreedArray* slot_starts;
+    size_t num_of_slots;
+  };
+  static constexpr size_t kMaxPendingBatches = 4;
+
+  // Queues a batch for `DrainPendingFrees()`, taking ownership of it. Returns
+  // false if the queue is full.
+  bool TryEnqueuePendingBatch(ToBeFreedArray* slot_starts, size_t num_of_slots);
+  // Batches are allocated by `EnableAsyncDrain()`, and recycled once drained,
+  // so that none is allocated with a branch lock held. Returns nullptr if they
+  // are all in use.
+  ToBeFreedArray* TakeSpareBatch();
+  void ReturnSpareBatch(ToBeFreedArray* batch);
+
   PartitionRoot& allocator_root_;
 
+  std::atomic<DrainRequestCallback> request_drain_ = nullptr;
+  Lock pending_lock_;
+  // Whether batches may be queued. Unlike `request_drain_`, which branches
+  // read without the lock, only changes with `pending_lock_` held.
+  bool async_drain_enabled_ PA_GUARDED_BY(pending_lock_) = false;
+  std::array<PendingBatch, kMaxPendingBatches> pending_batches_
+      PA_GUARDED_BY(pending_lock_) = {};
+  size_t num_pending_batches_ PA_GUARDED_BY(pending_lock_) = 0;
+  std::array<ToBeFreedArray*, kMaxPendingBatches> spare_batches_
+      PA_GUARDED_BY(pending_lock_) = {};
+  size_t num_spare_batches_ PA_GUARDED_BY(pending_lock_) = 0;
+
   // Stats.
   std::atomic_size_t size_in_bytes_ = 0;
   std::atomic_size_t count_ = 0;  // Number of quarantined entries
   std::atomic_size_t cumulative_count_ = 0;
   std::atomic_size_t cumulative_size_in_bytes_ = 0;
   std::atomic_size_t quarantine_miss_count_ = 0;
+  std::atomic_size_t async_drain_batch_count_ = 0;
+  std::atomic_size_t async_drain_fallback_count_ = 0;
 
   friend class LightweightQuarantineBranch;
 };
@@ -154,6 +219,12 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) LightweightQuarantineBranch {
   // requirement.
   void SetCapacityInBytes(size_t capacity_in_bytes);
 
+  // Capacity available to objects of `usable_size`. This is the whole
+  // capacity, unless the branch is segregated by size.
+  size_t GetCapacityInBytesForSize(size_t usable_size) {
+    return GetSizeClassCapacityInBytes(GetSizeClass(usable_size));
+  }
+
  private:
   enum class LockRequired { kNotRequired, kRequired };
   template <LockRequired lock_required>
@@ -164,8 +235,25 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) LightweightQuarantineBranch {
   // In order to avoid reentrancy issues, we must not deallocate any object in
   // `Quarantine`. So, std::vector is not an option. std::array doesn't
   // deallocate, plus, std::array has perf advantages.
-  static constexpr size_t kMaxFreeTimesPerPurge = 1024;
-  using ToBeFreedArray = std::array<uintptr_t, kMaxFreeTimesPerPurge>;
+  static constexpr size_t kMaxFreeTimesPerPurge =
+      kLightweightQuarantineMaxFreeTimesPerPurge;
+  using ToBeFreedArray = LightweightQuarantineToBeFreedArray;
+  // `PurgeInternal` frees entries by batches of this size, on the stack.
+  static constexpr size_t kPurgeBatchSize = 64;
+
+  // Size classes by usable size, with `segregate_by_size_`. Otherwise, all the
+  // entries belong to the first one.
+  static constexpr size_t kNumSizeClasses = 4;
+  static constexpr std::array<size_t, kNumSizeClasses - 1> kSizeClassLimits = {
+      256, 4096, 64 * 1024};
+  // Each size class gets a share of the capacity, out of
+  // `kBudgetShareDenominator`. Half of the capacity is evenly guaranteed to all
+  // classes, the other half is split according to the bytes freed in each
+  // class, recomputed every `kRebalancePeriod` quarantine requests.
+  static constexpr uint32_t kBudgetShareDenominator = 1024;
+  static constexpr uint32_t kMinBudgetShare =
+      kBudgetShareDenominator / (2 * kNumSizeClasses);
+  static constexpr size_t kRebalancePeriod = 1024;
 
   LightweightQuarantineBranch(Root& root,
                               const LightweightQuarantineBranchConfig& config);
@@ -176,12 +264,52 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) LightweightQuarantineBranch {
                           uintptr_t slot_start,
                           size_t usable_size);
 
-  // Try to dequarantine entries to satisfy below:
-  //   root_.size_in_bytes_ <=  target_size_in_bytes
+  PA_ALWAYS_INLINE size_t GetSizeClass(size_t usable_size) const {
+    if (!segregate_by_size_) [[likely]] {
+      return 0;
+    }
+    size_t size_class = 0;
+    while (size_class < kSizeClassLimits.size() &&
+           usable_size > kSizeClassLimits[size_class]) {
+      ++size_class;
+    }
+    return size_class;
+  }
+  PA_ALWAYS_INLINE size_t GetSizeClassCapacityInBytes(size_t size_class) {
+    const size_t capacity_in_bytes =
+        branch_capacity_in_bytes_.load(std::memory_order_relaxed);
+    if (!segregate_by_size_) [[likely]] {
+      return capacity_in_bytes;
+    }
+    const size_t share =
+        budget_shares_[size_class].load(std::memory_order_relaxed);
+    if (capacity_in_bytes >
+        std::numeric_limits<size_t>::max() / kBudgetShareDenominator)
+        [[unlikely]] {
+      return capacity_in_bytes / kBudgetShareDenominator * share;
+    }
+    return capacity_in_bytes * share / kBudgetShareDenominator;
+  }
+  // Records a quarantine request, and recomputes the shares of the size
+  // classes once in a while.
+  void RecordSizeClassRequest(size_t size_class, size_t usable_size);
+  // Whether adding an entry of `usable_size` would take the branch over its
+  // capacity. Size classes stay within their own shares, except the ones
+  // whose share was cut by a rebalance, which are then purged down to it.
+  PA_ALWAYS_INLINE bool IsOverBranchCapacity(size_t usable_size)
+      PA_EXCLUSIVE_LOCKS_REQUIRED(lock_) {
+    return segregate_by_size_ &&
+           branch_size_in_bytes_ + usable_size >
+               branch_capacity_in_bytes_.load(std::memory_order_relaxed);
+  }
+
+  // Try to dequarantine entries of `size_class` to satisfy below:
+  //   size_class_size_in_bytes_[size_class] <= target_size_in_bytes
   // It is possible that this branch cannot satisfy the
   // request as it has control over only what it has. If you need to ensure the
   // constraint, call `Purge()` for each branch in sequence, synchronously.
-  PA_ALWAYS_INLINE void PurgeInternal(size_t target_size_in_bytes)
+  PA_ALWAYS_INLINE void PurgeInternal(size_t size_class,
+                                      size_t target_size_in_bytes)
       PA_EXCLUSIVE_LOCKS_REQUIRED(lock_);
   // In order to reduce thread contention, dequarantines entries in two phases:
   //   Phase 1) With the lock acquired, saves `slot_start`s of the quarantined
@@ -190,33 +318,61 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) LightweightQuarantineBranch {
   //   Phase 2) Without the lock acquired, deallocates objects saved in the
   //     array in Phase 1. This may take some time, but doesn't block other
   //     threads.
+  // The entries are appended to the first `num_of_slots` ones, which is
+  // updated.
   PA_ALWAYS_INLINE void PurgeInternalWithDefferedFree(
+      size_t size_class,
       size_t target_size_in_bytes,
       ToBeFreedArray& to_be_freed,
       size_t& num_of_slots) PA_EXCLUSIVE_LOCKS_REQUIRED(lock_);
-  PA_ALWAYS_INLINE void BatchFree(const ToBeFreedArray& to_be_freed,
-                                  size_t num_of_slots);
+  // Frees `num_of_slots` dequarantined slots, sorting `slot_starts` so that
+  // they are released one slot span at a time.
+  PA_ALWAYS_INLINE void BatchFree(uintptr_t* slot_starts, size_t num_of_slots);
+  // With the asynchronous drain enabled, dequarantines entries like
+  // `PurgeInternal`, and queues them for the drain. Dequarantines a bit more
+  // than requested, so that batches are worth queueing. Returns false if the
+  // asynchronous drain is disabled or out of batches, in which case nothing is
+  // done. If the batch couldn't be queued, it is returned in `unqueued_batch`
+  // with `num_of_slots` entries, for the caller to pass to
+  // `FreeUnqueuedBatch()` once `lock_` is released.
+  bool TryPurgeInternalAsync(size_t size_class,
+                             size_t target_size_in_bytes,
+                             ToBeFreedArray*& unqueued_batch,
+                             size_t& num_of_slots)
+      PA_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  void FreeUnqueuedBatch(ToBeFreedArray* batch, size_t num_of_slots)
+      PA_LOCKS_EXCLUDED(lock_);
 
   Root& root_;
 
   const bool lock_required_;
+  const bool segregate_by_size_;
   Lock lock_;
 
   // Non-cryptographic random number generator.
   // Thread-unsafe so guarded by `lock_`.
   base::InsecureRandomGenerator random_ PA_GUARDED_BY(lock_);
 
-  // `slots_` hold quarantined entries.
+  // `slots_` hold quarantined entries, per size class.
   struct QuarantineSlot {
     uintptr_t slot_start;
     size_t usable_size;
   };
-  std::vector<QuarantineSlot, InternalAllocator<QuarantineSlot>> slots_
-      PA_GUARDED_BY(lock_);
+  std::array<std::vector<QuarantineSlot, InternalAllocator<QuarantineSlot>>,
+             kNumSizeClasses>
+      slots_ PA_GUARDED_BY(lock_);
+  std::array<size_t, kNumSizeClasses> size_class_size_in_bytes_
+      PA_GUARDED_BY(lock_) = {};
   size_t branch_size_in_bytes_ PA_GUARDED_BY(lock_) = 0;
   // Using `std::atomic` here so that other threads can update this value.
   std::atomic_size_t branch_capacity_in_bytes_;
 
+  // Only used with `segregate_by_size_`. Updated without `lock_`, as they are
+  // needed before it is taken, and only drive a heuristic.
+  std::array<std::atomic<uint32_t>, kNumSizeClasses> budget_shares_;
+  std::array<std::atomic_size_t, kNumSizeClasses> requested_bytes_ = {};
+  std::atomic_size_t requests_since_rebalance_ = 0;
+
   // This working memory is temporarily needed only while dequarantining
   // objects in slots_ when lock_required_ is true. However, allocating this
   // working memory on stack may cause stack overflow [1]. Plus, it's non-
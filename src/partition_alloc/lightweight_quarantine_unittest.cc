@@ -4,6 +4,10 @@
 
 #include "partition_alloc/lightweight_quarantine.h"
 
+#include <atomic>
+#include <vector>
+
+#include "partition_alloc/partition_alloc_base/threading/platform_thread_for_testing.h"
 #include "partition_alloc/partition_alloc_for_testing.h"
 #include "partition_alloc/partition_page.h"
 #include "partition_alloc/partition_root.h"
@@ -139,6 +143,336 @@ TEST_P(PartitionAllocLightweightQuarantineTest, TooLargeAllocation) {
   ASSERT_EQ(0u, stats.cumulative_count);
 }
 
+TEST_P(PartitionAllocLightweightQuarantineTest, PurgeMixedSizes) {
+  const size_t allocated_bytes_before =
+      GetPartitionRoot()->get_total_size_of_allocated_bytes();
+  const size_t capacity_in_bytes = GetQuarantineBranch()->GetCapacityInBytes();
+
+  // Entries from several buckets, and several slot spans of each, are
+  // evicted in batches.
+  std::vector<void*> objects;
+  size_t quarantined_size = 0;
+  for (size_t i = 0; quarantined_size < capacity_in_bytes; ++i) {
+    void* object = GetPartitionRoot()->Alloc(1 + (i % 4) * 16);
+    objects.push_back(object);
+    quarantined_size += GetObjectSize(object);
+    ASSERT_TRUE(Quarantine(object));
+  }
+  EXPECT_LT(0u, GetStats().count);
+
+  GetQuarantineBranch()->Purge();
+  auto stats = GetStats();
+  EXPECT_EQ(0u, stats.size_in_bytes);
+  EXPECT_EQ(0u, stats.count);
+  EXPECT_EQ(objects.size(), stats.cumulative_count);
+  for (void* object : objects) {
+    EXPECT_FALSE(GetQuarantineBranch()->IsQuarantinedForTesting(object));
+  }
+  EXPECT_EQ(allocated_bytes_before,
+            GetPartitionRoot()->get_total_size_of_allocated_bytes());
+
+  // The slots are back on their freelists, and can be reused.
+  for (size_t i = 0; i < objects.size(); ++i) {
+    objects[i] = GetPartitionRoot()->Alloc(1 + (i % 4) * 16);
+  }
+  for (void* object : objects) {
+    GetPartitionRoot()->Free(object);
+  }
+}
+
+namespace {
+
+std::atomic<size_t> g_drain_requests = 0;
+
+void CountDrainRequest(QuarantineRoot& root) {
+  g_drain_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+TEST_P(PartitionAllocLightweightQuarantineTest, AsyncDrain) {
+  const size_t allocated_bytes_before =
+      GetPartitionRoot()->get_total_size_of_allocated_bytes();
+  const size_t capacity_in_bytes = GetQuarantineBranch()->GetCapacityInBytes();
+  g_drain_requests = 0;
+  GetQuarantineRoot()->EnableAsyncDrain(CountDrainRequest);
+  ASSERT_TRUE(GetQuarantineRoot()->IsAsyncDrainEnabled());
+
+  // Overflow the branch, without draining.
+  std::vector<void*> objects;
+  size_t quarantined_size = 0;
+  while (quarantined_size <= capacity_in_bytes) {
+    void* object = GetPartitionRoot()->Alloc(1);
+    objects.push_back(object);
+    quarantined_size += GetObjectSize(object);
+    ASSERT_TRUE(Quarantine(object));
+  }
+  auto stats = GetStats();
+  EXPECT_EQ(1u, stats.async_drain_batch_count);
+  EXPECT_EQ(0u, stats.async_drain_fallback_count);
+  EXPECT_EQ(1u, g_drain_requests.load());
+  EXPECT_LE(stats.size_in_bytes, capacity_in_bytes);
+  // Evicts more than strictly needed, in a single batch.
+  EXPECT_LE(stats.size_in_bytes, capacity_in_bytes - capacity_in_bytes / 8 +
+                                     GetObjectSize(objects.back()));
+
+  // Pending slots are still allocated.
+  const size_t pending = objects.size() - stats.count;
+  EXPECT_EQ(pending, GetQuarantineRoot()->DrainPendingFrees());
+  EXPECT_EQ(0u, GetQuarantineRoot()->DrainPendingFrees());
+
+  GetQuarantineRoot()->DisableAsyncDrain();
+  GetQuarantineBranch()->Purge();
+  EXPECT_EQ(allocated_bytes_before,
+            GetPartitionRoot()->get_total_size_of_allocated_bytes());
+}
+
+TEST_P(PartitionAllocLightweightQuarantineTest, AsyncDrainBackpressure) {
+  const size_t allocated_bytes_before =
+      GetPartitionRoot()->get_total_size_of_allocated_bytes();
+  GetQuarantineRoot()->EnableAsyncDrain(CountDrainRequest);
+
+  // Nobody drains: once the queue is full, overflows are handled by the
+  // freeing thread.
+  for (size_t i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(Quarantine(GetPartitionRoot()->Alloc(1)));
+  }
+  auto stats = GetStats();
+  EXPECT_LT(0u, stats.async_drain_batch_count);
+  EXPECT_LT(0u, stats.async_drain_fallback_count);
+  EXPECT_LE(stats.size_in_bytes, GetQuarantineBranch()->GetCapacityInBytes());
+
+  // Frees the pending batches.
+  GetQuarantineRoot()->DisableAsyncDrain();
+  EXPECT_FALSE(GetQuarantineRoot()->IsAsyncDrainEnabled());
+  EXPECT_EQ(0u, GetQuarantineRoot()->DrainPendingFrees());
+  GetQuarantineBranch()->Purge();
+  EXPECT_EQ(allocated_bytes_before,
+            GetPartitionRoot()->get_total_size_of_allocated_bytes());
+}
+
+namespace {
+
+class DrainerThread : public internal::base::PlatformThreadForTesting::Delegate {
+ public:
+  explicit DrainerThread(QuarantineRoot& root) : root_(root) {}
+
+  void ThreadMain() override {
+    while (!stop_.load(std::memory_order_acquire)) {
+      freed_count_ += root_.DrainPendingFrees();
+      internal::base::PlatformThreadForTesting::YieldCurrentThread();
+    }
+  }
+
+  void Stop() { stop_.store(true, std::memory_order_release); }
+  size_t freed_count() const { return freed_count_; }
+
+ private:
+  QuarantineRoot& root_;
+  std::atomic<bool> stop_ = false;
+  size_t freed_count_ = 0;
+};
+
+}  // namespace
+
+TEST_P(PartitionAllocLightweightQuarantineTest, AsyncDrainOnAnotherThread) {
+  const size_t allocated_bytes_before =
+      GetPartitionRoot()->get_total_size_of_allocated_bytes();
+  GetQuarantineRoot()->EnableAsyncDrain(CountDrainRequest);
+
+  DrainerThread drainer(*GetQuarantineRoot());
+  internal::base::PlatformThreadHandle thread_handle;
+  internal::base::PlatformThreadForTesting::Create(0, &drainer,
+                                                   &thread_handle);
+  constexpr size_t kCount = 10000;
+  for (size_t i = 0; i < kCount; ++i) {
+    ASSERT_TRUE(Quarantine(GetPartitionRoot()->Alloc(1 + i % 64)));
+  }
+  drainer.Stop();
+  internal::base::PlatformThreadForTesting::Join(thread_handle);
+
+  GetQuarantineRoot()->DisableAsyncDrain();
+  auto stats = GetStats();
+  EXPECT_EQ(kCount, stats.cumulative_count);
+  EXPECT_LT(0u, stats.async_drain_batch_count);
+  EXPECT_LE(stats.size_in_bytes, GetQuarantineBranch()->GetCapacityInBytes());
+
+  GetQuarantineBranch()->Purge();
+  EXPECT_EQ(allocated_bytes_before,
+            GetPartitionRoot()->get_total_size_of_allocated_bytes());
+}
+
+TEST_P(PartitionAllocLightweightQuarantineTest, AsyncDrainOnDestruction) {
+  const size_t allocated_bytes_before =
+      GetPartitionRoot()->get_total_size_of_allocated_bytes();
+  GetQuarantineRoot()->EnableAsyncDrain(CountDrainRequest);
+  for (size_t i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(Quarantine(GetPartitionRoot()->Alloc(1)));
+  }
+  ASSERT_LT(0u, GetStats().async_drain_batch_count);
+
+  // The pending batches are freed, like the quarantined slots.
+  branch_.reset();
+  root_.reset();
+  EXPECT_EQ(allocated_bytes_before,
+            GetPartitionRoot()->get_total_size_of_allocated_bytes());
+}
+
+namespace {
+
+class AsyncDrainTogglerThread
+    : public internal::base::PlatformThreadForTesting::Delegate {
+ public:
+  explicit AsyncDrainTogglerThread(QuarantineRoot& root) : root_(root) {}
+
+  void ThreadMain() override {
+    while (!stop_.load(std::memory_order_acquire)) {
+      root_.EnableAsyncDrain(CountDrainRequest);
+      internal::base::PlatformThreadForTesting::YieldCurrentThread();
+      root_.DisableAsyncDrain();
+    }
+  }
+
+  void Stop() { stop_.store(true, std::memory_order_release); }
+
+ private:
+  QuarantineRoot& root_;
+  std::atomic<bool> stop_ = false;
+};
+
+}  // namespace
+
+TEST_P(PartitionAllocLightweightQuarantineTest, AsyncDrainToggledConcurrently) {
+  const size_t allocated_bytes_before =
+      GetPartitionRoot()->get_total_size_of_allocated_bytes();
+
+  AsyncDrainTogglerThread toggler(*GetQuarantineRoot());
+  internal::base::PlatformThreadHandle thread_handle;
+  internal::base::PlatformThreadForTesting::Create(0, &toggler,
+                                                   &thread_handle);
+  for (size_t i = 0; i < 10000; ++i) {
+    ASSERT_TRUE(Quarantine(GetPartitionRoot()->Alloc(1 + i % 64)));
+  }
+  toggler.Stop();
+  internal::base::PlatformThreadForTesting::Join(thread_handle);
+
+  // Nothing was queued after the last drain.
+  EXPECT_FALSE(GetQuarantineRoot()->IsAsyncDrainEnabled());
+  EXPECT_EQ(0u, GetQuarantineRoot()->DrainPendingFrees());
+  GetQuarantineBranch()->Purge();
+  EXPECT_EQ(allocated_bytes_before,
+            GetPartitionRoot()->get_total_size_of_allocated_bytes());
+}
+
+TEST_P(PartitionAllocLightweightQuarantineTest, SegregateBySize) {
+  constexpr size_t kCapacityInBytes = 64 * 1024;
+  QuarantineBranch branch = GetQuarantineRoot()->CreateBranch(
+      {.lock_required = GetParam().lock_required,
+       .branch_capacity_in_bytes = kCapacityInBytes,
+       .segregate_by_size = true});
+  auto quarantine = [&](void* object) {
+    auto* slot_span = internal::SlotSpanMetadata<
+        internal::MetadataKind::kReadOnly>::FromObject(object);
+    return branch.Quarantine(object, slot_span,
+                             GetPartitionRoot()->ObjectToSlotStart(object),
+                             GetObjectSize(object));
+  };
+
+  // Until the first rebalance, size classes share the capacity evenly.
+  EXPECT_EQ(kCapacityInBytes / 4, branch.GetCapacityInBytesForSize(32));
+  EXPECT_EQ(kCapacityInBytes / 4, branch.GetCapacityInBytesForSize(8192));
+
+  std::vector<void*> small_objects;
+  for (size_t i = 0; i < 16; ++i) {
+    small_objects.push_back(GetPartitionRoot()->Alloc(32));
+    ASSERT_TRUE(quarantine(small_objects.back()));
+  }
+  // Large objects exceed their own budget many times over, but only evict one
+  // another.
+  for (size_t i = 0; i < 64; ++i) {
+    ASSERT_TRUE(quarantine(GetPartitionRoot()->Alloc(8192)));
+  }
+  for (void* object : small_objects) {
+    EXPECT_TRUE(branch.IsQuarantinedForTesting(object));
+  }
+  auto stats = GetStats();
+  EXPECT_LE(stats.size_in_bytes,
+            kCapacityInBytes / 4 + 16 * GetObjectSize(small_objects[0]));
+
+  branch.Purge();
+  EXPECT_EQ(0u, GetStats().size_in_bytes);
+}
+
+TEST_P(PartitionAllocLightweightQuarantineTest, SegregateBySizeAdaptsBudgets) {
+  constexpr size_t kCapacityInBytes = 1024 * 1024;
+  QuarantineBranch branch = GetQuarantineRoot()->CreateBranch(
+      {.lock_required = GetParam().lock_required,
+       .branch_capacity_in_bytes = kCapacityInBytes,
+       .segregate_by_size = true});
+
+  // Only free small objects, for a few rebalance periods.
+  for (size_t i = 0; i < 4096; ++i) {
+    void* object = GetPartitionRoot()->Alloc(64);
+    auto* slot_span = internal::SlotSpanMetadata<
+        internal::MetadataKind::kReadOnly>::FromObject(object);
+    ASSERT_TRUE(branch.Quarantine(object, slot_span,
+                                  GetPartitionRoot()->ObjectToSlotStart(object),
+                                  GetObjectSize(object)));
+  }
+
+  // Small objects get most of the capacity, other size classes keep their
+  // floor.
+  EXPECT_GT(branch.GetCapacityInBytesForSize(64), kCapacityInBytes / 2);
+  EXPECT_EQ(kCapacityInBytes / 8, branch.GetCapacityInBytesForSize(1024));
+  EXPECT_EQ(kCapacityInBytes / 8, branch.GetCapacityInBytesForSize(8192));
+  EXPECT_EQ(kCapacityInBytes / 8, branch.GetCapacityInBytesForSize(1 << 20));
+
+  branch.Purge();
+  EXPECT_EQ(0u, GetStats().size_in_bytes);
+}
+
+TEST_P(PartitionAllocLightweightQuarantineTest,
+       SegregateBySizeStaysWithinCapacity) {
+  constexpr size_t kCapacityInBytes = 1024 * 1024;
+  QuarantineBranch branch = GetQuarantineRoot()->CreateBranch(
+      {.lock_required = GetParam().lock_required,
+       .branch_capacity_in_bytes = kCapacityInBytes,
+       .segregate_by_size = true});
+  auto quarantine = [&](size_t size) {
+    void* object = GetPartitionRoot()->Alloc(size);
+    auto* slot_span = internal::SlotSpanMetadata<
+        internal::MetadataKind::kReadOnly>::FromObject(object);
+    return branch.Quarantine(object, slot_span,
+                             GetPartitionRoot()->ObjectToSlotStart(object),
+                             GetObjectSize(object));
+  };
+
+  // Fill the larger size classes up to their initial share, before the first
+  // rebalance.
+  for (size_t i = 0; i < 512; ++i) {
+    ASSERT_TRUE(quarantine(1024));
+  }
+  for (size_t i = 0; i < 64; ++i) {
+    ASSERT_TRUE(quarantine(8192));
+  }
+  for (size_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(quarantine(128 * 1024));
+  }
+  EXPECT_LE(GetStats().size_in_bytes, kCapacityInBytes);
+
+  // Then only small objects, which take most of the capacity from the other
+  // size classes once rebalanced.
+  for (size_t i = 0; i < 8192; ++i) {
+    ASSERT_TRUE(quarantine(128));
+    ASSERT_LE(GetStats().size_in_bytes, kCapacityInBytes);
+  }
+  EXPECT_GT(branch.GetCapacityInBytesForSize(128), kCapacityInBytes / 2);
+  EXPECT_LT(branch.GetCapacityInBytesForSize(8192), kCapacityInBytes / 4);
+
+  branch.Purge();
+  EXPECT_EQ(0u, GetStats().size_in_bytes);
+}
+
 #endif  // !defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
 
 }  // namespace partition_alloc
@@ -363,6 +363,15 @@ void DiscardSystemPages(void* address, size_t length) {
   DiscardSystemPages(reinterpret_cast<uintptr_t>(address), length);
 }
 
+bool PrefaultSystemPages(uintptr_t address, size_t length) {
+  PA_DCHECK(!(address & internal::SystemPageOffsetMask()));
+  PA_DCHECK(!(length & internal::SystemPageOffsetMask()));
+  return internal::PrefaultSystemPagesInternal(address, length);
+}
+bool PrefaultSystemPages(void* address, size_t length) {
+  return PrefaultSystemPages(reinterpret_cast<uintptr_t>(address), length);
+}
+
 bool SealSystemPages(uintptr_t address, size_t length) {
   PA_DCHECK(!(length & internal::SystemPageOffsetMask()));
   return internal::SealSystemPagesInternal(address, length);
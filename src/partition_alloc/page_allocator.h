@@ -343,6 +343,18 @@ void DiscardSystemPages(uintptr_t address, size_t length);
 PA_COMPONENT_EXPORT(PARTITION_ALLOC)
 void DiscardSystemPages(void* address, size_t length);
 
+// Pre-faults a number of committed, writable system pages starting at
+// |address|, so that the first accesses to them don't take page faults. The
+// content of the pages is not changed. Returns |false| if this is not supported
+// by the system, in which case the pages are left alone.
+//
+// Only supported on Linux-based systems with a kernel >= 5.14, see
+// MADV_POPULATE_WRITE.
+PA_COMPONENT_EXPORT(PARTITION_ALLOC)
+bool PrefaultSystemPages(uintptr_t address, size_t length);
+PA_COMPONENT_EXPORT(PARTITION_ALLOC)
+bool PrefaultSystemPages(void* address, size_t length);
+
 // Seal a number of system pages starting at |address|. Returns |true| on
 // success.
 //
@@ -206,6 +206,10 @@ void DiscardSystemPagesInternal(uint64_t address, size_t length) {
   PA_ZX_CHECK(status == ZX_OK, status);
 }
 
+bool PrefaultSystemPagesInternal(uint64_t address, size_t length) {
+  return false;
+}
+
 bool SealSystemPagesInternal(uint64_t address, size_t length) {
   return false;
 }
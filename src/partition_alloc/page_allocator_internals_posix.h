@@ -320,6 +320,28 @@ void DiscardSystemPagesInternal(uintptr_t address, size_t length) {
 #endif  // PA_BUILDFLAG(IS_APPLE)
 }
 
+bool PrefaultSystemPagesInternal(uintptr_t address, size_t length) {
+#if PA_BUILDFLAG(IS_LINUX) || PA_BUILDFLAG(IS_CHROMEOS) || \
+    PA_BUILDFLAG(IS_ANDROID)
+#if !defined(MADV_POPULATE_WRITE)
+#define MADV_POPULATE_WRITE 23
+#endif
+  // Older kernels reject MADV_POPULATE_WRITE with EINVAL, don't try again.
+  static std::atomic<bool> unsupported = false;
+  if (unsupported.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  int ret = WrapEINTR(madvise)(reinterpret_cast<void*>(address), length,
+                               MADV_POPULATE_WRITE);
+  if (ret && errno == EINVAL) {
+    unsupported.store(true, std::memory_order_relaxed);
+  }
+  return !ret;
+#else
+  return false;
+#endif
+}
+
 bool SealSystemPagesInternal(uintptr_t address, size_t length) {
   // TODO(sroettger): we either need to ensure that __NR_mseal is defined in the
   // headers used by builders or define it ourselves.
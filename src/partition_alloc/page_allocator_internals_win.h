@@ -238,6 +238,10 @@ void DiscardSystemPagesInternal(uintptr_t address, size_t length) {
   }
 }
 
+bool PrefaultSystemPagesInternal(uintptr_t address, size_t length) {
+  return false;
+}
+
 bool SealSystemPagesInternal(uintptr_t address, size_t length) {
   return false;
 }
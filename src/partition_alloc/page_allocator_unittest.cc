@@ -605,6 +605,41 @@ TEST(PartitionAllocPageAllocatorTest, DecommitAndZero) {
   FreePages(buffer, size);
 }
 
+TEST(PartitionAllocPageAllocatorTest, Prefault) {
+  size_t size = 4 * PageAllocationGranularity();
+  uintptr_t buffer = AllocPages(size, PageAllocationGranularity(),
+                                PageAccessibilityConfiguration(
+                                    PageAccessibilityConfiguration::kReadWrite),
+                                PageTag::kChromium);
+  ASSERT_TRUE(buffer);
+  memset(reinterpret_cast<void*>(buffer), 42, SystemPageSize());
+
+  bool prefaulted = PrefaultSystemPages(buffer, size);
+#if !PA_BUILDFLAG(IS_LINUX) && !PA_BUILDFLAG(IS_CHROMEOS) && \
+    !PA_BUILDFLAG(IS_ANDROID)
+  EXPECT_FALSE(prefaulted);
+#endif
+
+#if PA_BUILDFLAG(IS_POSIX) && !PA_BUILDFLAG(IS_APPLE)
+  if (prefaulted) {
+    std::vector<unsigned char> residency(size / SystemPageSize());
+    ASSERT_EQ(0, mincore(reinterpret_cast<void*>(buffer), size,
+                         residency.data()));
+    for (unsigned char resident : residency) {
+      EXPECT_TRUE(resident & 1);
+    }
+  }
+#endif
+
+  // The content is preserved.
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(buffer);
+  EXPECT_EQ(42, bytes[0]);
+  EXPECT_EQ(42, bytes[SystemPageSize() - 1]);
+  EXPECT_EQ(0, bytes[SystemPageSize()]);
+
+  FreePages(buffer, size);
+}
+
 TEST(PartitionAllocPageAllocatorTest, MappedPagesAccounting) {
   size_t size = PageAllocationGranularity();
   // Ask for a large alignment to make sure that trimming doesn't change the
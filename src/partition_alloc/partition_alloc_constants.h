@@ -500,6 +500,10 @@ static_assert(kMaxEmptySlotSpanRingSize >= kForegroundEmptySlotSpanRingSize);
 static_assert(kMaxEmptySlotSpanRingSize >= kBackgroundEmptySlotSpanRingSize);
 static_assert(kMaxEmptySlotSpanRingSize >= kDefaultEmptySlotSpanRingSize);
 
+// Maximum number of freed direct maps that a partition keeps around for reuse.
+// See `PartitionOptions::direct_map_cache_capacity_in_bytes`.
+constexpr size_t kMaxDirectMapCacheEntries = 8;
+
 // If the total size in bytes of allocated but not committed pages exceeds this
 // value (probably it is a "out of virtual address space" crash), a special
 // crash stack trace is generated at
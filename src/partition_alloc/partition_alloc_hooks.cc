@@ -8,6 +8,7 @@
 
 #include "partition_alloc/partition_alloc_check.h"
 #include "partition_alloc/partition_lock.h"
+#include "partition_alloc/thread_cache.h"
 
 namespace partition_alloc {
 
@@ -32,8 +33,14 @@ std::atomic<PartitionAllocHooks::FreeOverrideHook*>
     PartitionAllocHooks::free_override_hook_(nullptr);
 std::atomic<PartitionAllocHooks::ReallocOverrideHook*>
     PartitionAllocHooks::realloc_override_hook_(nullptr);
+std::atomic<PartitionAllocHooks::BufferedObserverHook*>
+    PartitionAllocHooks::buffered_observer_hook_(nullptr);
+std::atomic<size_t> PartitionAllocHooks::buffered_observer_dropped_event_count_(
+    0);
 std::atomic<PartitionAllocHooks::QuarantineOverrideHook*>
     PartitionAllocHooks::quarantine_override_hook_(nullptr);
+std::atomic<PartitionAllocHooks::BrpQuarantineOverCapacityHook*>
+    PartitionAllocHooks::brp_quarantine_over_capacity_hook_(nullptr);
 
 void PartitionAllocHooks::SetObserverHooks(AllocationObserverHook* alloc_hook,
                                            FreeObserverHook* free_hook) {
@@ -67,6 +74,24 @@ void PartitionAllocHooks::SetOverrideHooks(AllocationOverrideHook* alloc_hook,
   hooks_enabled_ = allocation_observer_hook_ || allocation_override_hook_;
 }
 
+void PartitionAllocHooks::SetBufferedObserverHook(BufferedObserverHook* hook) {
+  internal::ScopedGuard guard(GetHooksLock());
+
+  PA_CHECK(!buffered_observer_hook_ || !hook)
+      << "Overwriting already set buffered observer hook";
+  buffered_observer_hook_ = hook;
+}
+
+size_t PartitionAllocHooks::FlushBufferedObserverEvents() {
+  // Events buffered before the hook was unset are dropped.
+  return ThreadCacheRegistry::Instance().FlushObservedEvents(
+      buffered_observer_hook_.load(std::memory_order_relaxed));
+}
+
+size_t PartitionAllocHooks::GetBufferedObserverDroppedEventCount() {
+  return buffered_observer_dropped_event_count_.load(std::memory_order_relaxed);
+}
+
 void PartitionAllocHooks::AllocationObserverHookIfEnabled(
     const partition_alloc::AllocationNotificationData& notification_data) {
   if (auto* hook = allocation_observer_hook_.load(std::memory_order_relaxed)) {
@@ -129,4 +154,9 @@ void PartitionAllocHooks::SetQuarantineOverrideHook(
   quarantine_override_hook_.store(hook, std::memory_order_release);
 }
 
+void PartitionAllocHooks::SetBrpQuarantineOverCapacityHook(
+    BrpQuarantineOverCapacityHook* hook) {
+  brp_quarantine_over_capacity_hook_.store(hook, std::memory_order_release);
+}
+
 }  // namespace partition_alloc
@@ -7,15 +7,18 @@
 
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 
 #include "partition_alloc/partition_alloc_base/compiler_specific.h"
 #include "partition_alloc/partition_alloc_base/component_export.h"
+#include "partition_alloc/partition_alloc_base/threading/platform_thread.h"
 #include "partition_alloc/partition_alloc_constants.h"
 
 namespace partition_alloc {
 
 class AllocationNotificationData;
 class FreeNotificationData;
+struct PartitionRoot;
 
 // PartitionAlloc supports setting hooks to observe allocations/frees as they
 // occur as well as 'override' hooks that allow overriding those operations.
@@ -44,6 +47,32 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionAllocHooks {
   // with a bit pattern that cannot be interpreted as a valid memory address.
   typedef void QuarantineOverrideHook(void* address, size_t size);
 
+  // Special hook type, independent of the rest. Triggered whenever a slot is
+  // quarantined by BackupRefPtr while `root` holds more than
+  // `PartitionOptions::backup_ref_ptr_quarantine_capacity_in_bytes` in its
+  // quarantine. Called on the freeing thread, without any lock of `root` held.
+  // Slots evicted from a scheduler-loop quarantine branch may be freed, and so
+  // reported, under the branch lock: the hook must not free memory itself.
+  typedef void BrpQuarantineOverCapacityHook(PartitionRoot* root,
+                                             size_t quarantined_bytes,
+                                             size_t capacity_in_bytes);
+
+  // Allocation or free, as recorded for the buffered observer hook.
+  struct BufferedObserverEvent {
+    enum class Type : uint8_t { kAllocation, kFree };
+
+    // Address of the object, as passed to the observer hooks.
+    uintptr_t address;
+    // Usable size of the slot.
+    size_t size;
+    internal::base::PlatformThreadId thread_id;
+    Type type;
+  };
+  // Receives a batch of events, from FlushBufferedObserverEvents(). Events of a
+  // given thread are in order, events of different threads are not.
+  typedef void BufferedObserverHook(const BufferedObserverEvent* events,
+                                    size_t count);
+
   // To unhook, call Set*Hooks with nullptrs.
   static void SetObserverHooks(AllocationObserverHook* alloc_hook,
                                FreeObserverHook* free_hook);
@@ -51,6 +80,31 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionAllocHooks {
                                FreeOverrideHook* free_hook,
                                ReallocOverrideHook realloc_hook);
 
+  // Alternative to the observer hooks, for tracing: allocations and frees are
+  // not reported as they happen, but appended to a lock-free buffer belonging
+  // to the calling thread, and only handed to `hook` once the embedder calls
+  // FlushBufferedObserverEvents(), typically from a dedicated thread. This
+  // doesn't divert allocations from the thread cache fast path, nor does it
+  // set AreHooksEnabled().
+  //
+  // Only sees the partitions with a thread cache, on threads which have one.
+  // Events are dropped when a thread's buffer is full, see
+  // GetBufferedObserverDroppedEventCount().
+  static void SetBufferedObserverHook(BufferedObserverHook* hook);
+  PA_ALWAYS_INLINE static bool IsBufferedObserverHookEnabled() {
+    return buffered_observer_hook_.load(std::memory_order_relaxed);
+  }
+  // Hands all events buffered so far to the buffered observer hook, outside of
+  // any PartitionAlloc lock, so that it may allocate. Must not be called from
+  // the hook itself. Returns the number of events delivered.
+  static size_t FlushBufferedObserverEvents();
+  static size_t GetBufferedObserverDroppedEventCount();
+  // Called when a thread's buffer is full.
+  static void RecordBufferedObserverDroppedEvent() {
+    buffered_observer_dropped_event_count_.fetch_add(1,
+                                                     std::memory_order_relaxed);
+  }
+
   // Helper method to check whether hooks are enabled. This is an optimization
   // so that if a function needs to call observer and override hooks in two
   // different places this value can be cached and only loaded once.
@@ -80,6 +134,14 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionAllocHooks {
 
   static void SetQuarantineOverrideHook(QuarantineOverrideHook* hook);
 
+  PA_ALWAYS_INLINE static BrpQuarantineOverCapacityHook*
+  GetBrpQuarantineOverCapacityHook() {
+    return brp_quarantine_over_capacity_hook_.load(std::memory_order_acquire);
+  }
+
+  static void SetBrpQuarantineOverCapacityHook(
+      BrpQuarantineOverCapacityHook* hook);
+
  private:
   // Single bool that is used to indicate whether observer or allocation hooks
   // are set to reduce the numbers of loads required to check whether hooking is
@@ -94,7 +156,12 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionAllocHooks {
   static std::atomic<FreeOverrideHook*> free_override_hook_;
   static std::atomic<ReallocOverrideHook*> realloc_override_hook_;
 
+  static std::atomic<BufferedObserverHook*> buffered_observer_hook_;
+  static std::atomic<size_t> buffered_observer_dropped_event_count_;
+
   static std::atomic<QuarantineOverrideHook*> quarantine_override_hook_;
+  static std::atomic<BrpQuarantineOverCapacityHook*>
+      brp_quarantine_over_capacity_hook_;
 };
 
 }  // namespace partition_alloc
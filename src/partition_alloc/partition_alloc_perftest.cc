@@ -8,6 +8,7 @@
 #include <atomic>
 #include <limits>
 #include <memory>
+#include <random>
 #include <vector>
 
 #include "base/debug/debugging_buildflags.h"
@@ -72,6 +73,7 @@ enum class AllocatorType {
   kSystem,
   kPartitionAlloc,
   kPartitionAllocWithThreadCache,
+  kPartitionAllocWithSchedulerLoopQuarantine,
 #if BUILDFLAG(ENABLE_ALLOCATION_STACK_TRACE_RECORDER)
   kPartitionAllocWithAllocationStackTraceRecorder,
 #endif
@@ -149,6 +151,37 @@ class PartitionAllocatorWithThreadCache : public Allocator {
   internal::ThreadCacheProcessScopeForTesting scope_;
 };
 
+// Measures the overhead of the scheduler-loop quarantine on free(): every
+// object goes through the (shared, locked) quarantine branch, and is evicted
+// once it is full.
+class PartitionAllocatorWithSchedulerLoopQuarantine : public Allocator {
+ public:
+  PartitionAllocatorWithSchedulerLoopQuarantine() = default;
+  ~PartitionAllocatorWithSchedulerLoopQuarantine() override {
+    alloc_.GetSchedulerLoopQuarantineBranchForTesting().Purge();
+    alloc_.DestructForTesting();
+  }
+
+  void* Alloc(size_t size) override {
+    return alloc_.AllocInline<AllocFlags::kNoHooks>(size);
+  }
+  void Free(void* data) override {
+    PartitionRoot::FreeInlineInUnknownRoot<
+        FreeFlags::kNoHooks | FreeFlags::kSchedulerLoopQuarantine>(data);
+  }
+
+ private:
+  static constexpr size_t kQuarantineCapacityInBytes = 256 * 1024;
+  static constexpr partition_alloc::PartitionOptions kOpts = [] {
+    partition_alloc::PartitionOptions opts;
+    opts.scheduler_loop_quarantine = PartitionOptions::kEnabled;
+    opts.scheduler_loop_quarantine_branch_capacity_in_bytes =
+        kQuarantineCapacityInBytes;
+    return opts;
+  }();
+  PartitionRoot alloc_{kOpts};
+};
+
 #if BUILDFLAG(ENABLE_ALLOCATION_STACK_TRACE_RECORDER)
 class PartitionAllocatorWithAllocationStackTraceRecorder : public Allocator {
  public:
@@ -348,6 +381,40 @@ float MultiBucketWithFree(Allocator* allocator) {
   return timer.LapsPerSecond() * kMultiBucketRounds;
 }
 
+// Allocations chase freelist pointers to cold cache lines: the free slots are
+// scattered across many pages in random order, and the working set is larger
+// than typical caches. This is the case freelist prefetching targets.
+float SingleBucketScatteredFreelist(Allocator* allocator) {
+  constexpr size_t kSlotCount = 1 << 16;
+  std::vector<void*> slots(kSlotCount);
+  for (void*& slot : slots) {
+    slot = allocator->Alloc(kAllocSize);
+    PA_CHECK(slot != nullptr);
+  }
+  // Fixed seed, to keep runs comparable.
+  std::minstd_rand random_engine(42);
+  std::shuffle(slots.begin(), slots.end(), random_engine);
+  for (void* slot : slots) {
+    allocator->Free(slot);
+  }
+
+  ::base::LapTimer timer(kWarmupRuns / kSlotCount + 1, kTimeLimit, 1);
+  do {
+    // Allocations come back in freelist order. Freeing them in the same order
+    // reverses the freelist, which keeps it scattered.
+    for (void*& slot : slots) {
+      slot = allocator->Alloc(kAllocSize);
+      PA_CHECK(slot != nullptr);
+    }
+    for (void* slot : slots) {
+      allocator->Free(slot);
+    }
+    timer.NextLap();
+  } while (!timer.HasTimeLimitExpired());
+
+  return timer.LapsPerSecond() * kSlotCount;
+}
+
 float DirectMapped(Allocator* allocator) {
   constexpr size_t kSize = 2 * 1000 * 1000;
 
@@ -372,6 +439,8 @@ std::unique_ptr<Allocator> CreateAllocator(AllocatorType type,
     case AllocatorType::kPartitionAllocWithThreadCache:
       return std::make_unique<PartitionAllocatorWithThreadCache>(
           use_alternate_bucket_dist);
+    case AllocatorType::kPartitionAllocWithSchedulerLoopQuarantine:
+      return std::make_unique<PartitionAllocatorWithSchedulerLoopQuarantine>();
 #if BUILDFLAG(ENABLE_ALLOCATION_STACK_TRACE_RECORDER)
     case AllocatorType::kPartitionAllocWithAllocationStackTraceRecorder:
       return std::make_unique<
@@ -431,6 +500,9 @@ void RunTest(int thread_count,
     case AllocatorType::kPartitionAllocWithThreadCache:
       alloc_type_str = "PartitionAllocWithThreadCache";
       break;
+    case AllocatorType::kPartitionAllocWithSchedulerLoopQuarantine:
+      alloc_type_str = "PartitionAllocWithSchedulerLoopQuarantine";
+      break;
 #if BUILDFLAG(ENABLE_ALLOCATION_STACK_TRACE_RECORDER)
     case AllocatorType::kPartitionAllocWithAllocationStackTraceRecorder:
       alloc_type_str = "PartitionAllocWithAllocationStackTraceRecorder";
@@ -470,7 +542,8 @@ INSTANTIATE_TEST_SUITE_P(
         ::testing::Values(
             AllocatorType::kSystem,
             AllocatorType::kPartitionAlloc,
-            AllocatorType::kPartitionAllocWithThreadCache
+            AllocatorType::kPartitionAllocWithThreadCache,
+            AllocatorType::kPartitionAllocWithSchedulerLoopQuarantine
 #if BUILDFLAG(ENABLE_ALLOCATION_STACK_TRACE_RECORDER)
             ,
             AllocatorType::kPartitionAllocWithAllocationStackTraceRecorder
@@ -510,6 +583,13 @@ TEST_P(PartitionAllocMemoryAllocationPerfTest, MultiBucketWithFree) {
           "MultiBucketWithFree");
 }
 
+TEST_P(PartitionAllocMemoryAllocationPerfTest, SingleBucketScatteredFreelist) {
+  auto params = GetParam();
+  RunTest(std::get<int>(params), std::get<bool>(params),
+          std::get<AllocatorType>(params), SingleBucketScatteredFreelist,
+          nullptr, "SingleBucketScatteredFreelist");
+}
+
 TEST_P(PartitionAllocMemoryAllocationPerfTest, DirectMapped) {
   auto params = GetParam();
   RunTest(std::get<int>(params), std::get<bool>(params),
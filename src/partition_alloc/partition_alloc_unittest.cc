@@ -3841,6 +3841,34 @@ TEST_P(PartitionAllocTest, SchedulerLoopQuarantineDisabled) {
   root->Free(ptr_to_keep_slot_span);
 }
 
+TEST_P(PartitionAllocTest, SchedulerLoopQuarantineSegregateBySize) {
+  constexpr size_t kCapacityInBytes = 64 * 1024;
+  PartitionOptions opts = GetCommonPartitionOptions();
+  opts.scheduler_loop_quarantine_branch_capacity_in_bytes = kCapacityInBytes;
+  opts.scheduler_loop_quarantine_segregate_by_size = PartitionOptions::kEnabled;
+  opts.thread_cache = PartitionOptions::kDisabled;
+  std::unique_ptr<PartitionRoot> root = CreateCustomTestRoot(opts, {});
+  LightweightQuarantineBranch& branch =
+      root->GetSchedulerLoopQuarantineBranchForTesting();
+  EXPECT_EQ(kCapacityInBytes / 4, branch.GetCapacityInBytesForSize(32));
+
+  std::vector<void*> small_objects;
+  for (size_t i = 0; i < 16; ++i) {
+    small_objects.push_back(root->Alloc(32, type_name));
+    root->Free<FreeFlags::kSchedulerLoopQuarantine>(small_objects.back());
+  }
+  // Large objects only evict one another.
+  for (size_t i = 0; i < 64; ++i) {
+    root->Free<FreeFlags::kSchedulerLoopQuarantine>(
+        root->Alloc(8192, type_name));
+  }
+  for (void* object : small_objects) {
+    EXPECT_TRUE(branch.IsQuarantinedForTesting(object));
+  }
+
+  branch.Purge();
+}
+
 TEST_P(PartitionAllocTest, ZapOnFree) {
   void* ptr = allocator.root()->Alloc(1, type_name);
   EXPECT_TRUE(ptr);
@@ -4036,6 +4064,32 @@ TEST_P(PartitionAllocTest, ZeroFreedMemory) {
   // and the freed memory cannot be touched anymore.
 }
 
+TEST_P(PartitionAllocTest, ZeroFreedMemoryBatch) {
+  auto* root = allocator.root();
+  ASSERT_TRUE(root->settings.eventually_zero_freed_memory);
+
+  constexpr int kByte = 'A';
+  constexpr size_t kSize = 1024;
+  constexpr size_t kCount = 8;
+  std::array<void*, kCount> ptrs;
+  std::array<uintptr_t, kCount> slot_starts;
+  for (size_t i = 0; i < kCount; ++i) {
+    ptrs[i] = root->Alloc(kSize, type_name);
+    ASSERT_TRUE(ptrs[i]);
+    memset(ptrs[i], kByte, kSize);
+    slot_starts[i] = root->ObjectToSlotStart(ptrs[i]);
+  }
+  std::sort(slot_starts.begin(), slot_starts.end());
+  root->FreeNoHooksImmediateBatch(slot_starts.data(), kCount);
+
+  for (void* ptr : ptrs) {
+    // Accessing memory after free requires a retag.
+    ptr = TagPtr(ptr);
+    EXPECT_EQ(0, *(static_cast<unsigned char*>(ptr) + 2 * sizeof(void*)));
+    EXPECT_EQ(0, *(static_cast<unsigned char*>(ptr) + kSize - 1));
+  }
+}
+
 TEST_P(PartitionAllocTest, Bug_897585) {
   // Need sizes big enough to be direct mapped and a delta small enough to
   // allow re-use of the slot span when cookied. These numbers fall out of the
@@ -4643,6 +4697,404 @@ TEST_P(PartitionAllocTest, RefCountRealloc) {
   }
 }
 
+namespace {
+
+PartitionRoot* g_brp_quarantine_over_capacity_root = nullptr;
+size_t g_brp_quarantine_over_capacity_count = 0;
+
+void BrpQuarantineOverCapacity(PartitionRoot* root,
+                               size_t quarantined_bytes,
+                               size_t capacity_in_bytes) {
+  EXPECT_GT(quarantined_bytes, capacity_in_bytes);
+  g_brp_quarantine_over_capacity_root = root;
+  ++g_brp_quarantine_over_capacity_count;
+}
+
+class PartitionAllocBrpQuarantineCapacityTest
+    : public testing::TestWithParam<
+          PartitionOptions::BackupRefPtrQuarantinePolicy> {
+ protected:
+  void SetUp() override {
+    g_brp_quarantine_over_capacity_root = nullptr;
+    g_brp_quarantine_over_capacity_count = 0;
+    PartitionAllocHooks::SetBrpQuarantineOverCapacityHook(
+        &BrpQuarantineOverCapacity);
+  }
+
+  void TearDown() override {
+    PartitionAllocHooks::SetBrpQuarantineOverCapacityHook(nullptr);
+  }
+
+  // Large enough to span whole system pages, and to fit once but not twice in
+  // the capacity.
+  size_t AllocSize() const { return 5 * SystemPageSize(); }
+
+  PartitionOptions Options() const {
+    PartitionOptions opts;
+    opts.backup_ref_ptr = PartitionOptions::kEnabled;
+    opts.backup_ref_ptr_quarantine_capacity_in_bytes = 2 * AllocSize();
+    opts.backup_ref_ptr_quarantine_policy = GetParam();
+    return opts;
+  }
+
+  bool Discards() const {
+    return GetParam() == PartitionOptions::BackupRefPtrQuarantinePolicy::
+                             kReportAndDiscard;
+  }
+};
+
+INSTANTIATE_TEST_SUITE_P(
+    AlternatePolicies,
+    PartitionAllocBrpQuarantineCapacityTest,
+    testing::Values(
+        PartitionOptions::BackupRefPtrQuarantinePolicy::kReport,
+        PartitionOptions::BackupRefPtrQuarantinePolicy::kReportAndDiscard));
+
+}  // namespace
+
+TEST_P(PartitionAllocBrpQuarantineCapacityTest, OverCapacity) {
+  partition_alloc::PartitionAllocatorForTesting allocator(Options());
+  PartitionRoot* root = allocator.root();
+
+  void* ptrs[2];
+  uintptr_t slot_starts[2];
+  InSlotMetadata* in_slot_metadatas[2];
+  for (size_t i = 0; i < 2; ++i) {
+    ptrs[i] = root->Alloc(AllocSize());
+    slot_starts[i] = root->ObjectToSlotStart(ptrs[i]);
+    in_slot_metadatas[i] =
+        root->InSlotMetadataPointerFromObjectForTesting(ptrs[i]);
+    in_slot_metadatas[i]->Acquire();
+  }
+  const size_t pinned_size = BrpQuarantinePinnedPagesSize(
+      UntagPtr(ptrs[0]), root->GetUsableSize(ptrs[0]));
+  EXPECT_GE(pinned_size, 3 * SystemPageSize());
+
+  // The first slot fits in the capacity.
+  root->Free(ptrs[0]);
+  EXPECT_EQ(0u, g_brp_quarantine_over_capacity_count);
+  EXPECT_EQ(pinned_size,
+            root->total_size_of_brp_quarantine_pinned_pages.load());
+
+  // The second one doesn't.
+  root->Free(ptrs[1]);
+  EXPECT_EQ(1u, g_brp_quarantine_over_capacity_count);
+  EXPECT_EQ(root, g_brp_quarantine_over_capacity_root);
+  EXPECT_EQ(2 * pinned_size,
+            root->total_size_of_brp_quarantine_pinned_pages.load());
+  EXPECT_EQ(1u, root->brp_quarantine_over_capacity_count.load());
+  EXPECT_EQ(Discards() ? pinned_size : 0u,
+            root->cumulative_size_of_brp_quarantine_discarded_pages.load());
+
+  // The page holding the in-slot metadata isn't discarded.
+  auto* object = static_cast<unsigned char*>(TagPtr(ptrs[1]));
+  EXPECT_EQ(kQuarantinedByte, object[root->GetUsableSize(ptrs[1]) - 1]);
+#if PA_BUILDFLAG(IS_LINUX) || PA_BUILDFLAG(IS_ANDROID)
+  const size_t interior_offset =
+      RoundUpToSystemPage(UntagPtr(ptrs[1])) - UntagPtr(ptrs[1]);
+  EXPECT_EQ(Discards() ? 0 : kQuarantinedByte, object[interior_offset]);
+#endif
+
+  for (size_t i = 0; i < 2; ++i) {
+    InSlotMetadata* in_slot_metadata = TagPtr(in_slot_metadatas[i]);
+    EXPECT_TRUE(in_slot_metadata->Release());
+    PartitionAllocFreeForRefCounting(slot_starts[i]);
+  }
+  EXPECT_EQ(0u, root->total_size_of_brp_quarantine_pinned_pages.load());
+
+  // Slots are reusable once released, discarded or not.
+  void* ptr = root->Alloc(AllocSize());
+  memset(ptr, 'A', AllocSize());
+  root->Free(ptr);
+}
+
+TEST(PartitionAllocBrpQuarantineTest, DecommitLargeSlots) {
+  const size_t threshold = 16 * SystemPageSize();
+  partition_alloc::PartitionAllocatorForTesting allocator([&] {
+    PartitionOptions opts;
+    opts.backup_ref_ptr = PartitionOptions::kEnabled;
+    opts.backup_ref_ptr_quarantine_decommit_threshold_in_bytes = threshold;
+    return opts;
+  }());
+  PartitionRoot* root = allocator.root();
+
+  for (size_t size : {threshold / 2, threshold, 4 * threshold,
+                      kMaxBucketed + SystemPageSize()}) {
+    void* ptr = root->Alloc(size);
+    memset(ptr, 'A', size);
+    const uintptr_t slot_start = root->ObjectToSlotStart(ptr);
+    auto* in_slot_metadata =
+        root->InSlotMetadataPointerFromObjectForTesting(ptr);
+    in_slot_metadata->Acquire();
+    const size_t usable_size = root->GetUsableSize(ptr);
+    const size_t pinned_size =
+        BrpQuarantinePinnedPagesSize(UntagPtr(ptr), usable_size);
+    const size_t committed = root->total_size_of_committed_pages.load();
+
+    root->Free(ptr);
+    const size_t decommitted = usable_size >= threshold ? pinned_size : 0;
+    EXPECT_EQ(decommitted,
+              root->total_size_of_brp_quarantine_decommitted_pages.load());
+    EXPECT_EQ(committed - decommitted,
+              root->total_size_of_committed_pages.load());
+    // Bytes on partially covered pages are zapped instead.
+    auto* object = static_cast<unsigned char*>(TagPtr(ptr));
+    const size_t head_size = RoundUpToSystemPage(UntagPtr(ptr)) - UntagPtr(ptr);
+    if (head_size) {
+      EXPECT_EQ(kQuarantinedByte, object[0]);
+    }
+    if (head_size + pinned_size < usable_size) {
+      EXPECT_EQ(kQuarantinedByte, object[usable_size - 1]);
+    }
+    // The in-slot metadata is still there.
+    in_slot_metadata = TagPtr(in_slot_metadata);
+    EXPECT_FALSE(in_slot_metadata->IsAlive());
+
+    EXPECT_TRUE(in_slot_metadata->Release());
+    PartitionAllocFreeForRefCounting(slot_start);
+    EXPECT_EQ(0u, root->total_size_of_brp_quarantine_decommitted_pages.load());
+
+    // The pages are usable again.
+    ptr = root->Alloc(size);
+    memset(ptr, 'B', size);
+    root->Free(ptr);
+  }
+}
+
+TEST(PartitionAllocBrpQuarantineTest, PinnedPagesOnlyForLargeSlots) {
+  partition_alloc::PartitionAllocatorForTesting allocator([] {
+    PartitionOptions opts;
+    opts.backup_ref_ptr = PartitionOptions::kEnabled;
+    return opts;
+  }());
+  PartitionRoot* root = allocator.root();
+
+  // Small slots share their pages with other slots.
+  void* ptr = root->Alloc(64);
+  auto* in_slot_metadata = root->InSlotMetadataPointerFromObjectForTesting(ptr);
+  in_slot_metadata->Acquire();
+  root->Free(ptr);
+  EXPECT_EQ(1u, root->total_count_of_brp_quarantined_slots.load());
+  EXPECT_EQ(0u, root->total_size_of_brp_quarantine_pinned_pages.load());
+  EXPECT_TRUE(TagPtr(in_slot_metadata)->Release());
+  PartitionAllocFreeForRefCounting(root->ObjectToSlotStart(ptr));
+  EXPECT_EQ(0u, root->brp_quarantine_over_capacity_count.load());
+}
+
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+
+namespace {
+
+// Runs `function` on a new thread, and waits for its completion.
+template <typename Function>
+void RunOnOtherThread(Function function) {
+  class Delegate : public base::PlatformThreadForTesting::Delegate {
+   public:
+    explicit Delegate(Function& function) : function_(function) {}
+    void ThreadMain() override { function_(); }
+
+   private:
+    Function& function_;
+  } delegate(function);
+  base::PlatformThreadHandle handle;
+  ASSERT_TRUE(base::PlatformThreadForTesting::Create(0, &delegate, &handle));
+  base::PlatformThreadForTesting::Join(handle);
+}
+
+PartitionOptions ThreadConfinedOptions() {
+  PartitionOptions opts;
+  opts.backup_ref_ptr = PartitionOptions::kEnabled;
+  opts.thread_confined = PartitionOptions::kEnabled;
+  return opts;
+}
+
+constexpr size_t kBiasedCountTestSize = 64;
+
+}  // namespace
+
+TEST(PartitionAllocBiasedCountTest, OwnerThread) {
+  partition_alloc::PartitionAllocatorForTesting allocator(
+      ThreadConfinedOptions());
+  PartitionRoot* root = allocator.root();
+
+  void* ptr = root->Alloc(kBiasedCountTestSize);
+  auto* in_slot_metadata = root->InSlotMetadataPointerFromObjectForTesting(ptr);
+  EXPECT_TRUE(in_slot_metadata->IsAliveWithNoKnownRefs());
+
+  in_slot_metadata->Acquire();
+  in_slot_metadata->Acquire();
+  EXPECT_FALSE(in_slot_metadata->IsAliveWithNoKnownRefs());
+  EXPECT_FALSE(in_slot_metadata->Release());
+  EXPECT_FALSE(in_slot_metadata->IsAliveWithNoKnownRefs());
+  EXPECT_FALSE(in_slot_metadata->Release());
+  EXPECT_TRUE(in_slot_metadata->IsAliveWithNoKnownRefs());
+
+  // Without references left, the slot is reclaimed right away.
+  root->Free(ptr);
+  EXPECT_EQ(0u, root->total_count_of_brp_quarantined_slots.load());
+  void* ptr2 = root->Alloc(kBiasedCountTestSize);
+  EXPECT_EQ(UntagPtr(ptr), UntagPtr(ptr2));
+  root->Free(ptr2);
+}
+
+TEST(PartitionAllocBiasedCountTest, ReferencesFromOtherThreads) {
+  partition_alloc::PartitionAllocatorForTesting allocator(
+      ThreadConfinedOptions());
+  PartitionRoot* root = allocator.root();
+
+  void* ptr = root->Alloc(kBiasedCountTestSize);
+  auto* in_slot_metadata = root->InSlotMetadataPointerFromObjectForTesting(ptr);
+
+  // Other threads can't see the owner's count, and assume references.
+  in_slot_metadata->Acquire();
+  RunOnOtherThread([&] {
+    EXPECT_FALSE(in_slot_metadata->IsAliveWithNoKnownRefs());
+    in_slot_metadata->Acquire();
+    in_slot_metadata->Acquire();
+    EXPECT_FALSE(in_slot_metadata->Release());
+  });
+  // References may move between threads.
+  EXPECT_FALSE(in_slot_metadata->Release());
+  EXPECT_FALSE(in_slot_metadata->IsAliveWithNoKnownRefs());
+  EXPECT_FALSE(in_slot_metadata->Release());
+  EXPECT_TRUE(in_slot_metadata->IsAliveWithNoKnownRefs());
+
+  root->Free(ptr);
+  EXPECT_EQ(0u, root->total_count_of_brp_quarantined_slots.load());
+}
+
+TEST(PartitionAllocBiasedCountTest, DanglingReferenceFromOtherThread) {
+  partition_alloc::PartitionAllocatorForTesting allocator(
+      ThreadConfinedOptions());
+  PartitionRoot* root = allocator.root();
+
+  void* ptr = root->Alloc(kBiasedCountTestSize);
+  auto* in_slot_metadata = root->InSlotMetadataPointerFromObjectForTesting(ptr);
+  const uintptr_t slot_start = root->ObjectToSlotStart(ptr);
+
+  in_slot_metadata->Acquire();
+  RunOnOtherThread([&] { in_slot_metadata->Acquire(); });
+
+  // The owner's references count when freeing.
+  root->Free(ptr);
+  EXPECT_EQ(1u, root->total_count_of_brp_quarantined_slots.load());
+  in_slot_metadata = TagPtr(in_slot_metadata);
+  EXPECT_FALSE(in_slot_metadata->IsAlive());
+
+  EXPECT_FALSE(in_slot_metadata->Release());
+  RunOnOtherThread([&] {
+    EXPECT_TRUE(in_slot_metadata->Release());
+    PartitionAllocFreeForRefCounting(slot_start);
+  });
+  EXPECT_EQ(0u, root->total_count_of_brp_quarantined_slots.load());
+}
+
+TEST(PartitionAllocBiasedCountTest, FreedOnOtherThread) {
+  partition_alloc::PartitionAllocatorForTesting allocator(
+      ThreadConfinedOptions());
+  PartitionRoot* root = allocator.root();
+
+  void* ptr = root->Alloc(kBiasedCountTestSize);
+  auto* in_slot_metadata = root->InSlotMetadataPointerFromObjectForTesting(ptr);
+  const uintptr_t slot_start = root->ObjectToSlotStart(ptr);
+
+  // The freeing thread can't see the owner's count, so it hands the slot over
+  // to the owner, which folds the counts on its next allocation.
+  in_slot_metadata->Acquire();
+  RunOnOtherThread([&] { root->Free(ptr); });
+  EXPECT_EQ(1u, root->total_count_of_brp_quarantined_slots.load());
+  in_slot_metadata = TagPtr(in_slot_metadata);
+  EXPECT_FALSE(in_slot_metadata->IsAlive());
+
+  // The owner's reference still counts after the folding.
+  void* ptr2 = root->Alloc(kBiasedCountTestSize);
+  EXPECT_EQ(1u, root->total_count_of_brp_quarantined_slots.load());
+  EXPECT_TRUE(in_slot_metadata->Release());
+  PartitionAllocFreeForRefCounting(slot_start);
+  EXPECT_EQ(0u, root->total_count_of_brp_quarantined_slots.load());
+  root->Free(ptr2);
+}
+
+TEST(PartitionAllocBiasedCountTest, FreedOnOtherThreadWithoutReferences) {
+  partition_alloc::PartitionAllocatorForTesting allocator(
+      ThreadConfinedOptions());
+  PartitionRoot* root = allocator.root();
+
+  void* ptr = root->Alloc(kBiasedCountTestSize);
+  void* ptr2 = root->Alloc(kBiasedCountTestSize);
+  auto* in_slot_metadata = root->InSlotMetadataPointerFromObjectForTesting(ptr);
+
+  // The owner released all its references before the slots were freed.
+  in_slot_metadata->Acquire();
+  EXPECT_FALSE(in_slot_metadata->Release());
+  RunOnOtherThread([&] {
+    root->Free(ptr);
+    root->Free(ptr2);
+  });
+  EXPECT_EQ(2u, root->total_count_of_brp_quarantined_slots.load());
+
+  // The owner's next allocation reclaims them.
+  void* ptr3 = root->Alloc(kBiasedCountTestSize);
+  EXPECT_EQ(0u, root->total_count_of_brp_quarantined_slots.load());
+  root->Free(ptr3);
+}
+
+TEST(PartitionAllocBiasedCountTest, FreedOnOtherThreadWithItsReference) {
+  partition_alloc::PartitionAllocatorForTesting allocator(
+      ThreadConfinedOptions());
+  PartitionRoot* root = allocator.root();
+
+  void* ptr = root->Alloc(kBiasedCountTestSize);
+  auto* in_slot_metadata = root->InSlotMetadataPointerFromObjectForTesting(ptr);
+  const uintptr_t slot_start = root->ObjectToSlotStart(ptr);
+
+  RunOnOtherThread([&] {
+    in_slot_metadata->Acquire();
+    root->Free(ptr);
+  });
+  in_slot_metadata = TagPtr(in_slot_metadata);
+
+  // Once the owner folded the counts, the slot waits for the other thread.
+  void* ptr2 = root->Alloc(kBiasedCountTestSize);
+  EXPECT_EQ(1u, root->total_count_of_brp_quarantined_slots.load());
+  RunOnOtherThread([&] {
+    EXPECT_TRUE(in_slot_metadata->Release());
+    PartitionAllocFreeForRefCounting(slot_start);
+  });
+  EXPECT_EQ(0u, root->total_count_of_brp_quarantined_slots.load());
+  root->Free(ptr2);
+}
+
+TEST(PartitionAllocBiasedCountTest, FreedOnOtherThreadReclaimedByPurge) {
+  partition_alloc::PartitionAllocatorForTesting allocator(
+      ThreadConfinedOptions());
+  PartitionRoot* root = allocator.root();
+
+  void* ptr = root->Alloc(kBiasedCountTestSize);
+  RunOnOtherThread([&] { root->Free(ptr); });
+  EXPECT_EQ(1u, root->total_count_of_brp_quarantined_slots.load());
+  // Handing the slot over doesn't write into it.
+  auto* object = static_cast<unsigned char*>(TagPtr(ptr));
+  EXPECT_EQ(kQuarantinedByte, object[0]);
+
+  // The owner doesn't need to allocate again.
+  root->PurgeMemory(0);
+  EXPECT_EQ(0u, root->total_count_of_brp_quarantined_slots.load());
+}
+
+TEST(PartitionAllocBiasedCountTest, FreedOnOtherThreadReclaimedOnTeardown) {
+  partition_alloc::PartitionAllocatorForTesting allocator(
+      ThreadConfinedOptions());
+  PartitionRoot* root = allocator.root();
+
+  void* ptr = root->Alloc(kBiasedCountTestSize);
+  RunOnOtherThread([&] { root->Free(ptr); });
+  EXPECT_EQ(1u, root->total_count_of_brp_quarantined_slots.load());
+  // Otherwise, tearing down the allocator reports the slot as leaked.
+}
+
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+
 int g_unretained_dangling_raw_ptr_detected_count = 0;
 
 class UnretainedDanglingRawPtrTest : public PartitionAllocTest {
@@ -6057,6 +6509,76 @@ TEST_P(PartitionAllocTest, SortActiveSlotSpans) {
   run_test(1);
 }
 
+TEST_P(PartitionAllocTest, PreferFullerSlotSpans) {
+  PartitionOptions opts = GetCommonPartitionOptions();
+  opts.scheduler_loop_quarantine = PartitionOptions::kDisabled;
+  opts.thread_cache = PartitionOptions::kDisabled;
+  opts.prefer_fuller_slot_spans = PartitionOptions::kEnabled;
+  std::unique_ptr<PartitionRoot> root = CreateCustomTestRoot(opts, {});
+
+  void* first = root->Alloc(kTestAllocSize, type_name);
+  const size_t slots_per_span =
+      SlotSpan::FromObject(first)->bucket->get_slots_per_span();
+  ASSERT_GE(slots_per_span, 4u);
+
+  // Fill 3 slot spans, and start a 4th one, so that the first 3 are marked
+  // full.
+  std::vector<void*> spans[4];
+  spans[0].push_back(first);
+  for (size_t i = 1; i < 3 * slots_per_span + 1; ++i) {
+    void* ptr = root->Alloc(kTestAllocSize, type_name);
+    spans[i / slots_per_span].push_back(ptr);
+  }
+  auto slot_span_of = [](void* ptr) { return SlotSpan::FromObject(ptr); };
+  for (size_t i = 0; i < 4; ++i) {
+    for (void* ptr : spans[i]) {
+      ASSERT_EQ(slot_span_of(spans[i][0]), slot_span_of(ptr));
+    }
+  }
+
+  // Freeing from a full slot span moves it to the head of the active list, so
+  // the list becomes: 2 (half full), 0 (1 slot), 1 (all but 1 slot), 3.
+  root->Free(spans[1].back());
+  spans[1].pop_back();
+  while (spans[0].size() > 1) {
+    root->Free(spans[0].back());
+    spans[0].pop_back();
+  }
+  while (spans[2].size() > slots_per_span / 2) {
+    root->Free(spans[2].back());
+    spans[2].pop_back();
+  }
+
+  // Exhaust the head.
+  std::vector<void*> allocated;
+  for (size_t i = spans[2].size(); i < slots_per_span; ++i) {
+    allocated.push_back(root->Alloc(kTestAllocSize, type_name));
+    EXPECT_EQ(slot_span_of(spans[2][0]), slot_span_of(allocated.back()));
+  }
+
+  // List order would pick span 0, but span 1 is fuller.
+  allocated.push_back(root->Alloc(kTestAllocSize, type_name));
+  EXPECT_EQ(slot_span_of(spans[1][0]), slot_span_of(allocated.back()));
+
+  // Spans 0 and 3 have as many allocated slots, the lowest address wins.
+  allocated.push_back(root->Alloc(kTestAllocSize, type_name));
+  auto* expected = std::min(slot_span_of(spans[0][0]), slot_span_of(spans[3][0]),
+                            [&](const SlotSpan* a, const SlotSpan* b) {
+                              return SlotSpan::ToSlotSpanStart(a) <
+                                     SlotSpan::ToSlotSpanStart(b);
+                            });
+  EXPECT_EQ(expected, slot_span_of(allocated.back()));
+
+  for (auto& span : spans) {
+    for (void* ptr : span) {
+      root->Free(ptr);
+    }
+  }
+  for (void* ptr : allocated) {
+    root->Free(ptr);
+  }
+}
+
 #if PA_BUILDFLAG(USE_FREESLOT_BITMAP)
 TEST_P(PartitionAllocTest, FreeSlotBitmapMarkedAsUsedAfterAlloc) {
   void* ptr = allocator.root()->Alloc(kTestAllocSize, type_name);
@@ -6128,6 +6650,210 @@ TEST_P(PartitionAllocTest, GlobalEmptySlotSpanRingIndexResets) {
 }
 #endif
 
+TEST_P(PartitionAllocTest, AdjacentEmptySlotSpansAreDecommittedTogether) {
+  std::unique_ptr<PartitionRoot> root = CreateCustomTestRoot(
+      GetCommonPartitionOptions(),
+      PartitionTestOptions{.uncap_empty_slot_span_memory = true,
+                           .set_bucket_distribution = true});
+
+  // Single-slot slot spans, allocated back to back from the same super page.
+  // Their slots fill them entirely, so that they are adjacent once committed.
+  constexpr size_t kCount = 8;
+  const size_t slot_size = MaxRegularSlotSpanSize() + 2 * PartitionPageSize();
+  const size_t size = slot_size - ExtraAllocSize(allocator);
+  ASSERT_EQ(slot_size, root->buckets[SizeToIndex(slot_size)].slot_size);
+  std::vector<void*> ptrs;
+  for (size_t i = 0; i < kCount; i++) {
+    ptrs.push_back(root->Alloc(size));
+  }
+  for (void* ptr : ptrs) {
+    root->Free(ptr);
+  }
+  ASSERT_GT(PA_TS_UNCHECKED_READ(root->empty_slot_spans_dirty_bytes), 0u);
+
+  const size_t committed_before =
+      root->total_size_of_committed_pages.load(std::memory_order_relaxed);
+  const size_t dirty_bytes =
+      PA_TS_UNCHECKED_READ(root->empty_slot_spans_dirty_bytes);
+  const uint64_t syscalls_before = root->syscall_count.load();
+  root->DecommitEmptySlotSpansForTesting();
+
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->empty_slot_spans_dirty_bytes));
+  EXPECT_LE(root->total_size_of_committed_pages.load(std::memory_order_relaxed),
+            committed_before - dirty_bytes);
+  // Fewer decommits than slot spans.
+  EXPECT_LT(root->syscall_count.load() - syscalls_before, kCount);
+
+  // The slot spans can be used again.
+  for (void*& ptr : ptrs) {
+    ptr = root->Alloc(size);
+    memset(ptr, 0xcd, size);
+  }
+  for (void* ptr : ptrs) {
+    root->Free(ptr);
+  }
+}
+
+TEST_P(PartitionAllocTest, DecommittedSlotSpanIsRecommittedWithoutLock) {
+  PartitionRoot* root = allocator.root();
+  const size_t size = MaxRegularSlotSpanSize() + 1;
+
+  // A new slot span is committed with the lock held.
+  void* ptr = root->Alloc(size);
+  const uint64_t commit_count = root->commit_under_lock_count.load();
+  EXPECT_GT(commit_count, 0u);
+
+  root->Free(ptr);
+  ClearEmptySlotSpanCache();
+  void* new_ptr = root->Alloc(size);
+  // The decommitted slot span was reused.
+  EXPECT_EQ(ptr, new_ptr);
+  // If lazy commit is enabled, pages are committed when provisioning slots.
+  if (!kUseLazyCommit) {
+    EXPECT_EQ(commit_count, root->commit_under_lock_count.load());
+  }
+  root->Free(new_ptr);
+}
+
+TEST_P(PartitionAllocTest, ProvisionSlotSpans) {
+  std::unique_ptr<PartitionRoot> root = CreateCustomTestRoot(
+      GetCommonPartitionOptions(),
+      PartitionTestOptions{.set_bucket_distribution = true});
+
+  // Many more slot spans than the empty slot span ring holds by default.
+  constexpr size_t kMaxSlotSize = 256;
+  constexpr size_t kSlotSpansPerBucket = 4;
+  root->ProvisionSlotSpans(kMaxSlotSize, kSlotSpansPerBucket);
+  const size_t super_pages =
+      root->total_size_of_super_pages.load(std::memory_order_relaxed);
+  const size_t committed =
+      root->total_size_of_committed_pages.load(std::memory_order_relaxed);
+  EXPECT_GT(super_pages, 0u);
+  EXPECT_GT(committed, 0u);
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->total_size_of_allocated_bytes));
+  // None of them went through the ring, so none got decommitted.
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->empty_slot_spans_dirty_bytes));
+  EXPECT_GT(PA_TS_UNCHECKED_READ(root->provisioned_slot_spans_dirty_bytes),
+            0u);
+  for (const auto& bucket : root->buckets) {
+    EXPECT_FALSE(bucket.decommitted_slot_spans_head);
+  }
+
+  // Allocations are served from the provisioned slot spans.
+  std::vector<void*> ptrs;
+  for (size_t size = 1; size + ExtraAllocSize(allocator) <= kMaxSlotSize;
+       size += kAlignment) {
+    ptrs.push_back(root->Alloc(size));
+  }
+  EXPECT_EQ(super_pages,
+            root->total_size_of_super_pages.load(std::memory_order_relaxed));
+  EXPECT_EQ(committed,
+            root->total_size_of_committed_pages.load(std::memory_order_relaxed));
+  for (void* ptr : ptrs) {
+    root->Free(ptr);
+  }
+
+  // Decommitting empty slot spans takes the unused provisioned ones as well.
+  root->PurgeMemory(PurgeFlags::kDecommitEmptySlotSpans);
+  EXPECT_EQ(0u,
+            PA_TS_UNCHECKED_READ(root->provisioned_slot_spans_dirty_bytes));
+  EXPECT_LT(root->total_size_of_committed_pages.load(std::memory_order_relaxed),
+            committed);
+}
+
+TEST_P(PartitionAllocTest, Warmup) {
+  std::unique_ptr<PartitionRoot> root = CreateCustomTestRoot(
+      GetCommonPartitionOptions(),
+      PartitionTestOptions{.set_bucket_distribution = true});
+
+  constexpr size_t kCount = 1000;
+  const PartitionRoot::WarmupEntry profile[] = {
+      {64, kCount}, {1000, kCount}, {kMaxBucketed + 1, kCount}};
+  root->Warmup(profile, std::size(profile), false);
+  const size_t super_pages =
+      root->total_size_of_super_pages.load(std::memory_order_relaxed);
+  const size_t committed =
+      root->total_size_of_committed_pages.load(std::memory_order_relaxed);
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->total_size_of_allocated_bytes));
+  // Sizes that aren't bucketed are ignored.
+  EXPECT_EQ(0u, root->total_size_of_direct_mapped_pages.load(
+                    std::memory_order_relaxed));
+
+  // The warmed up allocations don't need more memory.
+  std::vector<void*> ptrs;
+  for (size_t i = 0; i < kCount; ++i) {
+    ptrs.push_back(root->Alloc(64));
+    ptrs.push_back(root->Alloc(1000));
+  }
+  EXPECT_EQ(super_pages,
+            root->total_size_of_super_pages.load(std::memory_order_relaxed));
+  EXPECT_EQ(committed,
+            root->total_size_of_committed_pages.load(std::memory_order_relaxed));
+  for (void* ptr : ptrs) {
+    root->Free(ptr);
+  }
+}
+
+TEST_P(PartitionAllocTest, WarmupIsCapped) {
+  std::unique_ptr<PartitionRoot> root = CreateCustomTestRoot(
+      GetCommonPartitionOptions(),
+      PartitionTestOptions{.set_bucket_distribution = true});
+  const size_t committed_before =
+      root->total_size_of_committed_pages.load(std::memory_order_relaxed);
+
+  const PartitionRoot::WarmupEntry profile[] = {{64, size_t{1} << 40}};
+  root->Warmup(profile, std::size(profile), false);
+  const size_t committed =
+      root->total_size_of_committed_pages.load(std::memory_order_relaxed) -
+      committed_before;
+  EXPECT_GT(committed, 0u);
+  // Leave some room for the metadata and the rounding up to slot spans.
+  EXPECT_LE(committed, 2 * PartitionRoot::kMaxProvisionedBytesPerBucket);
+  EXPECT_LE(PA_TS_UNCHECKED_READ(root->provisioned_slot_spans_dirty_bytes),
+            PartitionRoot::kMaxProvisionedBytesPerBucket);
+}
+
+#if PA_BUILDFLAG(IS_LINUX) || PA_BUILDFLAG(IS_CHROMEOS) || \
+    PA_BUILDFLAG(IS_ANDROID)
+TEST_P(PartitionAllocTest, PrefaultSlotSpans) {
+  // Skip if the kernel doesn't support it.
+  const size_t size = SystemPageSize();
+  uintptr_t buffer = AllocPages(size, PageAllocationGranularity(),
+                                PageAccessibilityConfiguration(
+                                    PageAccessibilityConfiguration::kReadWrite),
+                                PageTag::kChromium);
+  ASSERT_TRUE(buffer);
+  const bool supported = PrefaultSystemPages(buffer, size);
+  FreePages(buffer, size);
+  if (!supported) {
+    GTEST_SKIP() << "MADV_POPULATE_WRITE is not supported";
+  }
+
+  PartitionOptions opts = GetCommonPartitionOptions();
+  opts.prefault_max_slot_size = 64;
+  std::unique_ptr<PartitionRoot> root = CreateCustomTestRoot(
+      opts, PartitionTestOptions{.set_bucket_distribution = true});
+
+  // Only the slot spans of small buckets are pre-faulted.
+  for (size_t slot_size : {size_t{64}, size_t{1024}}) {
+    void* ptr = root->Alloc(slot_size - ExtraAllocSize(allocator));
+    const SlotSpan* slot_span =
+        SlotSpan::FromSlotStart(root->ObjectToSlotStart(ptr));
+    ASSERT_EQ(slot_size, slot_span->bucket->slot_size);
+    const size_t span_size = slot_span->bucket->get_bytes_per_span();
+    ASSERT_GT(span_size, SystemPageSize());
+    std::vector<unsigned char> residency(span_size / SystemPageSize());
+    ASSERT_EQ(0, mincore(reinterpret_cast<void*>(
+                             SlotSpan::ToSlotSpanStart(slot_span)),
+                         span_size, residency.data()));
+    const bool expected = slot_size <= opts.prefault_max_slot_size;
+    // The last page is never touched by provisioning the first slots.
+    EXPECT_EQ(expected, static_cast<bool>(residency.back() & 1));
+    root->Free(ptr);
+  }
+}
+#endif
+
 TEST_P(PartitionAllocTest, FastReclaim) {
   static base::TimeTicks now = base::TimeTicks();
   // Advances times by the same amount every time.
@@ -6217,6 +6943,134 @@ TEST_P(PartitionAllocTest, FastReclaimEventuallyLooksAtAllBuckets) {
   allocator.root()->now_maybe_overridden_for_testing = base::TimeTicks::Now;
 }
 
+#if PA_BUILDFLAG(HAS_64_BIT_POINTERS) && !PA_CONFIG(ENABLE_SHADOW_METADATA)
+
+TEST(PartitionAllocDirectMapCacheTest, ReusesFreedDirectMaps) {
+  constexpr size_t kSize = 4 * kSuperPageSize - 3 * PartitionPageSize();
+  partition_alloc::PartitionAllocatorForTesting allocator([] {
+    PartitionOptions opts;
+    opts.direct_map_cache_capacity_in_bytes = 4 * kSize;
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
+    // Covers the in-slot metadata page as well.
+    opts.backup_ref_ptr = PartitionOptions::kEnabled;
+#endif
+    return opts;
+  }());
+  PartitionRoot* root = allocator.root();
+
+  const size_t committed_before = root->total_size_of_committed_pages;
+  void* ptr = root->Alloc(kSize);
+  ASSERT_TRUE(ptr);
+  const uintptr_t address = UntagPtr(ptr);
+  const size_t slot_committed =
+      root->total_size_of_committed_pages - committed_before;
+  const size_t mapped = root->total_size_of_direct_mapped_pages;
+  memset(ptr, 'A', kSize);
+  root->Free(ptr);
+
+  // Still committed and reserved, but cached.
+  EXPECT_EQ(committed_before + slot_committed,
+            root->total_size_of_committed_pages);
+  EXPECT_EQ(mapped, root->total_size_of_direct_mapped_pages);
+  EXPECT_EQ(slot_committed,
+            PA_TS_UNCHECKED_READ(root->direct_map_cache_committed_bytes));
+  EXPECT_FALSE(IsManagedByDirectMap(address));
+
+  // A smaller allocation with the same reservation size reuses it, and the
+  // slot tail is decommitted. The memory must still be zeroed on request.
+  constexpr size_t kSmallerSize = kSize - 2 * SystemPageSize();
+  ptr = root->Alloc<AllocFlags::kZeroFill>(kSmallerSize);
+  ASSERT_TRUE(ptr);
+  EXPECT_EQ(address, UntagPtr(ptr));
+  EXPECT_TRUE(IsManagedByDirectMap(address));
+  EXPECT_EQ(1u, PA_TS_UNCHECKED_READ(root->direct_map_cache_hit_count));
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->direct_map_cache_committed_bytes));
+  EXPECT_EQ(committed_before + slot_committed - 2 * SystemPageSize(),
+            root->total_size_of_committed_pages);
+  EXPECT_EQ(mapped, root->total_size_of_direct_mapped_pages);
+  const auto* bytes = static_cast<const unsigned char*>(ptr);
+  for (size_t i = 0; i < kSmallerSize; i += SystemPageSize() / 2) {
+    ASSERT_EQ(0u, bytes[i]);
+  }
+  EXPECT_EQ(0u, bytes[kSmallerSize - 1]);
+
+  // Growing in place still works on a reused mapping.
+  ptr = root->Realloc(ptr, kSize, "");
+  EXPECT_EQ(address, UntagPtr(ptr));
+  root->Free(ptr);
+
+  // Purging releases everything.
+  root->PurgeMemory(PurgeFlags::kDecommitEmptySlotSpans);
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->direct_map_cache_count));
+  EXPECT_EQ(committed_before, root->total_size_of_committed_pages);
+  EXPECT_EQ(mapped - 4 * kSuperPageSize,
+            root->total_size_of_direct_mapped_pages);
+}
+
+TEST(PartitionAllocDirectMapCacheTest, EvictsOldAndExpiredEntries) {
+  constexpr size_t kSize = 2 * kSuperPageSize - 3 * PartitionPageSize();
+  partition_alloc::PartitionAllocatorForTesting allocator([] {
+    PartitionOptions opts;
+    // Room for a single one, extras included.
+    opts.direct_map_cache_capacity_in_bytes = kSize + PartitionPageSize();
+    return opts;
+  }());
+  PartitionRoot* root = allocator.root();
+  static base::TimeTicks now = base::TimeTicks::Now();
+  root->now_maybe_overridden_for_testing = [] { return now; };
+
+  const size_t mapped = root->total_size_of_direct_mapped_pages;
+  void* ptr1 = root->Alloc(kSize);
+  void* ptr2 = root->Alloc(kSize);
+  const uintptr_t address2 = UntagPtr(ptr2);
+  root->Free(ptr1);
+  // Over capacity, the oldest entry goes away.
+  root->Free(ptr2);
+  EXPECT_EQ(1u, PA_TS_UNCHECKED_READ(root->direct_map_cache_count));
+  EXPECT_EQ(mapped + 2 * kSuperPageSize,
+            root->total_size_of_direct_mapped_pages);
+
+  // Too large to fit in the cache at all, so unmapped right away.
+  void* ptr3 = root->Alloc(2 * kSize);
+  root->Free(ptr3);
+  EXPECT_EQ(1u, PA_TS_UNCHECKED_READ(root->direct_map_cache_count));
+
+  // Different reservation size, not reused.
+  ptr3 = root->Alloc(kSize + kSuperPageSize);
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->direct_map_cache_hit_count));
+  root->Free(ptr3);
+  EXPECT_EQ(1u, PA_TS_UNCHECKED_READ(root->direct_map_cache_count));
+
+  // Expired entries are not handed out, and dropped on the next free.
+  now += PartitionRoot::kDirectMapCacheTimeToLive + base::Milliseconds(1);
+  ptr1 = root->Alloc(kSize);
+  EXPECT_NE(address2, UntagPtr(ptr1));
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->direct_map_cache_hit_count));
+  root->Free(ptr1);
+  EXPECT_EQ(1u, PA_TS_UNCHECKED_READ(root->direct_map_cache_count));
+  EXPECT_EQ(mapped + 2 * kSuperPageSize,
+            root->total_size_of_direct_mapped_pages);
+
+  // Any purge drops the expired entries, but only these.
+  root->PurgeMemory(PurgeFlags::kDiscardUnusedSystemPages);
+  EXPECT_EQ(1u, PA_TS_UNCHECKED_READ(root->direct_map_cache_count));
+  now += PartitionRoot::kDirectMapCacheTimeToLive + base::Milliseconds(1);
+  root->PurgeMemory(PurgeFlags::kDiscardUnusedSystemPages);
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->direct_map_cache_count));
+  EXPECT_EQ(mapped, root->total_size_of_direct_mapped_pages);
+
+  ptr1 = root->Alloc(kSize);
+  root->Free(ptr1);
+  EXPECT_EQ(1u, PA_TS_UNCHECKED_READ(root->direct_map_cache_count));
+  root->PurgeMemory(PurgeFlags::kDecommitEmptySlotSpans);
+  EXPECT_EQ(0u, PA_TS_UNCHECKED_READ(root->direct_map_cache_count));
+  EXPECT_EQ(mapped, root->total_size_of_direct_mapped_pages);
+  root->now_maybe_overridden_for_testing = base::TimeTicks::Now;
+}
+
+#endif  // PA_BUILDFLAG(HAS_64_BIT_POINTERS) &&
+        // !PA_CONFIG(ENABLE_SHADOW_METADATA)
+
 }  // namespace partition_alloc::internal
 
 #endif  // !defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <tuple>
 
 #include "partition_alloc/address_pool_manager.h"
@@ -17,6 +18,7 @@
 #include "partition_alloc/page_allocator.h"
 #include "partition_alloc/page_allocator_constants.h"
 #include "partition_alloc/partition_address_space.h"
+#include "partition_alloc/partition_alloc-inl.h"
 #include "partition_alloc/partition_alloc.h"
 #include "partition_alloc/partition_alloc_base/bits.h"
 #include "partition_alloc/partition_alloc_base/compiler_specific.h"
@@ -179,7 +181,8 @@ SlotSpanMetadata<MetadataKind::kReadOnly>* PartitionDirectMap(
     PartitionRoot* root,
     AllocFlags flags,
     size_t raw_size,
-    size_t slot_span_alignment) {
+    size_t slot_span_alignment,
+    bool* is_already_zeroed) {
   PA_DCHECK((slot_span_alignment >= PartitionPageSize()) &&
             base::bits::HasSingleBit(slot_span_alignment));
 
@@ -252,8 +255,9 @@ SlotSpanMetadata<MetadataKind::kReadOnly>* PartitionDirectMap(
     // thread cache, but as a simple example the buffer partition in blink is
     // frequently used for large allocations (e.g. ArrayBuffer), and frequent,
     // small ones (e.g. WTF::String), and does not have a thread cache.
-    ScopedUnlockGuard scoped_unlock{PartitionRootLock(root)};
-
+    //
+    // A recently freed direct map of the same reservation size, if cached,
+    // saves most of these calls.
     const size_t slot_size = PartitionRoot::GetDirectMapSlotSize(raw_size);
     // The super page starts with a partition page worth of metadata and guard
     // pages, hence alignment requests ==PartitionPageSize() will be
@@ -271,32 +275,53 @@ SlotSpanMetadata<MetadataKind::kReadOnly>* PartitionDirectMap(
     PA_DCHECK(slot_size <= available_reservation_size);
 #endif
 
+    uintptr_t reservation_start = 0;
+    size_t cached_committed_size = 0;
+    if (!padding_for_alignment) {
+      reservation_start =
+          root->TakeCachedDirectMap(reservation_size, &cached_committed_size);
+    }
+    const bool from_cache = reservation_start != 0;
+
+    ScopedUnlockGuard scoped_unlock{PartitionRootLock(root)};
+
     pool_handle pool = root->ChoosePool();
-    uintptr_t reservation_start;
-    {
-      // Reserving memory from the pool is actually not a syscall on 64 bit
-      // platforms.
+    if (!from_cache) {
+      {
+        // Reserving memory from the pool is actually not a syscall on 64 bit
+        // platforms.
 #if !PA_BUILDFLAG(HAS_64_BIT_POINTERS)
-      ScopedSyscallTimer timer{root};
+        ScopedSyscallTimer timer{root};
 #endif
-      reservation_start = ReserveMemoryFromPool(pool, 0, reservation_size);
-    }
-    if (!reservation_start) [[unlikely]] {
-      if (return_null) {
-        return nullptr;
+        reservation_start = ReserveMemoryFromPool(pool, 0, reservation_size);
       }
+      if (!reservation_start) [[unlikely]] {
+        if (return_null) {
+          return nullptr;
+        }
 
-      PartitionOutOfMemoryMappingFailure(root, reservation_size);
-    }
+        PartitionOutOfMemoryMappingFailure(root, reservation_size);
+      }
 
-    root->total_size_of_direct_mapped_pages.fetch_add(
-        reservation_size, std::memory_order_relaxed);
+      root->total_size_of_direct_mapped_pages.fetch_add(
+          reservation_size, std::memory_order_relaxed);
+    }
 
     // Shift by 1 partition page (metadata + guard pages) and alignment padding.
     const uintptr_t slot_start =
         reservation_start + PartitionPageSize() + padding_for_alignment;
 
-    {
+    if (from_cache) {
+      // The metadata pages are still committed, but not pristine. Shadow
+      // metadata is not supported by the cache.
+      memset(reinterpret_cast<void*>(reservation_start + SystemPageSize()), 0,
+             SystemPageSize());
+      if (pool == kBRPPoolHandle) {
+        memset(
+            reinterpret_cast<void*>(reservation_start + SystemPageSize() * 2),
+            0, SystemPageSize());
+      }
+    } else {
       ScopedSyscallTimer timer{root};
 #if PA_CONFIG(ENABLE_SHADOW_METADATA)
       if (PartitionAddressSpace::IsShadowMetadataEnabled(root->ChoosePool())) {
@@ -313,7 +338,7 @@ SlotSpanMetadata<MetadataKind::kReadOnly>* PartitionDirectMap(
       }
     }
 
-    if (pool == kBRPPoolHandle) {
+    if (!from_cache && pool == kBRPPoolHandle) {
       // Allocate a system page for InSlotMetadata table (only one of its
       // elements will be used). Shadow metadata does not need to protect
       // this table, because (1) corrupting the table won't help with the
@@ -435,13 +460,23 @@ SlotSpanMetadata<MetadataKind::kReadOnly>* PartitionDirectMap(
     //
     // Direct map never uses tagging, as size is always >kMaxMemoryTaggingSize.
     PA_DCHECK(raw_size > kMaxMemoryTaggingSize);
-    const bool ok = root->TryRecommitSystemPagesForDataWithAcquiringLock(
-        slot_start, slot_size, PageAccessibilityDisposition::kRequireUpdate,
-        false);
+    bool ok = true;
+    if (cached_committed_size < slot_size) {
+      ok = root->TryRecommitSystemPagesForDataWithAcquiringLock(
+          slot_start + cached_committed_size, slot_size - cached_committed_size,
+          PageAccessibilityDisposition::kRequireUpdate, false);
+    } else if (cached_committed_size > slot_size) {
+      ScopedSyscallTimer timer{root};
+      DecommitSystemPages(slot_start + slot_size,
+                          cached_committed_size - slot_size,
+                          PageAccessibilityDisposition::kRequireUpdate);
+      root->DecreaseCommittedPages(cached_committed_size - slot_size);
+    }
     if (!ok) {
       if (!return_null) {
         PartitionOutOfMemoryCommitFailure(root, slot_size);
       }
+      root->DecreaseCommittedPages(cached_committed_size);
 
       {
         ScopedSyscallTimer timer{root};
@@ -471,6 +506,9 @@ SlotSpanMetadata<MetadataKind::kReadOnly>* PartitionDirectMap(
     // Point to read-only bucket.
     writable_map_extent->bucket = &direct_map_metadata->bucket;
     map_extent = &direct_map_metadata->direct_map_extent;
+
+    // Memory from PageAllocator is always zeroed, unlike cached mappings.
+    *is_already_zeroed = !from_cache;
   }
 
   PartitionRootLock(root).AssertAcquired();
@@ -701,7 +739,7 @@ PartitionBucket::AllocNewSlotSpan(PartitionRoot* root,
   // System pages in the super page come in a decommited state. Commit them
   // before vending them back.
   // If lazy commit is enabled, pages will be committed when provisioning slots,
-  // in ProvisionMoreSlotsAndAllocOne(), not here.
+  // in ProvisionMoreSlotsAndAlloc(), not here.
   if (!kUseLazyCommit) {
     PA_DEBUG_DATA_ON_STACK("slotsize", slot_size);
     PA_DEBUG_DATA_ON_STACK("spansize", slot_span_reservation_size);
@@ -961,6 +999,18 @@ PA_ALWAYS_INLINE uintptr_t PartitionBucket::ProvisionMoreSlotsAndAllocOne(
     PartitionRoot* root,
     AllocFlags flags,
     SlotSpanMetadata<MetadataKind::kReadOnly>* slot_span) {
+  uintptr_t return_slot = 0;
+  ProvisionMoreSlotsAndAlloc(root, flags, slot_span, &return_slot, 1);
+  return return_slot;
+}
+
+PA_ALWAYS_INLINE size_t PartitionBucket::ProvisionMoreSlotsAndAlloc(
+    PartitionRoot* root,
+    AllocFlags flags,
+    SlotSpanMetadata<MetadataKind::kReadOnly>* slot_span,
+    uintptr_t* slots,
+    size_t max_count) {
+  PA_DCHECK(max_count);
   PA_DCHECK(
       slot_span !=
       SlotSpanMetadata<MetadataKind::kReadOnly>::get_sentinel_slot_span());
@@ -1012,11 +1062,13 @@ PA_ALWAYS_INLINE uintptr_t PartitionBucket::ProvisionMoreSlotsAndAllocOne(
 
   SlotSpanMetadata<MetadataKind::kWritable>* writable_slot_span =
       slot_span->ToWritable(root);
-  // The slot being returned is considered allocated.
-  writable_slot_span->num_allocated_slots++;
   // Round down, because a slot that doesn't fully fit in the new page(s) isn't
   // provisioned.
   size_t slots_to_provision = (commit_end - return_slot) / slot_size;
+  // The slots being returned are considered allocated. The first one always
+  // fits, see above.
+  const size_t count = std::min(max_count, slots_to_provision);
+  writable_slot_span->num_allocated_slots += count;
   writable_slot_span->num_unprovisioned_slots -= slots_to_provision;
   PA_DCHECK(slot_span->num_allocated_slots +
                 slot_span->num_unprovisioned_slots <=
@@ -1025,19 +1077,43 @@ PA_ALWAYS_INLINE uintptr_t PartitionBucket::ProvisionMoreSlotsAndAllocOne(
 #if PA_BUILDFLAG(HAS_MEMORY_TAGGING)
   const bool use_tagging =
       root->IsMemoryTaggingEnabled() && slot_size <= kMaxMemoryTaggingSize;
-  if (use_tagging) [[likely]] {
-    // Ensure the MTE-tag of the memory pointed by |return_slot| is unguessable.
-    TagMemoryRangeRandomly(return_slot, slot_size);
-  }
 #endif  // PA_BUILDFLAG(HAS_MEMORY_TAGGING)
-  // Add all slots that fit within so far committed pages to the free list.
+  for (size_t i = 0; i < count; i++) {
+    slots[i] = return_slot + i * slot_size;
+#if PA_BUILDFLAG(HAS_MEMORY_TAGGING)
+    if (use_tagging) [[likely]] {
+      // Ensure the MTE-tag of the memory pointed by the returned slot is
+      // unguessable.
+      TagMemoryRangeRandomly(slots[i], slot_size);
+    }
+#endif  // PA_BUILDFLAG(HAS_MEMORY_TAGGING)
+#if PA_BUILDFLAG(USE_FREESLOT_BITMAP)
+    FreeSlotBitmapMarkSlotAsFree(slots[i]);
+#endif
+  }
+  next_slot = return_slot + count * slot_size;
+
+  // Add all other slots that fit within so far committed pages to the free
+  // list.
   PartitionFreelistEntry* prev_entry = nullptr;
   uintptr_t next_slot_end = next_slot + slot_size;
   size_t free_list_entries_added = 0;
 
   const auto* freelist_dispatcher = root->get_freelist_dispatcher();
 
+  // Building the freelist writes to every provisioned slot, and these slots are
+  // allocated right after. Prefetch a few slots ahead, so that for small slots
+  // the writes do not serialize on cache misses. Prefetches to pages that are
+  // not faulted in yet are dropped by the CPU, so this only helps once the page
+  // is resident.
+  constexpr size_t kProvisioningPrefetchDistance = 4;
+  const size_t prefetch_offset = kProvisioningPrefetchDistance * slot_size;
+
   while (next_slot_end <= commit_end) {
+    if (next_slot + prefetch_offset < commit_end) {
+      PA_PREFETCH_FOR_WRITE(
+          reinterpret_cast<void*>(next_slot + prefetch_offset));
+    }
     void* next_slot_ptr;
 #if PA_BUILDFLAG(HAS_MEMORY_TAGGING)
     if (use_tagging) [[likely]] {
@@ -1074,14 +1150,10 @@ PA_ALWAYS_INLINE uintptr_t PartitionBucket::ProvisionMoreSlotsAndAllocOne(
 #endif
   }
 
-#if PA_BUILDFLAG(USE_FREESLOT_BITMAP)
-  FreeSlotBitmapMarkSlotAsFree(return_slot);
-#endif
-
 #if PA_BUILDFLAG(DCHECKS_ARE_ON)
-  // The only provisioned slot not added to the free list is the one being
+  // The only provisioned slots not added to the free list are the ones being
   // returned.
-  PA_DCHECK(slots_to_provision == free_list_entries_added + 1);
+  PA_DCHECK(slots_to_provision == free_list_entries_added + count);
   // We didn't necessarily provision more than one slot (e.g. if |slot_size|
   // is large), meaning that |slot_span->freelist_head| can be nullptr.
   if (slot_span->get_freelist_head()) {
@@ -1094,7 +1166,26 @@ PA_ALWAYS_INLINE uintptr_t PartitionBucket::ProvisionMoreSlotsAndAllocOne(
   // We had no free slots, and created some (potentially 0) in sorted order.
   writable_slot_span->set_freelist_sorted();
 
-  return return_slot;
+  return count;
+}
+
+size_t PartitionBucket::ProvisionSlotsInBulk(PartitionRoot* root,
+                                             uintptr_t* slots,
+                                             size_t max_count) {
+  SlotSpanMetadata<MetadataKind::kReadOnly>* slot_span = active_slot_spans_head;
+  // Only take the slots in bulk when the regular path would provision more
+  // slots in the active slot span, without changing it. That is, when it has
+  // no free slots left, but some unprovisioned ones.
+  if (slot_span ==
+          SlotSpanMetadata<MetadataKind::kReadOnly>::get_sentinel_slot_span() ||
+      slot_span->get_freelist_head() || !slot_span->num_unprovisioned_slots) {
+    return 0;
+  }
+  PA_DCHECK(!slot_span->marked_full);
+  PA_DCHECK(!CanStoreRawSize());
+  PA_DCHECK(!is_direct_mapped());
+  return ProvisionMoreSlotsAndAlloc(root, AllocFlags::kReturnNull, slot_span,
+                                    slots, max_count);
 }
 
 bool PartitionBucket::SetNewActiveSlotSpan(PartitionRoot* root) {
@@ -1187,6 +1278,39 @@ bool PartitionBucket::SetNewActiveSlotSpan(PartitionRoot* root) {
   // Found an active slot span with provisioned entries on the freelist.
   if (slot_span) {
     usable_active_list_head = true;
+    if (root->settings.prefer_fuller_slot_spans) {
+      // Look a bit further for a fuller slot span, and move it in front of
+      // the one we found. Spans with the same number of allocated slots are
+      // ordered by address, to keep the heap compact. The skipped spans are
+      // not maintained here, that happens when they reach the head.
+      SlotSpanMetadata<MetadataKind::kReadOnly>* best = slot_span;
+      uintptr_t best_start = SlotSpanMetadata<
+          MetadataKind::kReadOnly>::ToSlotSpanStart(best);
+      SlotSpanMetadata<MetadataKind::kReadOnly>* best_prev = nullptr;
+      SlotSpanMetadata<MetadataKind::kReadOnly>* prev = slot_span;
+      SlotSpanMetadata<MetadataKind::kReadOnly>* candidate =
+          slot_span->next_slot_span;
+      for (size_t i = 0; candidate && i < kMaxSlotSpansToScanForFullest;
+           ++i, prev = candidate, candidate = candidate->next_slot_span) {
+        if (!candidate->get_freelist_head() || candidate->is_empty()) {
+          continue;
+        }
+        uintptr_t candidate_start = SlotSpanMetadata<
+            MetadataKind::kReadOnly>::ToSlotSpanStart(candidate);
+        if (candidate->num_allocated_slots > best->num_allocated_slots ||
+            (candidate->num_allocated_slots == best->num_allocated_slots &&
+             candidate_start < best_start)) {
+          best = candidate;
+          best_start = candidate_start;
+          best_prev = prev;
+        }
+      }
+      if (best_prev) {
+        best_prev->ToWritable(root)->next_slot_span = best->next_slot_span;
+        best->ToWritable(root)->next_slot_span = slot_span;
+        slot_span = best;
+      }
+    }
     // We have active slot spans with unprovisioned entries. Re-attach them into
     // the active list, past the span with freelist entries.
     if (to_provision_head) {
@@ -1422,8 +1546,8 @@ uintptr_t PartitionBucket::SlowPathAlloc(
       return 0;
     }
 
-    new_slot_span =
-        PartitionDirectMap(root, flags, raw_size, slot_span_alignment);
+    new_slot_span = PartitionDirectMap(root, flags, raw_size,
+                                       slot_span_alignment, is_already_zeroed);
     if (new_slot_span) {
 #if !PA_CONFIG(ENABLE_SHADOW_METADATA)
       new_bucket = new_slot_span->bucket;
@@ -1442,8 +1566,6 @@ uintptr_t PartitionBucket::SlowPathAlloc(
           root->ShadowPoolOffset());
 #endif  // PA_CONFIG(ENABLE_SHADOW_METADATA)
     }
-    // Memory from PageAllocator is always zeroed.
-    *is_already_zeroed = true;
   } else if (!allocate_aligned_slot_span && SetNewActiveSlotSpan(root))
       [[likely]] {
     // First, did we find an active slot span in the active list?
@@ -1467,10 +1589,7 @@ uintptr_t PartitionBucket::SlowPathAlloc(
             ->IncrementNumberOfNonemptySlotSpans();
 
         // Re-activating an empty slot span, update accounting.
-        size_t dirty_size = base::bits::AlignUp(
-            new_slot_span->GetProvisionedSize(), SystemPageSize());
-        PA_DCHECK(root->empty_slot_spans_dirty_bytes >= dirty_size);
-        root->empty_slot_spans_dirty_bytes -= dirty_size;
+        new_slot_span->ToWritable(root)->UnregisterEmpty(root);
 
         break;
       }
@@ -1489,22 +1608,39 @@ uintptr_t PartitionBucket::SlowPathAlloc(
         new_slot_span = decommitted_slot_spans_head;
         PA_DCHECK(new_slot_span->bucket == this);
         PA_DCHECK(new_slot_span->is_decommitted());
+        decommitted_slot_spans_head = new_slot_span->next_slot_span;
 
         // If lazy commit is enabled, pages will be recommitted when
-        // provisioning slots, in ProvisionMoreSlotsAndAllocOne(), not here.
+        // provisioning slots, in ProvisionMoreSlotsAndAlloc(), not here.
         if (!kUseLazyCommit) {
           uintptr_t slot_span_start =
               SlotSpanMetadata<MetadataKind::kReadOnly>::ToSlotSpanStart(
                   new_slot_span);
-          // Since lazy commit isn't used, we have a guarantee that all slot
-          // span pages have been previously committed, and then decommitted
-          // using PageAccessibilityDisposition::kAllowKeepForPerf, so use the
-          // same option as an optimization.
-          const bool ok = root->TryRecommitSystemPagesForDataLocked(
-              slot_span_start, new_slot_span->bucket->get_bytes_per_span(),
-              PageAccessibilityDisposition::kAllowKeepForPerf,
-              slot_size <= kMaxMemoryTaggingSize);
+          bool ok;
+          {
+            // The slot span is not on any list anymore, so no other thread
+            // can get to it. Commit it without the lock, which can take a
+            // while, and would otherwise stall all allocations from this
+            // root.
+            ScopedUnlockGuard unlock{PartitionRootLock(root)};
+            // Since lazy commit isn't used, we have a guarantee that all slot
+            // span pages have been previously committed, and then decommitted
+            // using PageAccessibilityDisposition::kAllowKeepForPerf, so use
+            // the same option as an optimization.
+            ok = root->TryRecommitSystemPagesForDataWithAcquiringLock(
+                slot_span_start, new_slot_span->bucket->get_bytes_per_span(),
+                PageAccessibilityDisposition::kAllowKeepForPerf,
+                slot_size <= kMaxMemoryTaggingSize);
+            if (ok) {
+              root->MaybePrefaultSystemPagesForData(
+                  slot_span_start, new_slot_span->bucket->get_bytes_per_span(),
+                  slot_size);
+            }
+          }
           if (!ok) {
+            new_slot_span->ToWritable(root)->next_slot_span =
+                decommitted_slot_spans_head;
+            decommitted_slot_spans_head = new_slot_span;
             if (!ContainsFlags(flags, AllocFlags::kReturnNull)) {
               ScopedUnlockGuard unlock{PartitionRootLock(root)};
               PartitionOutOfMemoryCommitFailure(
@@ -1514,8 +1650,13 @@ uintptr_t PartitionBucket::SlowPathAlloc(
           }
         }
 
-        decommitted_slot_spans_head = new_slot_span->next_slot_span;
         new_slot_span->ToWritable(root)->Reset();
+        // Another thread may have found an active slot span meanwhile, keep it.
+        if (active_slot_spans_head !=
+            SlotSpanMetadata<MetadataKind::kReadOnly>::get_sentinel_slot_span()) {
+          new_slot_span->ToWritable(root)->next_slot_span =
+              active_slot_spans_head;
+        }
         *is_already_zeroed = DecommittedMemoryIsAlwaysZeroed();
       }
       PA_DCHECK(new_slot_span);
@@ -1532,6 +1673,29 @@ uintptr_t PartitionBucket::SlowPathAlloc(
     new_slot_span = AllocNewSlotSpan(root, flags, slot_span_alignment);
     // New memory from PageAllocator is always zeroed.
     *is_already_zeroed = true;
+
+    // If lazy commit is enabled, pages are committed, and pre-faulted, when
+    // provisioning slots.
+    if (!kUseLazyCommit && new_slot_span &&
+        root->ShouldPrefaultSystemPagesForData(slot_size)) [[unlikely]] {
+      auto* previous_head = active_slot_spans_head;
+      {
+        // As above, the slot span is not on any list yet, no other thread can
+        // get to it.
+        ScopedUnlockGuard unlock{PartitionRootLock(root)};
+        root->MaybePrefaultSystemPagesForData(
+            SlotSpanMetadata<MetadataKind::kReadOnly>::ToSlotSpanStart(
+                new_slot_span),
+            SlotSpanCommittedSize(root), slot_size);
+      }
+      // Another thread may have found an active slot span meanwhile, keep it.
+      if (active_slot_spans_head != previous_head &&
+          active_slot_spans_head !=
+              SlotSpanMetadata<MetadataKind::kReadOnly>::get_sentinel_slot_span()) {
+        new_slot_span->ToWritable(root)->next_slot_span =
+            active_slot_spans_head;
+      }
+    }
   }
 
   // Bail if we had a memory allocation failure.
@@ -61,6 +61,9 @@ struct PartitionBucket {
       "large.");
 
   static constexpr size_t kMaxSlotSpansToSort = 200;
+  // With PartitionOptions::prefer_fuller_slot_spans, how many slot spans past
+  // the first usable one SetNewActiveSlotSpan() looks at to find the fullest.
+  static constexpr size_t kMaxSlotSpansToScanForFullest = 16;
 
   // Public API.
   PA_COMPONENT_EXPORT(PARTITION_ALLOC)
@@ -172,6 +175,18 @@ struct PartitionBucket {
 
   size_t SlotSpanCommittedSize(PartitionRoot* root) const;
 
+  // Allocates up to |max_count| slots at once, writing them to |slots| in
+  // ascending address order. This only happens when the active slot span has no
+  // free slots, but unprovisioned ones, as is typical right after a slot span
+  // turnover. The slots are then handed out directly as they get provisioned,
+  // rather than chained into the slot span freelist only to be popped right
+  // away. Returns the number of allocated slots, 0 if the conditions above do
+  // not hold, or on commit failure. Accounting is left to the caller.
+  size_t ProvisionSlotsInBulk(PartitionRoot* root,
+                              uintptr_t* slots,
+                              size_t max_count)
+      PA_EXCLUSIVE_LOCKS_REQUIRED(PartitionRootLock(root));
+
  private:
   // Sets `this->can_store_raw_size`.
   void InitCanStoreRawSize(bool use_small_single_slot_spans);
@@ -227,6 +242,15 @@ struct PartitionBucket {
       AllocFlags flags,
       SlotSpanMetadata<MetadataKind::kReadOnly>* slot_span)
       PA_EXCLUSIVE_LOCKS_REQUIRED(PartitionRootLock(root));
+  // Same as ProvisionMoreSlotsAndAllocOne(), but allocates up to |max_count|
+  // of the newly provisioned slots, written to |slots|. Returns their number,
+  // 0 on failure.
+  PA_ALWAYS_INLINE size_t ProvisionMoreSlotsAndAlloc(
+      PartitionRoot* root,
+      AllocFlags flags,
+      SlotSpanMetadata<MetadataKind::kReadOnly>* slot_span,
+      uintptr_t* slots,
+      size_t max_count) PA_EXCLUSIVE_LOCKS_REQUIRED(PartitionRootLock(root));
 };
 
 }  // namespace partition_alloc::internal
@@ -0,0 +1,116 @@
+// Copyright 2026 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef PARTITION_ALLOC_PARTITION_OBJECT_POOL_H_
+#define PARTITION_ALLOC_PARTITION_OBJECT_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#include "partition_alloc/partition_alloc_base/compiler_specific.h"
+#include "partition_alloc/partition_alloc_check.h"
+#include "partition_alloc/partition_alloc_constants.h"
+#include "partition_alloc/partition_bucket_lookup.h"
+#include "partition_alloc/partition_root.h"
+
+namespace partition_alloc {
+
+// Typed front end to a PartitionRoot, for fixed-size objects.
+//
+// The generic allocation path maps the requested size to a bucket on every
+// call. Here the size is known at compile time, so the bucket index is
+// resolved once, when the pool is created, and allocations go straight to the
+// thread cache bucket (or the bucket itself on a miss).
+//
+// The pool does not own |root|, which must outlive it. Objects can be freed
+// either with Delete(), or with any of the regular PartitionRoot free paths.
+template <typename T>
+class PartitionObjectPool {
+ public:
+  static_assert(alignof(T) <= internal::kAlignment,
+                "Over-aligned types must use PartitionRoot::AlignedAlloc()");
+  static_assert(sizeof(T) <= internal::kMaxBucketed,
+                "Direct-mapped sizes do not benefit from a typed pool");
+
+  // Bucket indices of |raw_size|, for both bucket distributions. Only depends
+  // on the size, so is constant-evaluated whenever the extras are.
+  struct BucketIndices {
+    uint16_t neutral;
+    uint16_t denser;
+  };
+  static constexpr BucketIndices ComputeBucketIndices(size_t raw_size) {
+    return {
+        .neutral =
+            internal::BucketIndexLookup::GetIndexForNeutralBuckets(raw_size),
+        .denser =
+            internal::BucketIndexLookup::GetIndexForDenserBuckets(raw_size),
+    };
+  }
+
+  // Indices used when the root adds no extras to allocations.
+  static constexpr BucketIndices kBucketIndicesWithoutExtras =
+      ComputeBucketIndices(sizeof(T));
+
+  explicit PartitionObjectPool(PartitionRoot* root,
+                               const char* type_name = nullptr)
+      : root_(root), type_name_(type_name) {
+    PA_CHECK(root_);
+    const size_t raw_size = root_->AdjustSizeForExtrasAdd(sizeof(T));
+    bucket_indices_ = raw_size == sizeof(T) ? kBucketIndicesWithoutExtras
+                                            : ComputeBucketIndices(raw_size);
+    // Extras may push the slot to the direct-mapped range, which has no
+    // bucket to cache.
+    PA_CHECK(bucket_indices_.neutral < internal::kNumBuckets);
+    PA_CHECK(bucket_indices_.denser < internal::kNumBuckets);
+  }
+
+  PartitionObjectPool(const PartitionObjectPool&) = delete;
+  PartitionObjectPool& operator=(const PartitionObjectPool&) = delete;
+
+  // Returns uninitialized memory for a T.
+  template <AllocFlags flags = AllocFlags::kNone>
+  PA_ALWAYS_INLINE PA_MALLOC_FN void* Allocate() {
+    return root_->AllocWithBucketIndexInline<flags>(bucket_index(), sizeof(T),
+                                                    type_name_);
+  }
+
+  template <FreeFlags flags = FreeFlags::kNone>
+  PA_ALWAYS_INLINE void Deallocate(void* object) {
+    root_->FreeInline<flags>(object);
+  }
+
+  template <typename... Args>
+  PA_ALWAYS_INLINE T* New(Args&&... args) {
+    return new (Allocate()) T(std::forward<Args>(args)...);
+  }
+
+  PA_ALWAYS_INLINE void Delete(T* object) {
+    if (!object) {
+      return;
+    }
+    object->~T();
+    Deallocate(object);
+  }
+
+  // Index of the bucket objects are currently allocated from.
+  PA_ALWAYS_INLINE uint16_t bucket_index() const {
+    return root_->GetBucketDistribution() ==
+                   PartitionRoot::BucketDistribution::kNeutral
+               ? bucket_indices_.neutral
+               : bucket_indices_.denser;
+  }
+
+  PartitionRoot* root() const { return root_; }
+
+ private:
+  PartitionRoot* const root_;
+  const char* const type_name_;
+  BucketIndices bucket_indices_;
+};
+
+}  // namespace partition_alloc
+
+#endif  // PARTITION_ALLOC_PARTITION_OBJECT_POOL_H_
@@ -0,0 +1,127 @@
+// Copyright 2026 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "partition_alloc/partition_object_pool.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "partition_alloc/partition_alloc_for_testing.h"
+#include "partition_alloc/partition_page.h"
+#include "partition_alloc/partition_root.h"
+#include "testing/gtest/include/gtest/gtest.h"
+
+#if !defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
+
+namespace partition_alloc {
+
+namespace {
+
+struct SmallObject {
+  explicit SmallObject(uint64_t v) : value(v) {}
+  ~SmallObject() { ++destroyed; }
+
+  uint64_t value;
+  char padding[40];
+
+  static int destroyed;
+};
+int SmallObject::destroyed = 0;
+
+struct MediumObject {
+  char data[700];
+};
+
+// Without extras, the bucket indices are resolved at compile time.
+static_assert(
+    PartitionObjectPool<MediumObject>::kBucketIndicesWithoutExtras.neutral ==
+    internal::BucketIndexLookup::GetIndexForNeutralBuckets(
+        sizeof(MediumObject)));
+static_assert(
+    PartitionObjectPool<MediumObject>::kBucketIndicesWithoutExtras.denser ==
+    internal::BucketIndexLookup::GetIndexForDenserBuckets(
+        sizeof(MediumObject)));
+
+class PartitionObjectPoolTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    allocator_ =
+        std::make_unique<PartitionAllocatorForTesting>(PartitionOptions{});
+  }
+
+  PartitionRoot* root() { return allocator_->root(); }
+
+  std::unique_ptr<PartitionAllocatorForTesting> allocator_;
+};
+
+}  // namespace
+
+TEST_F(PartitionObjectPoolTest, NewDelete) {
+  PartitionObjectPool<SmallObject> pool(root(), "SmallObject");
+  SmallObject::destroyed = 0;
+
+  SmallObject* object = pool.New(42u);
+  ASSERT_TRUE(object);
+  EXPECT_EQ(42u, object->value);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(object) % internal::kAlignment);
+  EXPECT_GE(PartitionRoot::GetUsableSize(object), sizeof(SmallObject));
+
+  pool.Delete(object);
+  EXPECT_EQ(1, SmallObject::destroyed);
+  pool.Delete(nullptr);
+  EXPECT_EQ(1, SmallObject::destroyed);
+  EXPECT_EQ(0u, root()->get_total_size_of_allocated_bytes());
+}
+
+TEST_F(PartitionObjectPoolTest, SameBucketAsGenericPath) {
+  PartitionObjectPool<MediumObject> pool(root());
+
+  for (auto distribution : {PartitionRoot::BucketDistribution::kNeutral,
+                            PartitionRoot::BucketDistribution::kDenser}) {
+    if (distribution == PartitionRoot::BucketDistribution::kNeutral) {
+      root()->ResetBucketDistributionForTesting();
+    } else {
+      root()->SwitchToDenserBucketDistribution();
+    }
+
+    size_t raw_size = root()->AdjustSizeForExtrasAdd(sizeof(MediumObject));
+    EXPECT_EQ(PartitionRoot::SizeToBucketIndex(raw_size, distribution),
+              pool.bucket_index());
+
+    void* generic = root()->Alloc(sizeof(MediumObject), "");
+    void* typed = pool.Allocate();
+    auto* generic_slot_span = internal::SlotSpanMetadata<
+        internal::MetadataKind::kReadOnly>::FromObject(generic);
+    auto* typed_slot_span = internal::SlotSpanMetadata<
+        internal::MetadataKind::kReadOnly>::FromObject(typed);
+    EXPECT_EQ(generic_slot_span->bucket, typed_slot_span->bucket);
+    EXPECT_EQ(&root()->buckets[pool.bucket_index()], typed_slot_span->bucket);
+
+    root()->Free(generic);
+    pool.Deallocate(typed);
+  }
+  root()->ResetBucketDistributionForTesting();
+}
+
+TEST_F(PartitionObjectPoolTest, ManyObjects) {
+  PartitionObjectPool<SmallObject> pool(root());
+  std::vector<SmallObject*> objects;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    objects.push_back(pool.New(i));
+  }
+  for (uint64_t i = 0; i < objects.size(); ++i) {
+    EXPECT_EQ(i, objects[i]->value);
+  }
+  // Objects from the pool may be freed through the root.
+  for (SmallObject* object : objects) {
+    object->~SmallObject();
+    root()->Free(object);
+  }
+  EXPECT_EQ(0u, root()->get_total_size_of_allocated_bytes());
+}
+
+}  // namespace partition_alloc
+
+#endif  // !defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
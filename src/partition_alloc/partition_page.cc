@@ -29,6 +29,8 @@ namespace partition_alloc::internal {
 
 namespace {
 
+void ResetReservationOffsets(uintptr_t reservation_start,
+                             size_t reservation_size);
 void UnmapNow(uintptr_t reservation_start,
               size_t reservation_size,
               pool_handle pool);
@@ -53,13 +55,9 @@ PA_ALWAYS_INLINE void PartitionDirectUnmap(
     extent->next_extent->ToWritable(root)->prev_extent = extent->prev_extent;
   }
 
-  // The actual decommit is deferred below after releasing the lock.
-  root->DecreaseCommittedPages(slot_span->bucket->slot_size);
-
   size_t reservation_size = extent->reservation_size;
   PA_DCHECK(!(reservation_size & DirectMapAllocationGranularityOffsetMask()));
   PA_DCHECK(root->total_size_of_direct_mapped_pages >= reservation_size);
-  root->total_size_of_direct_mapped_pages -= reservation_size;
 
   uintptr_t reservation_start =
       SlotSpanMetadata<MetadataKind::kReadOnly>::ToSlotSpanStart(slot_span);
@@ -67,6 +65,26 @@ PA_ALWAYS_INLINE void PartitionDirectUnmap(
   // we always reserve memory aligned to super page size.
   reservation_start = base::bits::AlignDown(reservation_start, kSuperPageSize);
 
+  // Keep the mapping around instead, if it can be reused as is. Its offset
+  // table entries must be reset before it is visible in the cache, and so
+  // available to other threads.
+  const size_t slot_size = slot_span->bucket->slot_size;
+  if (!extent->padding_for_alignment && root->CanCacheDirectMap(slot_size)) {
+    ResetReservationOffsets(reservation_start, reservation_size);
+    PartitionRoot::DirectMapCacheEntry evicted[kMaxDirectMapCacheEntries];
+    const size_t evicted_count = root->CacheDirectMap(
+        reservation_start, reservation_size, slot_size, evicted);
+    if (evicted_count) {
+      ScopedUnlockGuard unlock{PartitionRootLock(root)};
+      root->ReleaseCachedDirectMaps(evicted, evicted_count);
+    }
+    return;
+  }
+
+  // The actual decommit is deferred below after releasing the lock.
+  root->DecreaseCommittedPages(slot_size);
+  root->total_size_of_direct_mapped_pages -= reservation_size;
+
   // All the metadata have been updated above, in particular the mapping has
   // been unlinked. We can safely release the memory outside the lock, which is
   // important as decommitting memory can be expensive.
@@ -96,11 +114,24 @@ SlotSpanMetadata<MetadataKind::kWritable>::RegisterEmpty() {
   auto* root = PartitionRoot::FromSlotSpanMetadata(this);
   PartitionRootLock(root).AssertAcquired();
 
-  root->empty_slot_spans_dirty_bytes +=
+  const size_t dirty_size =
       base::bits::AlignUp(GetProvisionedSize(), SystemPageSize());
-
   ToSuperPageExtent()->DecrementNumberOfNonemptySlotSpans();
 
+  // Slot spans provisioned ahead of use are not put in the ring, otherwise all
+  // but the last few would be decommitted right away.
+  if (root->provisioning_slot_spans) [[unlikely]] {
+    if (in_empty_cache_) {
+      root->global_empty_slot_span_ring[empty_cache_index_] = nullptr;
+      in_empty_cache_ = 0;
+    }
+    provisioned_ahead_ = 1;
+    root->provisioned_slot_spans_dirty_bytes += dirty_size;
+    return;
+  }
+
+  root->empty_slot_spans_dirty_bytes += dirty_size;
+
   // If the slot span is already registered as empty, don't do anything. This
   // prevents continually reusing a slot span from decommitting a bunch of other
   // slot spans.
@@ -237,7 +268,56 @@ void SlotSpanMetadata<MetadataKind::kWritable>::FreeSlowPath(
   }
 }
 
-void SlotSpanMetadata<MetadataKind::kWritable>::Decommit(PartitionRoot* root) {
+DecommitBatch::~DecommitBatch() {
+  Flush();
+}
+
+void DecommitBatch::Add(uintptr_t address, size_t length) {
+  PA_DCHECK(!(address % SystemPageSize()));
+  PA_DCHECK(!(length % SystemPageSize()));
+  // Slot spans of the ring are frequently freed in address order, check the
+  // last range first.
+  if (count_) {
+    Range& last = ranges_[count_ - 1];
+    if (last.address + last.length == address) {
+      last.length += length;
+      return;
+    }
+    if (address + length == last.address) {
+      last.address = address;
+      last.length += length;
+      return;
+    }
+  }
+  if (count_ == kMaxRanges) {
+    Flush();
+  }
+  ranges_[count_++] = {address, length};
+}
+
+void DecommitBatch::Flush() {
+  if (!count_) {
+    return;
+  }
+  PartitionRootLock(root_).AssertAcquired();
+  std::sort(ranges_, ranges_ + count_, [](const Range& a, const Range& b) {
+    return a.address < b.address;
+  });
+  size_t i = 0;
+  while (i < count_) {
+    uintptr_t address = ranges_[i].address;
+    size_t length = ranges_[i].length;
+    for (++i; i < count_ && address + length == ranges_[i].address; ++i) {
+      length += ranges_[i].length;
+    }
+    root_->DecommitSystemPagesForData(
+        address, length, PageAccessibilityDisposition::kAllowKeepForPerf);
+  }
+  count_ = 0;
+}
+
+void SlotSpanMetadata<MetadataKind::kWritable>::Decommit(PartitionRoot* root,
+                                                          DecommitBatch* batch) {
   PartitionRootLock(root).AssertAcquired();
   PA_DCHECK(is_empty_internal());
   PA_DCHECK(!bucket->is_direct_mapped());
@@ -249,15 +329,17 @@ void SlotSpanMetadata<MetadataKind::kWritable>::Decommit(PartitionRoot* root) {
       base::bits::AlignUp(GetProvisionedSize(), SystemPageSize());
   size_t size_to_decommit =
       kUseLazyCommit ? dirty_size : bucket->SlotSpanCommittedSize(root);
-
-  PA_DCHECK(root->empty_slot_spans_dirty_bytes >= dirty_size);
-  root->empty_slot_spans_dirty_bytes -= dirty_size;
+  UnregisterEmpty(root);
 
   // Not decommitted slot span must've had at least 1 allocation.
   PA_DCHECK(size_to_decommit > 0);
-  root->DecommitSystemPagesForData(
-      slot_span_start, size_to_decommit,
-      PageAccessibilityDisposition::kAllowKeepForPerf);
+  if (batch) {
+    batch->Add(slot_span_start, size_to_decommit);
+  } else {
+    root->DecommitSystemPagesForData(
+        slot_span_start, size_to_decommit,
+        PageAccessibilityDisposition::kAllowKeepForPerf);
+  }
 
 #if PA_BUILDFLAG(USE_FREESLOT_BITMAP)
   FreeSlotBitmapReset(slot_span_start, slot_span_start + size_to_decommit,
@@ -275,16 +357,33 @@ void SlotSpanMetadata<MetadataKind::kWritable>::Decommit(PartitionRoot* root) {
   PA_DCHECK(bucket);
 }
 
-void SlotSpanMetadata<MetadataKind::kWritable>::DecommitIfPossible(
+void SlotSpanMetadata<MetadataKind::kWritable>::UnregisterEmpty(
     PartitionRoot* root) {
   PartitionRootLock(root).AssertAcquired();
+  PA_DCHECK(is_empty_internal());
+  const size_t dirty_size =
+      base::bits::AlignUp(GetProvisionedSize(), SystemPageSize());
+  if (provisioned_ahead_) [[unlikely]] {
+    PA_DCHECK(root->provisioned_slot_spans_dirty_bytes >= dirty_size);
+    root->provisioned_slot_spans_dirty_bytes -= dirty_size;
+    provisioned_ahead_ = 0;
+  } else {
+    PA_DCHECK(root->empty_slot_spans_dirty_bytes >= dirty_size);
+    root->empty_slot_spans_dirty_bytes -= dirty_size;
+  }
+}
+
+void SlotSpanMetadata<MetadataKind::kWritable>::DecommitIfPossible(
+    PartitionRoot* root,
+    DecommitBatch* batch) {
+  PartitionRootLock(root).AssertAcquired();
   PA_DCHECK(in_empty_cache_);
   PA_DCHECK(empty_cache_index_ < kMaxEmptySlotSpanRingSize);
   PA_DCHECK(ToReadOnly(root) ==
             root->global_empty_slot_span_ring[empty_cache_index_]);
   in_empty_cache_ = 0;
   if (is_empty_internal()) {
-    Decommit(root);
+    Decommit(root, batch);
   }
   root->global_empty_slot_span_ring[empty_cache_index_] = nullptr;
 }
@@ -350,6 +449,20 @@ void SlotSpanMetadata<
 
 namespace {
 
+void ResetReservationOffsets(uintptr_t reservation_start,
+                             size_t reservation_size) {
+  PA_DCHECK((reservation_start & kSuperPageOffsetMask) == 0);
+  uintptr_t reservation_end = reservation_start + reservation_size;
+  auto* offset_ptr = ReservationOffsetPointer(reservation_start);
+  uint16_t i = 0;
+  for (uintptr_t address = reservation_start; address < reservation_end;
+       address += kSuperPageSize) {
+    PA_DCHECK(offset_ptr < GetReservationOffsetTableEnd(address));
+    PA_DCHECK(*offset_ptr == i++);
+    *offset_ptr++ = kOffsetTagNotAllocated;
+  }
+}
+
 void UnmapNow(uintptr_t reservation_start,
               size_t reservation_size,
               pool_handle pool) {
@@ -395,21 +508,12 @@ void UnmapNow(uintptr_t reservation_start,
   }
 #endif  // PA_BUILDFLAG(DCHECKS_ARE_ON)
 
-  PA_DCHECK((reservation_start & kSuperPageOffsetMask) == 0);
-  uintptr_t reservation_end = reservation_start + reservation_size;
-  auto* offset_ptr = ReservationOffsetPointer(reservation_start);
   // Reset the offset table entries for the given memory before unreserving
   // it. Since the memory is not unreserved and not available for other
   // threads, the table entries for the memory are not modified by other
   // threads either. So we can update the table entries without race
   // condition.
-  uint16_t i = 0;
-  for (uintptr_t address = reservation_start; address < reservation_end;
-       address += kSuperPageSize) {
-    PA_DCHECK(offset_ptr < GetReservationOffsetTableEnd(address));
-    PA_DCHECK(*offset_ptr == i++);
-    *offset_ptr++ = kOffsetTagNotAllocated;
-  }
+  ResetReservationOffsets(reservation_start, reservation_size);
 
 #if PA_CONFIG(ENABLE_SHADOW_METADATA)
   // UnmapShadowMetadata must be done before unreserving memory, because
@@ -37,6 +37,34 @@ namespace partition_alloc::internal {
 template <MetadataKind kind>
 struct SlotSpanMetadata;
 
+// Collects ranges of data pages to decommit, and decommits them coalesced with
+// their neighbours, so that decommitting many adjacent empty slot spans (as
+// when shrinking the empty slot span ring) takes a handful of system calls
+// rather than one per slot span. Pending ranges are decommitted when the batch
+// fills up, on Flush() and on destruction. Must only be used while holding the
+// root lock, and pages added to a batch must not be touched until it's flushed.
+class PA_COMPONENT_EXPORT(PARTITION_ALLOC) DecommitBatch {
+ public:
+  explicit DecommitBatch(PartitionRoot* root) : root_(root) {}
+  DecommitBatch(const DecommitBatch&) = delete;
+  DecommitBatch& operator=(const DecommitBatch&) = delete;
+  ~DecommitBatch();
+
+  void Add(uintptr_t address, size_t length);
+  void Flush();
+
+ private:
+  struct Range {
+    uintptr_t address;
+    size_t length;
+  };
+  static constexpr size_t kMaxRanges = 32;
+
+  PartitionRoot* const root_;
+  Range ranges_[kMaxRanges];
+  size_t count_ = 0;
+};
+
 // Metadata of the slot span.
 //
 // Some notes on slot span states. It can be in one of four major states:
@@ -107,6 +135,10 @@ struct SlotSpanMetadataBase {
   // `BitWidth(kMaxEmptySlotSpanRingSize - 1)`.
   MaybeConstT<kind, uint16_t> empty_cache_index_
       : internal::base::bits::BitWidth(kMaxEmptySlotSpanRingSize - 1) = 0u;
+  // Empty slot span provisioned ahead of use, see
+  // `PartitionRoot::ProvisionSlotSpans()`. It is kept out of the empty ring,
+  // and its dirty bytes are accounted for separately, until it is used.
+  MaybeConstT<kind, uint16_t> provisioned_ahead_ : 1 = 0u;
   // Can use only 48 bits (6B) in this bitfield, as this structure is embedded
   // in PartitionPage which has 2B worth of fields and must fit in 32B.
 
@@ -133,6 +165,7 @@ struct SlotSpanMetadataBase {
   }
 
   PA_ALWAYS_INLINE bool in_empty_cache() const { return in_empty_cache_; }
+  PA_ALWAYS_INLINE bool provisioned_ahead() const { return provisioned_ahead_; }
 
  protected:
   constexpr SlotSpanMetadataBase() noexcept = default;
@@ -145,6 +178,7 @@ struct SlotSpanMetadataBase {
       PA_DCHECK(!marked_full);
       PA_DCHECK(!num_unprovisioned_slots);
       PA_DCHECK(!in_empty_cache_);
+      PA_DCHECK(!provisioned_ahead_);
     }
     return ret;
   }
@@ -319,14 +353,19 @@ struct SlotSpanMetadata<MetadataKind::kWritable>
       const PartitionFreelistDispatcher* freelist_dispatcher)
       PA_EXCLUSIVE_LOCKS_REQUIRED(PartitionRootLock(root));
 
-  void Decommit(PartitionRoot* root);
-  void DecommitIfPossible(PartitionRoot* root);
+  // When `batch` is provided, the slot span's pages are added to it rather
+  // than decommitted right away.
+  void Decommit(PartitionRoot* root, DecommitBatch* batch = nullptr);
+  void DecommitIfPossible(PartitionRoot* root, DecommitBatch* batch = nullptr);
 
   // Sorts the freelist in ascending addresses order.
   void SortFreelist(PartitionRoot* root);
   // Inserts the slot span into the empty ring, making space for the new slot
   // span, and potentially shrinking the ring.
   void RegisterEmpty();
+  // Updates the accounting of an empty slot span which is about to be used
+  // again, or decommitted.
+  void UnregisterEmpty(PartitionRoot* root);
 
   // The caller is responsible for ensuring that raw_size can be stored before
   // calling Set/GetRawSize.
@@ -4,12 +4,14 @@
 
 #include "partition_alloc/partition_root.h"
 
+#include <algorithm>
 #include <cstdint>
 
 #include "partition_alloc/build_config.h"
 #include "partition_alloc/buildflags.h"
 #include "partition_alloc/freeslot_bitmap.h"
 #include "partition_alloc/in_slot_metadata.h"
+#include "partition_alloc/internal_allocator.h"
 #include "partition_alloc/oom.h"
 #include "partition_alloc/page_allocator.h"
 #include "partition_alloc/partition_address_space.h"
@@ -64,6 +66,30 @@ void RecordAllocOrFree(uintptr_t addr, size_t size) {
 }
 #endif  // PA_BUILDFLAG(RECORD_ALLOC_INFO)
 
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+base::PlatformThreadRef g_biased_count_owners[kMaxBiasedCountOwners];
+
+namespace {
+Lock g_biased_count_owners_lock;
+}  // namespace
+
+uint16_t RegisterBiasedCountOwner() {
+  const base::PlatformThreadRef current = base::PlatformThread::CurrentRef();
+  ScopedGuard guard(g_biased_count_owners_lock);
+  size_t tag = 1;
+  for (; tag < kMaxBiasedCountOwners && !g_biased_count_owners[tag].is_null();
+       ++tag) {
+    if (g_biased_count_owners[tag] == current) {
+      return static_cast<uint16_t>(tag);
+    }
+  }
+  // Tags aren't recycled, as slots may remain biased towards exited threads.
+  PA_CHECK(tag < kMaxBiasedCountOwners);
+  g_biased_count_owners[tag] = current;
+  return static_cast<uint16_t>(tag);
+}
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+
 #if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
 PtrPosWithinAlloc IsPtrWithinSameAlloc(uintptr_t orig_address,
                                        uintptr_t test_address,
@@ -256,10 +282,16 @@ void BeforeForkInParent() PA_NO_THREAD_SAFETY_ANALYSIS {
       internal::PartitionRootEnumerator::EnumerateOrder::kNormal);
 
   ThreadCacheRegistry::GetLock().Acquire();
+  for (size_t i = 0; i < ThreadCacheRegistry::kShardCount; ++i) {
+    ThreadCacheRegistry::GetShardLock(i).Acquire();
+  }
 }
 
 void ReleaseLocks(bool in_child) PA_NO_THREAD_SAFETY_ANALYSIS {
   // In reverse order, even though there are no lock ordering dependencies.
+  for (size_t i = ThreadCacheRegistry::kShardCount; i > 0; --i) {
+    UnlockOrReinit(ThreadCacheRegistry::GetShardLock(i - 1), in_child);
+  }
   UnlockOrReinit(ThreadCacheRegistry::GetLock(), in_child);
   internal::PartitionRootEnumerator::Instance().Enumerate(
       UnlockOrReinitRoot, in_child,
@@ -498,11 +530,35 @@ static size_t PartitionPurgeSlotSpan(
   memset(slot_usage, 1, num_provisioned_slots);
   uintptr_t slot_span_start = internal::SlotSpanMetadata<
       internal::MetadataKind::kReadOnly>::ToSlotSpanStart(slot_span);
-  // First, walk the freelist for this slot span and make a bitmap of which
-  // slots are not in use.
   const PartitionFreelistDispatcher* freelist_dispatcher =
       root->get_freelist_dispatcher();
 
+#if PA_BUILDFLAG(USE_FREESLOT_BITMAP)
+  // First, make a bitmap of which slots are not in use. The free slot bitmap
+  // is kept in sync with the freelist, and scanning it doesn't touch the free
+  // slots, contrary to walking the freelist, so that the freelist isn't pulled
+  // into the cache.
+  FreeSlotBitmapForEachFreeSlot(
+      slot_span_start, slot_span_start + num_provisioned_slots * slot_size,
+      [&](uintptr_t slot_start) {
+        size_t slot_number =
+            bucket->GetSlotNumber(slot_start - slot_span_start);
+        PA_DCHECK(slot_span_start + slot_number * slot_size == slot_start);
+        slot_usage[slot_number] = 0;
+#if !PA_BUILDFLAG(IS_WIN)
+        // See below, only used for slots spanning at least a system page, of
+        // which there are few per slot span.
+        if (slot_size >= SystemPageSize() &&
+            freelist_dispatcher->IsEncodedNextPtrZero(
+                static_cast<PartitionFreelistEntry*>(
+                    SlotStartAddr2Ptr(slot_start)))) {
+          last_slot = slot_number;
+        }
+#endif
+      });
+#else
+  // First, walk the freelist for this slot span and make a bitmap of which
+  // slots are not in use.
   for (PartitionFreelistEntry* entry = slot_span->get_freelist_head(); entry;
        entry = freelist_dispatcher->GetNext(entry, slot_size)) {
     size_t slot_number =
@@ -520,6 +576,7 @@ static size_t PartitionPurgeSlotSpan(
     }
 #endif
   }
+#endif  // PA_BUILDFLAG(USE_FREESLOT_BITMAP)
 
   // If the slot(s) at the end of the slot span are not in use, we can truncate
   // them entirely and rewrite the freelist.
@@ -566,6 +623,7 @@ static size_t PartitionPurgeSlotSpan(
     auto straighten_mode =
         PartitionRoot::GetStraightenLargerSlotSpanFreeListsMode();
     bool straighten =
+        root->settings.prefer_fuller_slot_spans ||
         straighten_mode == StraightenLargerSlotSpanFreeListsMode::kAlways ||
         (straighten_mode ==
              StraightenLargerSlotSpanFreeListsMode::kOnlyWhenUnprovisioning &&
@@ -951,12 +1009,149 @@ void PartitionRoot::DecommitEmptySlotSpans() {
   ShrinkEmptySlotSpansRing(0);
   // Just decommitted everything, and holding the lock, should be exactly 0.
   PA_DCHECK(empty_slot_spans_dirty_bytes == 0);
+
+  // The slot spans provisioned ahead of use are not in the ring, look for them
+  // in the buckets. Rare enough not to track them more precisely.
+  if (!provisioned_slot_spans_dirty_bytes) [[likely]] {
+    return;
+  }
+  internal::DecommitBatch batch(this);
+  for (Bucket& bucket : buckets) {
+    if (!bucket.is_valid()) {
+      continue;
+    }
+    for (auto* list :
+         {bucket.active_slot_spans_head, bucket.empty_slot_spans_head}) {
+      for (auto* slot_span = list; slot_span;
+           slot_span = slot_span->next_slot_span) {
+        if (slot_span->provisioned_ahead() && slot_span->is_empty()) {
+          slot_span->ToWritable(this)->Decommit(this, &batch);
+        }
+      }
+    }
+  }
+  PA_DCHECK(provisioned_slot_spans_dirty_bytes == 0);
 }
 
 void PartitionRoot::DecommitEmptySlotSpansForTesting() {
   ::partition_alloc::internal::ScopedGuard guard{
       internal::PartitionRootLock(this)};
   DecommitEmptySlotSpans();
+  ReleaseDirectMapCache();
+}
+
+uintptr_t PartitionRoot::TakeCachedDirectMap(size_t reservation_size,
+                                             size_t* committed_size) {
+  if (!direct_map_cache_count) {
+    return 0;
+  }
+  const auto now = now_maybe_overridden_for_testing();
+  // Newest first, as it is the most likely to still be in the CPU caches and
+  // TLB.
+  for (size_t i = direct_map_cache_count; i-- > 0;) {
+    const DirectMapCacheEntry& entry = direct_map_cache[i];
+    if (entry.reservation_size != reservation_size ||
+        now - entry.freed_time > kDirectMapCacheTimeToLive) {
+      continue;
+    }
+    const uintptr_t reservation_start = entry.reservation_start;
+    *committed_size = entry.committed_size;
+    direct_map_cache_committed_bytes -= entry.committed_size;
+    std::copy(direct_map_cache + i + 1,
+              direct_map_cache + direct_map_cache_count, direct_map_cache + i);
+    --direct_map_cache_count;
+    ++direct_map_cache_hit_count;
+    return reservation_start;
+  }
+  return 0;
+}
+
+size_t PartitionRoot::CacheDirectMap(uintptr_t reservation_start,
+                                     size_t reservation_size,
+                                     size_t committed_size,
+                                     DirectMapCacheEntry* evicted) {
+  PA_DCHECK(CanCacheDirectMap(committed_size));
+  const auto now = now_maybe_overridden_for_testing();
+  // Entries are sorted from oldest to newest, so the expired ones, and the
+  // ones to evict to make room, are at the front.
+  size_t evicted_count = 0;
+  while (evicted_count < direct_map_cache_count) {
+    const DirectMapCacheEntry& entry = direct_map_cache[evicted_count];
+    const bool expired = now - entry.freed_time > kDirectMapCacheTimeToLive;
+    const bool full =
+        direct_map_cache_count - evicted_count ==
+            internal::kMaxDirectMapCacheEntries ||
+        direct_map_cache_committed_bytes + committed_size >
+            direct_map_cache_capacity_in_bytes;
+    if (!expired && !full) {
+      break;
+    }
+    direct_map_cache_committed_bytes -= entry.committed_size;
+    evicted[evicted_count++] = entry;
+  }
+  std::copy(direct_map_cache + evicted_count,
+            direct_map_cache + direct_map_cache_count, direct_map_cache);
+  direct_map_cache_count -= evicted_count;
+
+  // The memory stays accounted for as committed and direct-mapped until it is
+  // released.
+  for (size_t i = 0; i < evicted_count; ++i) {
+    DecreaseCommittedPages(evicted[i].committed_size);
+    total_size_of_direct_mapped_pages.fetch_sub(evicted[i].reservation_size,
+                                                std::memory_order_relaxed);
+  }
+
+  PA_DCHECK(direct_map_cache_count < internal::kMaxDirectMapCacheEntries);
+  direct_map_cache[direct_map_cache_count++] = {
+      .reservation_start = reservation_start,
+      .reservation_size = reservation_size,
+      .committed_size = committed_size,
+      .freed_time = now,
+  };
+  direct_map_cache_committed_bytes += committed_size;
+  return evicted_count;
+}
+
+void PartitionRoot::ReleaseCachedDirectMaps(const DirectMapCacheEntry* entries,
+                                            size_t count) {
+  if (!count) {
+    return;
+  }
+  internal::ScopedSyscallTimer timer{this};
+  for (size_t i = 0; i < count; ++i) {
+    internal::AddressPoolManager::GetInstance().UnreserveAndDecommit(
+        ChoosePool(), entries[i].reservation_start,
+        entries[i].reservation_size);
+  }
+}
+
+size_t PartitionRoot::EvictCachedDirectMaps(bool expired_only,
+                                            DirectMapCacheEntry* evicted) {
+  const auto now = now_maybe_overridden_for_testing();
+  // Oldest first, so the expired entries are at the front.
+  size_t evicted_count = 0;
+  while (evicted_count < direct_map_cache_count) {
+    const DirectMapCacheEntry& entry = direct_map_cache[evicted_count];
+    if (expired_only &&
+        now - entry.freed_time <= kDirectMapCacheTimeToLive) {
+      break;
+    }
+    direct_map_cache_committed_bytes -= entry.committed_size;
+    DecreaseCommittedPages(entry.committed_size);
+    total_size_of_direct_mapped_pages.fetch_sub(entry.reservation_size,
+                                                std::memory_order_relaxed);
+    evicted[evicted_count++] = entry;
+  }
+  std::copy(direct_map_cache + evicted_count,
+            direct_map_cache + direct_map_cache_count, direct_map_cache);
+  direct_map_cache_count -= evicted_count;
+  return evicted_count;
+}
+
+void PartitionRoot::ReleaseDirectMapCache() {
+  DirectMapCacheEntry evicted[internal::kMaxDirectMapCacheEntries];
+  const size_t evicted_count = EvictCachedDirectMaps(false, evicted);
+  ReleaseCachedDirectMaps(evicted, evicted_count);
 }
 
 void PartitionRoot::DestructForTesting()
@@ -977,6 +1172,8 @@ void PartitionRoot::DestructForTesting()
   PA_DCHECK(pool_handle <= internal::kNumPools);
 #endif
 
+  ReleaseDirectMapCache();
+
   {
     auto* curr = first_extent;
     while (curr != nullptr) {
@@ -1143,9 +1340,27 @@ void PartitionRoot::Init(PartitionOptions opts) {
 
 #if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
     settings.brp_enabled_ = opts.backup_ref_ptr == PartitionOptions::kEnabled;
+    brp_quarantine_capacity_in_bytes =
+        opts.backup_ref_ptr_quarantine_capacity_in_bytes;
+    brp_quarantine_discard_over_capacity =
+        opts.backup_ref_ptr_quarantine_policy ==
+        PartitionOptions::BackupRefPtrQuarantinePolicy::kReportAndDiscard;
+    brp_quarantine_decommit_threshold =
+        opts.backup_ref_ptr_quarantine_decommit_threshold_in_bytes;
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+    if (settings.brp_enabled_ &&
+        opts.thread_confined == PartitionOptions::kEnabled) {
+      settings.biased_count_owner_tag_ = internal::RegisterBiasedCountOwner();
+    }
+#endif
 #else   // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
     PA_CHECK(opts.backup_ref_ptr == PartitionOptions::kDisabled);
 #endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
+#if PA_BUILDFLAG(HAS_64_BIT_POINTERS) && !PA_CONFIG(ENABLE_SHADOW_METADATA)
+    direct_map_cache_capacity_in_bytes =
+        opts.direct_map_cache_capacity_in_bytes;
+#endif
+    prefault_max_slot_size = opts.prefault_max_slot_size;
     settings.use_configurable_pool =
         (opts.use_configurable_pool == PartitionOptions::kAllowed) &&
         IsConfigurablePoolAvailable();
@@ -1156,17 +1371,27 @@ void PartitionRoot::Init(PartitionOptions opts) {
         opts.eventually_zero_freed_memory == PartitionOptions::kEnabled;
     settings.fewer_memory_regions =
         opts.fewer_memory_regions == PartitionOptions::kEnabled;
+#if PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+    settings.gwp_asan_sampling =
+        opts.gwp_asan_sampling == PartitionOptions::kEnabled;
+#endif
+    settings.prefer_fuller_slot_spans =
+        opts.prefer_fuller_slot_spans == PartitionOptions::kEnabled;
 
     settings.scheduler_loop_quarantine =
         opts.scheduler_loop_quarantine == PartitionOptions::kEnabled;
     if (settings.scheduler_loop_quarantine) {
+      scheduler_loop_quarantine_branch_capacity_in_bytes =
+          opts.scheduler_loop_quarantine_branch_capacity_in_bytes;
+      scheduler_loop_quarantine_segregate_by_size =
+          opts.scheduler_loop_quarantine_segregate_by_size ==
+          PartitionOptions::kEnabled;
       internal::LightweightQuarantineBranchConfig global_config = {
           .lock_required = true,
           .branch_capacity_in_bytes =
-              opts.scheduler_loop_quarantine_branch_capacity_in_bytes,
+              scheduler_loop_quarantine_branch_capacity_in_bytes,
+          .segregate_by_size = scheduler_loop_quarantine_segregate_by_size,
       };
-      scheduler_loop_quarantine_branch_capacity_in_bytes =
-          opts.scheduler_loop_quarantine_branch_capacity_in_bytes;
       scheduler_loop_quarantine.emplace(
           scheduler_loop_quarantine_root.CreateBranch(global_config));
     } else {
@@ -1218,6 +1443,13 @@ void PartitionRoot::Init(PartitionOptions opts) {
 
 #if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
     if (brp_enabled()) {
+      // Besides hosting the metadata, these extras make sure that the
+      // end-of-allocation address of an object lands in its own slot, as
+      // BackupRefPtr must attribute e.g. a past-the-end raw_ptr<T> to the right
+      // reference count. Moving the metadata out of the slot (e.g. to a side
+      // table) would thus still require a byte of extras, and wouldn't keep
+      // bucket-sized objects in their natural bucket, slot sizes being
+      // multiples of kAlignment.
       settings.in_slot_metadata_size = internal::kInSlotMetadataSizeAdjustment;
       settings.extras_size += internal::kInSlotMetadataSizeAdjustment;
       settings.extras_size += opts.backup_ref_ptr_extra_extras_size;
@@ -1266,11 +1498,16 @@ void PartitionRoot::Init(PartitionOptions opts) {
     settings.with_thread_cache = false;
 #else
     ThreadCache::EnsureThreadSpecificDataInitialized();
+    PA_CHECK(opts.thread_cache != PartitionOptions::kEnabled ||
+             opts.secondary_thread_cache != PartitionOptions::kEnabled);
     settings.with_thread_cache =
-        (opts.thread_cache == PartitionOptions::kEnabled);
+        (opts.thread_cache == PartitionOptions::kEnabled ||
+         opts.secondary_thread_cache == PartitionOptions::kEnabled);
 
-    if (settings.with_thread_cache) {
+    if (opts.thread_cache == PartitionOptions::kEnabled) {
       ThreadCache::Init(this);
+    } else if (settings.with_thread_cache) {
+      settings.thread_cache_index = ThreadCache::InitSecondary(this);
     }
 #endif  // !PA_CONFIG(THREAD_CACHE_SUPPORTED)
 
@@ -1313,6 +1550,12 @@ void PartitionRoot::Init(PartitionOptions opts) {
     internal::PartitionAllocThreadIsolationInit(settings.thread_isolation);
   }
 #endif
+
+  // Allocates, so the partition must be fully set up first.
+  if (opts.allocation_profile) {
+    ApplyAllocationProfile(*opts.allocation_profile,
+                           opts.thread_cache == PartitionOptions::kEnabled);
+  }
 }
 
 PartitionRoot::Settings::Settings() = default;
@@ -1329,6 +1572,14 @@ PartitionRoot::~PartitionRoot() {
   PA_CHECK(!settings.with_thread_cache)
       << "Must not destroy a partition with a thread cache";
 #endif  // PA_BUILDFLAG(USE_PARTITION_ALLOC_AS_MALLOC)
+  // Other threads' secondary thread caches would outlive it.
+  PA_CHECK(!settings.thread_cache_index)
+      << "Must not destroy a partition with a secondary thread cache";
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+  if (initialized) {
+    ReclaimBiasedSlotsFreedElsewhereIfOwner();
+  }
+#endif
 
 #if PA_CONFIG(USE_PARTITION_ROOT_ENUMERATOR)
   if (initialized) {
@@ -1477,8 +1728,8 @@ bool PartitionRoot::TryReallocInPlaceForDirectMap(
   // so this is consistent.
   auto* thread_cache = GetOrCreateThreadCache();
   if (ThreadCache::IsValid(thread_cache)) {
-    thread_cache->RecordDeallocation(current_usable_size);
-    thread_cache->RecordAllocation(GetSlotUsableSize(slot_span));
+    thread_cache->RecordDeallocation(slot_start, current_usable_size);
+    thread_cache->RecordAllocation(slot_start, GetSlotUsableSize(slot_span));
   }
 
   // Write a new trailing cookie.
@@ -1542,30 +1793,45 @@ bool PartitionRoot::TryReallocInPlaceForNormalBuckets(
   // falls back to free()+malloc(), so this is consistent.
   ThreadCache* thread_cache = GetOrCreateThreadCache();
   if (ThreadCache::IsValid(thread_cache)) [[likely]] {
-    thread_cache->RecordDeallocation(current_usable_size);
-    thread_cache->RecordAllocation(GetSlotUsableSize(slot_span));
+    thread_cache->RecordDeallocation(slot_start, current_usable_size);
+    thread_cache->RecordAllocation(slot_start, GetSlotUsableSize(slot_span));
   }
 
   return object;
 }
 
 void PartitionRoot::PurgeMemory(int flags) {
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+  // Otherwise, slots freed by other threads wait for the owner's next
+  // allocation, which may never come.
+  ReclaimBiasedSlotsFreedElsewhereIfOwner();
+#endif
   auto start = now_maybe_overridden_for_testing();
   unsigned int local_purge_generation, local_purge_next_bucket_index;
 
   {
-    ::partition_alloc::internal::ScopedGuard guard{
-        internal::PartitionRootLock(this)};
-    local_purge_next_bucket_index = purge_next_bucket_index;
-    local_purge_generation = purge_generation;
-
-    if (flags & PurgeFlags::kDecommitEmptySlotSpans) {
-      DecommitEmptySlotSpans();
+    DirectMapCacheEntry evicted[internal::kMaxDirectMapCacheEntries];
+    size_t evicted_count;
+    {
+      ::partition_alloc::internal::ScopedGuard guard{
+          internal::PartitionRootLock(this)};
+      local_purge_next_bucket_index = purge_next_bucket_index;
+      local_purge_generation = purge_generation;
 
-      if (flags & PurgeFlags::kLimitDuration &&
-          (now_maybe_overridden_for_testing() - start > kMaxPurgeDuration)) {
-        return;
+      if (flags & PurgeFlags::kDecommitEmptySlotSpans) {
+        DecommitEmptySlotSpans();
       }
+      // Cached direct maps only expire when the cache is used otherwise, so
+      // enforce their time to live here as well.
+      evicted_count = EvictCachedDirectMaps(
+          !(flags & PurgeFlags::kDecommitEmptySlotSpans), evicted);
+    }
+    ReleaseCachedDirectMaps(evicted, evicted_count);
+
+    if (flags & PurgeFlags::kDecommitEmptySlotSpans &&
+        flags & PurgeFlags::kLimitDuration &&
+        (now_maybe_overridden_for_testing() - start > kMaxPurgeDuration)) {
+      return;
     }
   }
 
@@ -1599,7 +1865,8 @@ void PartitionRoot::PurgeMemory(int flags) {
       if (bucket.slot_size >= min_bucket_size_to_purge) {
         internal::PartitionPurgeBucket(this, &bucket);
       } else {
-        if (sort_smaller_slot_span_free_lists_) {
+        if (sort_smaller_slot_span_free_lists_ ||
+            settings.prefer_fuller_slot_spans) {
           bucket.SortSmallerSlotSpanFreeLists(this);
         }
       }
@@ -1608,7 +1875,7 @@ void PartitionRoot::PurgeMemory(int flags) {
       // spans (e.g. empty -> decommitted).
       bucket.MaintainActiveList(this);
 
-      if (sort_active_slot_spans_) {
+      if (sort_active_slot_spans_ || settings.prefer_fuller_slot_spans) {
         bucket.SortActiveSlotSpans(this);
       }
       // Checking at the end to make sure we make progress by processing at
@@ -1635,15 +1902,219 @@ void PartitionRoot::PurgeMemory(int flags) {
   }
 }
 
+void PartitionRoot::ProvisionSlotSpans(size_t max_slot_size,
+                                       size_t slot_spans_per_bucket) {
+  for (size_t index = 0; index < internal::kNumBuckets; ++index) {
+    Bucket& bucket = buckets[index];
+    if (!bucket.is_valid() || bucket.slot_size > max_slot_size) {
+      continue;
+    }
+    // Skip the buckets that the current distribution doesn't use.
+    if (SizeToBucketIndex(bucket.slot_size, GetBucketDistribution()) !=
+        index) {
+      continue;
+    }
+    ProvisionSlotSpansInBucket(&bucket, slot_spans_per_bucket);
+  }
+}
+
+void PartitionRoot::Warmup(const WarmupEntry* profile,
+                           size_t profile_size,
+                           bool fill_thread_cache) {
+  size_t budget = kMaxProvisionedBytes;
+  for (size_t i = 0; i < profile_size; ++i) {
+    const size_t raw_size = AdjustSizeForExtrasAdd(profile[i].size);
+    if (raw_size > internal::kMaxBucketed) {
+      continue;
+    }
+    Bucket* bucket =
+        &buckets[SizeToBucketIndex(raw_size, GetBucketDistribution())];
+    ProvisionBytesInBucket(
+        bucket,
+        static_cast<uint64_t>(std::min<size_t>(
+            profile[i].count, std::numeric_limits<uint32_t>::max())) *
+            bucket->slot_size,
+        &budget);
+  }
+
+  if (!fill_thread_cache || !settings.with_thread_cache) {
+    return;
+  }
+  ThreadCache* thread_cache = GetOrCreateThreadCache();
+  if (!ThreadCache::IsValid(thread_cache)) {
+    return;
+  }
+  for (size_t i = 0; i < profile_size; ++i) {
+    const size_t raw_size = AdjustSizeForExtrasAdd(profile[i].size);
+    if (raw_size > internal::kMaxBucketed) {
+      continue;
+    }
+    thread_cache->Prefill(
+        SizeToBucketIndex(raw_size, GetBucketDistribution()));
+  }
+}
+
+size_t PartitionRoot::ProvisionSlotSpansInBucket(Bucket* bucket,
+                                                 size_t slot_spans) {
+  // All the slots are held until they are all provisioned, otherwise they would
+  // be reused. Rather than in a buffer, which would have to be allocated, they
+  // are chained through their first word, which their freelist entry
+  // overwrites once they are freed.
+  const size_t slots_per_span = bucket->get_slots_per_span();
+  uintptr_t slots = 0;
+  size_t count = 0;
+  for (size_t i = 0; i < slot_spans && count == i * slots_per_span; ++i) {
+    // Other threads can take the lock between slot spans.
+    ::partition_alloc::internal::ScopedGuard guard{
+        internal::PartitionRootLock(this)};
+    for (size_t j = 0; j < slots_per_span; ++j) {
+      size_t usable_size;
+      size_t slot_size;
+      bool is_already_zeroed;
+      uintptr_t slot_start = AllocFromBucket<AllocFlags::kReturnNull>(
+          bucket, bucket->slot_size, internal::PartitionPageSize(),
+          &usable_size, &slot_size, &is_already_zeroed);
+      if (!slot_start) {
+        break;
+      }
+      *static_cast<uintptr_t*>(internal::SlotStartAddr2Ptr(slot_start)) =
+          slots;
+      slots = slot_start;
+      ++count;
+    }
+  }
+  while (slots) {
+    ::partition_alloc::internal::ScopedGuard guard{
+        internal::PartitionRootLock(this)};
+    PA_DCHECK(!provisioning_slot_spans);
+    provisioning_slot_spans = true;
+    for (size_t j = 0; slots && j < slots_per_span; ++j) {
+      uintptr_t next =
+          *static_cast<uintptr_t*>(internal::SlotStartAddr2Ptr(slots));
+      RawFreeLocked(slots);
+      slots = next;
+    }
+    provisioning_slot_spans = false;
+  }
+  return count * bucket->slot_size;
+}
+
+void PartitionRoot::ProvisionBytesInBucket(Bucket* bucket,
+                                           uint64_t bytes,
+                                           size_t* budget) {
+  const size_t bytes_per_span = bucket->get_bytes_per_span();
+  const size_t max_bytes = std::min(kMaxProvisionedBytesPerBucket, *budget);
+  // Whole slot spans are provisioned anyway, round up within the limits.
+  const uint64_t capped_bytes = std::min<uint64_t>(bytes, max_bytes);
+  const size_t slot_spans = static_cast<size_t>(
+      std::min<uint64_t>((capped_bytes + bytes_per_span - 1) / bytes_per_span,
+                         max_bytes / bytes_per_span));
+  *budget -= ProvisionSlotSpansInBucket(bucket, slot_spans);
+}
+
+void PartitionRoot::ExportAllocationProfile(AllocationProfile* profile) {
+  *profile = AllocationProfile();
+  ::partition_alloc::internal::ScopedGuard guard{
+      internal::PartitionRootLock(this)};
+  profile->empty_slot_span_ring_size = global_empty_slot_span_ring_size;
+  for (const Bucket& bucket : buckets) {
+    if (!bucket.is_valid()) {
+      continue;
+    }
+    // Slot spans are never released, so the ones of a bucket are an upper
+    // bound of what it needed at once. Slot spans provisioned ahead of use tell
+    // nothing though, and are skipped so that the profile doesn't feed itself.
+    // Once decommitted, they are counted like the others, which can only
+    // overestimate the peak.
+    size_t slot_spans = bucket.num_full_slot_spans;
+    size_t active_slots =
+        bucket.num_full_slot_spans * bucket.get_slots_per_span();
+    for (const auto* list :
+         {bucket.active_slot_spans_head, bucket.empty_slot_spans_head,
+          bucket.decommitted_slot_spans_head}) {
+      for (const auto* slot_span = list; slot_span;
+           slot_span = slot_span->next_slot_span) {
+        if (slot_span == internal::SlotSpanMetadata<
+                             internal::MetadataKind::kReadOnly>::
+                             get_sentinel_slot_span() ||
+            slot_span->provisioned_ahead()) {
+          continue;
+        }
+        ++slot_spans;
+        active_slots += slot_span->num_allocated_slots;
+      }
+    }
+    if (!slot_spans) {
+      continue;
+    }
+    profile->buckets[profile->bucket_count++] = {
+        .slot_size = bucket.slot_size,
+        .active_slots = static_cast<uint32_t>(active_slots),
+        .peak_active_bytes = uint64_t{slot_spans} *
+                             bucket.get_slots_per_span() * bucket.slot_size};
+  }
+}
+
+void PartitionRoot::ApplyAllocationProfile(const AllocationProfile& profile,
+                                           bool owns_thread_cache) {
+  {
+    ::partition_alloc::internal::ScopedGuard guard{
+        internal::PartitionRootLock(this)};
+    if (profile.empty_slot_span_ring_size >
+        static_cast<uint32_t>(global_empty_slot_span_ring_size)) {
+      global_empty_slot_span_ring_size = static_cast<int16_t>(std::min(
+          size_t{profile.empty_slot_span_ring_size},
+          internal::kMaxEmptySlotSpanRingSize));
+    }
+  }
+
+  // Buckets with at least this many slots in use are worth a thread cache.
+  constexpr uint32_t kMinActiveSlotsToCache = 32;
+  size_t largest_size_to_cache = 0;
+  size_t budget = kMaxProvisionedBytes;
+  // The profile may come from a file, don't trust it.
+  const uint32_t bucket_count =
+      std::min(profile.bucket_count, static_cast<uint32_t>(std::size(buckets)));
+  for (uint32_t i = 0; i < bucket_count; ++i) {
+    const AllocationProfile::BucketUsage& usage = profile.buckets[i];
+    if (!usage.slot_size || usage.slot_size > internal::kMaxBucketed ||
+        uint64_t{usage.active_slots} * usage.slot_size >
+            usage.peak_active_bytes) {
+      continue;
+    }
+    if (usage.active_slots >= kMinActiveSlotsToCache) {
+      largest_size_to_cache =
+          std::max(largest_size_to_cache, size_t{usage.slot_size});
+    }
+    // The slot sizes of the current distribution may differ from the ones of
+    // the profile, round them up.
+    Bucket* bucket =
+        &buckets[SizeToBucketIndex(usage.slot_size, GetBucketDistribution())];
+    if (!bucket->is_valid()) {
+      continue;
+    }
+    ProvisionBytesInBucket(bucket, usage.peak_active_bytes, &budget);
+  }
+
+#if PA_CONFIG(THREAD_CACHE_SUPPORTED)
+  if (owns_thread_cache && largest_size_to_cache) {
+    ThreadCache::RaiseLargestCachedSize(largest_size_to_cache);
+  }
+#endif  // PA_CONFIG(THREAD_CACHE_SUPPORTED)
+}
+
 void PartitionRoot::ShrinkEmptySlotSpansRing(size_t limit) {
   int16_t index = global_empty_slot_span_ring_index;
   int16_t starting_index = index;
+  // Empty slot spans are often adjacent, e.g. after freeing a large number of
+  // objects of the same bucket. Coalesce their decommits.
+  internal::DecommitBatch batch(this);
   while (empty_slot_spans_dirty_bytes > limit) {
     internal::SlotSpanMetadata<internal::MetadataKind::kReadOnly>* slot_span =
         global_empty_slot_span_ring[index];
     // The ring is not always full, may be nullptr.
     if (slot_span) {
-      slot_span->ToWritable(this)->DecommitIfPossible(this);
+      slot_span->ToWritable(this)->DecommitIfPossible(this, &batch);
       // DecommitIfPossible() should set the buffer to null.
       PA_DCHECK(!global_empty_slot_span_ring[index]);
     }
@@ -1686,6 +2157,10 @@ void PartitionRoot::DumpStats(const char* partition_name,
   stats.syscall_count = syscall_count.load(std::memory_order_relaxed);
   stats.syscall_total_time_ns =
       syscall_total_time_ns.load(std::memory_order_relaxed);
+  stats.commit_under_lock_count =
+      commit_under_lock_count.load(std::memory_order_relaxed);
+  stats.commit_under_lock_time_ns =
+      commit_under_lock_time_ns.load(std::memory_order_relaxed);
 
   // Collect data with the lock held, cannot allocate or call third-party code
   // below.
@@ -1714,7 +2189,20 @@ void PartitionRoot::DumpStats(const char* partition_name,
     stats.cumulative_brp_quarantined_count =
         cumulative_count_of_brp_quarantined_slots.load(
             std::memory_order_relaxed);
+    stats.total_brp_quarantine_pinned_bytes =
+        total_size_of_brp_quarantine_pinned_pages.load(
+            std::memory_order_relaxed);
+    stats.cumulative_brp_quarantine_discarded_bytes =
+        cumulative_size_of_brp_quarantine_discarded_pages.load(
+            std::memory_order_relaxed);
+    stats.brp_quarantine_over_capacity_count =
+        brp_quarantine_over_capacity_count.load(std::memory_order_relaxed);
+    stats.total_brp_quarantine_decommitted_bytes =
+        total_size_of_brp_quarantine_decommitted_pages.load(
+            std::memory_order_relaxed);
 #endif
+    stats.total_direct_map_cached_bytes = direct_map_cache_committed_bytes;
+    stats.direct_map_cache_hit_count = direct_map_cache_hit_count;
 
     size_t direct_mapped_allocations_total_size = 0;
     for (size_t i = 0; i < internal::kNumBuckets; ++i) {
@@ -1756,9 +2244,9 @@ void PartitionRoot::DumpStats(const char* partition_name,
     stats.has_thread_cache = settings.with_thread_cache;
     if (stats.has_thread_cache) {
       ThreadCacheRegistry::Instance().DumpStats(
-          true, &stats.current_thread_cache_stats);
-      ThreadCacheRegistry::Instance().DumpStats(false,
-                                                &stats.all_thread_caches_stats);
+          true, &stats.current_thread_cache_stats, this);
+      ThreadCacheRegistry::Instance().DumpStats(
+          false, &stats.all_thread_caches_stats, this);
     }
 
     stats.has_scheduler_loop_quarantine = settings.scheduler_loop_quarantine;
@@ -1799,7 +2287,10 @@ void PartitionRoot::DumpStats(const char* partition_name,
 
 // static
 void PartitionRoot::DeleteForTesting(PartitionRoot* partition_root) {
-  if (partition_root->settings.with_thread_cache) {
+  if (partition_root->settings.thread_cache_index) {
+    ThreadCache::RemoveSecondaryForTesting(partition_root);
+    partition_root->settings.with_thread_cache = false;
+  } else if (partition_root->settings.with_thread_cache) {
     ThreadCache::SwapForTesting(nullptr);
     partition_root->settings.with_thread_cache = false;
   }
@@ -1814,7 +2305,16 @@ void PartitionRoot::DeleteForTesting(PartitionRoot* partition_root) {
 }
 
 void PartitionRoot::ResetForTesting(bool allow_leaks) {
-  if (settings.with_thread_cache) {
+  // Frees the slots queued for the asynchronous drain while the partition is
+  // still there.
+  scheduler_loop_quarantine_root.DisableAsyncDrain();
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+  ReclaimBiasedSlotsFreedElsewhereIfOwner();
+#endif
+  if (settings.thread_cache_index) {
+    ThreadCache::RemoveSecondaryForTesting(this);
+    settings.with_thread_cache = false;
+  } else if (settings.with_thread_cache) {
     ThreadCache::SwapForTesting(nullptr);
     settings.with_thread_cache = false;
   }
@@ -1896,7 +2396,7 @@ void PartitionRoot::SetGlobalEmptySlotSpanRingIndexForTesting(int16_t index) {
 }
 
 ThreadCache* PartitionRoot::MaybeInitThreadCache() {
-  auto* tcache = ThreadCache::Get();
+  auto* tcache = ThreadCache::Get(settings.thread_cache_index);
   // See comment in `EnableThreadCacheIfSupport()` for why this is an acquire
   // load.
   if (ThreadCache::IsTombstone(tcache) ||
@@ -1955,15 +2455,120 @@ PA_NOINLINE void PartitionRoot::QuarantineForBrp(
     internal::SlotSpanMetadata<internal::MetadataKind::kReadOnly>* slot_span,
     void* object) {
   auto usable_size = GetSlotUsableSize(slot_span);
+  const uintptr_t object_addr = internal::ObjectPtr2Addr(object);
+  const size_t pinned_size =
+      internal::BrpQuarantinePinnedPagesSize(object_addr, usable_size);
+  const bool decommit =
+      pinned_size && DecommitsBrpQuarantinedPages(usable_size);
   auto hook = PartitionAllocHooks::GetQuarantineOverrideHook();
   if (hook) [[unlikely]] {
     hook(object, usable_size);
+  } else if (decommit) {
+    // No need to zap the pages about to be decommitted: they become
+    // inaccessible, and read back as zeroes once recommitted.
+    const uintptr_t pinned_start = RoundUpToSystemPage(object_addr);
+    const size_t head_size = pinned_start - object_addr;
+    internal::SecureMemset(object, internal::kQuarantinedByte, head_size);
+    internal::SecureMemset(
+        static_cast<unsigned char*>(object) + head_size + pinned_size,
+        internal::kQuarantinedByte, usable_size - head_size - pinned_size);
   } else {
     internal::SecureMemset(object, internal::kQuarantinedByte, usable_size);
   }
+
+  if (decommit) [[unlikely]] {
+    ::partition_alloc::internal::ScopedGuard guard{
+        internal::PartitionRootLock(this)};
+    DecommitSystemPagesForData(RoundUpToSystemPage(object_addr), pinned_size,
+                               PageAccessibilityDisposition::kRequireUpdate);
+    total_size_of_brp_quarantine_decommitted_pages.fetch_add(
+        pinned_size, std::memory_order_relaxed);
+  }
+
+  // The slot isn't accounted for yet, and may still be reclaimed right away if
+  // the last raw_ptr<T> goes away in the meantime. It's still held by the
+  // allocator though, so its pages can't be in use elsewhere.
+  if (!brp_quarantine_capacity_in_bytes) [[likely]] {
+    return;
+  }
+  const size_t quarantined_bytes =
+      total_size_of_brp_quarantined_bytes.load(std::memory_order_relaxed) +
+      slot_span->GetSlotSizeForBookkeeping();
+  if (quarantined_bytes <= brp_quarantine_capacity_in_bytes) {
+    return;
+  }
+  brp_quarantine_over_capacity_count.fetch_add(1, std::memory_order_relaxed);
+  if (brp_quarantine_discard_over_capacity && pinned_size && !decommit) {
+    internal::ScopedSyscallTimer timer{this};
+    DiscardSystemPages(RoundUpToSystemPage(object_addr), pinned_size);
+    cumulative_size_of_brp_quarantine_discarded_pages.fetch_add(
+        pinned_size, std::memory_order_relaxed);
+  }
+  if (auto* over_capacity_hook =
+          PartitionAllocHooks::GetBrpQuarantineOverCapacityHook()) {
+    over_capacity_hook(this, quarantined_bytes,
+                       brp_quarantine_capacity_in_bytes);
+  }
+}
+
+PA_NOINLINE void PartitionRoot::RecommitBrpQuarantinedPages(
+    ReadOnlySlotSpanMetadata* slot_span,
+    uintptr_t slot_start) {
+  const uintptr_t object_addr = SlotStartToObjectAddr(slot_start);
+  const size_t pinned_size = internal::BrpQuarantinePinnedPagesSize(
+      object_addr, GetSlotUsableSize(slot_span));
+  if (!pinned_size) {
+    return;
+  }
+  {
+    ::partition_alloc::internal::ScopedGuard guard{
+        internal::PartitionRootLock(this)};
+    RecommitSystemPagesForData(
+        RoundUpToSystemPage(object_addr), pinned_size,
+        PageAccessibilityDisposition::kRequireUpdate,
+        slot_span->bucket->slot_size <= internal::kMaxMemoryTaggingSize);
+  }
+  total_size_of_brp_quarantine_decommitted_pages.fetch_sub(
+      pinned_size, std::memory_order_relaxed);
 }
 #endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
 
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+PA_NOINLINE void PartitionRoot::QueueBiasedSlotFreedElsewhere(
+    uintptr_t slot_start) {
+  ::partition_alloc::internal::ScopedGuard guard{
+      internal::PartitionRootLock(this)};
+  biased_slots_freed_elsewhere_.push_back(slot_start);
+  has_biased_slots_freed_elsewhere_.store(true, std::memory_order_relaxed);
+}
+
+PA_NOINLINE void PartitionRoot::ReclaimBiasedSlotsFreedElsewhere() {
+  decltype(biased_slots_freed_elsewhere_) slots;
+  {
+    ::partition_alloc::internal::ScopedGuard guard{
+        internal::PartitionRootLock(this)};
+    slots.swap(biased_slots_freed_elsewhere_);
+    has_biased_slots_freed_elsewhere_.store(false, std::memory_order_relaxed);
+  }
+
+  for (uintptr_t slot_start : slots) {
+    auto* slot_span = ReadOnlySlotSpanMetadata::FromSlotStart(slot_start);
+    auto* ref_count = InSlotMetadataPointerFromSlotStartAndSize(
+        slot_start, slot_span->bucket->slot_size);
+    if (ref_count->ReleaseFromOwnerAfterFreeElsewhere()) {
+      internal::PartitionAllocFreeForRefCounting(slot_start);
+    }
+  }
+}
+
+void PartitionRoot::ReclaimBiasedSlotsFreedElsewhereIfOwner() {
+  if (internal::IsBiasedCountOwner(settings.biased_count_owner_tag_) &&
+      has_biased_slots_freed_elsewhere_.load(std::memory_order_relaxed)) {
+    ReclaimBiasedSlotsFreedElsewhere();
+  }
+}
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+
 // static
 #if PA_CONFIG(ENABLE_SHADOW_METADATA)
 void PartitionRoot::EnableShadowMetadata(internal::PoolHandleMask mask) {
@@ -37,13 +37,16 @@
 #include <limits>
 #include <optional>
 #include <utility>
+#include <vector>
 
 #include "partition_alloc/address_pool_manager_types.h"
 #include "partition_alloc/allocation_guard.h"
+#include "partition_alloc/allocation_profile.h"
 #include "partition_alloc/build_config.h"
 #include "partition_alloc/buildflags.h"
 #include "partition_alloc/freeslot_bitmap.h"
 #include "partition_alloc/in_slot_metadata.h"
+#include "partition_alloc/internal_allocator_forward.h"
 #include "partition_alloc/lightweight_quarantine.h"
 #include "partition_alloc/page_allocator.h"
 #include "partition_alloc/partition_address_space.h"
@@ -166,14 +169,72 @@ struct PartitionOptions {
   static constexpr auto kEnabled = EnableToggle::kEnabled;
 
   EnableToggle thread_cache = kDisabled;
+  // Gives the partition a thread cache of its own, next to the one of the
+  // partition with `thread_cache`, typically malloc()'s, which keeps a TLS slot
+  // of its own. Secondary thread caches are found in a small per-thread table
+  // instead, at the cost of one more load. Up to
+  // `internal::kMaxSecondaryThreadCaches` partitions can have one, and they
+  // must outlive the threads allocating from them.
+  EnableToggle secondary_thread_cache = kDisabled;
   EnableToggle backup_ref_ptr = kDisabled;
   AllowToggle use_configurable_pool = kDisallowed;
 
   // TODO(https://crbug.com/371135823): Remove after the investigation.
   size_t backup_ref_ptr_extra_extras_size = 0;
 
+  // Threshold on the memory that BackupRefPtr keeps quarantined, that is freed
+  // slots still pointed to by raw_ptr<T>. 0 means none. It is not enforced:
+  // slots stay quarantined as long as they are pointed to, but every slot
+  // quarantined while over the threshold is reported to the hook set with
+  // PartitionAllocHooks::SetBrpQuarantineOverCapacityHook(), and handled as
+  // per `backup_ref_ptr_quarantine_policy`.
+  size_t backup_ref_ptr_quarantine_capacity_in_bytes = 0;
+  enum class BackupRefPtrQuarantinePolicy : uint8_t {
+    kReport,
+    // Also discard the system pages lying entirely within such slots, after
+    // zapping them. They read back as zeroes or as the zapping pattern, and no
+    // longer count towards the resident set size.
+    kReportAndDiscard,
+  };
+  BackupRefPtrQuarantinePolicy backup_ref_ptr_quarantine_policy =
+      BackupRefPtrQuarantinePolicy::kReport;
+  // The system pages lying entirely within slots quarantined by BackupRefPtr
+  // are decommitted, instead of zapped, if their usable size is at least this
+  // many bytes. Dangling pointers into them fault, and the slots cost almost
+  // nothing until the last raw_ptr<T> goes away and they're recommitted. 0
+  // disables it.
+  size_t backup_ref_ptr_quarantine_decommit_threshold_in_bytes = 0;
+
+  // Freed direct maps are kept committed, up to this many bytes in total, and
+  // handed out again to the next direct map of the same reservation size,
+  // skipping the system calls needed to unmap and remap them. They are released
+  // after a short while (on the next direct map free or PurgeMemory() call), or
+  // when empty slot spans are decommitted. 0 disables it. Only supported with
+  // 64-bit pointers, and without shadow metadata.
+  size_t direct_map_cache_capacity_in_bytes = 0;
+
+  // Slot spans of buckets with slots of at most this many bytes are pre-faulted
+  // when they're committed, rather than on first access, from the allocating
+  // thread. For latency-sensitive processes which would rather take the page
+  // faults all at once, e.g. at startup, see
+  // `PartitionRoot::ProvisionSlotSpans()`. 0 disables it. Only effective where
+  // PrefaultSystemPages() is supported.
+  size_t prefault_max_slot_size = 0;
+
+  // If set, the partition is initialized to resume from this profile, as taken
+  // by `PartitionRoot::ExportAllocationProfile()`: the empty slot span ring is
+  // as large, the thread cache (if this partition owns it) caches the sizes
+  // that were in heavy use, and enough slot spans are provisioned to reach the
+  // peak usage of each bucket, within `PartitionRoot::kMaxProvisionedBytes*`.
+  // Inconsistent entries are ignored. Only read during initialization.
+  const AllocationProfile* allocation_profile = nullptr;
+
   EnableToggle scheduler_loop_quarantine = kDisabled;
   size_t scheduler_loop_quarantine_branch_capacity_in_bytes = 0;
+  // Splits the capacity of each scheduler-loop quarantine branch between size
+  // classes, so that large objects only evict other large objects, see
+  // `internal::LightweightQuarantineBranchConfig::segregate_by_size`.
+  EnableToggle scheduler_loop_quarantine_segregate_by_size = kDisabled;
 
   EnableToggle zapping_by_free_flags = kDisabled;
   // As the name implies, this is not a security measure, as there is no
@@ -196,6 +257,27 @@ struct PartitionOptions {
 
   EnableToggle use_pool_offset_freelists = kDisabled;
   EnableToggle use_small_single_slot_spans = kDisabled;
+  // When a bucket runs out of free slots in its current slot span, prefer the
+  // fullest candidate span (then the lowest address) rather than the next one
+  // in list order, and keep active spans and their freelists sorted when
+  // purging. This packs long-lived allocations into fewer slot spans, so that
+  // the other ones can become empty and be decommitted, at the cost of a short
+  // bounded walk of the active list on the slow path.
+  EnableToggle prefer_fuller_slot_spans = kDisabled;
+  // Promise that the partition is used by the thread creating it only, which
+  // lets BackupRefPtr count that thread's references without atomics. Other
+  // threads may still hold raw_ptr<T> to its allocations, at a slightly higher
+  // cost, and may free them: such slots are handed over to the owner thread,
+  // and reclaimed on its next allocation in the partition, or when it purges or
+  // destroys the partition. Has no effect unless built with
+  // `enable_backup_ref_ptr_biased_count`.
+  EnableToggle thread_confined = kDisabled;
+  // Diverts a sample of the allocations served by the thread cache to
+  // GWP-ASan, see `GwpAsanSupport::SetSampler()`. Only for partitions whose
+  // frees, reallocs and size queries all go through the embedder's allocator
+  // shim, i.e. malloc()'s. Has no effect unless built with
+  // `enable_gwp_asan_support`.
+  EnableToggle gwp_asan_sampling = kDisabled;
 };
 
 constexpr PartitionOptions::PartitionOptions() = default;
@@ -247,6 +329,9 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
     BucketDistribution bucket_distribution = BucketDistribution::kNeutral;
 
     bool with_thread_cache = false;
+    // 0 for the primary thread cache, otherwise the index of the secondary
+    // one. See PartitionOptions::secondary_thread_cache.
+    uint8_t thread_cache_index = 0;
 
 #if PA_BUILDFLAG(USE_PARTITION_COOKIE)
     static constexpr bool use_cookie = true;
@@ -260,12 +345,19 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
     size_t mac11_malloc_size_hack_usable_size_ = 0;
 #endif  // PA_CONFIG(MAYBE_ENABLE_MAC11_MALLOC_SIZE_HACK)
     size_t in_slot_metadata_size = 0;
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+    // Tag of the owner thread of a thread-confined partition, 0 otherwise.
+    uint16_t biased_count_owner_tag_ = 0;
+#endif
 #endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
     bool use_configurable_pool = false;
     bool zapping_by_free_flags = false;
     bool eventually_zero_freed_memory = false;
     bool scheduler_loop_quarantine = false;
     bool fewer_memory_regions = false;
+#if PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+    bool gwp_asan_sampling = false;
+#endif
 #if PA_BUILDFLAG(HAS_MEMORY_TAGGING)
     bool memory_tagging_enabled_ = false;
     bool use_random_memory_tagging_ = false;
@@ -277,6 +369,7 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
 #endif
 
     bool use_pool_offset_freelists = false;
+    bool prefer_fuller_slot_spans = false;
 
 #if PA_CONFIG(EXTRAS_REQUIRED)
     uint32_t extras_size = 0;
@@ -331,11 +424,32 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
   // Atomic, because system calls can be made without the lock held.
   std::atomic<uint64_t> syscall_count{};
   std::atomic<uint64_t> syscall_total_time_ns{};
+  // Commits made with the lock held, which every other thread allocating from
+  // this root has to wait for.
+  std::atomic<uint64_t> commit_under_lock_count{};
+  std::atomic<uint64_t> commit_under_lock_time_ns{};
 #if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
   std::atomic<size_t> total_size_of_brp_quarantined_bytes{0};
   std::atomic<size_t> total_count_of_brp_quarantined_slots{0};
   std::atomic<size_t> cumulative_size_of_brp_quarantined_bytes{0};
   std::atomic<size_t> cumulative_count_of_brp_quarantined_slots{0};
+  // System pages lying entirely within BRP-quarantined slots, which nothing
+  // but quarantined data keeps around.
+  std::atomic<size_t> total_size_of_brp_quarantine_pinned_pages{0};
+  std::atomic<size_t> cumulative_size_of_brp_quarantine_discarded_pages{0};
+  std::atomic<size_t> brp_quarantine_over_capacity_count{0};
+  std::atomic<size_t> total_size_of_brp_quarantine_decommitted_pages{0};
+  size_t brp_quarantine_capacity_in_bytes = 0;
+  size_t brp_quarantine_decommit_threshold = 0;
+  bool brp_quarantine_discard_over_capacity = false;
+#endif
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+  // Biased slots freed by threads other than their owner. Kept out of the
+  // slots, which stay zapped. See ReclaimBiasedSlotsFreedElsewhere().
+  std::vector<uintptr_t, internal::InternalAllocator<uintptr_t>>
+      biased_slots_freed_elsewhere_
+          PA_GUARDED_BY(internal::PartitionRootLock(this));
+  std::atomic<bool> has_biased_slots_freed_elsewhere_{false};
 #endif
   // Slot span memory which has been provisioned, and is currently unused as
   // it's part of an empty SlotSpan. This is not clean memory, since it has
@@ -344,6 +458,13 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
   // can be decommitted at any time.
   size_t empty_slot_spans_dirty_bytes
       PA_GUARDED_BY(internal::PartitionRootLock(this)) = 0;
+  // Same, for the empty slot spans provisioned ahead of use, which are not in
+  // the empty slot span ring. See ProvisionSlotSpans().
+  size_t provisioned_slot_spans_dirty_bytes
+      PA_GUARDED_BY(internal::PartitionRootLock(this)) = 0;
+  // Set while ProvisionSlotSpans() frees the slots it provisioned.
+  bool provisioning_slot_spans PA_GUARDED_BY(internal::PartitionRootLock(this)) =
+      false;
 
   // Only tolerate up to |total_size_of_committed_pages >>
   // max_empty_slot_spans_dirty_bytes_shift| dirty bytes in empty slot
@@ -360,6 +481,27 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
   ReadOnlySuperPageExtentEntry* first_extent = nullptr;
   ReadOnlyDirectMapExtent* direct_map_list
       PA_GUARDED_BY(internal::PartitionRootLock(this)) = nullptr;
+  // Reservations of freed direct maps, oldest first, whose first
+  // `committed_size` bytes of slot are still committed. See
+  // `PartitionOptions::direct_map_cache_capacity_in_bytes`. They remain
+  // accounted as committed and direct-mapped pages.
+  struct DirectMapCacheEntry {
+    uintptr_t reservation_start;
+    size_t reservation_size;
+    size_t committed_size;
+    internal::base::TimeTicks freed_time;
+  };
+  DirectMapCacheEntry direct_map_cache[internal::kMaxDirectMapCacheEntries]
+      PA_GUARDED_BY(internal::PartitionRootLock(this)) = {};
+  size_t direct_map_cache_count
+      PA_GUARDED_BY(internal::PartitionRootLock(this)) = 0;
+  size_t direct_map_cache_committed_bytes
+      PA_GUARDED_BY(internal::PartitionRootLock(this)) = 0;
+  size_t direct_map_cache_hit_count
+      PA_GUARDED_BY(internal::PartitionRootLock(this)) = 0;
+  size_t direct_map_cache_capacity_in_bytes = 0;
+  // See `PartitionOptions::prefault_max_slot_size`.
+  size_t prefault_max_slot_size = 0;
   ReadOnlySlotSpanMetadata* global_empty_slot_span_ring
       [internal::kMaxEmptySlotSpanRingSize] PA_GUARDED_BY(
           internal::PartitionRootLock(this)) = {};
@@ -379,6 +521,7 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
   std::atomic<int> thread_caches_being_constructed_{0};
 
   size_t scheduler_loop_quarantine_branch_capacity_in_bytes = 0;
+  bool scheduler_loop_quarantine_segregate_by_size = false;
   internal::LightweightQuarantineRoot scheduler_loop_quarantine_root;
   // NoDestructor because we don't need to dequarantine objects as the root
   // associated with it is dying anyway.
@@ -388,6 +531,9 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
 
   static constexpr internal::base::TimeDelta kMaxPurgeDuration =
       internal::base::Milliseconds(2);
+  // How long freed direct maps may stay in `direct_map_cache`.
+  static constexpr internal::base::TimeDelta kDirectMapCacheTimeToLive =
+      internal::base::Seconds(1);
   // Not overriding the global one to only change it for this partition.
   internal::base::TimeTicks (*now_maybe_overridden_for_testing)() =
       internal::base::TimeTicks::Now;
@@ -414,6 +560,41 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
 
   void DecommitEmptySlotSpansForTesting();
 
+  // Direct map cache, see `PartitionOptions::direct_map_cache_capacity_in_bytes`.
+  //
+  // Takes the most recently freed direct map with a reservation of
+  // `reservation_size` bytes out of the cache, and returns its start, or 0 if
+  // there is none. `committed_size` is set to how much of its slot is still
+  // committed.
+  uintptr_t TakeCachedDirectMap(size_t reservation_size, size_t* committed_size)
+      PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
+  // Whether a freed direct map with `committed_size` bytes of slot committed
+  // can be cached.
+  PA_ALWAYS_INLINE bool CanCacheDirectMap(size_t committed_size) const {
+    return committed_size <= direct_map_cache_capacity_in_bytes;
+  }
+  // Puts a freed direct map in the cache. Its reservation offset table entries
+  // must have been reset already. Expired entries, and the oldest ones as
+  // needed to make room, are moved to `evicted`, and their number is returned.
+  // The caller releases them with ReleaseCachedDirectMaps(), preferably
+  // without holding the lock.
+  size_t CacheDirectMap(uintptr_t reservation_start,
+                        size_t reservation_size,
+                        size_t committed_size,
+                        DirectMapCacheEntry* evicted)
+      PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
+  void ReleaseCachedDirectMaps(const DirectMapCacheEntry* entries,
+                               size_t count);
+  // Moves all the cached direct maps, or only the expired ones if
+  // `expired_only`, to `evicted`, and returns their number. As above, the
+  // caller releases them without holding the lock.
+  size_t EvictCachedDirectMaps(bool expired_only, DirectMapCacheEntry* evicted)
+      PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
+  // Empties the cache, releasing the memory with the lock held. Only for when
+  // the lock cannot be dropped, e.g. to retry a failed commit.
+  void ReleaseDirectMapCache()
+      PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
+
 #if PA_CONFIG(MAYBE_ENABLE_MAC11_MALLOC_SIZE_HACK)
   void EnableMac11MallocSizeHackIfNeeded();
   void EnableMac11MallocSizeHackForTesting();
@@ -469,6 +650,16 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
       PageAccessibilityDisposition accessibility_disposition,
       bool request_tagging)
       PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
+  // Pre-faults the committed pages of a slot span with slots of `slot_size`
+  // bytes, if `PartitionOptions::prefault_max_slot_size` asks for it. Better
+  // called without the lock, as it takes a while.
+  PA_ALWAYS_INLINE bool ShouldPrefaultSystemPagesForData(
+      size_t slot_size) const {
+    return slot_size <= prefault_max_slot_size;
+  }
+  PA_ALWAYS_INLINE void MaybePrefaultSystemPagesForData(uintptr_t address,
+                                                        size_t length,
+                                                        size_t slot_size);
 
   template <bool already_locked>
   PA_ALWAYS_INLINE bool TryRecommitSystemPagesForDataInternal(
@@ -536,6 +727,18 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
                                 type_name);
   }
 
+  // Same as |AllocInline()|, for callers which have already resolved
+  // |requested_size| to a bucket, typically once per type (see
+  // PartitionObjectPool). |bucket_index| must have been computed with
+  // SizeToBucketIndex() from AdjustSizeForExtrasAdd(|requested_size|). It may
+  // have been computed for another bucket distribution than the current one,
+  // as any non-direct-mapped bucket large enough for the request is fine.
+  template <AllocFlags flags = AllocFlags::kNone>
+  PA_ALWAYS_INLINE PA_MALLOC_FN void* AllocWithBucketIndexInline(
+      uint16_t bucket_index,
+      size_t requested_size,
+      const char* type_name = nullptr);
+
   // AllocInternal exposed for testing.
   template <AllocFlags flags = AllocFlags::kNone>
   PA_NOINLINE PA_MALLOC_FN void* AllocInternalForTesting(
@@ -576,6 +779,12 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
       void* object,
       ReadOnlySlotSpanMetadata* slot_span,
       uintptr_t slot_start);
+  // Same as FreeNoHooksImmediate() for |count| slots of this root, given by
+  // their start. |slot_starts| must be sorted by address, so that the slots of
+  // a slot span which do not fit in the thread cache are returned to it with a
+  // single lock acquisition.
+  PA_ALWAYS_INLINE void FreeNoHooksImmediateBatch(const uintptr_t* slot_starts,
+                                                  size_t count);
 
   PA_ALWAYS_INLINE size_t
   GetSlotUsableSize(const ReadOnlySlotSpanMetadata* slot_span) {
@@ -621,6 +830,44 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
   // |limit|.
   void ShrinkEmptySlotSpansRing(size_t limit)
       PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
+
+  // Carves, commits and provisions `slot_spans_per_bucket` slot spans' worth of
+  // slots in each bucket with slots of at most `max_slot_size` bytes, so that
+  // the first allocations from them don't need new super pages, and don't take
+  // page faults. Meant to be called once at startup.
+  //
+  // The slot spans are left empty, but are not put in the empty slot span ring,
+  // so that they stay committed until they are used, however small the ring.
+  // Only PurgeMemory() with `PurgeFlags::kDecommitEmptySlotSpans` decommits
+  // them before that. They don't need new super pages afterwards.
+  void ProvisionSlotSpans(size_t max_slot_size, size_t slot_spans_per_bucket)
+      PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
+
+  // Number of allocations of `size` bytes expected soon, see Warmup().
+  struct WarmupEntry {
+    size_t size;
+    size_t count;
+  };
+  // Most memory provisioned ahead of use by Warmup() and allocation profiles,
+  // per bucket and in total. Their counts may be stale, or plain wrong.
+  static constexpr size_t kMaxProvisionedBytesPerBucket = 8 * (1 << 20);
+  static constexpr size_t kMaxProvisionedBytes = 64 * (1 << 20);
+  // Prepares for the allocations described by the `profile_size` entries of
+  // `profile`, typically right after startup, when all of them would otherwise
+  // take the slow path: provisions enough slot spans for each of them, as
+  // ProvisionSlotSpans() does, within the limits above. If `fill_thread_cache`
+  // is true, also fills the calling thread's cache for the sizes it serves, as
+  // the first allocation of each would. Sizes that aren't bucketed are ignored.
+  void Warmup(const WarmupEntry* profile,
+              size_t profile_size,
+              bool fill_thread_cache)
+      PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
+
+  // Summarizes how this partition's buckets are used, for a later instance of
+  // the process to start from, see `PartitionOptions::allocation_profile`.
+  void ExportAllocationProfile(AllocationProfile* profile)
+      PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
+
   // The empty slot span ring starts "small", can be enlarged later. This
   // improves performance by performing fewer system calls, at the cost of more
   // memory usage.
@@ -668,6 +915,19 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
       void* object,
       ReadOnlySlotSpanMetadata* slot_span);
 
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
+  // Whether QuarantineForBrp() decommits the system pages lying entirely within
+  // slots of `usable_size`. RecommitBrpQuarantinedPages() must be called on
+  // such slots before freeing them.
+  PA_ALWAYS_INLINE bool DecommitsBrpQuarantinedPages(size_t usable_size) const {
+    return brp_quarantine_decommit_threshold &&
+           usable_size >= brp_quarantine_decommit_threshold;
+  }
+  PA_NOINLINE void RecommitBrpQuarantinedPages(
+      ReadOnlySlotSpanMetadata* slot_span,
+      uintptr_t slot_start) PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
+
 #if PA_BUILDFLAG(HAS_MEMORY_TAGGING)
   // Sets a new MTE tag on the slot. This must not be called when an object
   // enters BRP quarantine because it might cause a race with |raw_ptr|'s
@@ -692,7 +952,9 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
   }
 
   ThreadCache* thread_cache_for_testing() const {
-    return settings.with_thread_cache ? ThreadCache::Get() : nullptr;
+    return settings.with_thread_cache
+               ? ThreadCache::Get(settings.thread_cache_index)
+               : nullptr;
   }
   size_t get_total_size_of_committed_pages() const {
     return total_size_of_committed_pages.load(std::memory_order_relaxed);
@@ -903,6 +1165,20 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
         capacity_in_bytes);
   }
 
+  // Hands the scheduler-loop quarantine overflow to a background thread, see
+  // `LightweightQuarantineRoot::EnableAsyncDrain()`. That thread must call
+  // `DrainSchedulerLoopQuarantine()` once `request_drain` has been invoked.
+  void EnableSchedulerLoopQuarantineAsyncDrain(
+      internal::LightweightQuarantineRoot::DrainRequestCallback request_drain) {
+    scheduler_loop_quarantine_root.EnableAsyncDrain(request_drain);
+  }
+  void DisableSchedulerLoopQuarantineAsyncDrain() {
+    scheduler_loop_quarantine_root.DisableAsyncDrain();
+  }
+  size_t DrainSchedulerLoopQuarantine() {
+    return scheduler_loop_quarantine_root.DrainPendingFrees();
+  }
+
   const internal::PartitionFreelistDispatcher* get_freelist_dispatcher() {
 #if PA_BUILDFLAG(USE_FREELIST_DISPATCHER)
     if (settings.use_pool_offset_freelists) {
@@ -993,6 +1269,14 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
   PA_ALWAYS_INLINE PA_MALLOC_FN void* AllocInternalNoHooks(
       size_t requested_size,
       size_t slot_span_alignment);
+  // Same as |AllocInternalNoHooks()|, once |raw_size| and |bucket_index| are
+  // known.
+  template <AllocFlags flags = AllocFlags::kNone>
+  PA_ALWAYS_INLINE PA_MALLOC_FN void* AllocInternalNoHooksWithBucketIndex(
+      uint16_t bucket_index,
+      size_t requested_size,
+      size_t raw_size,
+      size_t slot_span_alignment);
   // Allocates a memory slot, without initializing extras.
   //
   // - |flags| are as in Alloc().
@@ -1008,6 +1292,14 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
                                       size_t* usable_size,
                                       size_t* slot_size,
                                       bool* is_already_zeroed);
+  // Allocates up to |max_count| slots from |bucket| at once, when its active
+  // slot span needs to provision more slots. Returns the number of slots
+  // written to |slots|, 0 when the regular path has to be used instead. See
+  // PartitionBucket::ProvisionSlotsInBulk().
+  PA_ALWAYS_INLINE size_t AllocProvisionedSlotsFromBucket(Bucket* bucket,
+                                                          uintptr_t* slots,
+                                                          size_t max_count)
+      PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
   template <AllocFlags flags>
   PA_ALWAYS_INLINE uintptr_t AllocFromBucket(Bucket* bucket,
                                              size_t raw_size,
@@ -1039,8 +1331,27 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
       PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
   void DecommitEmptySlotSpans()
       PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
+  // Provisions up to `slot_spans` slot spans' worth of slots in `bucket`, see
+  // ProvisionSlotSpans(). The lock is taken for one slot span at a time.
+  // Returns the number of bytes provisioned.
+  size_t ProvisionSlotSpansInBucket(Bucket* bucket, size_t slot_spans)
+      PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
+  // Same, for the slot spans needed by `bytes` bytes worth of slots, within
+  // `*budget`, which is decreased accordingly, and at most
+  // `kMaxProvisionedBytesPerBucket`.
+  void ProvisionBytesInBucket(Bucket* bucket, uint64_t bytes, size_t* budget)
+      PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
+  // See `PartitionOptions::allocation_profile`.
+  void ApplyAllocationProfile(const AllocationProfile& profile,
+                              bool owns_thread_cache)
+      PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
   PA_ALWAYS_INLINE void RawFreeLocked(uintptr_t slot_start)
       PA_EXCLUSIVE_LOCKS_REQUIRED(internal::PartitionRootLock(this));
+  // Checks the cookie and in-slot metadata of a slot about to be freed. Returns
+  // false if the slot is still referenced, and must not be freed yet.
+  PA_ALWAYS_INLINE bool PrepareSlotForFree(void* object,
+                                           ReadOnlySlotSpanMetadata* slot_span,
+                                           uintptr_t slot_start);
   ThreadCache* MaybeInitThreadCache();
 
   // May return an invalid thread cache.
@@ -1065,6 +1376,20 @@ struct alignas(64) PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionRoot {
   PA_NOINLINE void QuarantineForBrp(ReadOnlySlotSpanMetadata* slot_span,
                                     void* object);
 #endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+  // Hands a quarantined slot released by a thread other than its owner over to
+  // the owner, the only thread able to fold its counts.
+  PA_NOINLINE void QueueBiasedSlotFreedElsewhere(uintptr_t slot_start)
+      PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
+  // Called on the owner thread. Folds the counts of the slots handed over by
+  // QueueBiasedSlotFreedElsewhere(), and frees those no longer referenced.
+  PA_NOINLINE void ReclaimBiasedSlotsFreedElsewhere()
+      PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
+  // Same, for purging and teardown: does nothing unless called on the owner
+  // thread.
+  void ReclaimBiasedSlotsFreedElsewhereIfOwner()
+      PA_LOCKS_EXCLUDED(internal::PartitionRootLock(this));
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
 
 #if PA_CONFIG(USE_PARTITION_ROOT_ENUMERATOR)
   static internal::Lock& GetEnumeratorLock();
@@ -1111,6 +1436,29 @@ class ScopedSyscallTimer {
 #endif
 };
 
+// Unlike ScopedSyscallTimer, always measures time: commits are only made on
+// slow paths, and this tracks how long they stall other threads.
+class ScopedCommitUnderLockTimer {
+ public:
+  explicit ScopedCommitUnderLockTimer(PartitionRoot* root)
+      : root_(root), tick_(base::TimeTicks::Now()) {
+    PartitionRootLock(root_).AssertAcquired();
+  }
+
+  ~ScopedCommitUnderLockTimer() {
+    root_->commit_under_lock_count.fetch_add(1, std::memory_order_relaxed);
+    int64_t elapsed_nanos = (base::TimeTicks::Now() - tick_).InNanoseconds();
+    if (elapsed_nanos > 0) {
+      root_->commit_under_lock_time_ns.fetch_add(
+          static_cast<uint64_t>(elapsed_nanos), std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  PartitionRoot* root_;
+  const base::TimeTicks tick_;
+};
+
 #if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
 
 struct SlotAddressAndSize {
@@ -1233,6 +1581,15 @@ PtrPosWithinAlloc IsPtrWithinSameAlloc(uintptr_t orig_address,
                                        uintptr_t test_address,
                                        size_t type_size);
 
+// Size of the system pages lying entirely within the object of a
+// BRP-quarantined slot, which nothing but quarantined data keeps around.
+PA_ALWAYS_INLINE size_t BrpQuarantinePinnedPagesSize(uintptr_t object_addr,
+                                                     size_t usable_size) {
+  const uintptr_t begin = RoundUpToSystemPage(object_addr);
+  const uintptr_t end = RoundDownToSystemPage(object_addr + usable_size);
+  return begin < end ? end - begin : 0;
+}
+
 PA_ALWAYS_INLINE void PartitionAllocFreeForRefCounting(uintptr_t slot_start) {
   auto* slot_span =
       SlotSpanMetadata<MetadataKind::kReadOnly>::FromSlotStart(slot_start);
@@ -1243,6 +1600,11 @@ PA_ALWAYS_INLINE void PartitionAllocFreeForRefCounting(uintptr_t slot_start) {
                  slot_start, slot_span->bucket->slot_size)
                  ->IsAlive());
 
+  const size_t usable_size = root->GetSlotUsableSize(slot_span);
+  if (root->DecommitsBrpQuarantinedPages(usable_size)) [[unlikely]] {
+    root->RecommitBrpQuarantinedPages(slot_span, slot_start);
+  }
+
   // Iterating over the entire slot can be really expensive.
 #if PA_BUILDFLAG(EXPENSIVE_DCHECKS_ARE_ON)
   auto hook = PartitionAllocHooks::GetQuarantineOverrideHook();
@@ -1251,8 +1613,12 @@ PA_ALWAYS_INLINE void PartitionAllocFreeForRefCounting(uintptr_t slot_start) {
   if (!hook) [[likely]] {
     unsigned char* object =
         static_cast<unsigned char*>(root->SlotStartToObject(slot_start));
-    for (size_t i = 0; i < root->GetSlotUsableSize(slot_span); ++i) {
-      PA_DCHECK(object[i] == kQuarantinedByte);
+    for (size_t i = 0; i < usable_size; ++i) {
+      // Discarded or recommitted pages may read back as zeroes.
+      PA_DCHECK(object[i] == kQuarantinedByte ||
+                ((root->brp_quarantine_discard_over_capacity ||
+                  root->DecommitsBrpQuarantinedPages(usable_size)) &&
+                 !object[i]));
     }
   }
   DebugMemset(SlotStartAddr2Ptr(slot_start), kFreedByte,
@@ -1263,6 +1629,10 @@ PA_ALWAYS_INLINE void PartitionAllocFreeForRefCounting(uintptr_t slot_start) {
       slot_span->GetSlotSizeForBookkeeping(), std::memory_order_relaxed);
   root->total_count_of_brp_quarantined_slots.fetch_sub(
       1, std::memory_order_relaxed);
+  root->total_size_of_brp_quarantine_pinned_pages.fetch_sub(
+      BrpQuarantinePinnedPagesSize(root->SlotStartToObjectAddr(slot_start),
+                                   usable_size),
+      std::memory_order_relaxed);
 
   root->RawFreeWithThreadCache(slot_start, SlotStartAddr2Ptr(slot_start),
                                slot_span);
@@ -1347,6 +1717,26 @@ PartitionRoot::AllocFromBucket(Bucket* bucket,
   return slot_start;
 }
 
+PA_ALWAYS_INLINE size_t
+PartitionRoot::AllocProvisionedSlotsFromBucket(Bucket* bucket,
+                                               uintptr_t* slots,
+                                               size_t max_count) {
+  size_t count = bucket->ProvisionSlotsInBulk(this, slots, max_count);
+  if (count) {
+    // The slots all come from the same slot span.
+    PA_CHECK(DeducedRootIsValid(
+        ReadOnlySlotSpanMetadata::FromSlotStart(slots[0])));
+  }
+  for (size_t i = 0; i < count; i++) {
+    IncreaseTotalSizeOfAllocatedBytes(slots[i], bucket->slot_size,
+                                      bucket->slot_size);
+#if PA_BUILDFLAG(USE_FREESLOT_BITMAP)
+    internal::FreeSlotBitmapMarkSlotAsUsed(slots[i]);
+#endif
+  }
+  return count;
+}
+
 AllocationNotificationData PartitionRoot::CreateAllocationNotificationData(
     void* object,
     size_t size,
@@ -1580,6 +1970,100 @@ PA_ALWAYS_INLINE void PartitionRoot::FreeNoHooksImmediate(
   PA_CHECK(DeducedRootIsValid(slot_span));
   PA_DCHECK(slot_start);
 
+  if (!PrepareSlotForFree(object, slot_span, slot_start)) [[unlikely]] {
+    return;
+  }
+
+  // TODO(keishi): Create function to convert |object| to |slot_start_ptr|.
+  void* slot_start_ptr = object;
+  RawFreeWithThreadCache(slot_start, slot_start_ptr, slot_span);
+}
+
+PA_ALWAYS_INLINE void PartitionRoot::FreeNoHooksImmediateBatch(
+    const uintptr_t* slot_starts,
+    size_t count) {
+  const internal::PartitionFreelistDispatcher* freelist_dispatcher =
+      get_freelist_dispatcher();
+  ThreadCache* thread_cache = GetThreadCache();
+  const bool thread_cache_is_valid = ThreadCache::IsValid(thread_cache);
+
+  // Freelist of the slots of |batch_slot_span| that are not freed yet.
+  ReadOnlySlotSpanMetadata* batch_slot_span = nullptr;
+  FreeListEntry* head = nullptr;
+  FreeListEntry* tail = nullptr;
+  size_t batch_size = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    const uintptr_t slot_start = slot_starts[i];
+    PA_DCHECK(slot_start);
+    PA_DCHECK(i == 0 || slot_starts[i - 1] < slot_start);
+    auto* slot_span = ReadOnlySlotSpanMetadata::FromSlotStart(slot_start);
+    void* object = SlotStartToObject(slot_start);
+    PA_DCHECK(slot_span == ReadOnlySlotSpanMetadata::FromObject(object));
+    PA_CHECK(DeducedRootIsValid(slot_span));
+
+    if (!PrepareSlotForFree(object, slot_span, slot_start)) [[unlikely]] {
+      continue;
+    }
+
+    // Single-slot spans and direct maps gain nothing from batching, and need
+    // the regular path to update their raw size.
+    if (slot_span->CanStoreRawSize()) [[unlikely]] {
+      RawFreeWithThreadCache(slot_start, object, slot_span);
+      continue;
+    }
+
+#if PA_BUILDFLAG(HAS_MEMORY_TAGGING)
+    RetagSlotIfNeeded(object, slot_span->bucket->slot_size);
+#endif
+    if (thread_cache_is_valid) [[likely]] {
+      size_t bucket_index =
+          static_cast<size_t>(slot_span->bucket - this->buckets);
+      std::optional<size_t> slot_size =
+          thread_cache->MaybePutInCache(slot_start, bucket_index);
+      if (slot_size.has_value()) [[likely]] {
+        thread_cache->RecordDeallocation(
+            slot_start, AdjustSizeForExtrasSubtract(slot_size.value()));
+        continue;
+      }
+      thread_cache->RecordDeallocation(slot_start,
+                                       GetSlotUsableSize(slot_span));
+    }
+
+    if (slot_span != batch_slot_span) {
+      if (batch_size) {
+        RawFreeBatch(head, tail, batch_size, batch_slot_span);
+      }
+      batch_slot_span = slot_span;
+      head = nullptr;
+      batch_size = 0;
+    }
+    // Zeroing and writing the freelist entry fault the slot in, if needed,
+    // before the lock is taken. See RawFree().
+    void* ptr = internal::SlotStartAddr2Ptr(slot_start);
+    if (settings.eventually_zero_freed_memory &&
+        slot_span->bucket->get_slots_per_span() > 1) {
+      internal::SecureMemset(ptr, 0, GetSlotUsableSize(slot_span));
+    }
+    FreeListEntry* entry = freelist_dispatcher->EmplaceAndInitNull(ptr);
+    if (head) {
+      freelist_dispatcher->SetNext(tail, entry);
+    } else {
+      head = entry;
+    }
+    tail = entry;
+    ++batch_size;
+  }
+
+  if (batch_size) {
+    RawFreeBatch(head, tail, batch_size, batch_slot_span);
+  }
+}
+
+PA_ALWAYS_INLINE bool PartitionRoot::PrepareSlotForFree(
+    void* object,
+    ReadOnlySlotSpanMetadata* slot_span,
+    uintptr_t slot_start) {
   // Layout inside the slot:
   //   |...object...|[empty]|[cookie]|[unused]|[metadata]|
   //   <--------(a)--------->
@@ -1620,6 +2104,9 @@ PA_ALWAYS_INLINE void PartitionRoot::FreeNoHooksImmediate(
 
     if (!(ref_count->ReleaseFromAllocator())) [[unlikely]] {
       PA_CHECK(was_zapped);
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+      const bool freed_elsewhere = ref_count->IsBiasedTowardsOtherThread();
+#endif
       total_size_of_brp_quarantined_bytes.fetch_add(
           slot_span->GetSlotSizeForBookkeeping(), std::memory_order_relaxed);
       total_count_of_brp_quarantined_slots.fetch_add(1,
@@ -1628,7 +2115,22 @@ PA_ALWAYS_INLINE void PartitionRoot::FreeNoHooksImmediate(
           slot_span->GetSlotSizeForBookkeeping(), std::memory_order_relaxed);
       cumulative_count_of_brp_quarantined_slots.fetch_add(
           1, std::memory_order_relaxed);
-      return;
+      total_size_of_brp_quarantine_pinned_pages.fetch_add(
+          internal::BrpQuarantinePinnedPagesSize(
+              SlotStartToObjectAddr(slot_start), GetSlotUsableSize(slot_span)),
+          std::memory_order_relaxed);
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+      if (freed_elsewhere) [[unlikely]] {
+        QueueBiasedSlotFreedElsewhere(slot_start);
+      }
+#endif
+      return false;
+    }
+    // The last reference went away while quarantining the slot.
+    if (was_zapped &&
+        DecommitsBrpQuarantinedPages(GetSlotUsableSize(slot_span)))
+        [[unlikely]] {
+      RecommitBrpQuarantinedPages(slot_span, slot_start);
     }
   }
 #endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_SUPPORT)
@@ -1646,9 +2148,7 @@ PA_ALWAYS_INLINE void PartitionRoot::FreeNoHooksImmediate(
                            slot_span->GetUtilizedSlotSize());
   }
 #endif  // PA_CONFIG(ZERO_RANDOMLY_ON_FREE)
-  // TODO(keishi): Create function to convert |object| to |slot_start_ptr|.
-  void* slot_start_ptr = object;
-  RawFreeWithThreadCache(slot_start, slot_start_ptr, slot_span);
+  return true;
 }
 
 PA_ALWAYS_INLINE void PartitionRoot::FreeInSlotSpan(
@@ -1761,6 +2261,22 @@ PA_ALWAYS_INLINE void PartitionRoot::RawFreeBatch(
   // not our metrics.
   DecreaseTotalSizeOfAllocatedBytes(
       0u, slot_span->GetSlotSizeForBookkeeping() * size);
+#if PA_BUILDFLAG(USE_FREESLOT_BITMAP)
+  // GetNext() expects the next entry to be marked as free already, hence the
+  // thread cache variant, which doesn't look at the bitmap.
+  const internal::PartitionFreelistDispatcher* freelist_dispatcher =
+      get_freelist_dispatcher();
+  for (FreeListEntry* entry = head; entry;) {
+    internal::FreeSlotBitmapMarkSlotAsFree(internal::SlotStartPtr2Addr(entry));
+#if PA_BUILDFLAG(USE_FREELIST_DISPATCHER)
+    entry = freelist_dispatcher->GetNextForThreadCacheTrue(
+        entry, slot_span->bucket->slot_size);
+#else
+    entry = freelist_dispatcher->GetNextForThreadCache<true>(
+        entry, slot_span->bucket->slot_size);
+#endif  // PA_BUILDFLAG(USE_FREELIST_DISPATCHER)
+  }
+#endif
 
   slot_span->ToWritable(this)->AppendFreeList(head, tail, size, this,
                                               this->get_freelist_dispatcher());
@@ -1813,7 +2329,7 @@ PA_ALWAYS_INLINE void PartitionRoot::RawFreeWithThreadCache(
       PA_DCHECK(!slot_span->CanStoreRawSize());
       size_t usable_size = AdjustSizeForExtrasSubtract(slot_size.value());
       PA_DCHECK(usable_size == GetSlotUsableSize(slot_span));
-      thread_cache->RecordDeallocation(usable_size);
+      thread_cache->RecordDeallocation(slot_start, usable_size);
       return;
     }
   }
@@ -1825,7 +2341,7 @@ PA_ALWAYS_INLINE void PartitionRoot::RawFreeWithThreadCache(
     // GetSlotUsableSize() will always give the correct result, and we are in
     // a slow path here (since the thread cache case returned earlier).
     size_t usable_size = GetSlotUsableSize(slot_span);
-    thread_cache->RecordDeallocation(usable_size);
+    thread_cache->RecordDeallocation(slot_start, usable_size);
   }
   RawFree(slot_start, slot_span);
 }
@@ -1923,12 +2439,24 @@ PA_ALWAYS_INLINE void PartitionRoot::DecommitSystemPagesForData(
   DecreaseCommittedPages(length);
 }
 
+PA_ALWAYS_INLINE void PartitionRoot::MaybePrefaultSystemPagesForData(
+    uintptr_t address,
+    size_t length,
+    size_t slot_size) {
+  if (!ShouldPrefaultSystemPagesForData(slot_size)) [[likely]] {
+    return;
+  }
+  internal::ScopedSyscallTimer timer{this};
+  PrefaultSystemPages(address, length);
+}
+
 // Not unified with TryRecommitSystemPagesForData() to preserve error codes.
 PA_ALWAYS_INLINE void PartitionRoot::RecommitSystemPagesForData(
     uintptr_t address,
     size_t length,
     PageAccessibilityDisposition accessibility_disposition,
     bool request_tagging) {
+  internal::ScopedCommitUnderLockTimer commit_timer{this};
   internal::ScopedSyscallTimer timer{this};
 
   auto page_accessibility = GetPageAccessibility(request_tagging);
@@ -1937,6 +2465,7 @@ PA_ALWAYS_INLINE void PartitionRoot::RecommitSystemPagesForData(
   if (!ok) [[unlikely]] {
     // Decommit some memory and retry. The alternative is crashing.
     DecommitEmptySlotSpans();
+    ReleaseDirectMapCache();
     RecommitSystemPages(address, length, page_accessibility,
                         accessibility_disposition);
   }
@@ -1950,6 +2479,10 @@ PA_ALWAYS_INLINE bool PartitionRoot::TryRecommitSystemPagesForDataInternal(
     size_t length,
     PageAccessibilityDisposition accessibility_disposition,
     bool request_tagging) {
+  std::optional<internal::ScopedCommitUnderLockTimer> commit_timer;
+  if constexpr (already_locked) {
+    commit_timer.emplace(this);
+  }
   internal::ScopedSyscallTimer timer{this};
 
   auto page_accessibility = GetPageAccessibility(request_tagging);
@@ -1959,12 +2492,19 @@ PA_ALWAYS_INLINE bool PartitionRoot::TryRecommitSystemPagesForDataInternal(
     {
       // Decommit some memory and retry. The alternative is crashing.
       if constexpr (!already_locked) {
-        ::partition_alloc::internal::ScopedGuard guard(
-            internal::PartitionRootLock(this));
-        DecommitEmptySlotSpans();
+        DirectMapCacheEntry evicted[internal::kMaxDirectMapCacheEntries];
+        size_t evicted_count;
+        {
+          ::partition_alloc::internal::ScopedGuard guard(
+              internal::PartitionRootLock(this));
+          DecommitEmptySlotSpans();
+          evicted_count = EvictCachedDirectMaps(false, evicted);
+        }
+        ReleaseCachedDirectMaps(evicted, evicted_count);
       } else {
         internal::PartitionRootLock(this).AssertAcquired();
         DecommitEmptySlotSpans();
+        ReleaseDirectMapCache();
       }
     }
     ok = TryRecommitSystemPages(address, length, page_accessibility,
@@ -2207,6 +2747,21 @@ PA_ALWAYS_INLINE void* PartitionRoot::AllocInternalNoHooks(
   // same allocation request, we'll get inconsistent state.
   uint16_t bucket_index =
       SizeToBucketIndex(raw_size, this->GetBucketDistribution());
+  return AllocInternalNoHooksWithBucketIndex<flags>(
+      bucket_index, requested_size, raw_size, slot_span_alignment);
+}
+
+template <AllocFlags flags>
+PA_ALWAYS_INLINE void* PartitionRoot::AllocInternalNoHooksWithBucketIndex(
+    uint16_t bucket_index,
+    size_t requested_size,
+    size_t raw_size,
+    size_t slot_span_alignment) {
+  static_assert(AreValidFlags(flags));
+  PA_DCHECK(bucket_index <= internal::kNumBuckets);
+  PA_DCHECK(bucket_index == internal::kNumBuckets ||
+            bucket_at(bucket_index).slot_size >= raw_size);
+
   size_t usable_size;
   bool is_already_zeroed = false;
   uintptr_t slot_start = 0;
@@ -2220,6 +2775,30 @@ PA_ALWAYS_INLINE void* PartitionRoot::AllocInternalNoHooks(
   // `[[likely]]`: performance-sensitive partitions use the thread cache.
   if (ThreadCache::IsValid(thread_cache) &&
       slot_span_alignment <= internal::PartitionPageSize()) [[likely]] {
+#if PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+    if constexpr (!ContainsFlags(flags, AllocFlags::kNoHooks)) {
+      if (settings.gwp_asan_sampling &&
+          thread_cache->ShouldSampleForGwpAsan()) [[unlikely]] {
+        // Slots are aligned on the largest power of two dividing their size,
+        // up to the partition page size, as slot spans are. Aligned
+        // allocations rely on it, see |AlignedAllocInline()|.
+        size_t alignment = internal::PartitionPageSize();
+        if (bucket_index != internal::kNumBuckets) {
+          alignment = std::min(
+              alignment,
+              size_t{1} << internal::base::bits::CountrZero(
+                  bucket_at(bucket_index).slot_size));
+        }
+        if (void* object = thread_cache->AllocSampledForGwpAsan(requested_size,
+                                                                alignment)) {
+          if constexpr (ContainsFlags(flags, AllocFlags::kZeroFill)) {
+            memset(object, 0, requested_size);
+          }
+          return object;
+        }
+      }
+    }
+#endif  // PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
     // Note: getting slot_size from the thread cache rather than by
     // `buckets[bucket_index].slot_size` to avoid touching `buckets` on the fast
     // path.
@@ -2262,7 +2841,7 @@ PA_ALWAYS_INLINE void* PartitionRoot::AllocInternalNoHooks(
   }
 
   if (ThreadCache::IsValid(thread_cache)) [[likely]] {
-    thread_cache->RecordAllocation(usable_size);
+    thread_cache->RecordAllocation(slot_start, usable_size);
   }
 
   // Layout inside the slot:
@@ -2337,9 +2916,23 @@ PA_ALWAYS_INLINE void* PartitionRoot::AllocInternalNoHooks(
       needs_mac11_malloc_size_hack = true;
     }
 #endif  // PA_CONFIG(MAYBE_ENABLE_MAC11_MALLOC_SIZE_HACK)
+#if PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
+    const uint16_t owner_tag =
+        internal::IsBiasedCountOwner(settings.biased_count_owner_tag_)
+            ? settings.biased_count_owner_tag_
+            : 0;
+    auto* ref_count =
+        new (InSlotMetadataPointerFromSlotStartAndSize(slot_start, slot_size))
+            internal::InSlotMetadata(needs_mac11_malloc_size_hack, owner_tag);
+    if (owner_tag && has_biased_slots_freed_elsewhere_.load(
+                         std::memory_order_relaxed)) [[unlikely]] {
+      ReclaimBiasedSlotsFreedElsewhere();
+    }
+#else
     auto* ref_count =
         new (InSlotMetadataPointerFromSlotStartAndSize(slot_start, slot_size))
             internal::InSlotMetadata(needs_mac11_malloc_size_hack);
+#endif  // PA_BUILDFLAG(ENABLE_BACKUP_REF_PTR_BIASED_COUNT)
 #if PA_CONFIG(IN_SLOT_METADATA_STORE_REQUESTED_SIZE)
     ref_count->SetRequestedSize(requested_size);
 #else
@@ -2351,6 +2944,30 @@ PA_ALWAYS_INLINE void* PartitionRoot::AllocInternalNoHooks(
   return object;
 }
 
+template <AllocFlags flags>
+PA_ALWAYS_INLINE void* PartitionRoot::AllocWithBucketIndexInline(
+    uint16_t bucket_index,
+    size_t requested_size,
+    const char* type_name) {
+  static_assert(AreValidFlags(flags));
+#if defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
+  return AllocInline<flags>(requested_size, type_name);
+#else
+  if constexpr (!ContainsFlags(flags, AllocFlags::kNoHooks)) {
+    PA_DCHECK(initialized);
+    // Hooks may override the allocation, let the regular path handle them.
+    if (PartitionAllocHooks::AreHooksEnabled()) [[unlikely]] {
+      return AllocInline<flags>(requested_size, type_name);
+    }
+  }
+
+  size_t raw_size = AdjustSizeForExtrasAdd(requested_size);
+  PA_CHECK(raw_size >= requested_size);  // check for overflows
+  return AllocInternalNoHooksWithBucketIndex<flags>(
+      bucket_index, requested_size, raw_size, internal::PartitionPageSize());
+#endif  // defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
+}
+
 template <AllocFlags flags>
 PA_ALWAYS_INLINE uintptr_t PartitionRoot::RawAlloc(Bucket* bucket,
                                                    size_t raw_size,
@@ -2575,7 +3192,7 @@ PartitionRoot::AllocationCapacityFromRequestedSize(size_t size) const {
 ThreadCache* PartitionRoot::GetOrCreateThreadCache() {
   ThreadCache* thread_cache = nullptr;
   if (settings.with_thread_cache) [[likely]] {
-    thread_cache = ThreadCache::Get();
+    thread_cache = ThreadCache::Get(settings.thread_cache_index);
     if (!ThreadCache::IsValid(thread_cache)) [[unlikely]] {
       thread_cache = MaybeInitThreadCache();
     }
@@ -2585,7 +3202,7 @@ ThreadCache* PartitionRoot::GetOrCreateThreadCache() {
 
 ThreadCache* PartitionRoot::GetThreadCache() {
   if (settings.with_thread_cache) [[likely]] {
-    return ThreadCache::Get();
+    return ThreadCache::Get(settings.thread_cache_index);
   }
   return nullptr;
 }
@@ -62,6 +62,11 @@ struct LightweightQuarantineStats {
   size_t cumulative_size_in_bytes;
   size_t cumulative_count;
   size_t quarantine_miss_count;  // Object too large.
+  // Batches handed to the asynchronous drain, and overflows purged on the
+  // freeing thread because its queue was full. Slots in queued batches are
+  // already dequarantined: they count in neither `size_in_bytes` nor `count`.
+  size_t async_drain_batch_count;
+  size_t async_drain_fallback_count;
 };
 
 // Struct used to retrieve total memory usage of a partition. Used by
@@ -86,7 +91,22 @@ struct PartitionMemoryStats {
                                             // quarantined by BRP.
   size_t cumulative_brp_quarantined_count;  // Cumulative number of slots that
                                             // are quarantined by BRP.
+  // System pages lying entirely within BRP-quarantined slots, which nothing
+  // else keeps around, and those discarded since the quarantine went over
+  // capacity. See `PartitionOptions::backup_ref_ptr_quarantine_policy`.
+  size_t total_brp_quarantine_pinned_bytes;
+  size_t cumulative_brp_quarantine_discarded_bytes;
+  size_t brp_quarantine_over_capacity_count;  // Slots quarantined while over
+                                              // capacity.
+  // Part of the pinned bytes decommitted until the slots are released. See
+  // `PartitionOptions::backup_ref_ptr_quarantine_decommit_threshold_in_bytes`.
+  size_t total_brp_quarantine_decommitted_bytes;
 #endif
+  // Committed bytes of freed direct maps kept for reuse, and the number of
+  // direct maps served from them. See
+  // `PartitionOptions::direct_map_cache_capacity_in_bytes`.
+  size_t total_direct_map_cached_bytes;
+  size_t direct_map_cache_hit_count;
 
   bool has_thread_cache;
   ThreadCacheStats current_thread_cache_stats;
@@ -99,6 +119,11 @@ struct PartitionMemoryStats {
   // be reported on all platforms.
   uint64_t syscall_count;
   uint64_t syscall_total_time_ns;
+
+  // Count and total duration of commits made while holding the partition lock,
+  // since process start.
+  uint64_t commit_under_lock_count;
+  uint64_t commit_under_lock_time_ns;
 };
 
 // Struct used to retrieve memory statistics about a partition bucket. Used by
@@ -60,6 +60,69 @@ void RawPtrBackupRefImpl<AllowDangling, DisableBRP>::ReleaseInternal(
   }
 }
 
+template <bool AllowDangling, bool DisableBRP>
+void RawPtrBackupRefImpl<AllowDangling, DisableBRP>::AcquireBatchInternal(
+    const uintptr_t* addresses,
+    size_t count) {
+  // Slot of the previous pointer, which the next ones may share.
+  uintptr_t last_slot_start = 0;
+  size_t last_slot_size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const uintptr_t address =
+        partition_alloc::internal::UntagAddr(addresses[i]);
+    if (!IsSupportedAndNotNull(address) ||
+        address - last_slot_start < last_slot_size) {
+      continue;
+    }
+    auto [slot_start, slot_size] =
+        partition_alloc::PartitionAllocGetSlotStartAndSizeInBRPPool(address);
+    if constexpr (AllowDangling) {
+      partition_alloc::PartitionRoot::InSlotMetadataPointerFromSlotStartAndSize(
+          slot_start, slot_size)
+          ->AcquireFromUnprotectedPtr();
+    } else {
+      partition_alloc::PartitionRoot::InSlotMetadataPointerFromSlotStartAndSize(
+          slot_start, slot_size)
+          ->Acquire();
+    }
+    last_slot_start = slot_start;
+    last_slot_size = slot_size;
+  }
+}
+
+template <bool AllowDangling, bool DisableBRP>
+void RawPtrBackupRefImpl<AllowDangling, DisableBRP>::ReleaseBatchInternal(
+    const uintptr_t* addresses,
+    size_t count) {
+  // Must skip exactly the pointers `AcquireBatchInternal()` skipped.
+  uintptr_t last_slot_start = 0;
+  size_t last_slot_size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const uintptr_t address =
+        partition_alloc::internal::UntagAddr(addresses[i]);
+    if (!IsSupportedAndNotNull(address) ||
+        address - last_slot_start < last_slot_size) {
+      continue;
+    }
+    auto [slot_start, slot_size] =
+        partition_alloc::PartitionAllocGetSlotStartAndSizeInBRPPool(address);
+    auto* in_slot_metadata =
+        partition_alloc::PartitionRoot::InSlotMetadataPointerFromSlotStartAndSize(
+            slot_start, slot_size);
+    bool should_free;
+    if constexpr (AllowDangling) {
+      should_free = in_slot_metadata->ReleaseFromUnprotectedPtr();
+    } else {
+      should_free = in_slot_metadata->Release();
+    }
+    if (should_free) {
+      partition_alloc::internal::PartitionAllocFreeForRefCounting(slot_start);
+    }
+    last_slot_start = slot_start;
+    last_slot_size = slot_size;
+  }
+}
+
 template <bool AllowDangling, bool DisableBRP>
 void RawPtrBackupRefImpl<AllowDangling, DisableBRP>::ReportIfDanglingInternal(
     uintptr_t address) {
@@ -424,6 +424,23 @@ struct RawPtrBackupRefImpl {
     return WrapRawPtr(wrapped_ptr);
   }
 
+  // Acquires a reference on behalf of each of the `count` pointers extracted
+  // from raw_ptr<T>, for base::RawPtrBorrow. Consecutive pointers into the same
+  // slot share a single reference, and the whole batch is processed in a single
+  // out-of-line call. ReleaseBatch() must be given the very same pointers.
+  PA_ALWAYS_INLINE static void AcquireBatch(const uintptr_t* addresses,
+                                            size_t count) {
+    if (count) {
+      AcquireBatchInternal(addresses, count);
+    }
+  }
+  PA_ALWAYS_INLINE static void ReleaseBatch(const uintptr_t* addresses,
+                                            size_t count) {
+    if (count) {
+      ReleaseBatchInternal(addresses, count);
+    }
+  }
+
   // Report the current wrapped pointer if pointee isn't alive anymore.
   template <typename T>
   PA_ALWAYS_INLINE static void ReportIfDangling(T* wrapped_ptr) {
@@ -497,6 +514,12 @@ struct RawPtrBackupRefImpl {
       uintptr_t address);
   PA_NOINLINE static PA_COMPONENT_EXPORT(RAW_PTR) void ReleaseInternal(
       uintptr_t address);
+  PA_NOINLINE static PA_COMPONENT_EXPORT(RAW_PTR) void AcquireBatchInternal(
+      const uintptr_t* addresses,
+      size_t count);
+  PA_NOINLINE static PA_COMPONENT_EXPORT(RAW_PTR) void ReleaseBatchInternal(
+      const uintptr_t* addresses,
+      size_t count);
   PA_NOINLINE static PA_COMPONENT_EXPORT(RAW_PTR) bool IsPointeeAlive(
       uintptr_t address);
   PA_NOINLINE static PA_COMPONENT_EXPORT(RAW_PTR) void ReportIfDanglingInternal(
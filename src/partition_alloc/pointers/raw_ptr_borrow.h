@@ -0,0 +1,156 @@
+// Copyright 2026 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef PARTITION_ALLOC_POINTERS_RAW_PTR_BORROW_H_
+#define PARTITION_ALLOC_POINTERS_RAW_PTR_BORROW_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+
+#include "partition_alloc/partition_alloc_base/compiler_specific.h"
+#include "partition_alloc/pointers/raw_ptr.h"
+
+namespace base {
+
+namespace internal {
+
+// Whether `Impl` keeps a reference count, which a borrow takes in batches.
+template <typename Impl, typename = void>
+struct SupportsBatchedAcquire : std::false_type {};
+template <typename Impl>
+struct SupportsBatchedAcquire<
+    Impl,
+    std::void_t<decltype(Impl::AcquireBatch(nullptr, 0)),
+                decltype(Impl::ReleaseBatch(nullptr, 0))>> : std::true_type {};
+
+}  // namespace internal
+
+// Scoped snapshot of up to `kCapacity` raw_ptr<T>, handing out plain T*.
+//
+// Copying a raw_ptr<T> out of a container costs BackupRefPtr an atomic
+// increment, and an atomic decrement once the copy goes away. In hot loops over
+// containers of raw_ptr<T>, a borrow instead acquires one reference per slot
+// for the whole batch (consecutive pointers into the same slot share it), and
+// releases them when it goes out of scope. The pointees remain protected until
+// then, even if the source raw_ptr<T> are reassigned or destroyed meanwhile.
+//
+//   RawPtrBorrow<Foo> borrow(foos.data(), foos.size());
+//   for (Foo* foo : borrow) {
+//     foo->Bar();
+//   }
+//
+// The T* handed out must not outlive the borrow. See ForEachBorrowed() for
+// ranges larger than `kCapacity`.
+template <typename T,
+          RawPtrTraits Traits = RawPtrTraits::kEmpty,
+          size_t kCapacity = 64>
+class RawPtrBorrow {
+ public:
+  using Impl = typename raw_ptr<T, Traits>::Impl;
+  static constexpr size_t kMaxSize = kCapacity;
+
+  PA_ALWAYS_INLINE RawPtrBorrow(const raw_ptr<T, Traits>* ptrs, size_t count)
+      : size_(count) {
+    PA_RAW_PTR_CHECK(count <= kCapacity);
+    for (size_t i = 0; i < count; ++i) {
+      addresses_[i] = reinterpret_cast<uintptr_t>(ptrs[i].get());
+    }
+    if constexpr (internal::SupportsBatchedAcquire<Impl>::value) {
+      Impl::AcquireBatch(addresses_, size_);
+    }
+  }
+
+  RawPtrBorrow(const RawPtrBorrow&) = delete;
+  RawPtrBorrow& operator=(const RawPtrBorrow&) = delete;
+
+  PA_ALWAYS_INLINE ~RawPtrBorrow() {
+    if constexpr (internal::SupportsBatchedAcquire<Impl>::value) {
+      Impl::ReleaseBatch(addresses_, size_);
+    }
+  }
+
+  class Iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T*;
+    using difference_type = ptrdiff_t;
+    using pointer = void;
+    using reference = T*;
+
+    PA_ALWAYS_INLINE T* operator*() const {
+      return reinterpret_cast<T*>(*address_);
+    }
+    PA_ALWAYS_INLINE Iterator& operator++() {
+      ++address_;
+      return *this;
+    }
+    PA_ALWAYS_INLINE Iterator operator++(int) {
+      Iterator it = *this;
+      ++address_;
+      return it;
+    }
+    PA_ALWAYS_INLINE friend bool operator==(const Iterator& lhs,
+                                            const Iterator& rhs) {
+      return lhs.address_ == rhs.address_;
+    }
+    PA_ALWAYS_INLINE friend bool operator!=(const Iterator& lhs,
+                                            const Iterator& rhs) {
+      return lhs.address_ != rhs.address_;
+    }
+
+   private:
+    friend class RawPtrBorrow;
+    PA_ALWAYS_INLINE explicit Iterator(const uintptr_t* address)
+        : address_(address) {}
+
+    const uintptr_t* address_;
+  };
+
+  PA_ALWAYS_INLINE Iterator begin() const { return Iterator(addresses_); }
+  PA_ALWAYS_INLINE Iterator end() const {
+    return Iterator(addresses_ + size_);
+  }
+  PA_ALWAYS_INLINE T* operator[](size_t index) const {
+    PA_RAW_PTR_CHECK(index < size_);
+    return reinterpret_cast<T*>(addresses_[index]);
+  }
+  PA_ALWAYS_INLINE size_t size() const { return size_; }
+  PA_ALWAYS_INLINE bool empty() const { return !size_; }
+
+ private:
+  // Pointers as extracted from the raw_ptr<T>, stored as integers so that
+  // implementations can take them as a batch regardless of `T`.
+  uintptr_t addresses_[kCapacity];
+  const size_t size_;
+};
+
+// Calls `function` with each of `ptrs` as a T*, borrowing them `kBatchSize` at
+// a time.
+template <size_t kBatchSize = 64,
+          typename T,
+          RawPtrTraits Traits,
+          typename Function>
+PA_ALWAYS_INLINE void ForEachBorrowed(const raw_ptr<T, Traits>* ptrs,
+                                      size_t count,
+                                      Function function) {
+  while (count) {
+    const size_t batch_size = std::min(count, kBatchSize);
+    RawPtrBorrow<T, Traits, kBatchSize> borrow(ptrs, batch_size);
+    for (T* ptr : borrow) {
+      function(ptr);
+    }
+    ptrs += batch_size;
+    count -= batch_size;
+  }
+}
+
+}  // namespace base
+
+using base::ForEachBorrowed;
+using base::RawPtrBorrow;
+
+#endif  // PARTITION_ALLOC_POINTERS_RAW_PTR_BORROW_H_
@@ -0,0 +1,131 @@
+// Copyright 2026 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "partition_alloc/pointers/raw_ptr.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "base/timer/lap_timer.h"
+#include "partition_alloc/buildflags.h"
+#include "partition_alloc/partition_alloc.h"
+#include "partition_alloc/partition_alloc_base/time/time.h"
+#include "partition_alloc/partition_root.h"
+#include "partition_alloc/pointers/raw_ptr_borrow.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "testing/perf/perf_result_reporter.h"
+
+#if PA_BUILDFLAG(USE_RAW_PTR_BACKUP_REF_IMPL) && \
+    !defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
+
+namespace base::internal {
+
+namespace {
+
+constexpr int kWarmupRuns = 10;
+constexpr ::base::TimeDelta kTimeLimit = ::base::Seconds(1);
+constexpr int kTimeCheckInterval = 100;
+
+constexpr char kMetricPrefixRawPtr[] = "RawPtrIteration.";
+constexpr char kMetricThroughput[] = "throughput";
+constexpr char kMetricLatency[] = "latency_per_element_ns";
+
+// Number of raw_ptr iterated over on every lap.
+constexpr size_t kNumPointers = 4096;
+
+struct Node {
+  uint64_t value;
+};
+
+perf_test::PerfResultReporter SetUpReporter(const std::string& story_name) {
+  perf_test::PerfResultReporter reporter(kMetricPrefixRawPtr, story_name);
+  reporter.RegisterImportantMetric(kMetricThroughput, "elements/s");
+  reporter.RegisterImportantMetric(kMetricLatency, "ns");
+  return reporter;
+}
+
+class RawPtrIterationPerfTest : public testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    // Half of the pointers share their slot with the previous one, as when
+    // pointing to members of the same object.
+    nodes_.reserve(kNumPointers);
+    for (size_t i = 0; i < kNumPointers; ++i) {
+      Node* node = nullptr;
+      if (GetParam() && i % 2) {
+        node = nodes_.back();
+      } else {
+        node = static_cast<Node*>(allocator_.root()->Alloc(sizeof(Node), ""));
+        node->value = i;
+      }
+      nodes_.push_back(node);
+      ptrs_.emplace_back(node);
+    }
+  }
+
+  void TearDown() override {
+    ptrs_.clear();
+    for (size_t i = 0; i < kNumPointers; ++i) {
+      if (!GetParam() || !(i % 2)) {
+        allocator_.root()->Free(nodes_[i]);
+      }
+    }
+  }
+
+  void Report(const char* story_name, const ::base::LapTimer& timer) {
+    const std::string story = std::string(story_name) +
+                              (GetParam() ? "_shared_slots" : "_distinct_slots");
+    auto reporter = SetUpReporter(story);
+    const double elements_per_second = kNumPointers * timer.LapsPerSecond();
+    reporter.AddResult(kMetricThroughput, elements_per_second);
+    reporter.AddResult(kMetricLatency, 1e9 / elements_per_second);
+  }
+
+  partition_alloc::PartitionAllocator allocator_ =
+      partition_alloc::PartitionAllocator([] {
+        partition_alloc::PartitionOptions opts;
+        opts.backup_ref_ptr = partition_alloc::PartitionOptions::kEnabled;
+        return opts;
+      }());
+  std::vector<Node*> nodes_;
+  std::vector<raw_ptr<Node>> ptrs_;
+};
+
+INSTANTIATE_TEST_SUITE_P(AlternateSharedSlots,
+                         RawPtrIterationPerfTest,
+                         ::testing::Bool());
+
+}  // namespace
+
+TEST_P(RawPtrIterationPerfTest, CopyEachPointer) {
+  ::base::LapTimer timer(kWarmupRuns, kTimeLimit, kTimeCheckInterval);
+  uint64_t sum = 0;
+  do {
+    // Each copy acquires and releases a reference.
+    for (raw_ptr<Node> node : ptrs_) {
+      sum += node->value;
+    }
+    timer.NextLap();
+  } while (!timer.HasTimeLimitExpired());
+  EXPECT_NE(0u, sum);
+  Report("copy_each_pointer", timer);
+}
+
+TEST_P(RawPtrIterationPerfTest, Borrow) {
+  ::base::LapTimer timer(kWarmupRuns, kTimeLimit, kTimeCheckInterval);
+  uint64_t sum = 0;
+  do {
+    ForEachBorrowed(ptrs_.data(), ptrs_.size(),
+                    [&](Node* node) { sum += node->value; });
+    timer.NextLap();
+  } while (!timer.HasTimeLimitExpired());
+  EXPECT_NE(0u, sum);
+  Report("borrow", timer);
+}
+
+}  // namespace base::internal
+
+#endif  // PA_BUILDFLAG(USE_RAW_PTR_BACKUP_REF_IMPL) &&
+        // !defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
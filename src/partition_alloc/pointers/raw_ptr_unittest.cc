@@ -14,6 +14,7 @@
 #include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
 
 #include "base/allocator/partition_alloc_features.h"
 #include "base/allocator/partition_alloc_support.h"
@@ -37,6 +38,7 @@
 #include "partition_alloc/partition_alloc_hooks.h"
 #include "partition_alloc/partition_root.h"
 #include "partition_alloc/pointers/instance_tracer.h"
+#include "partition_alloc/pointers/raw_ptr_borrow.h"
 #include "partition_alloc/pointers/raw_ptr_counting_impl_for_test.h"
 #include "partition_alloc/pointers/raw_ptr_test_support.h"
 #include "partition_alloc/pointers/raw_ref.h"
@@ -1359,6 +1361,34 @@ TEST_F(RawPtrTest, TrivialRelocability) {
         // PA_BUILDFLAG(RAW_PTR_ZERO_ON_DESTRUCT)
 }
 
+TEST_F(RawPtrTest, Borrow) {
+  int values[] = {1, 2, 3};
+  std::vector<CountingRawPtr<int>> ptrs = {&values[0], &values[1], nullptr,
+                                           &values[2]};
+
+  RawPtrCountingImpl::ClearCounters();
+  int sum = 0;
+  {
+    RawPtrBorrow<int, base::RawPtrTraits::kUseCountingImplForTest |
+                          base::RawPtrTraits::kAllowPtrArithmetic>
+        borrow(ptrs.data(), ptrs.size());
+    EXPECT_EQ(ptrs.size(), borrow.size());
+    EXPECT_EQ(nullptr, borrow[2]);
+    for (int* ptr : borrow) {
+      sum += ptr ? *ptr : 0;
+    }
+  }
+  EXPECT_EQ(6, sum);
+  // Pointers are extracted once, and no raw_ptr is copied.
+  EXPECT_THAT((CountingRawPtrExpectations{
+                  .wrap_raw_ptr_cnt = 0,
+                  .release_wrapped_ptr_cnt = 0,
+                  .get_for_extraction_cnt = static_cast<int>(ptrs.size()),
+                  .wrap_raw_ptr_for_dup_cnt = 0,
+              }),
+              CountersMatch());
+}
+
 struct BaseStruct {
   explicit BaseStruct(int a) : a(a) {}
   virtual ~BaseStruct() = default;
@@ -2461,6 +2491,97 @@ TEST_F(BackupRefPtrTest, RawPtrTraits_DisableBRP) {
   allocator_.root()->Free(sentinel);
 }
 
+TEST_F(BackupRefPtrTest, Borrow) {
+  constexpr size_t kCount = 8;
+  std::vector<uint64_t*> objects;
+  std::vector<raw_ptr<uint64_t, DisableDanglingPtrDetection>> ptrs;
+  for (size_t i = 0; i < kCount; ++i) {
+    objects.push_back(static_cast<uint64_t*>(
+        allocator_.root()->Alloc(sizeof(uint64_t), "")));
+    ptrs.emplace_back(objects.back());
+  }
+  ptrs.emplace_back(nullptr);
+
+  {
+    RawPtrBorrow<uint64_t, DisableDanglingPtrDetection> borrow(ptrs.data(),
+                                                               ptrs.size());
+    ASSERT_EQ(ptrs.size(), borrow.size());
+    for (size_t i = 0; i < kCount; ++i) {
+      EXPECT_EQ(objects[i], borrow[i]);
+    }
+    EXPECT_EQ(nullptr, borrow[kCount]);
+
+    // The borrow keeps the pointees protected, even once the raw_ptrs are
+    // gone.
+    ptrs.clear();
+    for (uint64_t* object : objects) {
+      allocator_.root()->Free(object);
+    }
+    EXPECT_EQ(kCount,
+              allocator_.root()->total_count_of_brp_quarantined_slots.load(
+                  std::memory_order_relaxed));
+  }
+  EXPECT_EQ(0u, allocator_.root()->total_count_of_brp_quarantined_slots.load(
+                    std::memory_order_relaxed));
+}
+
+TEST_F(BackupRefPtrTest, BorrowPointersIntoTheSameSlot) {
+  constexpr size_t kSize = 16;
+  char* object = static_cast<char*>(allocator_.root()->Alloc(kSize, ""));
+  void* other = allocator_.root()->Alloc(kSize, "");
+  std::vector<raw_ptr<char, DisableDanglingPtrDetection | AllowPtrArithmetic>>
+      ptrs;
+  for (size_t i = 0; i < kSize; ++i) {
+    ptrs.emplace_back(object + i);
+  }
+  ptrs.emplace_back(static_cast<char*>(other));
+  ptrs.emplace_back(object);
+
+  {
+    RawPtrBorrow<char, DisableDanglingPtrDetection | AllowPtrArithmetic>
+        borrow(ptrs.data(), ptrs.size());
+    ptrs.clear();
+    allocator_.root()->Free(object);
+    allocator_.root()->Free(other);
+    EXPECT_EQ(2u, allocator_.root()->total_count_of_brp_quarantined_slots.load(
+                      std::memory_order_relaxed));
+  }
+  // Shared references were released only once, and the others as many times
+  // as they were acquired: both slots are back to the allocator, and
+  // reference counts did not underflow.
+  EXPECT_EQ(0u, allocator_.root()->total_count_of_brp_quarantined_slots.load(
+                    std::memory_order_relaxed));
+}
+
+TEST_F(BackupRefPtrTest, ForEachBorrowed) {
+  constexpr size_t kCount = 100;
+  std::vector<raw_ptr<uint64_t>> ptrs;
+  for (size_t i = 0; i < kCount; ++i) {
+    auto* object = static_cast<uint64_t*>(
+        allocator_.root()->Alloc(sizeof(uint64_t), ""));
+    *object = i;
+    ptrs.emplace_back(object);
+  }
+
+  uint64_t sum = 0;
+  size_t calls = 0;
+  ForEachBorrowed</*kBatchSize=*/16>(ptrs.data(), ptrs.size(),
+                                     [&](uint64_t* object) {
+                                       sum += *object;
+                                       ++calls;
+                                     });
+  EXPECT_EQ(kCount, calls);
+  EXPECT_EQ(kCount * (kCount - 1) / 2, sum);
+
+  for (raw_ptr<uint64_t>& ptr : ptrs) {
+    uint64_t* object = ptr.get();
+    ptr = nullptr;
+    allocator_.root()->Free(object);
+  }
+  EXPECT_EQ(0u, allocator_.root()->total_count_of_brp_quarantined_slots.load(
+                    std::memory_order_relaxed));
+}
+
 #endif  // PA_BUILDFLAG(USE_RAW_PTR_BACKUP_REF_IMPL) &&
         // !defined(MEMORY_TOOL_REPLACES_ALLOCATOR)
 
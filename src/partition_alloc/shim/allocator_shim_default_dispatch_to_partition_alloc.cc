@@ -150,6 +150,9 @@ class MainPartitionConstructor {
     // Also tests, such as the ThreadCache tests create a thread cache.
     opts.thread_cache = partition_alloc::PartitionOptions::kDisabled;
     opts.backup_ref_ptr = partition_alloc::PartitionOptions::kDisabled;
+    // All frees of malloc()'s partition go through the shim, which can tell
+    // GWP-ASan allocations apart.
+    opts.gwp_asan_sampling = partition_alloc::PartitionOptions::kEnabled;
     auto* new_root = new (buffer) partition_alloc::PartitionRoot(opts);
 
     return new_root;
@@ -645,6 +648,7 @@ void ConfigurePartitions(
         opts.backup_ref_ptr =
             enable_brp ? partition_alloc::PartitionOptions::kEnabled
                        : partition_alloc::PartitionOptions::kDisabled;
+        opts.gwp_asan_sampling = partition_alloc::PartitionOptions::kEnabled;
         opts.zapping_by_free_flags =
             zapping_by_free_flags
                 ? partition_alloc::PartitionOptions::kEnabled
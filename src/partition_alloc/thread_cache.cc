@@ -9,9 +9,11 @@
 #include <algorithm>
 #include <atomic>
 #include <cstdint>
+#include <limits>
 
 #include "partition_alloc/build_config.h"
 #include "partition_alloc/buildflags.h"
+#include "partition_alloc/gwp_asan_support.h"
 #include "partition_alloc/internal_allocator.h"
 #include "partition_alloc/partition_alloc-inl.h"
 #include "partition_alloc/partition_alloc_base/component_export.h"
@@ -43,9 +45,13 @@ uintptr_t kThreadCacheNeedleArray[kThreadCacheNeedleArraySize] = {
 namespace internal {
 
 PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionTlsKey g_thread_cache_key;
+PA_COMPONENT_EXPORT(PARTITION_ALLOC)
+PartitionTlsKey g_secondary_thread_caches_key;
 #if PA_CONFIG(THREAD_CACHE_FAST_TLS)
 PA_COMPONENT_EXPORT(PARTITION_ALLOC)
 thread_local ThreadCache* g_thread_cache;
+PA_COMPONENT_EXPORT(PARTITION_ALLOC)
+thread_local SecondaryThreadCaches* g_secondary_thread_caches;
 #endif
 
 }  // namespace internal
@@ -54,21 +60,42 @@ namespace {
 // Since |g_thread_cache_key| is shared, make sure that no more than one
 // PartitionRoot can use it.
 static std::atomic<PartitionRoot*> g_thread_cache_root;
+// Partitions with a secondary thread cache, by index - 1.
+PartitionRoot* g_secondary_thread_cache_roots[internal::kMaxSecondaryThreadCaches]
+    PA_GUARDED_BY(ThreadCacheRegistry::GetLock()) = {};
 
 #if PA_BUILDFLAG(IS_WIN)
-void OnDllProcessDetach() {
+// Not locking: the process is terminating.
+void OnDllProcessDetach() PA_NO_THREAD_SAFETY_ANALYSIS {
   // Very late allocations do occur (see crbug.com/1159411#c7 for instance),
   // including during CRT teardown. This is problematic for the thread cache
   // which relies on the CRT for TLS access for instance. This cannot be
   // mitigated inside the thread cache (since getting to it requires querying
   // TLS), but the PartitionRoot associated wih the thread cache can be made to
   // not use the thread cache anymore.
-  g_thread_cache_root.load(std::memory_order_relaxed)
-      ->settings.with_thread_cache = false;
+  if (auto* root = g_thread_cache_root.load(std::memory_order_relaxed)) {
+    root->settings.with_thread_cache = false;
+  }
+  for (PartitionRoot* root : g_secondary_thread_cache_roots) {
+    if (root) {
+      root->settings.with_thread_cache = false;
+    }
+  }
 }
 #endif
 
 static bool g_thread_cache_key_created = false;
+
+// There is a single consumer of the observed events at a time, which is what
+// makes ObservedEventBuffer::Pop() safe.
+internal::Lock g_observed_events_flush_lock;
+constexpr size_t kObservedEventsBatchSize = 256;
+// Bounds the time spent flushing when threads produce faster than the hook
+// consumes.
+constexpr size_t kMaxObservedEventsBatchesPerFlush = 1024;
+PartitionAllocHooks::BufferedObserverEvent
+    g_observed_events_batch[kObservedEventsBatchSize] PA_GUARDED_BY(
+        g_observed_events_flush_lock);
 }  // namespace
 
 uint8_t ThreadCache::global_limits_[ThreadCache::kBucketCount];
@@ -88,58 +115,152 @@ ThreadCache::get_freelist_dispatcher_from_root() {
 }
 
 void ThreadCacheRegistry::RegisterThreadCache(ThreadCache* cache) {
-  internal::ScopedGuard scoped_locker(GetLock());
+  Shard& shard = shards_[cache->registry_shard_];
+  internal::ScopedGuard scoped_locker(shard.lock);
+  cache->registry_lock().AssertAcquired();
   cache->next_ = nullptr;
   cache->prev_ = nullptr;
 
-  ThreadCache* previous_head = list_head_;
-  list_head_ = cache;
+  ThreadCache* previous_head = shard.list_head;
+  shard.list_head = cache;
   cache->next_ = previous_head;
   if (previous_head) {
+    previous_head->registry_lock().AssertAcquired();
     previous_head->prev_ = cache;
   }
 }
 
 void ThreadCacheRegistry::UnregisterThreadCache(ThreadCache* cache) {
-  internal::ScopedGuard scoped_locker(GetLock());
+  Shard& shard = shards_[cache->registry_shard_];
+  internal::ScopedGuard scoped_locker(shard.lock);
+  cache->registry_lock().AssertAcquired();
   if (cache->prev_) {
+    cache->prev_->registry_lock().AssertAcquired();
     cache->prev_->next_ = cache->next_;
   }
   if (cache->next_) {
+    cache->next_->registry_lock().AssertAcquired();
     cache->next_->prev_ = cache->prev_;
   }
-  if (cache == list_head_) {
-    list_head_ = cache->next_;
+  if (cache == shard.list_head) {
+    shard.list_head = cache->next_;
+  }
+}
+
+template <typename Fn>
+void ThreadCacheRegistry::ForEachThreadCache(Fn fn) {
+  for (Shard& shard : shards_) {
+    internal::ScopedGuard scoped_locker(shard.lock);
+    for (ThreadCache* tcache = shard.list_head; tcache;
+         tcache = tcache->next_) {
+      // Same lock as `shard.lock`.
+      tcache->registry_lock().AssertAcquired();
+      fn(tcache);
+    }
+  }
+}
+
+size_t ThreadCacheRegistry::FlushObservedEvents(
+    PartitionAllocHooks::BufferedObserverHook* hook) {
+  internal::ScopedGuard flush_guard(g_observed_events_flush_lock);
+  size_t delivered = 0;
+
+  for (size_t i = 0; i < kMaxObservedEventsBatchesPerFlush; ++i) {
+    size_t count = 0;
+    // Emptied buffers of exited threads, freed once the lock is released.
+    internal::ObservedEventBuffer* drained = nullptr;
+    ForEachThreadCache([&](ThreadCache* tcache) {
+      if (count == kObservedEventsBatchSize) {
+        return;
+      }
+      if (auto* events =
+              tcache->observed_events_.load(std::memory_order_acquire)) {
+        count += events->Pop(g_observed_events_batch + count,
+                             kObservedEventsBatchSize - count);
+      }
+    });
+    {
+      internal::ScopedGuard scoped_locker(GetLock());
+      internal::ObservedEventBuffer** link = &retired_observed_events_;
+      while (*link && count < kObservedEventsBatchSize) {
+        internal::ObservedEventBuffer* events = *link;
+        count += events->Pop(g_observed_events_batch + count,
+                             kObservedEventsBatchSize - count);
+        if (events->empty()) {
+          *link = events->next_retired;
+          events->next_retired = drained;
+          drained = events;
+        } else {
+          link = &events->next_retired;
+        }
+      }
+    }
+
+    while (drained) {
+      internal::ObservedEventBuffer* next = drained->next_retired;
+      internal::DestroyAtInternalPartition(drained);
+      drained = next;
+    }
+
+    // Without any lock held, the hook may allocate.
+    if (count && hook) {
+      hook(g_observed_events_batch, count);
+      delivered += count;
+    }
+    if (count < kObservedEventsBatchSize) {
+      break;
+    }
+  }
+
+  return delivered;
+}
+
+void ThreadCacheRegistry::RetireObservedEvents(
+    internal::ObservedEventBuffer* events) {
+  {
+    internal::ScopedGuard scoped_locker(GetLock());
+    // Nothing else pushes to the buffer. The flushing thread pops from it with
+    // the lock of the registry shard held until the thread cache is
+    // unregistered, which ~ThreadCache() does before retiring the buffer, and
+    // with this lock held afterwards. So this doesn't race.
+    if (!events->empty()) {
+      events->next_retired = retired_observed_events_;
+      retired_observed_events_ = events;
+      return;
+    }
   }
+  internal::DestroyAtInternalPartition(events);
 }
 
 void ThreadCacheRegistry::DumpStats(bool my_thread_only,
-                                    ThreadCacheStats* stats) {
+                                    ThreadCacheStats* stats,
+                                    const PartitionRoot* root) {
   ThreadCache::EnsureThreadSpecificDataInitialized();
   memset(reinterpret_cast<void*>(stats), 0, sizeof(ThreadCacheStats));
 
-  internal::ScopedGuard scoped_locker(GetLock());
   if (my_thread_only) {
-    auto* tcache = ThreadCache::Get();
+    // Only this thread can destroy its own cache, no need to lock.
+    auto* tcache =
+        ThreadCache::Get(root ? root->settings.thread_cache_index : 0);
     if (!ThreadCache::IsValid(tcache)) {
       return;
     }
     tcache->AccumulateStats(stats);
   } else {
-    ThreadCache* tcache = list_head_;
-    while (tcache) {
+    ForEachThreadCache([&](ThreadCache* tcache) {
       // Racy, as other threads are still allocating. This is not an issue,
       // since we are only interested in statistics. However, this means that
       // count is not necessarily equal to hits + misses for the various types
       // of events.
-      tcache->AccumulateStats(stats);
-      tcache = tcache->next_;
-    }
+      if (!root || tcache->root_ == root) {
+        tcache->AccumulateStats(stats);
+      }
+    });
   }
 }
 
 void ThreadCacheRegistry::PurgeAll() {
-  auto* current_thread_tcache = ThreadCache::Get();
+  const auto current_thread_id = internal::base::PlatformThread::CurrentId();
 
   // May take a while, don't hold the lock while purging.
   //
@@ -153,31 +274,24 @@ void ThreadCacheRegistry::PurgeAll() {
   // the main thread for the partition lock, since it is acquired/released once
   // per bucket. By purging the main thread first, we avoid these interferences
   // for this thread at least.
-  if (ThreadCache::IsValid(current_thread_tcache)) {
-    current_thread_tcache->Purge();
-  }
+  ThreadCache::PurgeCurrentThread();
 
-  {
-    internal::ScopedGuard scoped_locker(GetLock());
-    ThreadCache* tcache = list_head_;
-    while (tcache) {
-      PA_DCHECK(ThreadCache::IsValid(tcache));
-      // Cannot purge directly, need to ask the other thread to purge "at some
-      // point".
-      // Note that this will not work if the other thread is sleeping forever.
-      // TODO(lizeb): Handle sleeping threads.
-      if (tcache != current_thread_tcache) {
-        tcache->SetShouldPurge();
-      }
-      tcache = tcache->next_;
+  ForEachThreadCache([&](ThreadCache* tcache) {
+    PA_DCHECK(ThreadCache::IsValid(tcache));
+    if (tcache->thread_id_ == current_thread_id) {
+      return;
     }
-  }
+    // Threads which said they are idle won't purge their cache any time soon,
+    // but can't touch it either, so do it for them. Otherwise, cannot purge
+    // directly, need to ask the other thread to purge "at some point".
+    if (!tcache->PurgeIfIdle()) {
+      tcache->SetShouldPurge();
+    }
+  });
 }
 
 void ThreadCacheRegistry::ForcePurgeAllThreadAfterForkUnsafe() {
-  internal::ScopedGuard scoped_locker(GetLock());
-  ThreadCache* tcache = list_head_;
-  while (tcache) {
+  ForEachThreadCache([](ThreadCache* tcache) {
 #if PA_BUILDFLAG(DCHECKS_ARE_ON)
     // Before fork(), locks are acquired in the parent process. This means that
     // a concurrent allocation in the parent which must be filled by the central
@@ -205,9 +319,7 @@ void ThreadCacheRegistry::ForcePurgeAllThreadAfterForkUnsafe() {
     // memory in some cases.
     //
     // see crbug.com/1289092 for details of the crashes.
-
-    tcache = tcache->next_;
-  }
+  });
 }
 
 void ThreadCacheRegistry::SetLargestActiveBucketIndex(
@@ -219,32 +331,27 @@ void ThreadCacheRegistry::SetThreadCacheMultiplier(float multiplier) {
   // Two steps:
   // - Set the global limits, which will affect newly created threads.
   // - Enumerate all thread caches and set the limit to the global one.
-  {
-    internal::ScopedGuard scoped_locker(GetLock());
-    ThreadCache* tcache = list_head_;
-
-    // If this is called before *any* thread cache has serviced *any*
-    // allocation, which can happen in tests, and in theory in non-test code as
-    // well.
-    if (!tcache) {
-      return;
+  //
+  // If this is called before *any* thread cache has serviced *any* allocation,
+  // which can happen in tests, and in theory in non-test code as well, there
+  // is nothing to do.
+  internal::ScopedGuard scoped_locker(GetLock());
+  bool global_limits_set = false;
+  ForEachThreadCache([&](ThreadCache* tcache) {
+    PA_DCHECK(ThreadCache::IsValid(tcache));
+    if (!global_limits_set) {
+      // Setting the global limit while locked, because we need
+      // |tcache->root_|.
+      ThreadCache::SetGlobalLimits(tcache->root_, multiplier);
+      global_limits_set = true;
     }
-
-    // Setting the global limit while locked, because we need |tcache->root_|.
-    ThreadCache::SetGlobalLimits(tcache->root_, multiplier);
-
-    while (tcache) {
-      PA_DCHECK(ThreadCache::IsValid(tcache));
-      for (int index = 0; index < ThreadCache::kBucketCount; index++) {
-        // This is racy, but we don't care if the limit is enforced later, and
-        // we really want to avoid atomic instructions on the fast path.
-        tcache->buckets_[index].limit.store(ThreadCache::global_limits_[index],
-                                            std::memory_order_relaxed);
-      }
-
-      tcache = tcache->next_;
+    for (int index = 0; index < ThreadCache::kBucketCount; index++) {
+      // This is racy, but we don't care if the limit is enforced later, and
+      // we really want to avoid atomic instructions on the fast path.
+      tcache->buckets_[index].limit.store(ThreadCache::global_limits_[index],
+                                          std::memory_order_relaxed);
     }
-  }
+  });
 }
 
 void ThreadCacheRegistry::SetPurgingConfiguration(
@@ -276,20 +383,16 @@ void ThreadCacheRegistry::RunPeriodicPurge() {
   // Since there is no synchronization with other threads, the value is stale,
   // which is fine.
   size_t cached_memory_approx = 0;
-  {
-    internal::ScopedGuard scoped_locker(GetLock());
-    ThreadCache* tcache = list_head_;
-    // Can run when there is no thread cache, in which case there is nothing to
-    // do, and the task should not be rescheduled. This would typically indicate
-    // a case where the thread cache was never enabled, or got disabled.
-    if (!tcache) {
-      return;
-    }
-
-    while (tcache) {
-      cached_memory_approx += tcache->cached_memory_;
-      tcache = tcache->next_;
-    }
+  bool has_thread_cache = false;
+  ForEachThreadCache([&](ThreadCache* tcache) {
+    cached_memory_approx += tcache->cached_memory_;
+    has_thread_cache = true;
+  });
+  // Can run when there is no thread cache, in which case there is nothing to
+  // do, and the task should not be rescheduled. This would typically indicate
+  // a case where the thread cache was never enabled, or got disabled.
+  if (!has_thread_cache) {
+    return;
   }
 
   // If cached memory is low, this means that either memory footprint is fine,
@@ -348,6 +451,9 @@ void ThreadCache::EnsureThreadSpecificDataInitialized() {
 
   bool ok = internal::PartitionTlsCreate(&internal::g_thread_cache_key, Delete);
   PA_CHECK(ok);
+  ok = internal::PartitionTlsCreate(&internal::g_secondary_thread_caches_key,
+                                    DeleteSecondary);
+  PA_CHECK(ok);
   g_thread_cache_key_created = true;
 }
 
@@ -401,8 +507,9 @@ void ThreadCache::Init(PartitionRoot* root) {
   if (!g_thread_cache_root.compare_exchange_strong(expected, root,
                                                    std::memory_order_seq_cst,
                                                    std::memory_order_seq_cst)) {
-    PA_CHECK(false)
-        << "Only one PartitionRoot is allowed to have a thread cache";
+    PA_CHECK(false) << "Only one PartitionRoot is allowed to have the primary "
+                       "thread cache, see "
+                       "PartitionOptions::secondary_thread_cache";
   }
 
 #if PA_BUILDFLAG(IS_WIN)
@@ -412,6 +519,59 @@ void ThreadCache::Init(PartitionRoot* root) {
   SetGlobalLimits(root, kDefaultMultiplier);
 }
 
+// static
+uint8_t ThreadCache::InitSecondary(PartitionRoot* root) {
+  // The largest active bucket may have changed since Init().
+  PA_CHECK(root->buckets[kBucketCount - 1].slot_size ==
+           ThreadCache::kLargeSizeThreshold);
+
+  EnsureThreadSpecificDataInitialized();
+
+  internal::ScopedGuard scoped_locker(ThreadCacheRegistry::GetLock());
+  size_t index = 0;
+  bool is_first = !g_thread_cache_root.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < internal::kMaxSecondaryThreadCaches; ++i) {
+    if (g_secondary_thread_cache_roots[i]) {
+      is_first = false;
+    } else if (!index) {
+      index = i + 1;
+    }
+  }
+  PA_CHECK(index) << "Too many PartitionRoots with a secondary thread cache";
+  g_secondary_thread_cache_roots[index - 1] = root;
+
+#if PA_BUILDFLAG(IS_WIN)
+  internal::PartitionTlsSetOnDllProcessDetach(OnDllProcessDetach);
+#endif
+
+  // The limits are shared by all thread caches. Don't override the ones set
+  // with ThreadCacheRegistry::SetThreadCacheMultiplier().
+  if (is_first) {
+    SetGlobalLimits(root, kDefaultMultiplier);
+  }
+  return static_cast<uint8_t>(index);
+}
+
+// static
+void ThreadCache::RemoveSecondaryForTesting(PartitionRoot* root) {
+  const size_t index = root->settings.thread_cache_index;
+  PA_CHECK(index);
+  ThreadCache* tcache = GetSecondary(index);
+  if (IsValid(tcache)) {
+    SetSecondary(index, nullptr);
+    delete tcache;
+  }
+
+  internal::ScopedGuard scoped_locker(ThreadCacheRegistry::GetLock());
+  ThreadCacheRegistry::Instance().ForEachThreadCache([&](ThreadCache* other) {
+    PA_CHECK(other->root_ != root)
+        << "A thread cache is still in use on another thread";
+  });
+  PA_CHECK(g_secondary_thread_cache_roots[index - 1] == root);
+  g_secondary_thread_cache_roots[index - 1] = nullptr;
+  root->settings.thread_cache_index = 0;
+}
+
 // static
 void ThreadCache::SetGlobalLimits(PartitionRoot* root, float multiplier) {
   size_t initial_value =
@@ -463,6 +623,16 @@ void ThreadCache::SetLargestCachedSize(size_t size) {
       largest_active_bucket_index_);
 }
 
+// static
+void ThreadCache::RaiseLargestCachedSize(size_t size) {
+  if (PartitionRoot::SizeToBucketIndex(
+          std::min(size, ThreadCache::kLargeSizeThreshold),
+          PartitionRoot::BucketDistribution::kNeutral) >
+      largest_active_bucket_index_) {
+    SetLargestCachedSize(size);
+  }
+}
+
 // static
 ThreadCache* ThreadCache::Create(PartitionRoot* root) {
   PA_CHECK(root);
@@ -474,6 +644,11 @@ ThreadCache* ThreadCache::Create(PartitionRoot* root) {
   // The internal partition does not use `ThreadCache`, so safe to depend on.
   ThreadCache* tcache = new ThreadCache(root);
 
+  if (const size_t index = root->settings.thread_cache_index) {
+    SetSecondary(index, tcache);
+    return tcache;
+  }
+
   // This may allocate.
   internal::PartitionTlsSet(internal::g_thread_cache_key, tcache);
 #if PA_CONFIG(THREAD_CACHE_FAST_TLS)
@@ -493,9 +668,15 @@ ThreadCache* ThreadCache::Create(PartitionRoot* root) {
 }
 
 ThreadCache::ThreadCache(PartitionRoot* root)
-    : should_purge_(false),
+    :
+#if PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+      gwp_asan_countdown_(GwpAsanSupport::NextSamplingCountdown()),
+#endif
+      should_purge_(false),
+      thread_alloc_stats_(),
       root_(root),
       thread_id_(internal::base::PlatformThread::CurrentId()),
+      registry_shard_(ThreadCacheRegistry::ShardIndex(thread_id_)),
       next_(nullptr),
       prev_(nullptr) {
   ThreadCacheRegistry::Instance().RegisterThreadCache(this);
@@ -525,6 +706,7 @@ ThreadCache::ThreadCache(PartitionRoot* root)
         .lock_required = false,
         .branch_capacity_in_bytes =
             root_->scheduler_loop_quarantine_branch_capacity_in_bytes,
+        .segregate_by_size = root_->scheduler_loop_quarantine_segregate_by_size,
     };
     scheduler_loop_quarantine_branch_.emplace(
         root_->GetSchedulerLoopQuarantineRoot().CreateBranch(
@@ -535,6 +717,9 @@ ThreadCache::ThreadCache(PartitionRoot* root)
 ThreadCache::~ThreadCache() {
   ThreadCacheRegistry::Instance().UnregisterThreadCache(this);
   Purge();
+  if (auto* events = observed_events_.load(std::memory_order_relaxed)) {
+    ThreadCacheRegistry::Instance().RetireObservedEvents(events);
+  }
 }
 
 // static
@@ -570,6 +755,61 @@ void ThreadCache::Delete(void* tcache_ptr) {
 #endif  // PA_BUILDFLAG(IS_WIN)
 }
 
+// static
+void ThreadCache::SetSecondary(size_t thread_cache_index, ThreadCache* tcache) {
+#if PA_CONFIG(THREAD_CACHE_FAST_TLS)
+  auto* table = internal::g_secondary_thread_caches;
+#else
+  auto* table = reinterpret_cast<internal::SecondaryThreadCaches*>(
+      internal::PartitionTlsGet(internal::g_secondary_thread_caches_key));
+#endif
+  // Not called once the thread is being terminated.
+  PA_DCHECK(!IsTombstone(reinterpret_cast<ThreadCache*>(table)));
+  if (!table) {
+    table = internal::ConstructAtInternalPartition<
+        internal::SecondaryThreadCaches>();
+    // This may allocate.
+    internal::PartitionTlsSet(internal::g_secondary_thread_caches_key, table);
+#if PA_CONFIG(THREAD_CACHE_FAST_TLS)
+    internal::g_secondary_thread_caches = table;
+#endif
+  }
+  table->caches[thread_cache_index - 1] = tcache;
+}
+
+// static
+void ThreadCache::DeleteSecondary(void* secondary_thread_caches_ptr) {
+  auto* table = static_cast<internal::SecondaryThreadCaches*>(
+      secondary_thread_caches_ptr);
+  if (!IsValid(reinterpret_cast<ThreadCache*>(table))) {
+    return;
+  }
+
+  // Frees from the deleted thread caches go to the central allocators.
+#if PA_CONFIG(THREAD_CACHE_FAST_TLS)
+  internal::g_secondary_thread_caches = nullptr;
+#else
+  internal::PartitionTlsSet(internal::g_secondary_thread_caches_key, nullptr);
+#endif
+
+  for (ThreadCache* tcache : table->caches) {
+    if (tcache) {
+      delete tcache;
+    }
+  }
+  internal::DestroyAtInternalPartition(table);
+
+#if PA_BUILDFLAG(IS_WIN)
+  // See Delete().
+  internal::PartitionTlsSet(internal::g_secondary_thread_caches_key,
+                            reinterpret_cast<void*>(kTombstone));
+#if PA_CONFIG(THREAD_CACHE_FAST_TLS)
+  internal::g_secondary_thread_caches =
+      reinterpret_cast<internal::SecondaryThreadCaches*>(kTombstone);
+#endif
+#endif  // PA_BUILDFLAG(IS_WIN)
+}
+
 // static
 void* ThreadCache::operator new(size_t count) {
   return internal::InternalAllocatorRoot().Alloc<AllocFlags::kNoHooks>(count);
@@ -583,6 +823,19 @@ ThreadCache::Bucket::Bucket() {
   limit.store(0, std::memory_order_relaxed);
 }
 
+void ThreadCache::Prefill(size_t bucket_index) {
+  ExitIdleIfNeeded();
+  PA_REENTRANCY_GUARD(is_in_thread_cache_);
+  if (bucket_index > largest_active_bucket_index_) {
+    return;
+  }
+  const Bucket& bucket = buckets_[bucket_index];
+  if (bucket.freelist_head || !bucket.limit.load(std::memory_order_relaxed)) {
+    return;
+  }
+  FillBucket(bucket_index);
+}
+
 void ThreadCache::FillBucket(size_t bucket_index) {
   // Filling multiple elements from the central allocator at a time has several
   // advantages:
@@ -620,7 +873,7 @@ void ThreadCache::FillBucket(size_t bucket_index) {
   //
   // In these cases, we do not really batch bucket filling, but this is expected
   // to be used for the largest buckets, where over-allocating is not advised.
-  int count = std::max(
+  size_t count = std::max<size_t>(
       1, bucket.limit.load(std::memory_order_relaxed) / kBatchFillRatio);
 
   size_t usable_size;
@@ -632,7 +885,25 @@ void ThreadCache::FillBucket(size_t bucket_index) {
   size_t allocated_slots = 0;
   // Same as calling RawAlloc() |count| times, but acquires the lock only once.
   internal::ScopedGuard guard(internal::PartitionRootLock(root_));
-  for (int i = 0; i < count; i++) {
+  while (allocated_slots < count) {
+    // Right after a slot span turnover, slots are provisioned one system page
+    // at a time. Take them in bulk rather than building the slot span freelist
+    // and popping it entry by entry.
+    constexpr size_t kMaxFillCount =
+        std::numeric_limits<uint8_t>::max() / kBatchFillRatio + 1;
+    uintptr_t provisioned_slots[kMaxFillCount];
+    size_t provisioned_count = root_->AllocProvisionedSlotsFromBucket(
+        &root_->buckets[bucket_index], provisioned_slots,
+        std::min(count - allocated_slots, kMaxFillCount));
+    if (provisioned_count) {
+      // In reverse order, so that the cache hands them out in address order.
+      for (size_t i = provisioned_count; i > 0; i--) {
+        PutInBucket(bucket, provisioned_slots[i - 1]);
+      }
+      allocated_slots += provisioned_count;
+      continue;
+    }
+
     // Thread cache fill should not trigger expensive operations, to not grab
     // the lock for a long time needlessly, but also to not inflate memory
     // usage. Indeed, without AllocFlags::kFastPathOrReturnNull, cache
@@ -824,21 +1095,74 @@ void ThreadCache::SetShouldPurge() {
 }
 
 void ThreadCache::Purge() {
+  ExitIdleIfNeeded();
   PA_REENTRANCY_GUARD(is_in_thread_cache_);
   PurgeInternal();
 }
 
 void ThreadCache::TryPurge() {
+  ExitIdleIfNeeded();
   PA_REENTRANCY_GUARD(is_in_thread_cache_);
   PurgeInternalHelper<false>();
 }
 
+// static
+void ThreadCache::MarkCurrentThreadIdle() {
+  auto* tcache = Get();
+  if (IsValid(tcache)) {
+    // Release: the purging thread must see the buckets as they are now.
+    tcache->idle_state_.store(IdleState::kIdle, std::memory_order_release);
+  }
+  for (size_t index = 1; index <= internal::kMaxSecondaryThreadCaches;
+       ++index) {
+    tcache = GetSecondary(index);
+    if (IsValid(tcache)) {
+      tcache->idle_state_.store(IdleState::kIdle, std::memory_order_release);
+    }
+  }
+}
+
+bool ThreadCache::PurgeIfIdle() {
+  IdleState expected = IdleState::kIdle;
+  if (!idle_state_.compare_exchange_strong(expected, IdleState::kPurging,
+                                           std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+    return false;
+  }
+  PA_REENTRANCY_GUARD(is_in_thread_cache_);
+  PurgeInternal();
+  idle_state_.store(IdleState::kIdle, std::memory_order_release);
+  return true;
+}
+
+void ThreadCache::ExitIdle() {
+  IdleState expected = IdleState::kIdle;
+  // Acquire: the buckets may have been purged by another thread.
+  while (!idle_state_.compare_exchange_weak(expected, IdleState::kActive,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+    if (expected == IdleState::kPurging) {
+      // The purging thread holds the lock until it is done.
+      internal::ScopedGuard wait(
+          ThreadCacheRegistry::GetShardLock(registry_shard_));
+    }
+    expected = IdleState::kIdle;
+  }
+}
+
 // static
 void ThreadCache::PurgeCurrentThread() {
   auto* tcache = Get();
   if (IsValid(tcache)) {
     tcache->Purge();
   }
+  for (size_t index = 1; index <= internal::kMaxSecondaryThreadCaches;
+       ++index) {
+    tcache = GetSecondary(index);
+    if (IsValid(tcache)) {
+      tcache->Purge();
+    }
+  }
 }
 
 void ThreadCache::PurgeInternal() {
@@ -849,6 +1173,32 @@ void ThreadCache::ResetPerThreadAllocationStatsForTesting() {
   thread_alloc_stats_ = {};
 }
 
+void ThreadCache::RecordObservedEvent(
+    uintptr_t slot_start,
+    size_t size,
+    PartitionAllocHooks::BufferedObserverEvent::Type type) {
+  auto* events = observed_events_.load(std::memory_order_relaxed);
+  if (!events) [[unlikely]] {
+    // Not reentrant: the internal partition has no thread cache.
+    events = internal::ConstructAtInternalPartition<
+        internal::ObservedEventBuffer>();
+    observed_events_.store(events, std::memory_order_release);
+  }
+  if (!events->Push({root_->SlotStartToObjectAddr(slot_start), size,
+                     thread_id_, type})) [[unlikely]] {
+    PartitionAllocHooks::RecordBufferedObserverDroppedEvent();
+  }
+}
+
+#if PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+void* ThreadCache::AllocSampledForGwpAsan(size_t size, size_t alignment) {
+  // Restart the countdown first, `alloc_fn` may allocate.
+  gwp_asan_countdown_ = GwpAsanSupport::NextSamplingCountdown();
+  auto* alloc_fn = GwpAsanSupport::GetSampledAllocFn();
+  return alloc_fn ? alloc_fn(root_, size, alignment) : nullptr;
+}
+#endif  // PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+
 template <bool crash_on_corruption>
 void ThreadCache::PurgeInternalHelper() {
   should_purge_.store(false, std::memory_order_relaxed);
@@ -5,11 +5,13 @@
 #ifndef PARTITION_ALLOC_THREAD_CACHE_H_
 #define PARTITION_ALLOC_THREAD_CACHE_H_
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <limits>
 #include <memory>
 #include <optional>
+#include <tuple>
 
 #include "partition_alloc/build_config.h"
 #include "partition_alloc/buildflags.h"
@@ -22,16 +24,13 @@
 #include "partition_alloc/partition_alloc_config.h"
 #include "partition_alloc/partition_alloc_constants.h"
 #include "partition_alloc/partition_alloc_forward.h"
+#include "partition_alloc/partition_alloc_hooks.h"
 #include "partition_alloc/partition_bucket_lookup.h"
 #include "partition_alloc/partition_freelist_entry.h"
 #include "partition_alloc/partition_lock.h"
 #include "partition_alloc/partition_stats.h"
 #include "partition_alloc/partition_tls.h"
 
-#if PA_BUILDFLAG(PA_ARCH_CPU_X86_64) && PA_BUILDFLAG(HAS_64_BIT_POINTERS)
-#include <algorithm>
-#endif
-
 namespace partition_alloc {
 
 class ThreadCache;
@@ -70,13 +69,29 @@ class ThreadCacheInspector;
 
 namespace internal {
 
+// Maximum number of partitions with a secondary thread cache, see
+// PartitionOptions::secondary_thread_cache.
+constexpr size_t kMaxSecondaryThreadCaches = 8;
+
+// Thread caches of the partitions with a secondary thread cache, for a given
+// thread, indexed by PartitionRoot::Settings::thread_cache_index - 1.
+struct SecondaryThreadCaches {
+  ThreadCache* caches[kMaxSecondaryThreadCaches] = {};
+};
+
 extern PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionTlsKey g_thread_cache_key;
+extern PA_COMPONENT_EXPORT(PARTITION_ALLOC) PartitionTlsKey
+    g_secondary_thread_caches_key;
 
 #if PA_CONFIG(THREAD_CACHE_FAST_TLS)
 extern PA_COMPONENT_EXPORT(
     PARTITION_ALLOC) thread_local ThreadCache* g_thread_cache;
+extern PA_COMPONENT_EXPORT(PARTITION_ALLOC) thread_local SecondaryThreadCaches*
+    g_secondary_thread_caches;
 #endif
 
+class ObservedEventBuffer;
+
 }  // namespace internal
 
 constexpr internal::base::TimeDelta kMinPurgeInterval =
@@ -94,6 +109,12 @@ constexpr size_t kMinCachedMemoryForPurgingBytes = 500 * 1024;
 // allocator. However the other members can allocate.
 class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCacheRegistry {
  public:
+  // Thread caches are spread over this many lists, by thread, each with its own
+  // lock. This way, threads starting and exiting don't all contend on a single
+  // lock, nor with walks over all the thread caches, which only hold one of the
+  // locks at a time.
+  static constexpr size_t kShardCount = 16;
+
   static ThreadCacheRegistry& Instance();
   // Do not instantiate.
   //
@@ -112,10 +133,15 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCacheRegistry {
 
   void RegisterThreadCache(ThreadCache* cache);
   void UnregisterThreadCache(ThreadCache* cache);
-  // Prints statistics for all thread caches, or this thread's only.
-  void DumpStats(bool my_thread_only, ThreadCacheStats* stats);
-  // Purge() this thread's cache, and asks the other ones to trigger Purge() at
-  // a later point (during a deallocation).
+  // Prints statistics for all thread caches, or this thread's only. Only
+  // counts the thread caches of `root` if it is not nullptr, otherwise the
+  // primary thread cache for `my_thread_only`.
+  void DumpStats(bool my_thread_only,
+                 ThreadCacheStats* stats,
+                 const PartitionRoot* root = nullptr);
+  // Purge() this thread's cache, and the ones of idle threads (see
+  // |ThreadCache::MarkCurrentThreadIdle()|). Asks the other ones to trigger
+  // Purge() at a later point (during a deallocation).
   void PurgeAll();
 
   // Runs `PurgeAll` and updates the next interval which
@@ -131,6 +157,11 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCacheRegistry {
   // Controls the thread cache size, by setting the multiplier to a value above
   // or below |ThreadCache::kDefaultMultiplier|.
   void SetThreadCacheMultiplier(float multiplier);
+  // Hands the events buffered by all threads to `hook`, or drops them if it is
+  // nullptr. See PartitionAllocHooks::FlushBufferedObserverEvents().
+  size_t FlushObservedEvents(PartitionAllocHooks::BufferedObserverHook* hook);
+  // Keeps the events of an exiting thread until they are flushed.
+  void RetireObservedEvents(internal::ObservedEventBuffer* events);
   void SetLargestActiveBucketIndex(uint16_t largest_active_bucket_index);
 
   // Controls the thread cache purging configuration.
@@ -154,6 +185,12 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCacheRegistry {
   bool is_purging_configured() const { return is_purging_configured_; }
 
   static internal::Lock& GetLock() { return Instance().lock_; }
+  // Lock of one of the lists of thread caches. When both are held, GetLock()
+  // is acquired first. Purging idle thread caches returns their memory with it
+  // held, so it is acquired before partition locks, and never under one.
+  static internal::Lock& GetShardLock(size_t index) {
+    return Instance().shards_[index].lock;
+  }
   // Purges all thread caches *now*. This is completely thread-unsafe, and
   // should only be called in a post-fork() handler.
   void ForcePurgeAllThreadAfterForkUnsafe();
@@ -161,12 +198,28 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCacheRegistry {
   void ResetForTesting();
 
  private:
+  friend class ThreadCache;
   friend class tools::ThreadCacheInspector;
   friend class tools::HeapDumper;
 
+  struct alignas(internal::kPartitionCachelineSize) Shard {
+    internal::Lock lock;
+    ThreadCache* list_head PA_GUARDED_BY(lock) = nullptr;
+  };
+
+  static size_t ShardIndex(internal::base::PlatformThreadId thread_id) {
+    return static_cast<size_t>(thread_id) % kShardCount;
+  }
+  // Calls `fn` on every registered thread cache, with the lock of its shard
+  // held.
+  template <typename Fn>
+  void ForEachThreadCache(Fn fn);
+
   // Not using base::Lock as the object's constructor must be constexpr.
   internal::Lock lock_;
-  ThreadCache* list_head_ PA_GUARDED_BY(GetLock()) = nullptr;
+  Shard shards_[kShardCount];
+  internal::ObservedEventBuffer* retired_observed_events_
+      PA_GUARDED_BY(GetLock()) = nullptr;
   bool periodic_purge_is_initialized_ = false;
   internal::base::TimeDelta min_purge_interval_;
   internal::base::TimeDelta max_purge_interval_;
@@ -181,6 +234,59 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCacheRegistry {
 
 constexpr ThreadCacheRegistry::ThreadCacheRegistry() = default;
 
+namespace internal {
+
+// Events recorded by a thread for the buffered observer hook, see
+// PartitionAllocHooks::SetBufferedObserverHook(). Lock-free, with a single
+// producer, the thread, and a single consumer, the flushing thread.
+class ObservedEventBuffer {
+ public:
+  using Event = PartitionAllocHooks::BufferedObserverEvent;
+  static constexpr size_t kCapacity = 512;
+
+  // Producer side. Returns false if the buffer is full.
+  PA_ALWAYS_INLINE bool Push(const Event& event) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+      return false;
+    }
+    events_[tail % kCapacity] = event;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Moves up to `max_count` of the oldest events to `out`, and
+  // returns how many.
+  size_t Pop(Event* out, size_t max_count) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t count =
+        std::min(tail_.load(std::memory_order_acquire) - head, max_count);
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = events_[(head + i) % kCapacity];
+    }
+    head_.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  // Buffers of exited threads, not yet flushed. Guarded by
+  // ThreadCacheRegistry::GetLock() while on the registry's list.
+  ObservedEventBuffer* next_retired = nullptr;
+
+ private:
+  // The events keep the indices, which are written by different threads, on
+  // different cache lines.
+  std::atomic<size_t> head_{0};
+  Event events_[kCapacity];
+  std::atomic<size_t> tail_{0};
+};
+
+}  // namespace internal
+
 #if PA_CONFIG(THREAD_CACHE_ENABLE_STATISTICS)
 #define PA_INCREMENT_COUNTER(counter) ++counter
 #else
@@ -244,8 +350,15 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
   // with the thread cache disabled on the partition side, and without the
   // partition lock held.
   //
-  // May only be called by a single PartitionRoot.
+  // May only be called by a single PartitionRoot, which gets the primary thread
+  // cache, with a TLS slot of its own.
   static void Init(PartitionRoot* root);
+  // Same as Init(), for a partition with a secondary thread cache. Returns its
+  // index in the per-thread table of secondary thread caches, plus one.
+  static uint8_t InitSecondary(PartitionRoot* root);
+  // Deletes this thread's secondary thread cache for |root|, and makes its
+  // index available again. Other threads must not have one.
+  static void RemoveSecondaryForTesting(PartitionRoot* root);
 
   static void DeleteForTesting(ThreadCache* tcache);
 
@@ -269,6 +382,32 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
 #endif
   }
 
+  // Thread cache of the partition with `thread_cache_index`, see
+  // PartitionRoot::Settings.
+  PA_ALWAYS_INLINE static ThreadCache* Get(size_t thread_cache_index) {
+    if (!thread_cache_index) [[likely]] {
+      return Get();
+    }
+    return GetSecondary(thread_cache_index);
+  }
+
+  static ThreadCache* GetSecondary(size_t thread_cache_index) {
+    PA_DCHECK(thread_cache_index &&
+              thread_cache_index <= internal::kMaxSecondaryThreadCaches);
+#if PA_CONFIG(THREAD_CACHE_FAST_TLS)
+    auto* table = internal::g_secondary_thread_caches;
+#else
+    // This region isn't MTE-tagged.
+    auto* table = reinterpret_cast<internal::SecondaryThreadCaches*>(
+        internal::PartitionTlsGet(internal::g_secondary_thread_caches_key));
+#endif
+    // nullptr or kTombstone, which have the same meaning for the table.
+    if (!(reinterpret_cast<uintptr_t>(table) & kTombstoneMask)) [[unlikely]] {
+      return reinterpret_cast<ThreadCache*>(table);
+    }
+    return table->caches[thread_cache_index - 1];
+  }
+
   static bool IsValid(ThreadCache* tcache) {
     // Do not MTE-untag, as it'd mess up the sentinel value.
     return reinterpret_cast<uintptr_t>(tcache) & kTombstoneMask;
@@ -311,6 +450,12 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
   PA_ALWAYS_INLINE uintptr_t GetFromCache(size_t bucket_index,
                                           size_t* slot_size);
 
+  // Fills the bucket at |bucket_index| if it is empty, as the next allocation
+  // from it would. Does nothing if the bucket isn't cached. See
+  // PartitionRoot::Warmup().
+  // The Partition lock must *not* be held when calling this.
+  void Prefill(size_t bucket_index);
+
   // Asks this cache to trigger |Purge()| at a later point. Can be called from
   // any thread.
   void SetShouldPurge();
@@ -326,8 +471,13 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
   size_t CachedMemory() const;
   void AccumulateStats(ThreadCacheStats* stats) const;
 
-  // Purge the thread cache of the current thread, if one exists.
+  // Purge the thread caches of the current thread, if any exists.
   static void PurgeCurrentThread();
+  // Tells that the current thread is about to be idle for a while, e.g.
+  // blocked in epoll_wait(). Until it allocates or frees memory again, other
+  // threads may purge its thread caches, see |ThreadCacheRegistry::PurgeAll()|.
+  // Otherwise, a thread only purges its own cache, when it is next active.
+  static void MarkCurrentThreadIdle();
 
   const ThreadAllocStats& thread_alloc_stats() const {
     return thread_alloc_stats_;
@@ -342,6 +492,8 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
   // cache. This applies to all threads. However, the maximum size is bounded by
   // |kLargeSizeThreshold|.
   static void SetLargestCachedSize(size_t size);
+  // Same as SetLargestCachedSize(), but never lowers the maximum size.
+  static void RaiseLargestCachedSize(size_t size);
 
   // Cumulative stats about *all* allocations made on the `root_` partition on
   // this thread, that is not only the allocations serviced by the thread cache,
@@ -350,10 +502,24 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
   // cache is the only per-thread data we have as of now.
   //
   // TODO(lizeb): Investigate adding a proper per-thread data structure.
-  PA_ALWAYS_INLINE void RecordAllocation(size_t size);
-  PA_ALWAYS_INLINE void RecordDeallocation(size_t size);
+  //
+  // Also buffers the events for the buffered observer hook, when it is set.
+  PA_ALWAYS_INLINE void RecordAllocation(uintptr_t slot_start, size_t size);
+  PA_ALWAYS_INLINE void RecordDeallocation(uintptr_t slot_start, size_t size);
   void ResetPerThreadAllocationStatsForTesting();
 
+#if PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+  // Counts allocations down to the next one sampled for GWP-ASan. Only touches
+  // this cache, so that the allocations which aren't sampled pay next to
+  // nothing. See GwpAsanSupport::SetSampler().
+  PA_ALWAYS_INLINE bool ShouldSampleForGwpAsan() {
+    return !--gwp_asan_countdown_;
+  }
+  // Restarts the countdown, and returns an allocation of `size` bytes aligned
+  // on `alignment` from GWP-ASan, or nullptr if it is disabled or declines.
+  PA_NOINLINE void* AllocSampledForGwpAsan(size_t size, size_t alignment);
+#endif  // PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+
   // Fill 1 / kBatchFillRatio * bucket.limit slots at a time.
   static constexpr uint16_t kBatchFillRatio = 8;
 
@@ -372,13 +538,18 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
       "Cannot have more cached buckets than what the allocator supports");
 
   const ThreadCache* prev_for_testing() const
-      PA_EXCLUSIVE_LOCKS_REQUIRED(ThreadCacheRegistry::GetLock()) {
+      PA_EXCLUSIVE_LOCKS_REQUIRED(registry_lock()) {
     return prev_;
   }
   const ThreadCache* next_for_testing() const
-      PA_EXCLUSIVE_LOCKS_REQUIRED(ThreadCacheRegistry::GetLock()) {
+      PA_EXCLUSIVE_LOCKS_REQUIRED(registry_lock()) {
     return next_;
   }
+  size_t registry_shard_for_testing() const { return registry_shard_; }
+  internal::Lock& registry_lock_for_testing() const
+      PA_LOCK_RETURNED(registry_lock()) {
+    return registry_lock();
+  }
 
   ThreadCacheStats& stats_for_testing() { return stats_; }
 
@@ -400,11 +571,29 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
 
   explicit ThreadCache(PartitionRoot* root);
   static void Delete(void* thread_cache_ptr);
+  static void DeleteSecondary(void* secondary_thread_caches_ptr);
+  static void SetSecondary(size_t thread_cache_index, ThreadCache* tcache);
 
   static void* operator new(size_t count);
   static void operator delete(void* ptr);
 
+  // Lock of the registry shard this thread cache is on.
+  internal::Lock& registry_lock() const
+      PA_LOCK_RETURNED(ThreadCacheRegistry::GetShardLock(registry_shard_)) {
+    return ThreadCacheRegistry::GetShardLock(registry_shard_);
+  }
+
   void PurgeInternal();
+  // Purges the cache of an idle thread, from another thread. Returns false if
+  // the owning thread is not idle. Requires the lock of the registry shard.
+  bool PurgeIfIdle();
+  // Called by the owning thread before touching the buckets.
+  PA_ALWAYS_INLINE void ExitIdleIfNeeded();
+  void ExitIdle();
+  PA_NOINLINE void RecordObservedEvent(
+      uintptr_t slot_start,
+      size_t size,
+      PartitionAllocHooks::BufferedObserverEvent::Type type);
   template <bool crash_on_corruption>
   void PurgeInternalHelper();
 
@@ -444,7 +633,18 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
 
   // These are at the beginning as they're accessed for each allocation.
   uint32_t cached_memory_ = 0;
+#if PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+  uint32_t gwp_asan_countdown_;
+#endif
   std::atomic<bool> should_purge_;
+  enum class IdleState : uint8_t {
+    kActive,
+    // Set by the owning thread, the buckets can be purged by another thread.
+    kIdle,
+    // Another thread is purging the buckets.
+    kPurging,
+  };
+  std::atomic<IdleState> idle_state_{IdleState::kActive};
   ThreadCacheStats stats_;
   ThreadAllocStats thread_alloc_stats_;
 
@@ -460,13 +660,20 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
 #endif
 
   // Intrusive list since ThreadCacheRegistry::RegisterThreadCache() cannot
-  // allocate.
-  ThreadCache* next_ PA_GUARDED_BY(ThreadCacheRegistry::GetLock());
-  ThreadCache* prev_ PA_GUARDED_BY(ThreadCacheRegistry::GetLock());
+  // allocate. All the thread caches on a list share the lock of its shard,
+  // which the thread safety analysis can't infer from the links: code walking
+  // the list asserts it for each thread cache, see
+  // ThreadCacheRegistry::ForEachThreadCache().
+  const size_t registry_shard_;
+  ThreadCache* next_ PA_GUARDED_BY(registry_lock());
+  ThreadCache* prev_ PA_GUARDED_BY(registry_lock());
 
   std::optional<internal::LightweightQuarantineBranch>
       scheduler_loop_quarantine_branch_;
 
+  // Allocated on the first event, read by the flushing thread.
+  std::atomic<internal::ObservedEventBuffer*> observed_events_{nullptr};
+
   friend class ThreadCacheRegistry;
   friend class PartitionAllocThreadCacheTest;
   friend class tools::ThreadCacheInspector;
@@ -475,6 +682,7 @@ class PA_COMPONENT_EXPORT(PARTITION_ALLOC) ThreadCache {
 PA_ALWAYS_INLINE std::optional<size_t> ThreadCache::MaybePutInCache(
     uintptr_t slot_start,
     size_t bucket_index) {
+  ExitIdleIfNeeded();
   PA_REENTRANCY_GUARD(is_in_thread_cache_);
   PA_INCREMENT_COUNTER(stats_.cache_fill_count);
 
@@ -508,8 +716,17 @@ PA_ALWAYS_INLINE std::optional<size_t> ThreadCache::MaybePutInCache(
   return bucket.slot_size;
 }
 
+PA_ALWAYS_INLINE void ThreadCache::ExitIdleIfNeeded() {
+  // Only this thread leaves kActive, no need for more than a relaxed load.
+  if (idle_state_.load(std::memory_order_relaxed) != IdleState::kActive)
+      [[unlikely]] {
+    ExitIdle();
+  }
+}
+
 PA_ALWAYS_INLINE uintptr_t ThreadCache::GetFromCache(size_t bucket_index,
                                                      size_t* slot_size) {
+  ExitIdleIfNeeded();
 #if PA_CONFIG(THREAD_CACHE_ALLOC_STATS)
   stats_.allocs_per_bucket_[bucket_index]++;
 #endif
@@ -573,6 +790,22 @@ PA_ALWAYS_INLINE uintptr_t ThreadCache::GetFromCache(size_t bucket_index,
   bucket.count--;
   PA_DCHECK(bucket.count != 0 || !next);
   bucket.freelist_head = next;
+
+#if PA_CONFIG(THREAD_CACHE_PREFETCH_NEXT_NEXT)
+  // |next| was prefetched by the previous allocation from this bucket, as its
+  // next-next entry, so reading it is likely a cache hit. |GetNext()| then
+  // prefetches the entry it points to, which the allocation after the next one
+  // will touch.
+  if (next) {
+#if PA_BUILDFLAG(USE_FREELIST_DISPATCHER)
+    std::ignore =
+        freelist_dispatcher->GetNextForThreadCacheTrue(next, bucket.slot_size);
+#else
+    std::ignore = freelist_dispatcher->GetNextForThreadCache<true>(
+        next, bucket.slot_size);
+#endif  // PA_BUILDFLAG(USE_FREELIST_DISPATCHER)
+  }
+#endif  // PA_CONFIG(THREAD_CACHE_PREFETCH_NEXT_NEXT)
   *slot_size = bucket.slot_size;
 
   PA_DCHECK(cached_memory_ >= bucket.slot_size);
@@ -641,14 +874,26 @@ PA_ALWAYS_INLINE void ThreadCache::PutInBucket(Bucket& bucket,
   bucket.count++;
 }
 
-PA_ALWAYS_INLINE void ThreadCache::RecordAllocation(size_t size) {
+PA_ALWAYS_INLINE void ThreadCache::RecordAllocation(uintptr_t slot_start,
+                                                   size_t size) {
   thread_alloc_stats_.alloc_count++;
   thread_alloc_stats_.alloc_total_size += size;
+  if (PartitionAllocHooks::IsBufferedObserverHookEnabled()) [[unlikely]] {
+    RecordObservedEvent(
+        slot_start, size,
+        PartitionAllocHooks::BufferedObserverEvent::Type::kAllocation);
+  }
 }
 
-PA_ALWAYS_INLINE void ThreadCache::RecordDeallocation(size_t size) {
+PA_ALWAYS_INLINE void ThreadCache::RecordDeallocation(uintptr_t slot_start,
+                                                     size_t size) {
   thread_alloc_stats_.dealloc_count++;
   thread_alloc_stats_.dealloc_total_size += size;
+  if (PartitionAllocHooks::IsBufferedObserverHookEnabled()) [[unlikely]] {
+    RecordObservedEvent(
+        slot_start, size,
+        PartitionAllocHooks::BufferedObserverEvent::Type::kFree);
+  }
 }
 
 }  // namespace partition_alloc
@@ -0,0 +1,146 @@
+// Copyright 2026 The Chromium Authors
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "partition_alloc/thread_cache.h"
+
+#include <atomic>
+#include <string>
+
+#include "base/timer/lap_timer.h"
+#include "partition_alloc/build_config.h"
+#include "partition_alloc/buildflags.h"
+#include "partition_alloc/extended_api.h"
+#include "partition_alloc/partition_alloc_base/threading/platform_thread_for_testing.h"
+#include "partition_alloc/partition_alloc_base/time/time.h"
+#include "partition_alloc/partition_alloc_check.h"
+#include "partition_alloc/partition_alloc_config.h"
+#include "partition_alloc/partition_alloc_for_testing.h"
+#include "partition_alloc/partition_root.h"
+#include "partition_alloc/partition_stats.h"
+#include "testing/gtest/include/gtest/gtest.h"
+#include "testing/perf/perf_result_reporter.h"
+
+#if !defined(MEMORY_TOOL_REPLACES_ALLOCATOR) && \
+    PA_CONFIG(THREAD_CACHE_SUPPORTED)
+
+namespace partition_alloc::internal {
+
+namespace {
+
+constexpr int kWarmupRuns = 1;
+constexpr ::base::TimeDelta kTimeLimit = ::base::Seconds(2);
+constexpr int kTimeCheckInterval = 1;
+
+constexpr char kMetricPrefixThreadCacheRegistry[] = "ThreadCacheRegistry.";
+constexpr char kMetricThroughput[] = "throughput";
+constexpr char kMetricLatency[] = "latency_per_thread_us";
+
+// Number of short-lived threads running at once, each of which creates,
+// registers, then unregisters a thread cache. Every lap starts and joins this
+// many of them, so a run goes through thousands of threads.
+constexpr size_t kThreadsPerLap = 32;
+
+perf_test::PerfResultReporter SetUpReporter(const std::string& story_name) {
+  perf_test::PerfResultReporter reporter(kMetricPrefixThreadCacheRegistry,
+                                         story_name);
+  reporter.RegisterImportantMetric(kMetricThroughput, "threads/s");
+  reporter.RegisterImportantMetric(kMetricLatency, "us");
+  return reporter;
+}
+
+class ShortLivedThread : public base::PlatformThreadForTesting::Delegate {
+ public:
+  void Start(PartitionRoot* root) {
+    root_ = root;
+    PA_CHECK(base::PlatformThreadForTesting::Create(0, this, &handle_));
+  }
+  void Join() { base::PlatformThreadForTesting::Join(handle_); }
+
+  void ThreadMain() override {
+    // Creates the thread cache, destroyed when the thread exits.
+    root_->Free(root_->Alloc(64, ""));
+  }
+
+ private:
+  PartitionRoot* root_ = nullptr;
+  base::PlatformThreadHandle handle_;
+};
+
+// Walks the registry in a loop, as periodic purges and stats dumps do.
+class RegistryWalkerThread : public base::PlatformThreadForTesting::Delegate {
+ public:
+  explicit RegistryWalkerThread(PartitionRoot* root) : root_(root) {
+    PA_CHECK(base::PlatformThreadForTesting::Create(0, this, &handle_));
+  }
+
+  void Stop() {
+    stop_.store(true, std::memory_order_relaxed);
+    base::PlatformThreadForTesting::Join(handle_);
+  }
+
+  void ThreadMain() override {
+    ThreadCacheStats stats;
+    while (!stop_.load(std::memory_order_relaxed)) {
+      ThreadCacheRegistry::Instance().PurgeAll();
+      ThreadCacheRegistry::Instance().DumpStats(false, &stats, root_);
+    }
+  }
+
+ private:
+  PartitionRoot* const root_;
+  base::PlatformThreadHandle handle_;
+  std::atomic<bool> stop_{false};
+};
+
+class ThreadCacheRegistryPerfTest : public testing::Test {
+ protected:
+  static PartitionOptions Options() {
+    PartitionOptions opts;
+#if !PA_BUILDFLAG(USE_PARTITION_ALLOC_AS_MALLOC)
+    opts.thread_cache = PartitionOptions::kEnabled;
+#endif
+    return opts;
+  }
+
+  void RunTest(const char* story_name) {
+    ::base::LapTimer timer(kWarmupRuns, kTimeLimit, kTimeCheckInterval);
+    do {
+      for (ShortLivedThread& thread : threads_) {
+        thread.Start(root());
+      }
+      for (ShortLivedThread& thread : threads_) {
+        thread.Join();
+      }
+      timer.NextLap();
+    } while (!timer.HasTimeLimitExpired());
+
+    auto reporter = SetUpReporter(story_name);
+    const double threads_per_second = kThreadsPerLap * timer.LapsPerSecond();
+    reporter.AddResult(kMetricThroughput, threads_per_second);
+    reporter.AddResult(kMetricLatency, 1e6 / threads_per_second);
+  }
+
+  PartitionRoot* root() { return allocator_.root(); }
+
+  PartitionAllocatorForTesting<DisallowLeaks> allocator_{Options()};
+  ThreadCacheProcessScopeForTesting scope_{allocator_.root()};
+  ShortLivedThread threads_[kThreadsPerLap];
+};
+
+}  // namespace
+
+TEST_F(ThreadCacheRegistryPerfTest, ThreadChurn) {
+  RunTest("thread_churn");
+}
+
+TEST_F(ThreadCacheRegistryPerfTest, ThreadChurnWithRegistryWalks) {
+  RegistryWalkerThread walker(root());
+  RunTest("thread_churn_with_registry_walks");
+  walker.Stop();
+}
+
+}  // namespace partition_alloc::internal
+
+#endif  // !defined(MEMORY_TOOL_REPLACES_ALLOCATOR) &&
+        // PA_CONFIG(THREAD_CACHE_SUPPORTED)
@@ -6,17 +6,22 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cstring>
+#include <iterator>
 #include <vector>
 
 #include "partition_alloc/build_config.h"
 #include "partition_alloc/buildflags.h"
 #include "partition_alloc/extended_api.h"
+#include "partition_alloc/gwp_asan_support.h"
 #include "partition_alloc/internal_allocator.h"
 #include "partition_alloc/partition_address_space.h"
 #include "partition_alloc/partition_alloc_base/thread_annotations.h"
+#include "partition_alloc/partition_alloc_base/threading/platform_thread.h"
 #include "partition_alloc/partition_alloc_base/threading/platform_thread_for_testing.h"
 #include "partition_alloc/partition_alloc_config.h"
 #include "partition_alloc/partition_alloc_for_testing.h"
+#include "partition_alloc/partition_alloc_hooks.h"
 #include "partition_alloc/partition_freelist_entry.h"
 #include "partition_alloc/partition_lock.h"
 #include "partition_alloc/partition_root.h"
@@ -89,6 +94,8 @@ std::unique_ptr<PartitionAllocatorForTesting> CreateAllocator(
 #if !PA_BUILDFLAG(USE_PARTITION_ALLOC_AS_MALLOC)
   opts.thread_cache = PartitionOptions::kEnabled;
 #endif  // PA_BUILDFLAG(USE_PARTITION_ALLOC_AS_MALLOC)
+  // Stands for malloc()'s partition.
+  opts.gwp_asan_sampling = PartitionOptions::kEnabled;
   opts.use_pool_offset_freelists =
       (encoding == internal::PartitionFreelistEncoding::kPoolOffsetFreeList)
           ? PartitionOptions::kEnabled
@@ -299,6 +306,63 @@ TEST_P(PartitionAllocThreadCacheTest, Purge) {
   EXPECT_EQ(0u, tcache->bucket_count_for_testing(bucket_index));
 }
 
+TEST_P(PartitionAllocThreadCacheTest, FillFromUnprovisionedSlots) {
+  // Not used in SetUp(), so that slots get provisioned while filling the cache.
+  constexpr size_t kRawSize = 512;
+  auto* tcache = root()->thread_cache_for_testing();
+  size_t bucket_index = SizeToIndex(kRawSize);
+  size_t slot_size = root()->buckets[bucket_index].slot_size;
+  size_t allocated_bytes_before = root()->get_total_size_of_allocated_bytes();
+
+  std::vector<void*> objects;
+  for (size_t i = 0; i < 1000; i++) {
+    objects.push_back(
+        root()->Alloc(root()->AdjustSizeForExtrasSubtract(kRawSize), ""));
+  }
+
+  std::vector<void*> sorted_objects = objects;
+  std::sort(sorted_objects.begin(), sorted_objects.end());
+  EXPECT_EQ(sorted_objects.end(),
+            std::adjacent_find(sorted_objects.begin(), sorted_objects.end()));
+  // Slots taken from the central allocator are either in use, or cached.
+  EXPECT_EQ(
+      (objects.size() + tcache->bucket_count_for_testing(bucket_index)) *
+          slot_size,
+      root()->get_total_size_of_allocated_bytes() - allocated_bytes_before);
+
+  for (void* object : objects) {
+    root()->Free(object);
+  }
+}
+
+TEST_P(PartitionAllocThreadCacheTest, WarmupFillsThreadCache) {
+  // Not used in SetUp().
+  constexpr size_t kRawSize = 640;
+  auto* tcache = root()->thread_cache_for_testing();
+  size_t bucket_index = SizeToIndex(kRawSize);
+  ASSERT_EQ(0u, tcache->bucket_count_for_testing(bucket_index));
+  DeltaCounter batch_fill_counter{tcache->stats_for_testing().batch_fill_count};
+
+  const PartitionRoot::WarmupEntry profile[] = {
+      {root()->AdjustSizeForExtrasSubtract(kRawSize), 100}};
+  root()->Warmup(profile, std::size(profile), true);
+  EXPECT_EQ(1u, batch_fill_counter.Delta());
+  size_t cached = tcache->bucket_count_for_testing(bucket_index);
+  EXPECT_GT(cached, 0u);
+
+  // Already filled, the first allocation doesn't go to the central allocator.
+  void* ptr =
+      root()->Alloc(root()->AdjustSizeForExtrasSubtract(kRawSize), "");
+  EXPECT_EQ(cached - 1, tcache->bucket_count_for_testing(bucket_index));
+  EXPECT_EQ(1u, batch_fill_counter.Delta());
+  root()->Free(ptr);
+
+  // Filling a non-empty bucket is a no-op.
+  root()->Warmup(profile, std::size(profile), true);
+  EXPECT_EQ(cached, tcache->bucket_count_for_testing(bucket_index));
+  EXPECT_EQ(1u, batch_fill_counter.Delta());
+}
+
 TEST_P(PartitionAllocThreadCacheTest, NoCrossPartitionCache) {
   PartitionOptions opts;
   PartitionAllocatorForTesting allocator(opts);
@@ -447,6 +511,102 @@ TEST_P(PartitionAllocThreadCacheTest, MultipleThreadCaches) {
 
 namespace {
 
+std::unique_ptr<PartitionAllocatorForTesting> CreateSecondaryAllocator() {
+  PartitionOptions opts;
+  opts.secondary_thread_cache = PartitionOptions::kEnabled;
+  return std::make_unique<PartitionAllocatorForTesting>(opts);
+}
+
+class ThreadDelegateForSecondaryThreadCaches
+    : public internal::base::PlatformThreadForTesting::Delegate {
+ public:
+  explicit ThreadDelegateForSecondaryThreadCaches(PartitionRoot* root)
+      : root_(root) {}
+
+  void ThreadMain() override {
+    EXPECT_FALSE(root_->thread_cache_for_testing());  // No allocations yet.
+    root_->Free(root_->Alloc(kSmallSize));
+    tcache_ = root_->thread_cache_for_testing();
+    EXPECT_TRUE(tcache_);
+    EXPECT_NE(0u, tcache_->CachedMemory());
+  }
+
+  ThreadCache* tcache() const { return tcache_; }
+
+ private:
+  PartitionRoot* root_ = nullptr;
+  ThreadCache* tcache_ = nullptr;
+};
+
+}  // namespace
+
+TEST_P(PartitionAllocThreadCacheTest, SecondaryThreadCaches) {
+  auto secondary = CreateSecondaryAllocator();
+  auto other_secondary = CreateSecondaryAllocator();
+  PartitionRoot* secondary_root = secondary->root();
+  EXPECT_NE(0u, secondary_root->settings.thread_cache_index);
+  EXPECT_NE(0u, other_secondary->root()->settings.thread_cache_index);
+  EXPECT_NE(secondary_root->settings.thread_cache_index,
+            other_secondary->root()->settings.thread_cache_index);
+
+  // Each partition caches its slots in its own thread cache, which doesn't
+  // touch the primary one.
+  ThreadCache* primary_tcache = root()->thread_cache_for_testing();
+  const size_t primary_cached_memory = primary_tcache->CachedMemory();
+  void* ptr = secondary_root->Alloc(kSmallSize);
+  secondary_root->Free(ptr);
+  ThreadCache* tcache = secondary_root->thread_cache_for_testing();
+  ASSERT_TRUE(tcache);
+  EXPECT_NE(primary_tcache, tcache);
+  EXPECT_NE(0u, tcache->CachedMemory());
+  EXPECT_EQ(1u, tcache->thread_alloc_stats().alloc_count);
+  void* ptr2 = secondary_root->Alloc(kSmallSize);
+  EXPECT_EQ(ptr, ptr2);
+  secondary_root->Free(ptr2);
+
+  other_secondary->root()->Free(other_secondary->root()->Alloc(kSmallSize));
+  ThreadCache* other_tcache = other_secondary->root()->thread_cache_for_testing();
+  ASSERT_TRUE(other_tcache);
+  EXPECT_NE(primary_tcache, other_tcache);
+  EXPECT_NE(tcache, other_tcache);
+  EXPECT_EQ(primary_cached_memory, primary_tcache->CachedMemory());
+
+  // Other threads get theirs, deleted when they exit.
+  ThreadDelegateForSecondaryThreadCaches delegate(secondary_root);
+  internal::base::PlatformThreadHandle thread_handle;
+  internal::base::PlatformThreadForTesting::Create(0, &delegate,
+                                                   &thread_handle);
+  internal::base::PlatformThreadForTesting::Join(thread_handle);
+  EXPECT_NE(tcache, delegate.tcache());
+  ThreadCacheStats all_threads_stats;
+  ThreadCacheRegistry::Instance().DumpStats(false, &all_threads_stats,
+                                            secondary_root);
+  ThreadCacheStats this_thread_stats;
+  ThreadCacheRegistry::Instance().DumpStats(true, &this_thread_stats,
+                                            secondary_root);
+  EXPECT_EQ(sizeof(ThreadCache), all_threads_stats.metadata_overhead);
+  EXPECT_EQ(this_thread_stats.bucket_total_memory,
+            all_threads_stats.bucket_total_memory);
+
+  ThreadCacheRegistry::Instance().PurgeAll();
+  EXPECT_EQ(0u, tcache->CachedMemory());
+  EXPECT_EQ(0u, other_tcache->CachedMemory());
+
+  // The index of a deleted partition is available again.
+  const uint8_t index = other_secondary->root()->settings.thread_cache_index;
+  other_secondary.reset();
+  auto third_secondary = CreateSecondaryAllocator();
+  EXPECT_EQ(index, third_secondary->root()->settings.thread_cache_index);
+  third_secondary->root()->Free(third_secondary->root()->Alloc(kSmallSize));
+  ASSERT_TRUE(third_secondary->root()->thread_cache_for_testing());
+  EXPECT_EQ(1u, third_secondary->root()
+                    ->thread_cache_for_testing()
+                    ->thread_alloc_stats()
+                    .alloc_count);
+}
+
+namespace {
+
 class ThreadDelegateForThreadCacheReclaimedWhenThreadExits
     : public internal::base::PlatformThreadForTesting::Delegate {
  public:
@@ -519,9 +679,13 @@ class ThreadDelegateForThreadCacheRegistry
     auto* tcache = root_->thread_cache_for_testing();
     EXPECT_TRUE(tcache);
 
-    internal::ScopedGuard lock(ThreadCacheRegistry::GetLock());
+    internal::ScopedGuard lock(tcache->registry_lock_for_testing());
     EXPECT_EQ(tcache->prev_for_testing(), nullptr);
-    EXPECT_EQ(tcache->next_for_testing(), parent_thread_tcache_);
+    // Thread caches are only listed with the ones of the same shard.
+    if (tcache->registry_shard_for_testing() ==
+        parent_thread_tcache_->registry_shard_for_testing()) {
+      EXPECT_EQ(tcache->next_for_testing(), parent_thread_tcache_);
+    }
   }
 
  private:
@@ -550,7 +714,8 @@ TEST_P(PartitionAllocThreadCacheTest, ThreadCacheRegistry) {
   // be still running after the tests are finished, and will break
   // an assumption that there exists only main thread here.
   {
-    internal::ScopedGuard lock(ThreadCacheRegistry::GetLock());
+    internal::ScopedGuard lock(
+        parent_thread_tcache->registry_lock_for_testing());
     EXPECT_EQ(parent_thread_tcache->prev_for_testing(), nullptr);
     EXPECT_EQ(parent_thread_tcache->next_for_testing(), nullptr);
   }
@@ -567,7 +732,8 @@ TEST_P(PartitionAllocThreadCacheTest, ThreadCacheRegistry) {
 #if !(PA_BUILDFLAG(IS_APPLE) || PA_BUILDFLAG(IS_ANDROID) ||   \
       PA_BUILDFLAG(IS_CHROMEOS) || PA_BUILDFLAG(IS_LINUX)) && \
     PA_BUILDFLAG(USE_PARTITION_ALLOC_AS_MALLOC)
-  internal::ScopedGuard lock(ThreadCacheRegistry::GetLock());
+  internal::ScopedGuard lock(
+      parent_thread_tcache->registry_lock_for_testing());
   EXPECT_EQ(parent_thread_tcache->prev_for_testing(), nullptr);
   EXPECT_EQ(parent_thread_tcache->next_for_testing(), nullptr);
 #endif
@@ -716,8 +882,14 @@ TEST_P(PartitionAllocThreadCacheTest, MultipleThreadCachesAccounting) {
 // TODO(crbug.com/40816487): Flaky on IOS.
 #if PA_BUILDFLAG(IS_IOS)
 #define MAYBE_PurgeAll DISABLED_PurgeAll
+#define MAYBE_PurgeAllIdleThread DISABLED_PurgeAllIdleThread
+#define MAYBE_PurgeAllIdleThreadsWhileAllocating \
+  DISABLED_PurgeAllIdleThreadsWhileAllocating
 #else
 #define MAYBE_PurgeAll PurgeAll
+#define MAYBE_PurgeAllIdleThread PurgeAllIdleThread
+#define MAYBE_PurgeAllIdleThreadsWhileAllocating \
+  PurgeAllIdleThreadsWhileAllocating
 #endif
 
 namespace {
@@ -806,6 +978,150 @@ PA_NO_THREAD_SAFETY_ANALYSIS {
   internal::base::PlatformThreadForTesting::Join(thread_handle);
 }
 
+namespace {
+
+class ThreadDelegateForPurgeAllIdle
+    : public internal::base::PlatformThreadForTesting::Delegate {
+ public:
+  ThreadDelegateForPurgeAllIdle(PartitionRoot* root,
+                                ThreadCache*& other_thread_tcache,
+                                std::atomic<bool>& other_thread_idle,
+                                std::atomic<bool>& purge_called,
+                                int bucket_index,
+                                BucketDistribution bucket_distribution)
+      : root_(root),
+        other_thread_tcache_(other_thread_tcache),
+        other_thread_idle_(other_thread_idle),
+        purge_called_(purge_called),
+        bucket_index_(bucket_index),
+        bucket_distribution_(bucket_distribution) {}
+
+  void ThreadMain() override PA_NO_THREAD_SAFETY_ANALYSIS {
+    FillThreadCacheAndReturnIndex(root_, kSmallSize, bucket_distribution_);
+    other_thread_tcache_ = root_->thread_cache_for_testing();
+
+    ThreadCache::MarkCurrentThreadIdle();
+    other_thread_idle_.store(true, std::memory_order_release);
+    while (!purge_called_.load(std::memory_order_acquire)) {
+    }
+
+    // The cache is usable again after having been purged by another thread:
+    // the allocation refills the bucket.
+    void* data =
+        root_->Alloc(root_->AdjustSizeForExtrasSubtract(kSmallSize), "");
+    root_->Free(data);
+    EXPECT_EQ(kFillCountForSmallBucket,
+              other_thread_tcache_->bucket_count_for_testing(bucket_index_));
+  }
+
+ private:
+  PartitionRoot* root_ = nullptr;
+  ThreadCache*& other_thread_tcache_;
+  std::atomic<bool>& other_thread_idle_;
+  std::atomic<bool>& purge_called_;
+  const int bucket_index_;
+  BucketDistribution bucket_distribution_;
+};
+
+}  // namespace
+
+TEST_P(PartitionAllocThreadCacheTest, MAYBE_PurgeAllIdleThread)
+PA_NO_THREAD_SAFETY_ANALYSIS {
+  std::atomic<bool> other_thread_idle{false};
+  std::atomic<bool> purge_called{false};
+
+  size_t bucket_index = FillThreadCacheAndReturnIndex(kSmallSize);
+  ThreadCache* other_thread_tcache = nullptr;
+
+  ThreadDelegateForPurgeAllIdle delegate(root(), other_thread_tcache,
+                                         other_thread_idle, purge_called,
+                                         bucket_index,
+                                         GetParam().bucket_distribution);
+  internal::base::PlatformThreadHandle thread_handle;
+  internal::base::PlatformThreadForTesting::Create(0, &delegate,
+                                                   &thread_handle);
+
+  while (!other_thread_idle.load(std::memory_order_acquire)) {
+  }
+  EXPECT_EQ(kFillCountForSmallBucket,
+            other_thread_tcache->bucket_count_for_testing(bucket_index));
+
+  ThreadCacheRegistry::Instance().PurgeAll();
+  // The idle thread is purged synchronously as well.
+  EXPECT_EQ(0u, other_thread_tcache->bucket_count_for_testing(bucket_index));
+
+  purge_called.store(true, std::memory_order_release);
+  internal::base::PlatformThreadForTesting::Join(thread_handle);
+}
+
+namespace {
+
+class ThreadDelegateForPurgeAllIdleThreadsWhileAllocating
+    : public internal::base::PlatformThreadForTesting::Delegate {
+ public:
+  ThreadDelegateForPurgeAllIdleThreadsWhileAllocating(
+      PartitionRoot* root,
+      std::atomic<bool>& can_finish)
+      : root_(root), can_finish_(can_finish) {}
+
+  void ThreadMain() override {
+    const size_t small_size = root_->AdjustSizeForExtrasSubtract(kSmallSize);
+    // Not cached, so served by the central allocator under the partition lock.
+    const size_t large_size = 2 * ThreadCache::kLargeSizeThreshold;
+    while (!can_finish_.load(std::memory_order_acquire)) {
+      void* ptrs[kFillCountForSmallBucket];
+      for (void*& ptr : ptrs) {
+        ptr = root_->Alloc(small_size, "");
+        memset(ptr, 0x42, small_size);
+      }
+      void* large = root_->Alloc(large_size, "");
+      memset(large, 0x42, large_size);
+      for (void* ptr : ptrs) {
+        EXPECT_EQ(0x42, *static_cast<unsigned char*>(ptr));
+        root_->Free(ptr);
+      }
+      root_->Free(large);
+
+      // Lets another thread purge the cache, possibly while this one wakes up
+      // and allocates again.
+      ThreadCache::MarkCurrentThreadIdle();
+      internal::base::PlatformThreadForTesting::YieldCurrentThread();
+    }
+  }
+
+ private:
+  PartitionRoot* root_ = nullptr;
+  std::atomic<bool>& can_finish_;
+};
+
+}  // namespace
+
+// Purging idle thread caches takes the registry shard lock, then the partition
+// lock, while their owners and other threads keep allocating.
+TEST_P(PartitionAllocThreadCacheTest,
+       MAYBE_PurgeAllIdleThreadsWhileAllocating) {
+  std::atomic<bool> can_finish{false};
+  ThreadDelegateForPurgeAllIdleThreadsWhileAllocating delegate(root(),
+                                                               can_finish);
+  internal::base::PlatformThreadHandle thread_handle;
+  internal::base::PlatformThreadForTesting::Create(0, &delegate,
+                                                   &thread_handle);
+  internal::base::PlatformThreadHandle thread_handle_2;
+  internal::base::PlatformThreadForTesting::Create(0, &delegate,
+                                                   &thread_handle_2);
+
+  const size_t large_size = 2 * ThreadCache::kLargeSizeThreshold;
+  for (int i = 0; i < 1000; ++i) {
+    ThreadCacheRegistry::Instance().PurgeAll();
+    root()->Free(root()->Alloc(large_size, ""));
+    internal::base::PlatformThreadForTesting::YieldCurrentThread();
+  }
+
+  can_finish.store(true, std::memory_order_release);
+  internal::base::PlatformThreadForTesting::Join(thread_handle);
+  internal::base::PlatformThreadForTesting::Join(thread_handle_2);
+}
+
 TEST_P(PartitionAllocThreadCacheTest, PeriodicPurge) {
   auto& registry = ThreadCacheRegistry::Instance();
   auto NextInterval = [&registry] {
@@ -1165,6 +1481,26 @@ TEST_P(PartitionAllocThreadCacheTest, DynamicSizeThreshold) {
   EXPECT_EQ(3u, alloc_miss_too_large_counter.Delta());
 }
 
+TEST_P(PartitionAllocThreadCacheTest, RaiseLargestCachedSize) {
+  auto* tcache = root()->thread_cache_for_testing();
+  DeltaCounter alloc_miss_too_large_counter{
+      tcache->stats_for_testing().alloc_miss_too_large};
+
+  ThreadCache::SetLargestCachedSize(ThreadCache::kDefaultSizeThreshold);
+  FillThreadCacheAndReturnIndex(ThreadCache::kDefaultSizeThreshold + 1);
+  EXPECT_EQ(1u, alloc_miss_too_large_counter.Delta());
+
+  // Increase.
+  ThreadCache::RaiseLargestCachedSize(ThreadCache::kLargeSizeThreshold);
+  FillThreadCacheAndReturnIndex(ThreadCache::kDefaultSizeThreshold + 1);
+  EXPECT_EQ(1u, alloc_miss_too_large_counter.Delta());
+
+  // Never lowers.
+  ThreadCache::RaiseLargestCachedSize(ThreadCache::kDefaultSizeThreshold);
+  FillThreadCacheAndReturnIndex(ThreadCache::kDefaultSizeThreshold + 1);
+  EXPECT_EQ(1u, alloc_miss_too_large_counter.Delta());
+}
+
 // Disabled due to flakiness: crbug.com/1287811
 TEST_P(PartitionAllocThreadCacheTest, DISABLED_DynamicSizeThresholdPurge) {
   auto* tcache = root()->thread_cache_for_testing();
@@ -1323,6 +1659,146 @@ TEST_P(PartitionAllocThreadCacheTest, TryPurgeMultipleCorrupted) {
   root()->Free(ptr);
 }
 
+#if PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+
+namespace {
+
+constexpr size_t kGwpAsanMaxSize = 64;
+constexpr size_t kGwpAsanMaxAlignment = 256;
+size_t g_gwp_asan_sampled_count = 0;
+PartitionRoot* g_gwp_asan_sampled_root = nullptr;
+
+// Stands for GWP-ASan, with memory from outside PartitionAlloc. Doesn't use
+// malloc(), which may be PartitionAlloc, and sample allocations as well.
+struct GwpAsanSlot {
+  alignas(2 * kGwpAsanMaxAlignment) char memory[2 * kGwpAsanMaxAlignment];
+  void* allocation;
+};
+GwpAsanSlot g_gwp_asan_slots[4];
+
+void* GwpAsanSampledAlloc(PartitionRoot* root,
+                          size_t size,
+                          size_t alignment) {
+  ++g_gwp_asan_sampled_count;
+  g_gwp_asan_sampled_root = root;
+  if (size > kGwpAsanMaxSize || alignment > kGwpAsanMaxAlignment) {
+    return nullptr;
+  }
+  for (GwpAsanSlot& slot : g_gwp_asan_slots) {
+    if (!slot.allocation) {
+      // Aligned on `alignment`, and no more, to catch callers relying on a
+      // larger one.
+      slot.allocation = slot.memory + alignment;
+      return slot.allocation;
+    }
+  }
+  return nullptr;
+}
+
+GwpAsanSlot* FindGwpAsanSlot(void* ptr) {
+  for (GwpAsanSlot& slot : g_gwp_asan_slots) {
+    if (ptr && slot.allocation == ptr) {
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+bool IsSampled(void* ptr) {
+  return FindGwpAsanSlot(ptr) != nullptr;
+}
+
+void GwpAsanSampledFree(void* ptr) {
+  GwpAsanSlot* slot = FindGwpAsanSlot(ptr);
+  PA_CHECK(slot);
+  slot->allocation = nullptr;
+}
+
+}  // namespace
+
+TEST_P(PartitionAllocThreadCacheTest, GwpAsanSampling) {
+  constexpr size_t kSize = 32;
+  auto free_any = [&](void* ptr) {
+    if (IsSampled(ptr)) {
+      GwpAsanSampledFree(ptr);
+    } else {
+      root()->Free(ptr);
+    }
+  };
+  g_gwp_asan_sampled_count = 0;
+  GwpAsanSupport::SetSampler(1, &GwpAsanSampledAlloc);
+
+  // The thread cache picks the sampler up soon enough.
+  for (size_t i = 0; i < GwpAsanSupport::kSamplingDisabledCountdown &&
+                     !g_gwp_asan_sampled_count;
+       ++i) {
+    free_any(root()->Alloc(kSize, ""));
+  }
+  EXPECT_EQ(1u, g_gwp_asan_sampled_count);
+
+  // Every allocation is sampled from now on, unless GWP-ASan declines it, or
+  // it opts out of hooks.
+  void* ptr = root()->Alloc(kSize, "");
+  EXPECT_TRUE(IsSampled(ptr));
+  EXPECT_EQ(root(), g_gwp_asan_sampled_root);
+  GwpAsanSampledFree(ptr);
+  ptr = root()->Alloc(2 * kGwpAsanMaxSize, "");
+  EXPECT_FALSE(IsSampled(ptr));
+  root()->Free(ptr);
+  ptr = root()->Alloc<AllocFlags::kNoHooks>(kSize, "");
+  EXPECT_FALSE(IsSampled(ptr));
+  root()->Free(ptr);
+  EXPECT_EQ(3u, g_gwp_asan_sampled_count);
+
+  // Nor are the allocations of partitions which didn't opt in, even with a
+  // thread cache.
+  auto secondary = CreateSecondaryAllocator();
+  for (size_t i = 0; i < 2 * GwpAsanSupport::kSamplingDisabledCountdown; ++i) {
+    ptr = secondary->root()->Alloc(kSize, "");
+    EXPECT_FALSE(IsSampled(ptr));
+    secondary->root()->Free(ptr);
+  }
+  ASSERT_TRUE(secondary->root()->thread_cache_for_testing());
+  EXPECT_EQ(3u, g_gwp_asan_sampled_count);
+
+  auto* zeroed =
+      static_cast<char*>(root()->Alloc<AllocFlags::kZeroFill>(kSize, ""));
+  EXPECT_TRUE(IsSampled(zeroed));
+  for (size_t i = 0; i < kSize; ++i) {
+    EXPECT_EQ(0, zeroed[i]);
+  }
+  GwpAsanSampledFree(zeroed);
+
+  // Sampled allocations keep the alignment of the slot they stand for.
+  for (size_t alignment = 16; alignment <= kGwpAsanMaxSize; alignment <<= 1) {
+    ptr = root()->AlignedAlloc(alignment, 16);
+    EXPECT_TRUE(IsSampled(ptr));
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(ptr) & (alignment - 1));
+    GwpAsanSampledFree(ptr);
+  }
+
+  // About one in `kSamplingInterval` allocations is sampled.
+  constexpr size_t kSamplingInterval = 100;
+  constexpr size_t kAllocations = 1000 * kSamplingInterval;
+  GwpAsanSupport::SetSampler(kSamplingInterval, &GwpAsanSampledAlloc);
+  free_any(root()->Alloc(kSize, ""));
+  g_gwp_asan_sampled_count = 0;
+  for (size_t i = 0; i < kAllocations; ++i) {
+    free_any(root()->Alloc(kSize, ""));
+  }
+  EXPECT_GT(g_gwp_asan_sampled_count, 800u);
+  EXPECT_LT(g_gwp_asan_sampled_count, 1200u);
+
+  GwpAsanSupport::SetSampler(0, nullptr);
+  g_gwp_asan_sampled_count = 0;
+  for (size_t i = 0; i < kAllocations; ++i) {
+    free_any(root()->Alloc(kSize, ""));
+  }
+  EXPECT_EQ(0u, g_gwp_asan_sampled_count);
+}
+
+#endif  // PA_BUILDFLAG(ENABLE_GWP_ASAN_SUPPORT)
+
 TEST(AlternateBucketDistributionTest, SizeToIndex) {
   using internal::BucketIndexLookup;
 
@@ -1530,6 +2006,123 @@ TEST_P(PartitionAllocThreadCacheTest, AllocationRecordingRealloc) {
             tcache->thread_alloc_stats().dealloc_total_size);
 }
 
+namespace {
+
+using BufferedObserverEvent = PartitionAllocHooks::BufferedObserverEvent;
+
+// Doesn't allocate, the hook is called from the test thread.
+constexpr size_t kMaxObservedEvents =
+    4 * internal::ObservedEventBuffer::kCapacity;
+BufferedObserverEvent g_observed_events[kMaxObservedEvents];
+size_t g_observed_event_count = 0;
+
+void BufferedObserverHook(const BufferedObserverEvent* events, size_t count) {
+  for (size_t i = 0; i < count && g_observed_event_count < kMaxObservedEvents;
+       ++i) {
+    g_observed_events[g_observed_event_count++] = events[i];
+  }
+}
+
+// Index of the first event from `from` on matching the arguments, or
+// `kMaxObservedEvents`.
+size_t FindObservedEvent(size_t from,
+                         void* ptr,
+                         BufferedObserverEvent::Type type,
+                         internal::base::PlatformThreadId thread_id) {
+  for (size_t i = from; i < g_observed_event_count; ++i) {
+    const auto& event = g_observed_events[i];
+    if (event.address == UntagPtr(ptr) && event.type == type &&
+        event.thread_id == thread_id) {
+      return i;
+    }
+  }
+  return kMaxObservedEvents;
+}
+
+class ThreadDelegateForBufferedObserverHook
+    : public internal::base::PlatformThreadForTesting::Delegate {
+ public:
+  explicit ThreadDelegateForBufferedObserverHook(PartitionRoot* root)
+      : root_(root) {}
+
+  void ThreadMain() override {
+    thread_id_ = internal::base::PlatformThread::CurrentId();
+    ptr_ = root_->Alloc(kSmallSize);
+    root_->Free(ptr_);
+    // The thread exits with its events not flushed yet.
+  }
+
+  void* ptr() const { return ptr_; }
+  internal::base::PlatformThreadId thread_id() const { return thread_id_; }
+
+ private:
+  PartitionRoot* root_ = nullptr;
+  void* ptr_ = nullptr;
+  internal::base::PlatformThreadId thread_id_;
+};
+
+}  // namespace
+
+TEST_P(PartitionAllocThreadCacheTest, BufferedObserverHook) {
+  const auto thread_id = internal::base::PlatformThread::CurrentId();
+  g_observed_event_count = 0;
+  PartitionAllocHooks::SetBufferedObserverHook(&BufferedObserverHook);
+  // Allocations don't take the slow path.
+  EXPECT_FALSE(PartitionAllocHooks::AreHooksEnabled());
+
+  void* ptr = root()->Alloc(kSmallSize);
+  size_t usable_size = PartitionRoot::GetUsableSize(ptr);
+  root()->Free(ptr);
+  // Nothing is reported before the flush.
+  EXPECT_EQ(0u, g_observed_event_count);
+
+  ThreadDelegateForBufferedObserverHook delegate(root());
+  internal::base::PlatformThreadHandle thread_handle;
+  internal::base::PlatformThreadForTesting::Create(0, &delegate,
+                                                   &thread_handle);
+  internal::base::PlatformThreadForTesting::Join(thread_handle);
+
+  EXPECT_EQ(4u, PartitionAllocHooks::FlushBufferedObserverEvents());
+  ASSERT_EQ(4u, g_observed_event_count);
+  size_t alloc_index = FindObservedEvent(
+      0, ptr, BufferedObserverEvent::Type::kAllocation, thread_id);
+  ASSERT_LT(alloc_index, kMaxObservedEvents);
+  EXPECT_EQ(usable_size, g_observed_events[alloc_index].size);
+  EXPECT_LT(FindObservedEvent(alloc_index, ptr,
+                              BufferedObserverEvent::Type::kFree, thread_id),
+            kMaxObservedEvents);
+  // The events of the exited thread are delivered as well.
+  alloc_index = FindObservedEvent(0, delegate.ptr(),
+                                  BufferedObserverEvent::Type::kAllocation,
+                                  delegate.thread_id());
+  ASSERT_LT(alloc_index, kMaxObservedEvents);
+  EXPECT_LT(FindObservedEvent(alloc_index, delegate.ptr(),
+                              BufferedObserverEvent::Type::kFree,
+                              delegate.thread_id()),
+            kMaxObservedEvents);
+  EXPECT_EQ(0u, PartitionAllocHooks::FlushBufferedObserverEvents());
+
+  // When the buffer is full, events are dropped rather than blocking the
+  // thread.
+  const size_t dropped =
+      PartitionAllocHooks::GetBufferedObserverDroppedEventCount();
+  for (size_t i = 0; i < internal::ObservedEventBuffer::kCapacity; ++i) {
+    root()->Free(root()->Alloc(kSmallSize));
+  }
+  EXPECT_EQ(dropped + internal::ObservedEventBuffer::kCapacity,
+            PartitionAllocHooks::GetBufferedObserverDroppedEventCount());
+  g_observed_event_count = 0;
+  EXPECT_EQ(internal::ObservedEventBuffer::kCapacity,
+            PartitionAllocHooks::FlushBufferedObserverEvents());
+
+  // Nothing is buffered while the hook is unset.
+  PartitionAllocHooks::SetBufferedObserverHook(nullptr);
+  root()->Free(root()->Alloc(kSmallSize));
+  PartitionAllocHooks::SetBufferedObserverHook(&BufferedObserverHook);
+  EXPECT_EQ(0u, PartitionAllocHooks::FlushBufferedObserverEvents());
+  PartitionAllocHooks::SetBufferedObserverHook(nullptr);
+}
+
 // This test makes sure it's safe to switch to the alternate bucket distribution
 // at runtime. This is intended to happen once, near the start of Chrome,
 // once we have enabled features.
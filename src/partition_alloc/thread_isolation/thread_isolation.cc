@@ -73,7 +73,7 @@ void WriteProtectThreadIsolatedGlobals(ThreadIsolationOption thread_isolation) {
       AddressPoolManager::GetInstance().GetPool(kThreadIsolatedPoolHandle);
   WriteProtectThreadIsolatedVariable(
       thread_isolation, *pool,
-      offsetof(AddressPoolManager::Pool, alloc_bitset_));
+      offsetof(AddressPoolManager::Pool, alloc_bitmap_));
 
   uint16_t* pkey_reservation_offset_table =
       GetReservationOffsetTable(kThreadIsolatedPoolHandle);